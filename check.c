@@ -0,0 +1,657 @@
+/*
+ * Copyright (c) 2021 Greg Banks <gnb@fmeh.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#include "common.h"
+#include "stream.h"
+#include "check.h"
+#include "panic.h"
+#include "fileset.h"
+#include <limits.h>
+#include <pthread.h>
+
+const char *failure_names[FM_NUM] =
+{
+    "valid data",
+    "file short",
+    "zero data",
+    "bad checksum",
+    "bad tag",
+    "bad offset",
+    "bad creator",
+    "lost",
+    "duplicated",
+    "reordered",
+    "total"
+};
+
+static const char *failure_explanations[FM_NUM] =
+{
+    0,
+    "less data was read than expected at offset %llu",
+    "you may wish to check for file holes with xfs_bmap",
+    "data is probably rubbish",
+    "data is from a previous run or from another file tagged %lld",
+    "data has been transposed within the file by %lld bytes",
+    "data generated by genstream pid %u started at %s",
+    "datagrams were lost on the way or dropped by the receiver",
+    "datagrams were received more than once",
+    "datagrams arrived after later ones",
+    0
+};
+
+/* statistics */
+uint64_t	total_bytes;		/* bytes read */
+uint64_t	corrupt_bytes[FM_NUM];	/* bytes corrupted, by failure mode */
+uint32_t	num_errors[FM_NUM];	/* number of detected corrupt ranges */
+uint32_t	num_unreadable;		/* files and directories, in --recursive mode */
+uint64_t	start_us;		/* test start timeval as microseconds */
+stream_latency_t latency;		/* of the operations on every stream */
+
+/* most bytes handed to the block checking kernel at once */
+#define CHECK_BATCH_SIZE	(1ULL<<20)
+
+void
+emit_separator(void)
+{
+    fprintf(stderr, "%s: ------------------------------------------------\n", argv0);
+}
+
+void
+handle_first_error(void)
+{
+    if (stop_on_error)
+	exit(1);
+
+    if (dump_on_error)
+	panic();
+}
+
+uint32_t
+get_num_errors(void)
+{
+    failure_mode_t failure;
+    uint32_t n = 0;
+
+    for (failure = 0 ; failure < FM_TOTAL ; failure++)
+    {
+	if (failure != FM_NONE && failure != FM_TOTAL)
+	    n += num_errors[failure];
+    }
+    n += num_unreadable;
+
+    return n;
+}
+
+/* the counts by failure mode, as an array for --json */
+void
+json_add_failures(json_obj_t *o)
+{
+    failure_mode_t failure;
+
+    json_open_array(o, "failures");
+    for (failure = FM_NONE ; failure < FM_TOTAL ; failure++)
+    {
+	json_open_object(o, 0);
+	json_add_str(o, "failure", failure_names[failure]);
+	json_add_uint(o, "extents", num_errors[failure]);
+	json_add_uint(o, "bytes", corrupt_bytes[failure]);
+	json_close_object(o);
+    }
+    json_close_array(o);
+}
+
+void
+emit_stats(stream_t *s)
+{
+    failure_mode_t failure;
+    uint64_t deltat = time_now() - start_us;
+    char sizebuf1[32];
+    char sizebuf2[32];
+
+    if (deltat == 0)
+	deltat = 1;		/* JIC, avoid divide by zero */
+    for (failure = FM_NONE ; failure < FM_TOTAL ; failure++)
+    {
+	if (num_errors[failure] > 0)
+	    fprintf(stderr, "%s: [%s] %u %s in %u.%06u seconds (%g err/sec)\n",
+		    argv0,
+		    failure_names[failure],
+		    num_errors[failure],
+		    (failure == FM_NONE ? "valid extents" : "errors"),
+		    time_seconds(deltat), time_microseconds(deltat),
+		    (double)num_errors[failure] / time_double(deltat));
+	if (corrupt_bytes[failure] > 0)
+	    fprintf(stderr, "%s: [%s] %llu/%llu bytes (%s/%s)\n",
+		    argv0,
+		    failure_names[failure],
+		    (unsigned long long)corrupt_bytes[failure],
+		    (unsigned long long)total_bytes,
+		    iec_sizestr(corrupt_bytes[failure], sizebuf1, sizeof(sizebuf1)),
+		    iec_sizestr(total_bytes, sizebuf2, sizeof(sizebuf2)));
+    }
+    /* used for determining how many blocks have been read or written */
+    fprintf(stderr, "%s: read %llu blocks %llu bytes in %u.%06u seconds (%g KiB/sec)%s\n",
+		argv0,
+		(unsigned long long)s->stats.nblocks,
+		(unsigned long long)s->stats.nbytes,
+		time_seconds(deltat), time_microseconds(deltat),
+		(double)s->stats.nbytes / time_double(deltat) / 1024.0,
+		(get_num_errors() ? "" : ", no errors"));
+    if (verbose && s->stats.nbytes)
+	fprintf(stderr, "%s: copied %llu bytes within buffers (%g per GiB)\n",
+		argv0,
+		(unsigned long long)s->stats.ncopied,
+		(double)s->stats.ncopied * (1ULL<<30) / (double)s->stats.nbytes);
+    /* tells whether the run was limited by reading or by checking */
+    if (read_ahead)
+	fprintf(stderr, "%s: read-ahead: checker starved for %u.%06u seconds, "
+			"reader blocked for %u.%06u seconds (%s bound)\n",
+		argv0,
+		time_seconds(s->stats.starved), time_microseconds(s->stats.starved),
+		time_seconds(s->stats.blocked), time_microseconds(s->stats.blocked),
+		(s->stats.starved >= s->stats.blocked ? "I/O" : "CPU"));
+    /* per-datagram costs dominate at high packet rates */
+    if (udp_flag)
+	fprintf(stderr, "%s: udp: %llu datagrams in %u.%06u seconds (%g datagrams/sec), "
+			"%llu syscalls (%g per GiB)\n",
+		argv0,
+		(unsigned long long)s->stats.ndatagrams,
+		time_seconds(deltat), time_microseconds(deltat),
+		(double)s->stats.ndatagrams / time_double(deltat),
+		(unsigned long long)s->stats.nsyscalls,
+		(double)s->stats.nsyscalls * (1ULL<<30) / (double)MAX(s->stats.nbytes, 1));
+    if (json)
+    {
+	json_obj_t o;
+
+	json_begin(&o, "stats");
+	json_add_str(&o, "name", s->name);
+	json_add_uint(&o, "blocks", s->stats.nblocks);
+	json_add_uint(&o, "bytes", s->stats.nbytes);
+	json_add_uint(&o, "checked_bytes", total_bytes);
+	json_add_double(&o, "seconds", time_double(deltat));
+	json_add_double(&o, "kib_per_sec",
+			(double)s->stats.nbytes / time_double(deltat) / 1024.0);
+	json_add_uint(&o, "errors", get_num_errors());
+	json_add_failures(&o);
+	json_emit(json, &o);
+    }
+
+    fflush(stderr); /* JIC */
+}
+
+static void
+count_extent(uint64_t len, failure_mode_t failure)
+{
+    num_errors[failure]++;
+    num_errors[FM_TOTAL]++;
+    corrupt_bytes[failure] += len;
+    corrupt_bytes[FM_TOTAL] += len;
+}
+
+/*
+ * Counts and reports an extent; who prefixes the report, and is argv0
+ * except in --server and --fileset modes.
+ */
+void
+found_extent(const char *who, uint64_t offset, uint64_t len,
+	     failure_mode_t failure, uint64_t detail)
+{
+    if (!len)
+	return;
+    count_extent(len, failure);
+
+    emit_separator();
+    fprintf(stderr, "%s: %s for %llu bytes at offset %llu\n",
+	    who, failure_names[failure],
+	    (unsigned long long)len, (unsigned long long)offset);
+    if (failure_explanations[failure])
+    {
+	fprintf(stderr, "%s: ", who);
+	if (failure == FM_BAD_CREATOR)
+	{
+	    fprintf(stderr, failure_explanations[failure],
+		    creator_get_pid(detail),
+		    creator_to_timestamp_str(detail));
+	}
+	else
+	    fprintf(stderr, failure_explanations[failure], detail);
+	fprintf(stderr, "\n");
+    }
+    if (json)
+    {
+	json_obj_t o;
+
+	json_begin(&o, "extent");
+	json_add_str(&o, "name", who);
+	json_add_str(&o, "failure", failure_names[failure]);
+	json_add_uint(&o, "offset", offset);
+	json_add_uint(&o, "length", len);
+	if (failure == FM_BAD_CREATOR)
+	{
+	    json_add_uint(&o, "creator_pid", creator_get_pid(detail));
+	    json_add_str(&o, "creator_start", creator_to_timestamp_str(detail));
+	}
+	else if (failure == FM_BAD_TAG || failure == FM_BAD_OFFSET)
+	    json_add_uint(&o, "detail", detail);
+	json_emit(json, &o);
+    }
+}
+
+void
+announce_creator(FILE *fp, uint64_t creator)
+{
+    fprintf(fp, "%s: file was generated by genstream pid %u started at %s\n",
+		argv0,
+		creator_get_pid(creator),
+		creator_to_timestamp_str(creator));
+}
+
+void
+extent_begin(extent_t *e, const char *who, uint64_t offset0)
+{
+    memset(e, 0, sizeof(*e));
+    e->who = who;
+    e->start = offset0;
+    e->failure = FM_NONE;
+}
+
+/* reports the current extent as far as off, returning TRUE if it was bad */
+static bool_t
+extent_report(extent_t *e, uint64_t off)
+{
+    uint64_t len = off - e->start;
+
+    if (!len)
+	return FALSE;
+    if (e->failure)
+    {
+	found_extent(e->who, e->start, len, e->failure, e->detail);
+	e->nerrors++;
+	return TRUE;
+    }
+    if (!e->quiet || verbose)
+	found_extent(e->who, e->start, len, FM_NONE, 0);
+    else
+	count_extent(len, FM_NONE);
+    return FALSE;
+}
+
+/*
+ * Ends the current extent at off and starts one of the given failure.
+ * Called with whatever lock serialises the reports held.
+ */
+void
+extent_advance(extent_t *e, uint64_t off, failure_mode_t failure, uint64_t detail)
+{
+    if (e->failure == FM_SHORT ||
+	(failure == e->failure && detail == e->detail))
+	return;
+
+    /* at a run of FM_SHORT the summary follows, as for extent_finish() */
+    if (extent_report(e, off) && failure != FM_SHORT)
+    {
+	if (e->stats)
+	    emit_stats(e->stats);
+	if (get_num_errors() == 1)
+	    handle_first_error();
+    }
+    if (failure && failure != FM_ZERO && failure != FM_SHORT && verbose)
+    {
+	emit_separator();
+	fprintf(stderr, "%s: 0x%llx: hexdump of %s data\n",
+		e->who, (unsigned long long)off, failure_names[failure]);
+    }
+    e->start = off;
+    e->failure = failure;
+    e->detail = detail;
+}
+
+/*
+ * Ends the last extent at end, where the data stopped, or where it
+ * stopped at a run of FM_SHORT, and reports the rest up to where it
+ * was expected to stop as short.  The owner's summary follows, so the
+ * statistics and the first error are left to that.
+ */
+void
+extent_finish(extent_t *e, uint64_t end, uint64_t expected)
+{
+    if (e->failure == FM_SHORT)
+	end = e->start;
+    else
+	extent_report(e, end);
+    e->start = end;
+    e->failure = FM_SHORT;
+    e->detail = end;
+    if (end < expected)
+	extent_report(e, expected);
+}
+
+void
+checker_init(checker_t *c, FILE *out,
+	     void (*found_run)(checker_t *, uint64_t, failure_mode_t, uint64_t),
+	     void *closure)
+{
+    memset(c, 0, sizeof(*c));
+    record_format_init(&c->fmt, tag_flag, tag, creator_flag, 0);
+    c->failure = FM_NUM;
+    c->out = out;
+    c->found_run = found_run;
+    c->closure = closure;
+}
+
+void
+checker_new_run(checker_t *c, uint64_t off,
+		failure_mode_t failure, uint64_t detail)
+{
+    c->failure = failure;
+    c->failure_detail = detail;
+    c->found_run(c, off, failure, detail);
+}
+
+/*
+ * While the data is good, checks as many as possible of the n records
+ * at buf with the block kernel, so that the per-record state machine
+ * need only be run from the first bad record.  Returns the number of
+ * good records checked.
+ */
+uint64_t
+checker_block(checker_t *c, const void *buf, uint64_t n, uint64_t off)
+{
+    uint64_t ngood;
+
+    if (c->failure || verbose > 2 || (c->fmt.creator_flag && !c->fmt.creator))
+	return 0;
+    ngood = record_check_block(&c->fmt, buf,
+			       MIN(n, CHECK_BATCH_SIZE / c->fmt.size), off);
+    c->total_bytes += ngood * c->fmt.size;
+    return ngood;
+}
+
+/*
+ * Checks one record, which should be at offset off.
+ */
+void
+checker_record(checker_t *c, const record_t *rec, uint64_t off)
+{
+    size_t record_size = c->fmt.size;
+    uint16_t csum;
+    uint64_t fi;
+    failure_mode_t failure;
+    uint64_t failure_detail;
+    uint8_t ftag = 0;
+    static const record_t zero_record;
+    uint64_t creator = 0;
+
+    c->total_bytes += record_size;
+
+    if (verbose > 3)
+	fhexdump(c->out, off, rec, record_size);
+
+    csum = record_checksum(rec, c->fmt.creator_flag);
+    fi = record_get_offset(rec, c->fmt.tag_flag);
+    if (c->fmt.tag_flag)
+	ftag = record_get_tag(rec);
+    if (c->fmt.creator_flag)
+    {
+	creator = record_get_creator(rec);
+	if (!c->fmt.creator)
+	{
+	    if (!c->quiet_creator)
+		announce_creator(c->out, creator);
+	    c->fmt.creator = creator;
+	}
+    }
+
+    if (verbose > 2)
+	fprintf(c->out, "[0x%llx] offset 0x%llx tag %02x checksum %04x\n",
+		(unsigned long long)off, (unsigned long long)fi,
+		(unsigned)ftag, (unsigned)csum);
+
+    failure = FM_NONE;
+    failure_detail = 0;
+    if (csum)
+    {
+	/*
+	 * Note, a zero record will fail the checksum, so we
+	 * can delay checking for zero records until then.
+	 */
+	if (!memcmp(rec, &zero_record, record_size))
+	{
+	    if (verbose > 1)
+		fprintf(c->out, "%s: record is zero at 0x%llx\n",
+			argv0, (unsigned long long)off);
+	    failure = FM_ZERO;
+	}
+	else
+	{
+	    if (verbose > 1)
+		fprintf(c->out, "%s: checksum failed at 0x%llx\n",
+			argv0, (unsigned long long)off);
+	    failure = FM_BAD_CHECKSUM;
+	}
+    }
+    else
+    {
+	if (fi != off)
+	{
+	    if (verbose > 1)
+		fprintf(c->out, "%s: record at 0x%llx should be at 0x%llx\n",
+			argv0, (unsigned long long)off, (unsigned long long)fi);
+	    failure = FM_BAD_OFFSET;
+	    failure_detail = (off - fi);
+	}
+	if (c->fmt.tag_flag && ftag != c->fmt.tag)
+	{
+	    if (verbose > 1)
+		fprintf(c->out, "%s: record at 0x%llx should be tagged %u not %u\n",
+			argv0, (unsigned long long)off, (unsigned)c->fmt.tag,
+			(unsigned)ftag);
+	    failure = FM_BAD_TAG;
+	    failure_detail = ftag;
+	}
+	if (c->fmt.creator_flag && creator != c->fmt.creator)
+	{
+	    if (verbose > 1)
+		fprintf(c->out, "%s: record at 0x%llx should have creator 0x%llx not 0x%llx\n",
+			argv0, (unsigned long long)off,
+			(unsigned long long)c->fmt.creator,
+			(unsigned long long)creator);
+	    failure = FM_BAD_CREATOR;
+	    failure_detail = creator;
+	}
+    }
+
+    if (failure && failure != FM_ZERO && verbose)
+	fhexdump(c->out, off-record_size, rec, record_size);
+
+    if (failure != c->failure || failure_detail != c->failure_detail)
+	checker_new_run(c, off, failure, failure_detail);
+}
+
+/*
+ * Returns the expected offset just past the last record checked.
+ */
+uint64_t
+checker_scan(checker_t *c, stream_t *s, uint64_t length, uint64_t offset0)
+{
+    uint64_t i, off, n, ngood;
+    size_t record_size = c->fmt.size;
+    const record_t *rec;
+
+    for (i = 0 ; !signalled && i < length ; i += record_size)
+    {
+	off = i + offset0;
+
+	n = MIN((uint64_t)stream_inline_available(s), length - i) / record_size;
+	if (n && (ngood = checker_block(c, stream_inline_peek(s), n, off)))
+	{
+	    stream_inline_read(s, ngood * record_size);
+	    i += ngood * record_size;
+	    if (i >= length)
+		break;
+	    off = i + offset0;
+	}
+
+	if ((rec = (const record_t *)stream_inline_read(s, record_size)) == 0)
+	{
+	    if (!signalled)
+	    {
+		fprintf(c->out, "%s: read failed at offset %llu\n",
+			    argv0, (unsigned long long)off);
+		checker_new_run(c, off, FM_SHORT, off);
+	    }
+	    return off;
+	}
+	checker_record(c, rec, off);
+    }
+
+    return offset0 + i;
+}
+
+/* a file being checked, with a checker and extents of its own */
+typedef struct
+{
+    files_t *files;
+    checker_t checker;
+    extent_t extent;
+} file_check_t;
+
+void
+files_init(files_t *fl, int oflags, int xflags, uint64_t bsize)
+{
+    memset(fl, 0, sizeof(*fl));
+    pthread_mutex_init(&fl->lock, 0);
+    fl->oflags = oflags;
+    fl->xflags = xflags;
+    fl->bsize = bsize;
+    fl->stats = xmalloc(sizeof(stream_t));
+    /* each file's bytes count when it's finished */
+    if (progress)
+	progress_watch(progress, &fl->stats, 1, 0);
+}
+
+/*
+ * Each thread times its streams into histograms of its own, which
+ * are added to the rest when it finishes.
+ */
+void
+files_merge_latency(files_t *fl, stream_latency_t *lat)
+{
+    pthread_mutex_lock(&fl->lock);
+    stream_latency_merge(&latency, lat);
+    pthread_mutex_unlock(&fl->lock);
+    xfree(lat);
+}
+
+void
+files_finish(files_t *fl)
+{
+    fileset_emit_stats("checked", fl->nfiles, time_now() - start_us,
+		       &fl->open_ns);
+    emit_stats(fl->stats);
+    if (progress)
+	progress_unwatch(progress);
+    xfree(fl->stats);
+    pthread_mutex_destroy(&fl->lock);
+}
+
+static void
+file_found_run(checker_t *c, uint64_t off,
+	       failure_mode_t failure, uint64_t detail)
+{
+    file_check_t *f = c->closure;
+
+    pthread_mutex_lock(&f->files->lock);
+    extent_advance(&f->extent, off, failure, detail);
+    pthread_mutex_unlock(&f->files->lock);
+}
+
+/*
+ * Checks the *sizep bytes of the file at path, which should be in the
+ * format fmt starting from the record for *offset0p, or given infer,
+ * as many whole records as the file has in whatever format infer finds
+ * its first records have, which are returned.  A file which should be
+ * there but can't be opened is short for all of it.  The stream is timed into the
+ * calling thread's lat.  Returns the number of errors found, or -1 if
+ * the file can't be opened.
+ */
+int
+check_file(files_t *fl, const char *path, record_format_t *fmt,
+	   uint64_t *offset0p, uint64_t *sizep, file_infer_t infer,
+	   stream_latency_t *lat)
+{
+    char name[PATH_MAX+64];
+    uint64_t end = *offset0p, nblocks = 0, nbytes = 0;
+    uint64_t t0, t1;
+    file_check_t f;
+    struct stat64 sb;
+    stream_t *s;
+
+    snprintf(name, sizeof(name), "%s: %s", argv0, path);
+    memset(&f, 0, sizeof(f));
+    f.files = fl;
+    extent_begin(&f.extent, name, *offset0p);
+    f.extent.quiet = TRUE;
+
+    t0 = time_now_ns();
+    s = stream_unix_open(path, fl->oflags, fl->xflags, fl->bsize);
+    t1 = time_now_ns();
+    if (s != 0)
+    {
+	s->latency = lat;
+	if (infer)
+	{
+	    if (fstat64(s->fd, &sb) < 0)
+	    {
+		perrorf("fstat64(\"%s\")", path);
+		sb.st_size = 0;
+	    }
+	    *sizep = sb.st_size;
+	    infer(path, s->fd, *sizep, fmt, offset0p);
+	    end = f.extent.start = *offset0p;
+	    *sizep &= ~(uint64_t)(fmt->size - 1);
+	}
+	checker_init(&f.checker, stderr, file_found_run, &f);
+	f.checker.fmt = *fmt;
+	f.checker.quiet_creator = TRUE;
+	end = checker_scan(&f.checker, s, *sizep, *offset0p);
+	nblocks = s->stats.nblocks;
+	nbytes = s->stats.nbytes;
+	stream_close(s);
+    }
+    else if (infer)
+	*sizep = 0;
+
+    pthread_mutex_lock(&fl->lock);
+    extent_finish(&f.extent, end, (signalled ? end : *offset0p + *sizep));
+    if (s == 0 && infer)
+	num_unreadable++;
+    if ((s == 0 || f.extent.nerrors) && get_num_errors() == 1)
+	handle_first_error();
+    if (s != 0)
+	histogram_add(&fl->open_ns, t1 - t0);
+    total_bytes += f.checker.total_bytes;
+    fl->stats->stats.nblocks += nblocks;
+    fl->stats->stats.nbytes += nbytes;
+    if (s == 0 || f.extent.nerrors)
+	fl->nfailed++;
+    fl->nfiles++;
+    pthread_mutex_unlock(&fl->lock);
+
+    return (s == 0 ? -1 : (int)f.extent.nerrors);
+}
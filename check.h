@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2021 Greg Banks <gnb@fmeh.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef _CHECKSTREAM_CHECK_H_
+#define _CHECKSTREAM_CHECK_H_ 1
+
+#include "common.h"
+#include "record.h"
+#include "watchdog.h"
+#include "progress.h"
+#include "json.h"
+#include "histogram.h"
+#include <pthread.h>
+
+/*
+ * The checking shared by checkstream's modes: records are checked by
+ * a checker_t, runs of records which fail in the same way are merged
+ * into extents by an extent_t, and the extents are counted into the
+ * statistics below and reported.
+ */
+typedef enum
+{
+    FM_NONE,	    /* everything's cool */
+    FM_SHORT,	    /* file too short */
+    FM_ZERO,	    /* record is entirely zero */
+    FM_BAD_CHECKSUM,/* failed checksum */
+    FM_BAD_TAG,	    /* valid record, wrong tag */
+    FM_BAD_OFFSET,  /* valid record, wrong offset */
+    FM_BAD_CREATOR, /* valid record, wrong creator */
+    FM_LOST,	    /* UDP: datagrams never arrived */
+    FM_DUPLICATE,   /* UDP: datagrams arrived more than once */
+    FM_REORDERED,   /* UDP: datagrams arrived after later ones */
+    FM_TOTAL,	    /* sum of above */
+    FM_NUM
+} failure_mode_t;
+
+extern const char *failure_names[FM_NUM];
+
+struct stream;
+struct stream_latency;
+
+/* set from the options, in checkstream.c */
+extern const char *argv0;
+extern int verbose;
+extern bool_t stop_on_error;
+extern bool_t dump_on_error;
+extern uint8_t tag;
+extern bool_t tag_flag;
+extern bool_t creator_flag;
+extern unsigned int num_threads;
+extern unsigned int read_ahead;
+extern bool_t udp_flag;
+extern watchdog_t *watchdog;
+extern progress_t *progress;
+extern json_writer_t *json;
+extern volatile int signalled;
+
+/* statistics */
+extern uint64_t total_bytes;		/* bytes read */
+extern uint64_t corrupt_bytes[FM_NUM];	/* bytes corrupted, by failure mode */
+extern uint32_t num_errors[FM_NUM];	/* number of detected corrupt ranges */
+extern uint32_t num_unreadable;		/* files and directories, in --recursive mode */
+extern uint64_t start_us;		/* test start timeval as microseconds */
+extern struct stream_latency latency;	/* of the operations on every stream */
+
+extern void emit_separator(void);
+extern void handle_first_error(void);
+extern uint32_t get_num_errors(void);
+extern void json_add_failures(json_obj_t *o);
+extern void emit_stats(struct stream *s);
+extern void found_extent(const char *who, uint64_t offset, uint64_t len,
+			 failure_mode_t failure, uint64_t detail);
+extern void announce_creator(FILE *fp, uint64_t creator);
+
+/*
+ * Runs of records which fail in the same way, or don't fail, are
+ * merged into extents in offset order, and each extent is reported
+ * when the next one starts.  Each stream, --server client or file
+ * being checked has an extent_t of its own.  A run of FM_SHORT means
+ * the data stopped there, and nothing after it is merged.
+ */
+typedef struct
+{
+    const char *who;		/* prefixes the reports */
+    bool_t quiet;		/* report valid extents only with -v */
+    struct stream *stats;	/* emitted after each bad extent, or 0 */
+    uint64_t start;
+    failure_mode_t failure;
+    uint64_t detail;
+    uint32_t nerrors;		/* bad extents reported */
+} extent_t;
+
+extern void extent_begin(extent_t *e, const char *who, uint64_t offset0);
+extern void extent_advance(extent_t *e, uint64_t off,
+			   failure_mode_t failure, uint64_t detail);
+extern void extent_finish(extent_t *e, uint64_t end, uint64_t expected);
+
+/*
+ * Checks the records in a range of a stream, calling found_run()
+ * at the first record of each run of records which fail in the
+ * same way, or don't fail.  Per-record diagnostics are written to
+ * the out stream as each record is checked.
+ */
+typedef struct checker checker_t;
+struct checker
+{
+    record_format_t fmt;
+    uint64_t total_bytes;	/* bytes checked */
+    failure_mode_t failure;	/* of the current run, FM_NUM before the first */
+    uint64_t failure_detail;
+    bool_t quiet_creator;	/* don't announce the creator when found */
+    FILE *out;
+    void (*found_run)(checker_t *, uint64_t off,
+		      failure_mode_t failure, uint64_t detail);
+    void *closure;
+};
+
+extern void checker_init(checker_t *c, FILE *out,
+			 void (*found_run)(checker_t *, uint64_t,
+					   failure_mode_t, uint64_t),
+			 void *closure);
+extern void checker_new_run(checker_t *c, uint64_t off,
+			    failure_mode_t failure, uint64_t detail);
+extern uint64_t checker_block(checker_t *c, const void *buf, uint64_t n,
+			      uint64_t off);
+extern void checker_record(checker_t *c, const record_t *rec, uint64_t off);
+extern uint64_t checker_scan(checker_t *c, struct stream *s,
+			     uint64_t length, uint64_t offset0);
+
+/*
+ * In --fileset and --recursive modes a pool of --threads threads
+ * checks many files, each as a stream of its own.  The runs in each
+ * file are merged into an extent_t of its own and reported prefixed
+ * by the file's path, but the valid extents only with -v, there being
+ * so many files.
+ */
+typedef struct
+{
+    /* serialises the reports and the statistics */
+    pthread_mutex_t lock;
+    int oflags;
+    int xflags;
+    uint64_t bsize;
+    uint64_t nfiles;		/* files checked */
+    uint64_t nfailed;		/* files with errors */
+    struct stream *stats;	/* for all the files together */
+    histogram_t open_ns;
+} files_t;
+
+/* works out a file's format and first offset from its first records */
+typedef void (*file_infer_t)(const char *path, int fd, uint64_t size,
+			     record_format_t *fmt, uint64_t *offset0p);
+
+extern void files_init(files_t *fl, int oflags, int xflags, uint64_t bsize);
+extern void files_merge_latency(files_t *fl, struct stream_latency *lat);
+extern void files_finish(files_t *fl);
+extern int check_file(files_t *fl, const char *path, record_format_t *fmt,
+		      uint64_t *offset0p, uint64_t *sizep, file_infer_t infer,
+		      struct stream_latency *lat);
+
+#endif /* _CHECKSTREAM_CHECK_H_ */
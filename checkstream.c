@@ -18,25 +18,28 @@
  */
 #include "common.h"
 #include "stream.h"
+#include "record.h"
+#include "check.h"
+#include "server.h"
+#include "reassembly.h"
+#include "walk.h"
 #include "panic.h"
+#include "fileset.h"
+#include "watchdog.h"
+#include "progress.h"
+#include "json.h"
+#include "shmstats.h"
+#include "perfcount.h"
+#include <limits.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
 
 /*
  * Checks the stream of data generated by genstream for consistency.
  */
 
-typedef enum
-{
-    FM_NONE,	    /* everything's cool */
-    FM_SHORT,	    /* file too short */
-    FM_ZERO,	    /* record is entirely zero */
-    FM_BAD_CHECKSUM,/* failed checksum */
-    FM_BAD_TAG,	    /* valid record, wrong tag */
-    FM_BAD_OFFSET,  /* valid record, wrong offset */
-    FM_BAD_CREATOR, /* valid record, wrong creator */
-    FM_TOTAL,	    /* sum of above */
-    FM_NUM
-} failure_mode_t;
-
 const char *argv0;
 int verbose = 0;
 bool_t stop_on_error = FALSE;
@@ -44,168 +47,448 @@ bool_t dump_on_error = FALSE;
 uint8_t tag = 0x0;
 bool_t tag_flag = FALSE;
 bool_t creator_flag = FALSE;
-static const char *failure_names[FM_NUM] =
-{
-    "valid data",
-    "file short",
-    "zero data",
-    "bad checksum",
-    "bad tag",
-    "bad offset",
-    "bad creator",
-    "total"
-};
-static const char *failure_explanations[FM_NUM] =
-{
-    0,
-    "less data was read than expected at offset %llu",
-    "you may wish to check for file holes with xfs_bmap",
-    "data is probably rubbish",
-    "data is from a previous run or from another file tagged %lld",
-    "data has been transposed within the file by %lld bytes",
-    "data generated by genstream pid %u started at %s",
-    0
-};
-
-/* statistics */
-uint64_t	total_bytes;		/* bytes read */
-uint64_t	corrupt_bytes[FM_NUM];	/* bytes corrupted, by failure mode */
-uint32_t	num_errors[FM_NUM];	/* number of detected corrupt ranges */
-uint64_t	start_us;		/* test start timeval as microseconds */
+unsigned int num_threads = 1;
+uint64_t chunk_size;
+unsigned int num_connections = 1;
+stream_t **connections;
+unsigned int read_ahead = 0;
+bool_t udp_flag = FALSE;
+watchdog_t *watchdog;		/* with --watchdog */
+progress_t *progress;		/* with --interval */
+json_writer_t *json;		/* with --json */
+shmstats_t *shm;		/* with --shm-stats */
+perfcount_t *perf;		/* with --perf-counters */
 
 volatile int signalled = 0;
 
+/* default bytes checked by each thread at a time in --threads mode */
+#define CHECK_CHUNK_SIZE	(64ULL<<20)
+
 static void
 handle_sig(int sig)
 {
     signalled++;
 }
 
+/* the counts which only checkstream has, for --shm-stats */
 static void
-emit_separator(void)
+fill_shmstats(shmstats_data_t *d)
 {
-    fprintf(stderr, "%s: ------------------------------------------------\n", argv0);
+    failure_mode_t failure;
+
+    d->total_bytes = total_bytes;
+    d->nerrors = get_num_errors();
+    for (failure = FM_NONE ; failure < FM_NUM ; failure++)
+    {
+	d->num_errors[failure] = num_errors[failure];
+	d->corrupt_bytes[failure] = corrupt_bytes[failure];
+    }
 }
 
 static void
-handle_first_error(void)
+found_run(checker_t *c, uint64_t off, failure_mode_t failure, uint64_t detail)
 {
-    if (stop_on_error)
-	exit(1);
-
-    if (dump_on_error)
-	panic();
+    total_bytes = c->total_bytes;
+    extent_advance((extent_t *)c->closure, off, failure, detail);
 }
 
-static uint32_t
-get_num_errors(void)
+/*
+ * In --threads mode the range to be checked is split into chunks,
+ * which are checked by a pool of threads each reading with pread()
+ * into its own buffer.  In --connections mode the chunks are the
+ * stripes, and each connection has a thread which checks its own
+ * chunks in turn as they arrive.  The threads record the runs they find and
+ * the per-record diagnostics, and the main thread replays them in
+ * offset order into the stream's extent_t, so that
+ * runs which cross chunk boundaries are reported as single extents
+ * and the report is the same as when checking with one thread.
+ * Chunks are claimed no more than a window ahead of the replay, to
+ * bound the memory used by results waiting to be replayed.
+ */
+typedef struct
 {
+    uint64_t offset;		/* expected offset of the first record */
     failure_mode_t failure;
-    uint32_t n = 0;
+    uint64_t detail;
+    uint64_t total_bytes;	/* checked in the chunk so far */
+    long text;			/* length of diagnostics so far */
+} run_t;
+
+typedef struct
+{
+    checker_t checker;
+    uint64_t offset;		/* expected offset of the first record */
+    uint64_t length;
+    uint64_t end;		/* expected offset after the last record checked */
+    run_t *runs;
+    unsigned int nruns;
+    unsigned int maxruns;
+    char *text;			/* per-record diagnostics */
+    size_t textlen;
+    uint64_t nblocks;
+    uint64_t nbytes;
+    stream_latency_t latency;
+    bool_t done;
+} chunk_t;
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    stream_t *stream;		/* provides the fd, name and block size */
+    extent_t *extent;		/* the runs are replayed into */
+    uint64_t seek;		/* file offset of the range */
+    uint64_t offset0;		/* expected offset of the range */
+    uint64_t length;
+    uint64_t chunk_size;
+    uint64_t creator;
+    uint64_t nchunks;
+    uint64_t next;		/* next chunk to be claimed */
+    uint64_t replayed;		/* number of chunks replayed */
+    bool_t stopping;
+    unsigned int window;
+    chunk_t *chunks;		/* indexed by chunk number modulo window */
+    struct connection *conns;	/* in --connections mode */
+} check_pool_t;
+
+typedef struct connection
+{
+    check_pool_t *pool;
+    unsigned int index;
+    pthread_t thread;
+    uint64_t nbytes;		/* read on this connection */
+    uint64_t elapsed;		/* microseconds until its last chunk was checked */
+} connection_t;
 
-    for (failure = 0 ; failure < FM_TOTAL ; failure++)
+static void
+chunk_found_run(checker_t *c, uint64_t off,
+		failure_mode_t failure, uint64_t detail)
+{
+    chunk_t *ch = c->closure;
+    run_t *r;
+
+    if (ch->nruns == ch->maxruns)
     {
-	if (failure != FM_NONE && failure != FM_TOTAL)
-	    n += num_errors[failure];
+	ch->maxruns = (ch->maxruns ? 2 * ch->maxruns : 16);
+	ch->runs = xrealloc(ch->runs, ch->maxruns * sizeof(run_t));
     }
+    r = &ch->runs[ch->nruns++];
+    r->offset = off;
+    r->failure = failure;
+    r->detail = detail;
+    r->total_bytes = c->total_bytes;
+    r->text = ftell(c->out);
+}
+
+static void
+check_chunk(check_pool_t *p, chunk_t *ch, uint64_t k)
+{
+    uint64_t start = k * p->chunk_size;
+    FILE *out;
+    stream_t *s;
+
+    memset(ch, 0, sizeof(*ch));
+    ch->offset = p->offset0 + start;
+    ch->length = MIN(p->chunk_size, p->length - start);
+
+    if ((out = open_memstream(&ch->text, &ch->textlen)) == 0)
+	fatal("open_memstream: %s", strerror(errno));
+    checker_init(&ch->checker, out, chunk_found_run, ch);
+    ch->checker.fmt.creator = p->creator;
+    ch->checker.quiet_creator = TRUE;
 
-    return n;
+    if (p->conns)
+    {
+	/* the connection's stream carries on from the previous chunk */
+	s = connections[k % num_connections];
+	ch->nblocks = s->stats.nblocks;
+	ch->nbytes = s->stats.nbytes;
+	s->latency = &ch->latency;
+	/* the connection's bytes so far were the earlier chunks */
+	if (watchdog)
+	    s->watch = watchdog_slot(watchdog, 1 + k % p->window,
+				     s->name, p->seek + start - ch->nbytes);
+	ch->end = checker_scan(&ch->checker, s, ch->length, ch->offset);
+	s->latency = 0;
+	s->watch = 0;
+	ch->nblocks = s->stats.nblocks - ch->nblocks;
+	ch->nbytes = s->stats.nbytes - ch->nbytes;
+    }
+    else
+    {
+	s = stream_pread_open(p->stream->name, p->stream->fd, p->stream->xflags,
+			      p->stream->bufsize, p->seek + start, ch->length);
+	s->latency = &ch->latency;
+	if (watchdog)
+	    s->watch = watchdog_slot(watchdog, 1 + k % p->window,
+				     s->name, p->seek + start);
+	ch->end = checker_scan(&ch->checker, s, ch->length, ch->offset);
+	ch->nblocks = s->stats.nblocks;
+	ch->nbytes = s->stats.nbytes;
+	stream_close(s);
+    }
+    fclose(out);
+}
+
+static void *
+check_thread(void *arg)
+{
+    check_pool_t *p = arg;
+    chunk_t *ch;
+    uint64_t k;
+
+    pthread_mutex_lock(&p->lock);
+    for (;;)
+    {
+	while (!p->stopping && p->next < p->nchunks &&
+	       p->next >= p->replayed + p->window)
+	    pthread_cond_wait(&p->cond, &p->lock);
+	if (p->stopping || p->next >= p->nchunks)
+	    break;
+	k = p->next++;
+	ch = &p->chunks[k % p->window];
+	pthread_mutex_unlock(&p->lock);
+
+	check_chunk(p, ch, k);
+
+	pthread_mutex_lock(&p->lock);
+	ch->done = TRUE;
+	pthread_cond_broadcast(&p->cond);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return 0;
+}
+
+static void *
+connection_thread(void *arg)
+{
+    connection_t *conn = arg;
+    check_pool_t *p = conn->pool;
+    uint64_t start = time_now();
+    chunk_t *ch;
+    uint64_t k;
+    bool_t stop;
+
+    for (k = conn->index ; k < p->nchunks ; k += num_connections)
+    {
+	pthread_mutex_lock(&p->lock);
+	while (!p->stopping && k >= p->replayed + p->window)
+	    pthread_cond_wait(&p->cond, &p->lock);
+	stop = p->stopping;
+	pthread_mutex_unlock(&p->lock);
+	if (stop)
+	    break;
+
+	ch = &p->chunks[k % p->window];
+	check_chunk(p, ch, k);
+	conn->nbytes += ch->nbytes;
+	conn->elapsed = time_now() - start;
+
+	pthread_mutex_lock(&p->lock);
+	ch->done = TRUE;
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->lock);
+    }
+    return 0;
 }
 
 static void
-emit_stats(stream_t *s)
+emit_connection_stats(check_pool_t *p)
 {
-    failure_mode_t failure;
-    uint64_t deltat = time_now() - start_us;
-    char sizebuf1[32];
-    char sizebuf2[32];
-
-    if (deltat == 0)
-	deltat = 1;		/* JIC, avoid divide by zero */
-    for (failure = FM_NONE ; failure < FM_TOTAL ; failure++)
-    {
-	if (num_errors[failure] > 0)
-	    fprintf(stderr, "%s: [%s] %u %s in %u.%06u seconds (%g err/sec)\n",
-		    argv0,
-		    failure_names[failure],
-		    num_errors[failure],
-		    (failure == FM_NONE ? "valid extents" : "errors"),
-		    time_seconds(deltat), time_microseconds(deltat),
-		    (double)num_errors[failure] / time_double(deltat));
-	if (corrupt_bytes[failure] > 0)
-	    fprintf(stderr, "%s: [%s] %llu/%llu bytes (%s/%s)\n",
-		    argv0,
-		    failure_names[failure],
-		    (unsigned long long)corrupt_bytes[failure],
-		    (unsigned long long)total_bytes,
-		    iec_sizestr(corrupt_bytes[failure], sizebuf1, sizeof(sizebuf1)),
-		    iec_sizestr(total_bytes, sizebuf2, sizeof(sizebuf2)));
-    }
-    /* used for determining how many blocks have been read or written */
-    fprintf(stderr, "%s: read %llu blocks %llu bytes in %u.%06u seconds (%g KiB/sec)%s\n",
-		argv0,
-		(unsigned long long)s->stats.nblocks,
-		(unsigned long long)s->stats.nbytes,
+    unsigned int i;
+
+    for (i = 0 ; i < num_connections ; i++)
+    {
+	connection_t *conn = &p->conns[i];
+	uint64_t deltat = MAX(conn->elapsed, 1);
+
+	fprintf(stderr, "%s: connection %u: read %llu bytes in %u.%06u seconds (%g KiB/sec)\n",
+		argv0, i,
+		(unsigned long long)conn->nbytes,
 		time_seconds(deltat), time_microseconds(deltat),
-		(double)s->stats.nbytes / time_double(deltat) / 1024.0,
-		(get_num_errors() ? "" : ", no errors"));
+		(double)conn->nbytes / time_double(deltat) / 1024.0);
+    }
+}
 
-    fflush(stderr); /* JIC */
+/*
+ * Returns TRUE if checking stops with this chunk,
+ * because the file was short or we were interrupted.
+ */
+static bool_t
+replay_chunk(check_pool_t *p, chunk_t *ch)
+{
+    uint64_t base = total_bytes;
+    long printed = 0;
+    unsigned int i;
+
+    p->stream->stats.nblocks += ch->nblocks;
+    p->stream->stats.nbytes += ch->nbytes;
+    if (p->stream->latency)
+	stream_latency_merge(p->stream->latency, &ch->latency);
+    if (!p->creator && ch->checker.fmt.creator)
+    {
+	p->creator = ch->checker.fmt.creator;
+	announce_creator(stderr, p->creator);
+    }
+    for (i = 0 ; i < ch->nruns ; i++)
+    {
+	run_t *r = &ch->runs[i];
+
+	fwrite(ch->text + printed, 1, r->text - printed, stderr);
+	printed = r->text;
+	total_bytes = base + r->total_bytes;
+	extent_advance(p->extent, r->offset, r->failure, r->detail);
+    }
+    fwrite(ch->text + printed, 1, ch->textlen - printed, stderr);
+    total_bytes = base + ch->checker.total_bytes;
+
+    return (p->extent->failure == FM_SHORT ||
+	    ch->end < ch->offset + ch->length);
 }
 
-static void
-found_extent(uint64_t offset, uint64_t len,
-	     failure_mode_t failure, uint64_t detail)
+/*
+ * The chunks are checked independently, so they all need to know
+ * the expected creator before they start.  Like the single threaded
+ * checker, take it from the first record with a non-zero creator,
+ * announcing each one on the way, but only look as far as the end of
+ * the first chunk.  Failing that, each chunk takes the first creator
+ * it finds.
+ */
+static uint64_t
+read_first_creator(check_pool_t *p)
 {
-    if (!len)
-	return;
-    num_errors[failure]++;
-    num_errors[FM_TOTAL]++;
-    corrupt_bytes[failure] += len;
-    corrupt_bytes[FM_TOTAL] += len;
+    stream_t *s;
+    const record_t *rec;
+    uint64_t creator = 0;
+
+    s = stream_pread_open(p->stream->name, p->stream->fd, p->stream->xflags,
+			  p->stream->bufsize, p->seek,
+			  MIN(p->chunk_size, p->length));
+    while (!creator &&
+	   (rec = (const record_t *)stream_inline_read(s, RECORD_SIZE_CREATOR)) != 0)
+    {
+	creator = record_get_creator(rec);
+	announce_creator(stderr, creator);
+    }
+    stream_close(s);
+    return creator;
+}
 
-    emit_separator();
-    fprintf(stderr, "%s: %s for %llu bytes at offset %llu\n",
-	    argv0, failure_names[failure],
-	    (unsigned long long)len, (unsigned long long)offset);
-    if (failure_explanations[failure])
+static uint64_t
+check_threaded(stream_t *s, extent_t *e, uint64_t seek, uint64_t length,
+	       uint64_t offset0)
+{
+    check_pool_t pool;
+    pthread_t *threads = 0;
+    uint64_t k, end = offset0;
+    unsigned int i;
+    bool_t stop = FALSE;
+    int r;
+
+    memset(&pool, 0, sizeof(pool));
+    pthread_mutex_init(&pool.lock, 0);
+    pthread_cond_init(&pool.cond, 0);
+    pool.stream = s;
+    pool.extent = e;
+    pool.seek = seek;
+    pool.offset0 = offset0;
+    pool.length = length;
+    pool.chunk_size = chunk_size & ~(creator_flag ? RECORD_MASK_CREATOR : RECORD_MASK);
+    if (pool.chunk_size == 0)
+	pool.chunk_size = (creator_flag ? RECORD_SIZE_CREATOR : RECORD_SIZE);
+    pool.nchunks = (length + pool.chunk_size - 1) / pool.chunk_size;
+    /* the chunks of every connection have to fit in the window */
+    pool.window = 2 * MAX(num_threads, num_connections);
+    pool.chunks = xmalloc(pool.window * sizeof(chunk_t));
+    /* a connection can't be peeked at, so each chunk finds the creator */
+    if (creator_flag && num_connections == 1)
+	pool.creator = read_first_creator(&pool);
+
+    if (num_connections > 1)
     {
-	fprintf(stderr, "%s: ", argv0);
-	if (failure == FM_BAD_CREATOR)
+	pool.conns = xmalloc(num_connections * sizeof(connection_t));
+	for (i = 0 ; i < num_connections ; i++)
 	{
-	    fprintf(stderr, failure_explanations[failure],
-		    creator_get_pid(detail),
-		    creator_to_timestamp_str(detail));
+	    pool.conns[i].pool = &pool;
+	    pool.conns[i].index = i;
+	    if ((r = pthread_create(&pool.conns[i].thread, 0,
+				    connection_thread, &pool.conns[i])))
+		fatal("pthread_create: %s", strerror(r));
 	}
-	else
-	    fprintf(stderr, failure_explanations[failure], detail);
-	fprintf(stderr, "\n");
+    }
+    else
+    {
+	threads = xmalloc(num_threads * sizeof(pthread_t));
+	for (i = 0 ; i < num_threads ; i++)
+	{
+	    if ((r = pthread_create(&threads[i], 0, check_thread, &pool)))
+		fatal("pthread_create: %s", strerror(r));
+	}
+    }
+
+    for (k = 0 ; k < pool.nchunks && !stop ; k++)
+    {
+	chunk_t *ch = &pool.chunks[k % pool.window];
+
+	pthread_mutex_lock(&pool.lock);
+	while (!ch->done)
+	    pthread_cond_wait(&pool.cond, &pool.lock);
+	pthread_mutex_unlock(&pool.lock);
+
+	stop = replay_chunk(&pool, ch);
+	end = ch->end;
+	xfree(ch->runs);
+	free(ch->text);		/* allocated by open_memstream() */
+
+	pthread_mutex_lock(&pool.lock);
+	ch->done = FALSE;
+	pool.replayed++;
+	pthread_cond_broadcast(&pool.cond);
+	pthread_mutex_unlock(&pool.lock);
     }
 
+    pthread_mutex_lock(&pool.lock);
+    pool.stopping = TRUE;
+    pthread_cond_broadcast(&pool.cond);
+    pthread_mutex_unlock(&pool.lock);
+    if (pool.conns)
+    {
+	for (i = 0 ; i < num_connections ; i++)
+	    pthread_join(pool.conns[i].thread, 0);
+	emit_connection_stats(&pool);
+	xfree(pool.conns);
+    }
+    else
+    {
+	for (i = 0 ; i < num_threads ; i++)
+	    pthread_join(threads[i], 0);
+	xfree(threads);
+    }
+    xfree(pool.chunks);
+    pthread_cond_destroy(&pool.cond);
+    pthread_mutex_destroy(&pool.lock);
+    return end;
 }
 
 static void
-check_stream(stream_t *s, uint64_t length, uint64_t offset0)
+check_stream(stream_t *s, uint64_t seek, uint64_t length, uint64_t offset0)
 {
-    uint64_t i, off = offset0, fi, start = offset0;
     size_t record_size = (creator_flag ? RECORD_SIZE_CREATOR : RECORD_SIZE);
     uint64_t record_mask = (creator_flag ? RECORD_MASK_CREATOR : RECORD_MASK);
-    uint16_t csum;
-    failure_mode_t failure, last_failure = FM_NONE;
-    uint64_t failure_detail, last_failure_detail = 0;
-    record_t *rec;
-    uint8_t ftag = 0;
-    static const record_t zero_record;
-    uint64_t creator, expected_creator = 0;
+    checker_t c;
+    extent_t e;
+    uint64_t end;
 
     if (start_us == 0)
 	start_us = time_now();
+    if (progress)
+	progress_watch(progress, &s, 1, seek);
 
     if (length < record_size)
     {
 	fprintf(stderr, "%s: file too short: must be at least %u bytes long\n",
 		argv0, (unsigned int)record_size);
-	found_extent(0, length, FM_SHORT, 0);
+	found_extent(argv0, 0, length, FM_SHORT, 0);
 	goto out;
     }
     /* has to be multiple of 8 bytes */
@@ -217,168 +500,112 @@ check_stream(stream_t *s, uint64_t length, uint64_t offset0)
 	length &= ~record_mask;
     }
 
-    for (i = 0 ; !signalled && i < length ; i += record_size)
+    extent_begin(&e, argv0, offset0);
+    e.stats = s;
+    if (num_threads > 1 || num_connections > 1)
+    {
+	end = check_threaded(s, &e, seek, length, offset0);
+    }
+    else if (udp_flag)
+    {
+	checker_init(&c, stderr, found_run, &e);
+	c.total_bytes = total_bytes;
+	end = check_datagrams(&c, s, length, offset0);
+	total_bytes = c.total_bytes;
+    }
+    else
     {
-	off = i + offset0;
+	checker_init(&c, stderr, found_run, &e);
+	c.total_bytes = total_bytes;
+	end = checker_scan(&c, s, length, offset0);
+	total_bytes = c.total_bytes;
+    }
+    /*
+     * A stream is only reported short by the record which couldn't be
+     * read, as the rest of the length given may never have been meant.
+     */
+    extent_finish(&e, end, (e.failure == FM_SHORT ? e.start + record_size : end));
 
-	if ((rec = (record_t *)stream_inline_read(s, record_size)) == 0)
-	{
-	    if (!signalled)
-	    {
-		fprintf(stderr, "%s: read failed at offset %llu\n",
-			    argv0, (unsigned long long)off);
-		found_extent(start, (off-start), last_failure, last_failure_detail);
-		found_extent(off, record_size, FM_SHORT, off);
-		last_failure = FM_SHORT;
-	    }
-	    break;
-	}
-	total_bytes += record_size;
+out:
+    if (progress)
+	progress_unwatch(progress);
+    if (get_num_errors())
+	fprintf(stderr, "%s: \n", argv0);
+    emit_separator();
+    fprintf(stderr, "%s: end of file summary\n", argv0);
+    emit_stats(s);
+    if (get_num_errors() == 1)
+	handle_first_error();
+}
 
-	if (verbose > 3)
-	    hexdump(off, rec, record_size);
+/*
+ * In --fileset mode each thread claims the next file not yet claimed,
+ * and checks it with the size and tag which fileset_size() and
+ * fileset_tag() give it.
+ */
+typedef struct
+{
+    files_t files;
+    const fileset_t *fs;
+    uint64_t next;		/* next file to be claimed, under files.lock */
+} fileset_pool_t;
 
-	if (creator_flag)
-	    csum = aligned_ip_checksum_8(&rec->w16[0]);
-	else
-	    csum = aligned_ip_checksum_4(&rec->w16[0]);
+static void *
+fileset_check_thread(void *arg)
+{
+    fileset_pool_t *p = arg;
+    stream_latency_t *lat = xmalloc(sizeof(stream_latency_t));
+    char path[PATH_MAX];
+    record_format_t fmt;
+    uint64_t i, offset0, size;
 
-	if (tag_flag)
-	{
-	    fi = (uint64_t)ntohl(rec->w32[1]) | ((uint64_t)rec->w8[3] << 32);
-	    ftag = rec->w8[2];
-	}
-	else
-	{
-	    fi = (uint64_t)ntohl(rec->w32[1]) | ((uint64_t)ntohs(rec->w16[1]) << 32);
-	}
-	if (creator_flag)
-	{
-	    creator = (uint64_t)ntohl(rec->w32[3]) | ((uint64_t)ntohl(rec->w32[2]) << 32);
-	    if (!expected_creator)
-	    {
-		fprintf(stderr, "%s: file was generated by genstream pid %u started at %s\n",
-				argv0,
-				creator_get_pid(creator),
-				creator_to_timestamp_str(creator));
-		expected_creator = creator;
-	    }
-	}
+    for (;;)
+    {
+	pthread_mutex_lock(&p->files.lock);
+	i = p->next++;
+	pthread_mutex_unlock(&p->files.lock);
+	if (signalled || i >= p->fs->nfiles)
+	    break;
 
-	if (verbose > 2)
-	    fprintf(stderr, "[0x%llx] offset 0x%llx tag %02x checksum %04x\n",
-		    (unsigned long long)off, (unsigned long long)fi,
-		    (unsigned)ftag, (unsigned)csum);
+	fileset_path(p->fs, i, path, sizeof(path));
+	record_format_init(&fmt, TRUE, fileset_tag(tag, i), creator_flag, 0);
+	offset0 = 0;
+	size = fileset_size(p->fs, i);
+	check_file(&p->files, path, &fmt, &offset0, &size, 0, lat);
+    }
+    files_merge_latency(&p->files, lat);
+    return 0;
+}
 
-	failure = FM_NONE;
-	failure_detail = 0;
-	if (csum)
-	{
-	    /*
-	     * Note, a zero record will fail the checksum, so we
-	     * can delay checking for zero records until then.
-	     */
-	    if (!memcmp(rec, &zero_record, record_size))
-	    {
-		if (verbose > 1)
-		    fprintf(stderr, "%s: record is zero at 0x%llx\n",
-			    argv0, (unsigned long long)off);
-		failure = FM_ZERO;
-	    }
-	    else
-	    {
-		if (verbose > 1)
-		    fprintf(stderr, "%s: checksum failed at 0x%llx\n",
-			    argv0, (unsigned long long)off);
-		failure = FM_BAD_CHECKSUM;
-	    }
-	}
-	else
-	{
-	    if (fi != off)
-	    {
-		if (verbose > 1)
-		    fprintf(stderr, "%s: record at 0x%llx should be at 0x%llx\n",
-			    argv0, (unsigned long long)off, (unsigned long long)fi);
-		failure = FM_BAD_OFFSET;
-		failure_detail = (off - fi);
-	    }
-	    if (tag_flag && ftag != tag)
-	    {
-		if (verbose > 1)
-		    fprintf(stderr, "%s: record at 0x%llx should be tagged %u not %u\n",
-			    argv0, (unsigned long long)off, (unsigned)tag, (unsigned)ftag);
-		failure = FM_BAD_TAG;
-		failure_detail = ftag;
-	    }
-	    if (creator_flag && creator != expected_creator)
-	    {
-		if (verbose > 1)
-		    fprintf(stderr, "%s: record at 0x%llx should have creator 0x%llx not 0x%llx\n",
-			    argv0, (unsigned long long)off,
-			    (unsigned long long)expected_creator,
-			    (unsigned long long)creator);
-		failure = FM_BAD_CREATOR;
-		failure_detail = creator;
-	    }
-	}
+static void
+check_fileset(const fileset_t *fs, int oflags, int xflags, uint64_t bsize)
+{
+    fileset_pool_t p;
+    pthread_t *threads;
+    unsigned int i;
+    int r;
 
-	if (failure && failure != FM_ZERO && verbose)
-	    hexdump(off-record_size, rec, record_size);
+    memset(&p, 0, sizeof(p));
+    files_init(&p.files, oflags, xflags, bsize);
+    p.fs = fs;
 
-	if (failure && !last_failure)
-	{
-	    /* start of range of bad records */
-	    found_extent(start, (off-start), FM_NONE, 0);
-	    start = off;
-	    if (failure != FM_ZERO && verbose)
-	    {
-		emit_separator();
-		fprintf(stderr, "%s: 0x%llx: hexdump of %s data\n",
-			argv0, (unsigned long long)off, failure_names[failure]);
-	    }
-	}
-	else if (!failure && last_failure)
-	{
-	    /* end of range of bad records */
-	    found_extent(start, (off-start), last_failure, last_failure_detail);
-	    emit_stats(s);
-	    if (get_num_errors() == 1)
-		handle_first_error();
-	    start = off;
-	}
-	else if (failure &&
-	         (failure != last_failure ||
-		  failure_detail != last_failure_detail))
-	{
-	    /* transition between two failure modes */
-	    found_extent(start, (off-start), last_failure, last_failure_detail);
-	    emit_stats(s);
-	    if (get_num_errors() == 1)
-		handle_first_error();
-	    start = off;
-	    if (failure != FM_ZERO && verbose)
-	    {
-		emit_separator();
-		fprintf(stderr, "%s: 0x%llx: hexdump of %s data\n",
-			argv0, (unsigned long long)off, failure_names[failure]);
-	    }
-	}
-	last_failure = failure;
-	last_failure_detail = failure_detail;
-    }
+    start_us = time_now();
 
-    if (last_failure != FM_SHORT)
-	found_extent(start, (off+record_size-start), last_failure, last_failure_detail);
+    threads = xmalloc(num_threads * sizeof(pthread_t));
+    for (i = 0 ; i < num_threads ; i++)
+    {
+	if ((r = pthread_create(&threads[i], 0, fileset_check_thread, &p)))
+	    fatal("pthread_create: %s", strerror(r));
+    }
+    for (i = 0 ; i < num_threads ; i++)
+	pthread_join(threads[i], 0);
 
-out:
-    if (get_num_errors())
-	fprintf(stderr, "%s: \n", argv0);
     emit_separator();
-    fprintf(stderr, "%s: end of file summary\n", argv0);
-    emit_stats(s);
-    if (get_num_errors() == 1)
-	handle_first_error();
+    fprintf(stderr, "%s: checked %llu files, %llu with errors\n",
+	    argv0, (unsigned long long)p.files.nfiles,
+	    (unsigned long long)p.files.nfailed);
+    files_finish(&p.files);
+    xfree(threads);
 }
 
 static void
@@ -395,11 +622,54 @@ format_argv0(const char *filename)
     argv0 = buf;
 }
 
+/* with --read-ahead, wrap a newly opened stream */
+static stream_t *
+read_ahead_stream(stream_t *s)
+{
+    if (s == 0 || !read_ahead)
+	return s;
+    return stream_readahead_open(s, read_ahead);
+}
+
+/*
+ * The streams checked one at a time are all timed together, and
+ * watched in slot 0; base is the offset of the stream's first byte.
+ */
+static stream_t *
+timed_stream(stream_t *s, uint64_t base)
+{
+    if (s == 0)
+	return s;
+    s->latency = &latency;
+    if (watchdog)
+	s->watch = watchdog_slot(watchdog, 0, s->name, base);
+    return s;
+}
+
+static void
+set_socket_buffer(stream_t *s, uint64_t size)
+{
+    int actual;
+
+    if (!size)
+	return;
+    if ((actual = stream_set_socket_buffer(s, size)) < 0)
+	exit(1);	    /* error printed at lower level in stream.c */
+    if (verbose)
+	printf("%s: %s: socket receive buffer is %d bytes\n",
+		argv0, s->name, actual);
+}
+
 static const char usage_str[] =
 "Usage: checkstream [options] --length=SIZE < file\n"
 "       checkstream [options] [--loop] file\n"
 "       checkstream [options] --seek=SIZE --length=SIZE file\n"
 "       checkstream [options] --protocol=tcp --length NUM [--port=PORT]\n"
+"       checkstream [options] --protocol=tcp --server --length NUM [--port=PORT]\n"
+"       checkstream [options] --protocol=udp --length NUM [--port=PORT]\n"
+"       checkstream [options] --protocol=unix|unix-seqpacket --length NUM path\n"
+"       checkstream [options] --fileset=N --length=SIZE|MIN-MAX directory\n"
+"       checkstream [options] --recursive directory\n"
 "options:\n"
 "    -v, --verbose              emit more messages (repeat for more messages)\n"
 "    -l SIZE, --length=SIZE     check only the given length of data for filter mode\n"
@@ -407,16 +677,76 @@ static const char usage_str[] =
 "    -S, --sync                 open files with O_SYNC\n"
 "    -D, --direct               open files with O_DIRECT\n"
 "    -M, --mmap                 use mmap instead of the read() syscall\n"
+"    --mmap-window=SIZE         with --mmap, map at most SIZE bytes of the file\n"
+"                               at once (default and maximum 1GiB)\n"
+"    --mmap-sequential          with --mmap, advise the kernel of sequential access\n"
+"    --mmap-hugepage            with --mmap, advise the kernel to use huge pages\n"
+"    --mmap-populate            with --mmap, fault in each window when it's mapped\n"
 "    -b SIZE, --blocksize=SIZE  block size for read() syscalls\n"
 "    -e, --stop-on-error        exit on first detected error\n"
 "    -s SIZE, --seek=SIZE       seek to the given offset before reading\n"
 "    -o SIZE, --offset=SIZE     set expected offset of start of stream\n"
 "    -T NUM, --tag=N            expect given 8-bit tag value in stream (default 0)\n"
 "    --kernel-dump-on-error     trigger a kernel panic and dump on detecting an error\n"
-"    -p PORT, --port=PORT       use PORT in TCP mode, default 5000. Use \"dynamic\"\n"
+"    -p PORT, --port=PORT       use PORT in TCP or UDP mode, default 5000. Use \"dynamic\"\n"
 "                               to allow kernel to choose a port\n"
 "    --port-filename=FILE       write TCP port used to FILE\n"
+"    --record-impl=NAME         use the named record checking implementation\n"
+"                               (auto, scalar, template, sse2, avx2,\n"
+"                               avx512; default auto)\n"
+"    --threads=N                check a file with N threads in parallel\n"
+"    --chunk-size=SIZE          in --threads mode, check SIZE bytes at a time\n"
+"                               in each thread (default 64MiB)\n"
+"    --connections=N            in TCP mode, accept N connections from\n"
+"                               genstream --connections=N and check each\n"
+"                               in its own thread\n"
+"    --engine=ENGINE            read files with sync read() calls or io_uring\n"
+"                               (sync, io_uring; default sync)\n"
+"    --iodepth=N                with --engine=io_uring, keep N reads in flight\n"
+"                               (default 8)\n"
+"    --register-buffers         with --engine=io_uring, use registered buffers\n"
+"    --register-files           with --engine=io_uring, use a registered file\n"
+"    --sqpoll                   with --engine=io_uring, use a kernel thread to\n"
+"                               poll for submissions\n"
+"    --read-ahead=N             read in a separate thread into N buffers ahead\n"
+"                               of checking\n"
+"    --server                   in TCP mode, keep checking clients which each\n"
+"                               send NUM bytes until interrupted, multiplexed\n"
+"                               over --threads event loops\n"
+"    --max-clients=N            in --server mode, check at most N clients at\n"
+"                               once (default 64)\n"
+"    --socket-buffer=SIZE       with --protocol, set the socket's receive buffer\n"
+"                               to SIZE bytes, beyond the sysctl limit if\n"
+"                               allowed\n"
+"    --fileset=N                check N files under the directory written by\n"
+"                               genstream --fileset with the same options,\n"
+"                               with --threads threads\n"
+"    --fileset-depth=D          with --fileset, the levels of subdirectories\n"
+"                               (default 0)\n"
+"    --fileset-fanout=F         with --fileset, the subdirectories of each\n"
+"                               directory (default 16)\n"
+"    --recursive                check every file in the directory tree, working\n"
+"                               out each one's format and starting offset from\n"
+"                               its first records, with --threads threads\n"
+"                               (default one per CPU)\n"
+"    --watchdog=TIME            report any read which takes longer than TIME,\n"
+"                               and a timeline of them at the end\n"
+"    --stall-panic=TIME         trigger a kernel panic and dump on a read\n"
+"                               which takes longer than TIME\n"
+"    --interval=TIME            report the bytes and records checked, the\n"
+"                               throughput and the errors every TIME\n"
+"    --interval-csv=FILE        with --interval, write the reports to FILE\n"
+"                               as CSV rows instead\n"
+"    --json=FILE                write the configuration, each extent, the\n"
+"                               --interval reports and the summary to FILE as\n"
+"                               JSON lines\n"
+"    --shm-stats                publish the counters in shared memory for\n"
+"                               streamtop, every --interval or second\n"
+"    --perf-counters            report the CPU time, and the cycles and\n"
+"                               instructions per byte where perf events are\n"
+"                               allowed\n"
 "SIZE arguments may be specified as nnn[KMGT]\n"
+"TIME arguments may be specified as nnn[.nnn][s|ms|us]\n"
 ;
 
 static void
@@ -445,6 +775,34 @@ static const struct option longopts[] =
     {"protocol",		required_argument,  NULL, 'P'},
     {"port",			required_argument,  NULL, 'p'},
     {"port-filename",		required_argument,  NULL, ARGS_NOSHORT(2)},
+    {"record-impl",		required_argument,  NULL, ARGS_NOSHORT(3)},
+    {"threads",			required_argument,  NULL, ARGS_NOSHORT(4)},
+    {"chunk-size",		required_argument,  NULL, ARGS_NOSHORT(5)},
+    {"engine",			required_argument,  NULL, ARGS_NOSHORT(6)},
+    {"iodepth",			required_argument,  NULL, ARGS_NOSHORT(7)},
+    {"register-buffers",	no_argument,	    NULL, ARGS_NOSHORT(8)},
+    {"register-files",		no_argument,	    NULL, ARGS_NOSHORT(9)},
+    {"sqpoll",			no_argument,	    NULL, ARGS_NOSHORT(10)},
+    {"read-ahead",		required_argument,  NULL, ARGS_NOSHORT(11)},
+    {"mmap-window",		required_argument,  NULL, ARGS_NOSHORT(12)},
+    {"mmap-sequential",		no_argument,	    NULL, ARGS_NOSHORT(13)},
+    {"mmap-hugepage",		no_argument,	    NULL, ARGS_NOSHORT(14)},
+    {"mmap-populate",		no_argument,	    NULL, ARGS_NOSHORT(15)},
+    {"connections",		required_argument,  NULL, ARGS_NOSHORT(16)},
+    {"server",			no_argument,	    NULL, ARGS_NOSHORT(17)},
+    {"max-clients",		required_argument,  NULL, ARGS_NOSHORT(18)},
+    {"socket-buffer",		required_argument,  NULL, ARGS_NOSHORT(19)},
+    {"fileset",			required_argument,  NULL, ARGS_NOSHORT(20)},
+    {"fileset-depth",		required_argument,  NULL, ARGS_NOSHORT(21)},
+    {"fileset-fanout",		required_argument,  NULL, ARGS_NOSHORT(22)},
+    {"recursive",		no_argument,	    NULL, ARGS_NOSHORT(23)},
+    {"watchdog",		required_argument,  NULL, ARGS_NOSHORT(24)},
+    {"stall-panic",		required_argument,  NULL, ARGS_NOSHORT(25)},
+    {"interval",		required_argument,  NULL, ARGS_NOSHORT(26)},
+    {"interval-csv",		required_argument,  NULL, ARGS_NOSHORT(27)},
+    {"json",			required_argument,  NULL, ARGS_NOSHORT(28)},
+    {"shm-stats",		no_argument,	    NULL, ARGS_NOSHORT(29)},
+    {"perf-counters",		no_argument,	    NULL, ARGS_NOSHORT(30)},
     {"version",			no_argument,	    NULL, 'V'},
     {0, 0, 0, 0}
 };
@@ -469,6 +827,30 @@ main(int argc, char **argv)
     int protocol = 0;
     uint16_t port = DEFAULT_PORT;
     const char *port_filename = 0;
+    int engine = ENGINE_SYNC;
+    unsigned int iodepth = 0;
+    uint64_t mmap_window = DEFAULT_MMAP_WINDOW;
+    bool_t server_flag = FALSE;
+    unsigned int max_clients = 0;
+    uint64_t socket_buffer = 0;
+    uint64_t max_length = 0;
+    uint64_t nfiles = 0;
+    unsigned int depth = 0;
+    unsigned int fanout = 0;
+    bool_t recursive_flag = FALSE;
+    uint64_t watchdog_us = 0;
+    uint64_t stall_panic_us = 0;
+    watchdog_t wd;
+    uint64_t interval_us = 0;
+    const char *interval_csv = 0;
+    FILE *csv = 0;
+    progress_t pr;
+    const char *json_path = 0;
+    bool_t json_failed = FALSE;
+    bool_t shm_flag = FALSE;
+    bool_t perf_flag = FALSE;
+    perfcount_t pc;
+    bool_t have_threads = FALSE;
     stream_t *stream;
 
 #ifdef O_LARGEFILE
@@ -490,7 +872,8 @@ main(int argc, char **argv)
 	case 'l':
 	    if (have_length)
 		usage();
-	    if (!parse_length(optarg, &length))
+	    /* a range only makes sense with --fileset, checked below */
+	    if (!parse_length_range(optarg, &length, &max_length))
 	    {
 		fprintf(stderr, "%s: cannot parse length \"%s\"\n",
 			    argv0, optarg);
@@ -590,6 +973,186 @@ main(int argc, char **argv)
             port_filename = optarg;
             break;
 
+	case ARGS_NOSHORT(3):
+	    if (!record_impl_select(optarg))
+		fatal("unknown or unsupported record implementation \"%s\"", optarg);
+	    break;
+
+	case ARGS_NOSHORT(4):
+	    {
+		char *end;
+		long n = strtol(optarg, &end, 0);
+
+		if (*end || n < 1)
+		    fatal("cannot parse number of threads \"%s\"", optarg);
+		num_threads = n;
+		have_threads = TRUE;
+	    }
+	    break;
+
+	case ARGS_NOSHORT(5):
+	    if (!parse_length(optarg, &chunk_size) || !chunk_size)
+		fatal("cannot parse chunk size \"%s\"", optarg);
+	    break;
+
+	case ARGS_NOSHORT(6):
+	    if (!parse_engine(optarg, &engine))
+		fatal("cannot parse engine \"%s\"", optarg);
+	    break;
+
+	case ARGS_NOSHORT(7):
+	    {
+		char *end;
+		long n = strtol(optarg, &end, 0);
+
+		if (*end || n < 1 || n > 4096)
+		    fatal("cannot parse iodepth \"%s\"", optarg);
+		iodepth = n;
+	    }
+	    break;
+
+	case ARGS_NOSHORT(8):
+	    xflags |= STREAM_URING_REGISTER_BUFFERS;
+	    break;
+
+	case ARGS_NOSHORT(9):
+	    xflags |= STREAM_URING_REGISTER_FILES;
+	    break;
+
+	case ARGS_NOSHORT(10):
+	    xflags |= STREAM_URING_SQPOLL;
+	    break;
+
+	case ARGS_NOSHORT(11):
+	    {
+		char *end;
+		long n = strtol(optarg, &end, 0);
+
+		if (*end || n < 2 || n > 4096)
+		    fatal("cannot parse number of read-ahead buffers \"%s\"", optarg);
+		read_ahead = n;
+	    }
+	    break;
+
+	case ARGS_NOSHORT(12):
+	    if (!parse_length(optarg, &mmap_window) || !mmap_window ||
+		mmap_window > MAX_MMAP_WINDOW)
+		fatal("cannot parse mmap window \"%s\"", optarg);
+	    break;
+
+	case ARGS_NOSHORT(13):
+	    xflags |= STREAM_MMAP_SEQUENTIAL;
+	    break;
+
+	case ARGS_NOSHORT(14):
+	    xflags |= STREAM_MMAP_HUGEPAGE;
+	    break;
+
+	case ARGS_NOSHORT(15):
+	    xflags |= STREAM_MMAP_POPULATE;
+	    break;
+
+	case ARGS_NOSHORT(16):
+	    {
+		char *end;
+		long n = strtol(optarg, &end, 0);
+
+		if (*end || n < 1 || n > MAX_CONNECTIONS)
+		    fatal("cannot parse number of connections \"%s\"", optarg);
+		num_connections = n;
+	    }
+	    break;
+
+	case ARGS_NOSHORT(17):
+	    server_flag = TRUE;
+	    break;
+
+	case ARGS_NOSHORT(18):
+	    {
+		char *end;
+		long n = strtol(optarg, &end, 0);
+
+		if (*end || n < 1 || n > MAX_MAX_CLIENTS)
+		    fatal("cannot parse maximum number of clients \"%s\"", optarg);
+		max_clients = n;
+	    }
+	    break;
+
+	case ARGS_NOSHORT(19):
+	    if (!parse_length(optarg, &socket_buffer) || socket_buffer == 0 ||
+		socket_buffer > MAX_SOCKET_BUFFER)
+		fatal("cannot parse socket buffer size \"%s\"", optarg);
+	    break;
+
+	case ARGS_NOSHORT(20):
+	    {
+		char *end;
+
+		nfiles = strtoull(optarg, &end, 0);
+		if (*end || nfiles < 1)
+		    fatal("cannot parse number of files \"%s\"", optarg);
+	    }
+	    break;
+
+	case ARGS_NOSHORT(21):
+	    {
+		char *end;
+		long n = strtol(optarg, &end, 0);
+
+		if (*end || n < 0 || n > FILESET_MAX_DEPTH)
+		    fatal("cannot parse fileset depth \"%s\"", optarg);
+		depth = n;
+	    }
+	    break;
+
+	case ARGS_NOSHORT(22):
+	    {
+		char *end;
+		long n = strtol(optarg, &end, 0);
+
+		if (*end || n < 1 || n > FILESET_MAX_FANOUT)
+		    fatal("cannot parse fileset fanout \"%s\"", optarg);
+		fanout = n;
+	    }
+	    break;
+
+	case ARGS_NOSHORT(23):
+	    recursive_flag = TRUE;
+	    break;
+
+	case ARGS_NOSHORT(24):
+	    if (!parse_duration(optarg, &watchdog_us) || !watchdog_us)
+		fatal("cannot parse watchdog time \"%s\"", optarg);
+	    break;
+
+	case ARGS_NOSHORT(25):
+	    if (!parse_duration(optarg, &stall_panic_us) || !stall_panic_us)
+		fatal("cannot parse stall panic time \"%s\"", optarg);
+	    if (!panic_enable())
+		exit(1);
+	    break;
+
+	case ARGS_NOSHORT(26):
+	    if (!parse_duration(optarg, &interval_us) || !interval_us)
+		fatal("cannot parse interval \"%s\"", optarg);
+	    break;
+
+	case ARGS_NOSHORT(27):
+	    interval_csv = optarg;
+	    break;
+
+	case ARGS_NOSHORT(28):
+	    json_path = optarg;
+	    break;
+
+	case ARGS_NOSHORT(29):
+	    shm_flag = TRUE;
+	    break;
+
+	case ARGS_NOSHORT(30):
+	    perf_flag = TRUE;
+	    break;
+
 	case 'V':
 	    fputs("checkstream version " VERSION "\n", stdout);
 	    fflush(stdout);
@@ -619,20 +1182,118 @@ main(int argc, char **argv)
 	usage();
     if (protocol && !have_length)
 	usage();
+    if (IS_UNIX_PROTOCOL(protocol) && (!file || port_filename))
+	fatal("--protocol=unix needs a socket path, and cannot be used with --port-filename");
+    if (socket_buffer && (!protocol || server_flag))
+	fatal("--socket-buffer needs --protocol, and cannot be used with --server");
+    if (nfiles)
+    {
+	if (filter_mode || !have_length || loop_mode || protocol || mmap_flag ||
+	    have_seek || have_offset || engine != ENGINE_SYNC || read_ahead)
+	    fatal("--fileset needs a directory and --length, and cannot be used with "
+		  "--loop, --protocol, --mmap, --seek, --offset, --engine=io_uring "
+		  "or --read-ahead");
+	if (max_length > length && length == 0)
+	    fatal("the smallest file size in a range must not be zero");
+    }
+    else if (depth || fanout)
+	fatal("--fileset-depth and --fileset-fanout need --fileset");
+    else if (max_length > length)
+	fatal("a range of lengths needs --fileset");
+    if (!fanout)
+	fanout = FILESET_DEFAULT_FANOUT;
+    if (recursive_flag)
+    {
+	if (filter_mode || have_length || loop_mode || protocol || mmap_flag ||
+	    have_seek || have_offset || engine != ENGINE_SYNC || read_ahead ||
+	    nfiles)
+	    fatal("--recursive needs a directory, and cannot be used with --length, "
+		  "--loop, --protocol, --mmap, --seek, --offset, --engine=io_uring, "
+		  "--read-ahead or --fileset");
+	/* by default, as many threads as there are CPUs to check on */
+	if (!have_threads)
+	    num_threads = MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+    }
+    if (num_threads > 1 && !server_flag && !nfiles && !recursive_flag &&
+	(filter_mode || protocol || mmap_flag))
+	fatal("--threads only works when reading a named file or with --server");
+    if (!chunk_size)
+	chunk_size = CHECK_CHUNK_SIZE;
+    if (watchdog_us || stall_panic_us)
+    {
+	if (server_flag || nfiles || recursive_flag)
+	    fatal("--watchdog and --stall-panic cannot be used with --server, "
+		  "--fileset or --recursive");
+	if (!watchdog_us)
+	    watchdog_us = stall_panic_us;
+	if (stall_panic_us && stall_panic_us < watchdog_us)
+	    fatal("--stall-panic cannot be shorter than --watchdog");
+    }
+    if (engine == ENGINE_URING)
+    {
+	if (filter_mode || protocol || mmap_flag)
+	    fatal("--engine=io_uring only works when reading a named file");
+	if (num_threads > 1)
+	    fatal("cannot use --engine=io_uring with --threads");
+	if (!iodepth)
+	    iodepth = DEFAULT_IODEPTH;
+    }
+    else if (iodepth || (xflags & (STREAM_URING_REGISTER_BUFFERS|
+				   STREAM_URING_REGISTER_FILES|
+				   STREAM_URING_SQPOLL)))
+    {
+	fatal("--iodepth, --register-buffers, --register-files and --sqpoll need --engine=io_uring");
+    }
+    if (!mmap_flag && (xflags & (STREAM_MMAP_SEQUENTIAL|
+				 STREAM_MMAP_HUGEPAGE|
+				 STREAM_MMAP_POPULATE)))
+	fatal("--mmap-sequential, --mmap-hugepage and --mmap-populate need --mmap");
+    udp_flag = (protocol == IPPROTO_UDP);
+    if (udp_flag && (have_seek || read_ahead))
+	fatal("cannot use --seek or --read-ahead with --protocol=udp");
+    if (num_connections > 1 && (protocol != IPPROTO_TCP || have_seek || read_ahead))
+	fatal("--connections needs --protocol=tcp, and cannot be used with --seek or --read-ahead");
+    if (read_ahead && (mmap_flag || num_threads > 1 || engine == ENGINE_URING))
+	fatal("cannot use --read-ahead with --mmap, --threads or --engine=io_uring");
+    if (server_flag)
+    {
+#if HAVE_SYS_EPOLL_H
+	if (protocol != IPPROTO_TCP || have_seek || read_ahead || num_connections > 1)
+	    fatal("--server needs --protocol=tcp, and cannot be used with --seek, --read-ahead or --connections");
+	if (!max_clients)
+	    max_clients = DEFAULT_MAX_CLIENTS;
+#else
+	fatal("--server is not supported on this platform");
+#endif
+    }
+    else if (max_clients)
+	fatal("--max-clients needs --server");
+    if (interval_csv && !interval_us)
+	fatal("--interval-csv needs --interval");
 
     format_argv0(file);
 
     /* tell the user what the config is */
     if (verbose)
     {
-	if (protocol)
+	if (nfiles)
+	    printf("%s: checking %llu files under \"%s\"\n",
+		    argv0, (unsigned long long)nfiles, file);
+	else if (recursive_flag)
+	    printf("%s: checking all files under \"%s\"\n", argv0, file);
+	else if (IS_UNIX_PROTOCOL(protocol))
+	    printf("%s: reading %s from unix socket \"%s\"\n",
+		    argv0, iec_sizestr(length, 0, 0), file);
+	else if (protocol)
         {
             if (port == DYNAMIC_PORT)
-                printf("%s: reading %s from tcp port to be chosen by kernel\n",
-                        argv0, iec_sizestr(length, 0, 0));
+                printf("%s: reading %s from %s port to be chosen by kernel\n",
+                        argv0, iec_sizestr(length, 0, 0),
+			(udp_flag ? "udp" : "tcp"));
             else
-                printf("%s: reading %s from tcp port %d\n",
-                        argv0, iec_sizestr(length, 0, 0), (int)port);
+                printf("%s: reading %s from %s port %d\n",
+                        argv0, iec_sizestr(length, 0, 0),
+			(udp_flag ? "udp" : "tcp"), (int)port);
         }
 	else if (filter_mode)
 	    printf("%s: reading %s from standard input\n",
@@ -653,8 +1314,21 @@ main(int argc, char **argv)
 	    if ((oflags & O_DIRECT))
 		printf("%s: using O_DIRECT\n", argv0);
 #endif /* O_DIRECT */
+	    if (engine == ENGINE_URING)
+		printf("%s: using io_uring with iodepth %u\n", argv0, iodepth);
 	}
 	printf("%s: tag %d\n", argv0, tag);
+	printf("%s: using %s record checking\n", argv0, record_impl_name());
+	if (read_ahead)
+	    printf("%s: reading ahead into %u buffers\n", argv0, read_ahead);
+	if (server_flag)
+	    printf("%s: checking at most %u clients at once with %u threads\n",
+		    argv0, max_clients, num_threads);
+	else if (nfiles || recursive_flag)
+	    printf("%s: checking with %u threads\n", argv0, num_threads);
+	else if (num_threads > 1)
+	    printf("%s: checking with %u threads, %s at a time\n",
+		    argv0, num_threads, iec_sizestr(chunk_size, 0, 0));
     }
 
 
@@ -664,23 +1338,158 @@ main(int argc, char **argv)
     if (have_seek && !have_offset)
 	offset = seek;
 
-    if (protocol)
+    if (json_path)
     {
-	stream = stream_server_open(protocol, port, xflags, bsize, port_filename);
+	json_obj_t o;
+
+	if ((json = json_open(json_path)) == 0)
+	    exit(1);
+	json_begin(&o, "config");
+	json_add_str(&o, "program", "checkstream");
+	json_add_str(&o, "version", VERSION);
+	json_add_str(&o, "mode",
+		     (nfiles ? "fileset" :
+		      recursive_flag ? "recursive" :
+		      server_flag ? "server" :
+		      udp_flag ? "udp" :
+		      IS_UNIX_PROTOCOL(protocol) ? "unix" :
+		      protocol ? "tcp" :
+		      filter_mode ? "stdin" :
+		      mmap_flag ? "mmap" : "file"));
+	json_add_str(&o, "path", file);
+	if (have_length)
+	    json_add_uint(&o, "length", length);
+	json_add_uint(&o, "seek", seek);
+	json_add_uint(&o, "offset", offset);
+	json_add_uint(&o, "tag", tag);
+	json_add_bool(&o, "creator", creator_flag);
+	json_add_uint(&o, "blocksize", bsize);
+	json_add_uint(&o, "threads", num_threads);
+	json_add_uint(&o, "connections", num_connections);
+	json_add_str(&o, "engine", (engine == ENGINE_URING ? "io_uring" : "sync"));
+	json_add_str(&o, "record_impl", record_impl_name());
+	json_emit(json, &o);
+    }
+    if (watchdog_us)
+    {
+	/* slot 0 for a single stream, then one for each chunk in the window */
+	watchdog = &wd;
+	watchdog_init(watchdog, 1 + 2 * MAX(num_threads, num_connections),
+		      watchdog_us * 1000, stall_panic_us * 1000, panic);
+	watchdog_start(watchdog);
+    }
+    if (shm_flag)
+    {
+	failure_mode_t failure;
+
+	if ((shm = shmstats_create("checkstream", file, tag)) == 0)
+	    exit(1);
+	shm->data->nfailures = FM_NUM;
+	for (failure = FM_NONE ; failure < FM_NUM ; failure++)
+	    snprintf(shm->data->failure_names[failure], SHMSTATS_NAMELEN,
+		     "%s", failure_names[failure]);
+	shm->latency = &latency;
+	shm->fill = fill_shmstats;
+    }
+    /* the --interval thread also updates the segment, quietly if need be */
+    if (interval_us || shm)
+    {
+	if (interval_csv && (csv = fopen(interval_csv, "w")) == 0)
+	{
+	    perrorf("fopen(\"%s\")", interval_csv);
+	    exit(1);
+	}
+	progress = &pr;
+	progress_init(progress,
+		      (interval_us ? interval_us * 1000 : SHMSTATS_INTERVAL),
+		      csv, (creator_flag ? RECORD_SIZE_CREATOR : RECORD_SIZE),
+		      get_num_errors);
+	progress->json = json;
+	progress->shm = shm;
+	progress->quiet = !interval_us;
+	progress_start(progress);
+    }
+    /* last, so the counters see only the checking */
+    if (perf_flag)
+    {
+	perf = &pc;
+	perfcount_init(perf);
+	perfcount_start(perf);
+    }
+
+    if (nfiles)
+    {
+	fileset_t fs;
+
+	fileset_init(&fs, file, nfiles, depth, fanout, length, max_length,
+		     (creator_flag ? RECORD_MASK_CREATOR : RECORD_MASK));
+	check_fileset(&fs, oflags, xflags, bsize);
+    }
+    else if (recursive_flag)
+	check_recursive(file, oflags, xflags, bsize);
+    else if (server_flag)
+    {
+#if HAVE_SYS_EPOLL_H
+	check_server(protocol, port, port_filename, bsize, length, offset,
+		     max_clients);
+	/* being stopped is how the server finishes, not a failure */
+	signalled = 0;
+#endif
+    }
+    else if (protocol && num_connections > 1)
+    {
+	unsigned int i;
+
+	connections = xmalloc(num_connections * sizeof(stream_t *));
+	if (stream_server_open_many(protocol, port, xflags, bsize, port_filename,
+				    connections, num_connections, &chunk_size) < 0)
+	    exit(1);	    /* error printed at lower level in stream.c */
+	for (i = 0 ; i < num_connections ; i++)
+	    set_socket_buffer(connections[i], socket_buffer);
+	if (verbose)
+	    printf("%s: striped across %u connections, %s at a time\n",
+		    argv0, num_connections, iec_sizestr(chunk_size, 0, 0));
+	/* the statistics are for all the connections together */
+	stream = timed_stream(xmalloc(sizeof(stream_t)), 0);
+	stream->name = xstrdup(connections[0]->name);
+	check_stream(stream, 0, length, offset);
+	for (i = 0 ; i < num_connections ; i++)
+	    stream_close(timed_stream(connections[i], 0));
+    }
+    else if (udp_flag)
+    {
+	stream = timed_stream(stream_udp_server_open(port, xflags, port_filename,
+						     UDP_IDLE_TIMEOUT), 0);
 	if (stream == 0)
 	    exit(1);	    /* error printed at lower level in stream.c */
+	set_socket_buffer(stream, socket_buffer);
+	check_stream(stream, 0, length, offset);
+    }
+    else if (protocol)
+    {
+	if (IS_UNIX_PROTOCOL(protocol))
+	    stream = stream_unix_server_open(file, protocol, xflags, bsize);
+	else
+	    stream = stream_server_open(protocol, port, xflags, bsize,
+					port_filename);
+	if (stream == 0)
+	    exit(1);	    /* error printed at lower level in stream.c */
+	set_socket_buffer(stream, socket_buffer);
+	stream = timed_stream(read_ahead_stream(stream), seek);
 	if (have_seek && stream_seek(stream, seek) < 0)
 	    fatal("%s: failed to stream_seek", stream->name);
-	check_stream(stream, length, offset);
+	check_stream(stream, seek, length, offset);
     }
     else if (filter_mode)
     {
-	stream = stream_unix_dopen(fileno(stdin), oflags, xflags, bsize);
+	stream = timed_stream(read_ahead_stream(stream_unix_dopen(fileno(stdin),
+								  oflags, xflags,
+								  bsize)), seek);
 	if (stream == 0)
 	    exit(1);	    /* error printed at lower level in stream.c */
 	if (have_seek && stream_seek(stream, seek) < 0)
 	    fatal("%s: failed to stream_seek", stream->name);
-	check_stream(stream, length, offset);
+	check_stream(stream, seek, length, offset);
     }
     else
     {
@@ -695,12 +1504,21 @@ main(int argc, char **argv)
 		    perrorf("stat64(\"%s\")", file);
 		    exit(1);
 		}
-		if ((stream = stream_mmap_open(file, oflags, xflags, sb.st_size)) == 0)
+		/* map only the range to be checked */
+		if ((stream = timed_stream(stream_mmap_open(file, oflags, xflags, seek,
+							    (have_length ? seek + length : (uint64_t)sb.st_size),
+							    mmap_window), seek)) == 0)
 		    exit(1);	    /* error printed at lower level in stream.c */
 	    }
 	    else
 	    {
-		if ((stream = stream_unix_open(file, oflags, xflags, bsize)) == 0)
+		if (engine == ENGINE_URING)
+		    stream = stream_uring_open(file, oflags, xflags, bsize, iodepth);
+		else
+		    stream = read_ahead_stream(stream_unix_open(file, oflags,
+								xflags, bsize));
+		stream = timed_stream(stream, seek);
+		if (stream == 0)
 		    exit(1);	    /* error printed at lower level in stream.c */
 		if (fstat64(stream->fd, &sb) < 0)
 		{
@@ -713,11 +1531,58 @@ main(int argc, char **argv)
 		fatal("%s: failed to stream_seek", stream->name);
 	    if (!have_length)
 		length = sb.st_size - seek;
-	    check_stream(stream, length, offset);
+	    check_stream(stream, seek, length, offset);
 	    stream_close(stream);
 	}
 	while (loop_mode && !signalled);
     }
+    if (perf)
+	perfcount_stop(perf);
+    if (progress)
+    {
+	progress_stop(progress);
+	progress_destroy(progress);
+	if (csv && fclose(csv) < 0)
+	    perrorf("fclose(\"%s\")", interval_csv);
+    }
+    if (shm)
+	shmstats_destroy(shm);
+    /* the tail latencies which the averages hide */
+    stream_emit_latency(argv0, &latency);
+    /* whether it was the CPU which limited the throughput */
+    if (perf)
+	perfcount_emit(perf, total_bytes, (creator_flag ? RECORD_SIZE_CREATOR : RECORD_SIZE));
+    if (watchdog)
+    {
+	watchdog_stop(watchdog);
+	watchdog_emit_timeline(watchdog);
+    }
+    if (json)
+    {
+	json_obj_t o;
+
+	json_begin(&o, "summary");
+	json_add_uint(&o, "checked_bytes", total_bytes);
+	json_add_uint(&o, "errors", get_num_errors());
+	if (recursive_flag)
+	    json_add_uint(&o, "unreadable", num_unreadable);
+	json_add_failures(&o);
+	stream_json_latency(&o, "latency", &latency);
+	if (perf)
+	    perfcount_json(&o, "cpu", perf, total_bytes, (creator_flag ? RECORD_SIZE_CREATOR : RECORD_SIZE));
+	if (watchdog)
+	    json_add_uint(&o, "stalls", watchdog->nstalls);
+	json_add_bool(&o, "interrupted", !!signalled);
+	json_emit(json, &o);
+	/* the results are incomplete, so the run can't pass */
+	if (json_close(json) < 0)
+	    json_failed = TRUE;
+	json = 0;
+    }
+    if (watchdog)
+	watchdog_destroy(watchdog);
+    if (perf)
+	perfcount_destroy(perf);
 
     if (get_num_errors())
     {
@@ -726,7 +1591,7 @@ main(int argc, char **argv)
 		argv0, get_num_errors());
     }
 
-    return (get_num_errors() || signalled ? 1 : 0);
+    return (get_num_errors() || signalled || json_failed ? 1 : 0);
 }
 
 /* vim: set ts=8 sw=4 sts=4: */
@@ -95,6 +95,98 @@ parse_protocol(const char *str, int *protp)
 	*protp = IPPROTO_TCP;
 	return true;
     }
+    if (!strcmp(str, "udp"))
+    {
+	*protp = IPPROTO_UDP;
+	return true;
+    }
+    if (!strcmp(str, "unix"))
+    {
+	*protp = PROTOCOL_UNIX;
+	return true;
+    }
+    if (!strcmp(str, "unix-seqpacket"))
+    {
+	*protp = PROTOCOL_UNIX_SEQPACKET;
+	return true;
+    }
+    return false;
+}
+
+/*
+ * Parses a time like "2", "1.5s", "250ms" or "100us", seconds by
+ * default, into microseconds.
+ */
+bool
+parse_duration(const char *str, uint64_t *usp)
+{
+    char *end = 0;
+    double d;
+
+    if (str == 0 || *str == '\0')
+	return false;
+
+    d = strtod(str, &end);
+    if (end == 0 || end == str || !(d >= 0.0))
+	return false;
+
+    if (!strcmp(end, "") || !strcmp(end, "s"))
+	d *= MICROSEC;
+    else if (!strcmp(end, "ms"))
+	d *= 1000;
+    else if (strcmp(end, "us"))
+	return false;
+    if (d >= 1e18)
+	return false;
+    *usp = (uint64_t)(d + 0.5);
+    return true;
+}
+
+/*
+ * Parses a size like "4K", or a range of sizes like "4K-1M", for
+ * --fileset.  A single size is a range of one.
+ */
+bool
+parse_length_range(const char *str, uint64_t *minp, uint64_t *maxp)
+{
+    char *copy;
+    char *dash;
+    uint64_t min, max;
+    bool ok;
+
+    if (str == 0)
+	return false;
+    copy = xstrdup(str);
+    if ((dash = strchr(copy, '-')) != 0)
+	*dash++ = '\0';
+    ok = parse_length(copy, &min);
+    if (ok && dash)
+	ok = (parse_length(dash, &max) && max >= min);
+    else
+	max = min;
+    xfree(copy);
+    if (!ok)
+	return false;
+    *minp = min;
+    *maxp = max;
+    return true;
+}
+
+bool
+parse_engine(const char *str, int *enginep)
+{
+    if (str == 0 || *str == '\0')
+	return false;
+    if (!strcmp(str, "sync"))
+    {
+	*enginep = ENGINE_SYNC;
+	return true;
+    }
+    if (!strcmp(str, "io_uring"))
+    {
+	*enginep = ENGINE_URING;
+	return true;
+    }
     return false;
 }
 
@@ -150,6 +242,15 @@ time_now(void)
      return (uint64_t)now.tv_sec * MICROSEC + (uint64_t)now.tv_usec;
 }
 
+uint64_t
+time_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NANOSEC + (uint64_t)ts.tv_nsec;
+}
+
 const char *
 tail(const char *path)
 {
@@ -269,6 +370,15 @@ xstrdup(const char *s)
     return x;
 }
 
+void *
+xrealloc(void *x, size_t sz)
+{
+    x = realloc(x, sz);
+    if (!x)
+	_oom();         /* LCOV_EXCL_LINE */
+    return x;
+}
+
 void *
 xvalloc(size_t sz)
 {
@@ -319,20 +429,26 @@ creator_to_timestamp_str(uint64_t creator)
 }
 
 void
-hexdump(uint64_t off, const void *buf, size_t len)
+fhexdump(FILE *fp, uint64_t off, const void *buf, size_t len)
 {
     unsigned int i;
     const unsigned char *ubuf = buf;
 
-    fprintf(stderr, "%s: 0x%llx:", argv0, (unsigned long long)off);
+    fprintf(fp, "%s: 0x%llx:", argv0, (unsigned long long)off);
     for (i = 0 ; i < len ; i++)
-	fprintf(stderr, " %02x", (unsigned)ubuf[i]);
-    fputs("    ", stderr);
+	fprintf(fp, " %02x", (unsigned)ubuf[i]);
+    fputs("    ", fp);
     for (i = 0 ; i < len ; i++)
     {
 	unsigned int c = (unsigned)ubuf[i];
-	fprintf(stderr, "%c", (isprint(c) ? c : '.'));
+	fprintf(fp, "%c", (isprint(c) ? c : '.'));
     }
-    fputc('\n', stderr);
+    fputc('\n', fp);
+}
+
+void
+hexdump(uint64_t off, const void *buf, size_t len)
+{
+    fhexdump(stderr, off, buf, len);
 }
 
@@ -52,11 +52,21 @@
 #define __attribute__(x)
 #endif
 
+#ifndef MIN
+#define MIN(a,b)    ((a)<(b)?(a):(b))
+#endif
+#ifndef MAX
+#define MAX(a,b)    ((a)>(b)?(a):(b))
+#endif
+
 
 extern bool parse_length(const char *str, uint64_t *lengthp);
 extern bool parse_tag(const char *str, uint8_t *tagp);
 extern bool parse_protocol(const char *str, int *protp);
 extern bool parse_tcp_port(const char *str, uint16_t *portp);
+extern bool parse_engine(const char *str, int *enginep);
+extern bool parse_duration(const char *str, uint64_t *usp);
+extern bool parse_length_range(const char *str, uint64_t *minp, uint64_t *maxp);
 /* compose and return a string in IEC standard notation e.g. 124KiB */
 extern char *iec_sizestr(uint64_t sz, char *buf, int maxlen);
 const char *tail(const char *);
@@ -66,6 +76,7 @@ extern void error(const char *fmt, ...) __attribute__(( format(printf,1,2) ));
 extern void message(const char *fmt, ...) __attribute__(( format(printf,1,2) ));
 extern ssize_t write_handling_shorts(int fd, const char *buf, size_t len);
 extern void *xmalloc(size_t sz) __attribute__(( malloc ));
+extern void *xrealloc(void *x, size_t sz);
 extern char *xstrdup(const char *s) __attribute__(( malloc ));
 extern void *xvalloc(size_t sz) __attribute__(( malloc ));
 extern void xfree(void *x);
@@ -144,6 +155,7 @@ aligned_ip_checksum_8(const uint16_t *buf)
 typedef union
 {
     /* sized for the largest possible record */
+    uint64_t w64[2];
     uint32_t w32[4];
     uint16_t w16[8];
     uint8_t w8[16];
@@ -155,10 +167,35 @@ typedef union
 #define RECORD_SIZE_CREATOR	16
 #define RECORD_MASK_CREATOR	0xfULL
 
+/* --protocol values for Unix domain sockets, beyond any IP protocol */
+#define PROTOCOL_UNIX		0x1000	/* SOCK_STREAM */
+#define PROTOCOL_UNIX_SEQPACKET	0x1001	/* SOCK_SEQPACKET */
+#define IS_UNIX_PROTOCOL(p)	((p) == PROTOCOL_UNIX || (p) == PROTOCOL_UNIX_SEQPACKET)
+
 #define DEFAULT_PORT	5000
 /* special value indicating we'll let the kernel choose a port */
 #define DYNAMIC_PORT	0
 
+/* how files are read or written, see --engine */
+#define ENGINE_SYNC	0
+#define ENGINE_URING	1
+#define DEFAULT_IODEPTH	8
+
+/* TCP striped across connections, see --connections */
+#define DEFAULT_STRIPE_SIZE	(1ULL<<20)
+#define MAX_CONNECTIONS		1024
+
+/* UDP datagrams, see --datagram-size; multiples of any record size */
+#define DEFAULT_DATAGRAM_SIZE	1472	/* fills a 1500 byte Ethernet frame */
+#define MAX_DATAGRAM_SIZE	65504
+
+/* largest --socket-buffer, which the kernel doubles into an int */
+#define MAX_SOCKET_BUFFER	(1ULL<<30)
+
+/* how much of a file --mmap maps at once, see --mmap-window */
+#define DEFAULT_MMAP_WINDOW	(1ULL<<30)
+#define MAX_MMAP_WINDOW		(1ULL<<30)
+
 /*
  * Time functions for dealing with timevals (microseconds
  * since the UNIX epoch) as 64 bit ints; arithmetic trivial.
@@ -169,6 +206,10 @@ extern uint64_t time_now(void);
 #define time_microseconds(t)		((uint32_t)((t) % MICROSEC))
 #define time_double(t)			((double)(t) / (double)MICROSEC)
 
+/* CLOCK_MONOTONIC nanoseconds, for timing short intervals */
+#define NANOSEC		1000000000ULL
+extern uint64_t time_now_ns(void);
+
 
 /*
  * Encoding and decoding the creator information.  We encode a
@@ -217,6 +258,7 @@ static inline uint64_t creator_make(unsigned int pid, const struct timeval *now)
 extern const char *creator_to_timestamp_str(uint64_t creator);
 
 extern void hexdump(uint64_t off, const void *buf, size_t len);
+extern void fhexdump(FILE *fp, uint64_t off, const void *buf, size_t len);
 
 #ifndef TRUE
 #define TRUE 1
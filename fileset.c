@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2021 Greg Banks <gnb@fmeh.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#include "common.h"
+#include "fileset.h"
+#include <limits.h>
+#include <math.h>
+
+extern const char *argv0;
+
+/*
+ * File i lives in bottom level directory i % nleaves, whose path is
+ * the digits of that number in base fanout, most significant first,
+ * one directory level per digit, like DIR/d01/d0e/f0000011e.  With
+ * no depth all the files are in DIR itself.
+ */
+void
+fileset_init(fileset_t *fs, const char *dir, uint64_t nfiles,
+	     unsigned int depth, unsigned int fanout,
+	     uint64_t min_size, uint64_t max_size, uint64_t record_mask)
+{
+    unsigned int k;
+
+    memset(fs, 0, sizeof(*fs));
+    fs->dir = dir;
+    fs->nfiles = nfiles;
+    fs->depth = depth;
+    fs->fanout = fanout;
+    fs->min_size = min_size;
+    fs->max_size = max_size;
+    fs->record_mask = record_mask;
+
+    /* no more leaves than files, which also keeps fanout^depth in range */
+    fs->nleaves = 1;
+    for (k = 0 ; k < depth && fs->nleaves < nfiles ; k++)
+	fs->nleaves *= fanout;
+    if (fs->nleaves > nfiles)
+	fs->nleaves = MAX(nfiles, 1);
+}
+
+/* the path of the directory at level k (0 being fs->dir) above leaf j */
+static int
+fileset_dir_path(const fileset_t *fs, uint64_t j, unsigned int k,
+		 char *buf, size_t len)
+{
+    uint64_t div = 1;
+    unsigned int l;
+    int n;
+
+    for (l = 1 ; l < fs->depth ; l++)
+	div *= fs->fanout;
+    n = snprintf(buf, len, "%s", fs->dir);
+    for (l = 0 ; l < k && n < (int)len ; l++, div /= fs->fanout)
+	n += snprintf(buf + n, len - n, "/d%02x",
+		      (unsigned)((j / div) % fs->fanout));
+    return n;
+}
+
+void
+fileset_path(const fileset_t *fs, uint64_t i, char *buf, size_t len)
+{
+    int n = fileset_dir_path(fs, i % fs->nleaves, fs->depth, buf, len);
+
+    if (n < (int)len)
+	snprintf(buf + n, len - n, "/f%08llx", (unsigned long long)i);
+}
+
+/* mixes the bits of x, so consecutive files get unrelated sizes */
+static uint64_t
+fileset_hash(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/*
+ * Sizes are spread log-uniformly across the range, as many files
+ * between 4K and 8K as between 512K and 1M, which is closer to a
+ * real population of objects than a uniform spread would be.
+ */
+uint64_t
+fileset_size(const fileset_t *fs, uint64_t i)
+{
+    double u, lo, hi;
+    uint64_t size;
+
+    if (fs->max_size <= fs->min_size || fs->min_size == 0)
+	return fs->min_size & ~fs->record_mask;
+    u = (double)(fileset_hash(i) >> 11) / (double)(1ULL<<53);
+    lo = log((double)fs->min_size);
+    hi = log((double)fs->max_size);
+    size = (uint64_t)exp(lo + u * (hi - lo));
+    size = MAX(size, fs->min_size);
+    size = MIN(size, fs->max_size);
+    return size & ~fs->record_mask;
+}
+
+/* each file is tagged differently, so a misplaced one is detected */
+uint8_t
+fileset_tag(uint8_t tag, uint64_t i)
+{
+    return (uint8_t)(tag + i);
+}
+
+/*
+ * Creates the directory and all the subdirectories the files will
+ * need, those which exist already being left alone.  Returns 0, or
+ * -1 having reported the error.
+ */
+int
+fileset_make_dirs(const fileset_t *fs)
+{
+    char path[PATH_MAX];
+    uint64_t j, span;
+    unsigned int k, l;
+
+    if (mkdir(fs->dir, 0777) < 0 && errno != EEXIST)
+    {
+	perrorf("mkdir(\"%s\")", fs->dir);
+	return -1;
+    }
+    for (j = 0 ; fs->depth && j < fs->nleaves ; j++)
+    {
+	for (k = 1 ; k <= fs->depth ; k++)
+	{
+	    /* the directory at level k is new at the first leaf below it */
+	    for (span = 1, l = k ; l < fs->depth ; l++)
+		span *= fs->fanout;
+	    if (j % span)
+		continue;
+	    fileset_dir_path(fs, j, k, path, sizeof(path));
+	    if (mkdir(path, 0777) < 0 && errno != EEXIST)
+	    {
+		perrorf("mkdir(\"%s\")", path);
+		return -1;
+	    }
+	}
+    }
+    return 0;
+}
+
+/*
+ * How fast the files went, and how long opening them took; the
+ * streams time their own closing, see stream_emit_latency().
+ */
+void
+fileset_emit_stats(const char *verb, uint64_t nfiles, uint64_t deltat,
+		   const histogram_t *open_ns)
+{
+    deltat = MAX(deltat, 1);
+    fprintf(stderr, "%s: %s %llu files in %u.%06u seconds (%g files/sec)\n",
+	    argv0, verb,
+	    (unsigned long long)nfiles,
+	    time_seconds(deltat), time_microseconds(deltat),
+	    (double)nfiles / time_double(deltat));
+    histogram_emit(argv0, "open", open_ns);
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2021 Greg Banks <gnb@fmeh.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef _CHECKSTREAM_FILESET_H_
+#define _CHECKSTREAM_FILESET_H_ 1
+
+#include "common.h"
+#include "histogram.h"
+
+/*
+ * A set of many small files under one directory, see --fileset.
+ * Everything about file i, its path, its size and its tag, follows
+ * from i and the parameters here, so genstream and checkstream given
+ * the same parameters agree without any index being written.
+ */
+typedef struct
+{
+    const char *dir;
+    uint64_t nfiles;
+    unsigned int depth;		/* levels of subdirectories */
+    unsigned int fanout;	/* subdirectories of each directory */
+    uint64_t nleaves;		/* bottom level directories in use */
+    uint64_t min_size;
+    uint64_t max_size;
+    uint64_t record_mask;	/* sizes are whole records */
+} fileset_t;
+
+#define FILESET_DEFAULT_FANOUT	16
+#define FILESET_MAX_FANOUT	256
+#define FILESET_MAX_DEPTH	8
+
+extern void fileset_init(fileset_t *fs, const char *dir, uint64_t nfiles,
+			 unsigned int depth, unsigned int fanout,
+			 uint64_t min_size, uint64_t max_size,
+			 uint64_t record_mask);
+extern void fileset_path(const fileset_t *fs, uint64_t i,
+			 char *buf, size_t len);
+extern uint64_t fileset_size(const fileset_t *fs, uint64_t i);
+extern uint8_t fileset_tag(uint8_t tag, uint64_t i);
+extern int fileset_make_dirs(const fileset_t *fs);
+extern void fileset_emit_stats(const char *verb, uint64_t nfiles,
+			       uint64_t deltat, const histogram_t *open_ns);
+
+#endif /* _CHECKSTREAM_FILESET_H_ */
@@ -18,15 +18,41 @@
  */
 #include "common.h"
 #include "stream.h"
+#include "record.h"
+#include "pacer.h"
+#include "fileset.h"
+#include "watchdog.h"
+#include "progress.h"
+#include "json.h"
+#include "shmstats.h"
+#include "perfcount.h"
+#include <limits.h>
+#include <pthread.h>
 
 
 const char *argv0;
 uint8_t tag = 0x0;
 bool_t tag_flag = FALSE;
 bool_t creator_flag = FALSE;
+unsigned int num_threads = 1;
+uint64_t chunk_size;
+unsigned int num_connections = 1;
+stream_t **connections;
+enum { LAYOUT_INTERLEAVED, LAYOUT_CONTIGUOUS } layout = LAYOUT_INTERLEAVED;
+watchdog_t *watchdog;		/* with --watchdog */
+progress_t *progress;		/* with --interval */
+const char *interval_csv;	/* with --interval-csv */
+json_writer_t *json;		/* with --json */
+shmstats_t *shm;		/* with --shm-stats */
+perfcount_t *perf;		/* with --perf-counters */
 
 volatile int signalled = 0;
 
+/* most bytes handed to the block generating kernel at once */
+#define GENERATE_BATCH_SIZE	(1ULL<<20)
+/* default bytes written by each thread at a time in --threads mode */
+#define GENERATE_CHUNK_SIZE	(64ULL<<20)
+
 static void
 handle_sig(int sig)
 {
@@ -45,22 +71,172 @@ handle_sig(int sig)
  * versions of genstream.
  */
 
+/*
+ * Write the records for offsets [off, off+length) to the stream,
+ * which must already be positioned at off.
+ */
+static void
+generate_records(stream_t *st, const record_format_t *fmt,
+		 uint64_t length, uint64_t off)
+{
+    uint64_t i, n;
+    char *buf;
+
+    /*
+     * Fill as many records as will fit in the stream's buffer at
+     * once.  When the buffer is full, asking for a single record
+     * pushes it, exactly as when records were written one by one.
+     */
+    for (i = 0 ; !signalled && i < length ; i += n * fmt->size)
+    {
+	n = MIN((uint64_t)stream_inline_available(st), length - i);
+	n = MIN(n, GENERATE_BATCH_SIZE) / fmt->size;
+	if (n == 0)
+	    n = 1;
+	buf = stream_inline_write(st, n * fmt->size);
+	if (buf == 0)
+	{
+	    if (signalled)
+	    	break;
+	    fatal("%s: stream_inline_write failed", st->name);
+	}
+	record_fill_block(fmt, buf, n, i + off);
+    }
+}
+
+/*
+ * In --threads mode the range to be written is split into chunks,
+ * and chunk k is generated by thread k % num_threads, which writes
+ * it with pwrite() from its own buffer.  With the interleaved layout
+ * the chunks are --chunk-size bytes, so the threads take turns along
+ * the file; with the contiguous layout there is one chunk per thread,
+ * so each thread writes one long run.  Records depend only on their
+ * offset, so the file is the same as when written by one thread.
+ */
+typedef struct
+{
+    stream_t *stream;		/* shared, provides fd and block size */
+    const record_format_t *fmt;
+    uint64_t seek;
+    uint64_t length;
+    uint64_t chunk_size;
+    uint64_t nchunks;
+    unsigned int index;
+    pthread_t thread;
+    stream_latency_t latency;
+} generator_t;
+
+static void *
+generate_thread(void *arg)
+{
+    generator_t *g = arg;
+    uint64_t k;
+
+    for (k = g->index ; !signalled && k < g->nchunks ; k += num_threads)
+    {
+	uint64_t start = g->seek + k * g->chunk_size;
+	uint64_t len = MIN(g->chunk_size, g->length - k * g->chunk_size);
+	stream_t *s;
+
+	s = stream_pwrite_open(g->stream->name, g->stream->fd,
+			       g->stream->xflags, g->stream->bufsize,
+			       start, len);
+	s->latency = &g->latency;
+	if (watchdog)
+	    s->watch = watchdog_slot(watchdog, 1 + g->index, s->name, start);
+	generate_records(s, g->fmt, len, start);
+	if (stream_flush(s) < 0 && !signalled)
+	    fatal("%s: stream_flush failed", s->name);
+	/* as each chunk is done, so --interval sees the progress */
+	__atomic_fetch_add(&g->stream->stats.nblocks, s->stats.nblocks, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&g->stream->stats.nbytes, s->stats.nbytes, __ATOMIC_RELAXED);
+	stream_close(s);
+    }
+    return 0;
+}
+
+static void
+generate_threaded(stream_t *st, const record_format_t *fmt,
+		  uint64_t length, uint64_t seek)
+{
+    generator_t *gens;
+    uint64_t granule;
+    uint64_t csize;
+    unsigned int i;
+    int r;
+
+    /* chunks are whole blocks, so O_DIRECT writes stay aligned */
+    granule = st->bufsize;
+    if (granule % fmt->size)
+	granule *= fmt->size;
+    if (layout == LAYOUT_CONTIGUOUS)
+	csize = (length + num_threads - 1) / num_threads + granule - 1;
+    else
+	csize = chunk_size;
+    csize -= csize % granule;
+    if (csize == 0)
+	csize = granule;
+
+    gens = xmalloc(num_threads * sizeof(generator_t));
+    for (i = 0 ; i < num_threads ; i++)
+    {
+	generator_t *g = &gens[i];
+
+	memset(g, 0, sizeof(*g));
+	g->stream = st;
+	g->fmt = fmt;
+	g->seek = seek;
+	g->length = length;
+	g->chunk_size = csize;
+	g->nchunks = (length + csize - 1) / csize;
+	g->index = i;
+	if ((r = pthread_create(&g->thread, 0, generate_thread, g)))
+	    fatal("pthread_create: %s", strerror(r));
+    }
+    for (i = 0 ; i < num_threads ; i++)
+    {
+	pthread_join(gens[i].thread, 0);
+	if (st->latency)
+	    stream_latency_merge(st->latency, &gens[i].latency);
+    }
+    xfree(gens);
+}
+
+/*
+ * In --connections mode chunk k of the stream goes to connection
+ * k % num_connections, each connection carrying its chunks back to
+ * back.  Chunks are --chunk-size bytes, and the receiver learns the
+ * size from the connection's hello.
+ */
+static void
+generate_striped(const record_format_t *fmt, uint64_t length)
+{
+    uint64_t k, off;
+    unsigned int i;
+
+    for (k = 0, off = 0 ; !signalled && off < length ; k++, off += chunk_size)
+	generate_records(connections[k % num_connections], fmt,
+			 MIN(chunk_size, length - off), off);
+    for (i = 0 ; i < num_connections ; i++)
+    {
+	if (stream_flush(connections[i]) < 0 && !signalled)
+	    fatal("%s: stream_flush failed", connections[i]->name);
+    }
+}
+
 static void
 generate_stream(stream_t *st, uint64_t length, uint64_t seek)
 {
-    uint64_t i, off;
-    size_t record_size = (creator_flag ? RECORD_SIZE_CREATOR : RECORD_SIZE);
     uint64_t record_mask = (creator_flag ? RECORD_MASK_CREATOR : RECORD_MASK);
-    record_t *rec;
-    uint32_t creator_bits[2];
+    uint64_t creator = 0;
+    record_format_t fmt;
 
-    if (seek && stream_seek(st, seek) < 0)
+    if (seek && num_threads == 1 && stream_seek(st, seek) < 0)
 	fatal("%s: stream_seek failed", st->name);
 
     if (creator_flag)
     {
 	struct timeval now;
-	uint64_t creator;
 
 	gettimeofday(&now, 0);
 	creator = creator_make(getpid(), &now);
@@ -68,53 +244,299 @@ generate_stream(stream_t *st, uint64_t length, uint64_t seek)
 		argv0,
 		creator_get_pid(creator),
 		creator_to_timestamp_str(creator));
-	creator_bits[0] = htonl(creator >> 32);
-	creator_bits[1] = htonl(creator & 0xffffffffULL);
     }
+    record_format_init(&fmt, tag_flag, tag, creator_flag, creator);
 
     length &= ~record_mask;	/* has to be multiple of record size */
 
-    for (i = 0 ; !signalled && i < length ; i += record_size)
+    if (num_threads > 1)
     {
-	off = i + seek;
-	rec = (record_t *)stream_inline_write(st, record_size);
-	if (rec == 0)
-	{
-	    if (signalled)
-	    	break;
-	    fatal("%s: stream_inline_write failed", st->name);
-	}
-	if (tag_flag)
-	{
-	    rec->w8[2] = tag;
-	    rec->w8[3] = (off >> 32) & 0xff;
-	}
-	else
-	{
-	    rec->w16[1] = htons((off >> 32) & 0xffff);
-	}
-	rec->w32[1] = htonl(off & 0xffffffff);
-	if (creator_flag)
-	{
-	    rec->w32[2] = creator_bits[0];
-	    rec->w32[3] = creator_bits[1];
-	    rec->w16[0] = aligned_ip_checksum_7(&rec->w16[1]);
-	}
-	else
-	{
-	    rec->w16[0] = aligned_ip_checksum_3(&rec->w16[1]);
-	}
+	generate_threaded(st, &fmt, length, seek);
+    }
+    else if (num_connections > 1)
+    {
+	generate_striped(&fmt, length);
+    }
+    else
+    {
+	generate_records(st, &fmt, length, seek);
+	stream_flush(st);
+    }
+}
+
+/* the totals for --json, of the stream or all the files together */
+static void
+json_summary(const char *name, uint64_t nblocks, uint64_t nbytes,
+	     uint64_t deltat, const stream_latency_t *lat)
+{
+    json_obj_t o;
+
+    deltat = MAX(deltat, 1);
+    json_begin(&o, "summary");
+    json_add_str(&o, "name", name);
+    json_add_uint(&o, "blocks", nblocks);
+    json_add_uint(&o, "bytes", nbytes);
+    json_add_double(&o, "seconds", time_double(deltat));
+    json_add_double(&o, "kib_per_sec",
+		    (double)nbytes / time_double(deltat) / 1024.0);
+    stream_json_latency(&o, "latency", lat);
+    if (perf)
+	perfcount_json(&o, "cpu", perf, nbytes, (creator_flag ? RECORD_SIZE_CREATOR : RECORD_SIZE));
+    if (watchdog)
+	json_add_uint(&o, "stalls", watchdog->nstalls);
+    json_add_bool(&o, "interrupted", !!signalled);
+    json_emit(json, &o);
+}
+
+/*
+ * The last report for --interval, which is the whole run so far, and
+ * the last update of the --shm-stats segment, which then goes away.
+ */
+static void
+stop_progress(void)
+{
+    FILE *csv;
+
+    if (!progress)
+	return;
+    csv = progress->csv;
+    progress_stop(progress);
+    progress_destroy(progress);
+    progress = 0;
+    if (csv && fclose(csv) < 0)
+	perrorf("fclose(\"%s\")", interval_csv);
+    if (shm)
+	shmstats_destroy(shm);
+    shm = 0;
+}
+
+/*
+ * In --fileset mode a pool of --threads threads writes the files,
+ * each thread claiming the next file not yet claimed, so the threads
+ * stay busy however the sizes fall.  Each file is a stream of its
+ * own starting at offset 0 and tagged with fileset_tag(), and the
+ * time taken to open each is recorded, the streams timing the rest
+ * into histograms of each thread's own.
+ */
+typedef struct
+{
+    pthread_mutex_t lock;
+    const fileset_t *fs;
+    const record_format_t *fmt;
+    int oflags;
+    int xflags;
+    uint64_t bsize;
+    uint64_t next;		/* next file to be claimed */
+    uint64_t nfiles;		/* files written */
+    stream_t *stats;		/* for all the files together */
+    histogram_t open_ns;
+    stream_latency_t latency;
+} fileset_pool_t;
+
+static void *
+fileset_thread(void *arg)
+{
+    fileset_pool_t *p = arg;
+    record_format_t fmt = *p->fmt;
+    stream_latency_t *lat = xmalloc(sizeof(stream_latency_t));
+    char path[PATH_MAX];
+    uint64_t i, t0, t1;
+    uint64_t nblocks, nbytes;
+    stream_t *s;
+
+    for (;;)
+    {
+	pthread_mutex_lock(&p->lock);
+	i = p->next++;
+	pthread_mutex_unlock(&p->lock);
+	if (signalled || i >= p->fs->nfiles)
+	    break;
+
+	fileset_path(p->fs, i, path, sizeof(path));
+	fmt.tag = fileset_tag(tag, i);
+	t0 = time_now_ns();
+	if ((s = stream_unix_open(path, p->oflags, p->xflags, p->bsize)) == 0)
+	    exit(1);	/* error message printed at lower level in stream.c */
+	t1 = time_now_ns();
+	s->latency = lat;
+	generate_records(s, &fmt, fileset_size(p->fs, i), 0);
+	if (stream_flush(s) < 0 && !signalled)
+	    fatal("%s: stream_flush failed", s->name);
+	nblocks = s->stats.nblocks;
+	nbytes = s->stats.nbytes;
+	if (stream_close(s) < 0)
+	    fatal("%s: stream_close failed", path);
+
+	pthread_mutex_lock(&p->lock);
+	histogram_add(&p->open_ns, t1 - t0);
+	p->stats->stats.nblocks += nblocks;
+	p->stats->stats.nbytes += nbytes;
+	p->nfiles++;
+	pthread_mutex_unlock(&p->lock);
     }
+
+    pthread_mutex_lock(&p->lock);
+    stream_latency_merge(&p->latency, lat);
+    pthread_mutex_unlock(&p->lock);
+    xfree(lat);
+    return 0;
+}
+
+static void
+generate_fileset(const fileset_t *fs, int oflags, int xflags, uint64_t bsize)
+{
+    uint64_t creator = 0;
+    record_format_t fmt;
+    fileset_pool_t p;
+    pthread_t *threads;
+    uint64_t start;
+    unsigned int i;
+    int r;
+
+    if (creator_flag)
+    {
+	struct timeval now;
+
+	gettimeofday(&now, 0);
+	creator = creator_make(getpid(), &now);
+	fprintf(stderr, "%s: pid %u started at %s\n",
+		argv0,
+		creator_get_pid(creator),
+		creator_to_timestamp_str(creator));
+    }
+    record_format_init(&fmt, TRUE, tag, creator_flag, creator);
+
+    if (fileset_make_dirs(fs) < 0)
+	exit(1);
+
+    memset(&p, 0, sizeof(p));
+    pthread_mutex_init(&p.lock, 0);
+    p.fs = fs;
+    p.fmt = &fmt;
+    p.oflags = oflags;
+    p.xflags = xflags;
+    p.bsize = bsize;
+    p.stats = xmalloc(sizeof(stream_t));
+    /* each file's bytes count when it's finished */
+    if (progress)
+	progress_watch(progress, &p.stats, 1, 0);
+    if (shm)
+	shm->latency = &p.latency;
+
+    start = time_now();
+    threads = xmalloc(num_threads * sizeof(pthread_t));
+    for (i = 0 ; i < num_threads ; i++)
+    {
+	if ((r = pthread_create(&threads[i], 0, fileset_thread, &p)))
+	    fatal("pthread_create: %s", strerror(r));
+    }
+    for (i = 0 ; i < num_threads ; i++)
+	pthread_join(threads[i], 0);
+    if (perf)
+	perfcount_stop(perf);
+    stop_progress();
+
+    /* used for determining how many blocks have been read or written */
+    fprintf(stderr, "%s: %s %llu blocks %llu bytes\n",
+	    argv0,
+	    fs->dir,
+	    (unsigned long long)p.stats->stats.nblocks,
+	    (unsigned long long)p.stats->stats.nbytes);
+    fileset_emit_stats("wrote", p.nfiles, time_now() - start, &p.open_ns);
+    stream_emit_latency(argv0, &p.latency);
+    if (perf)
+	perfcount_emit(perf, p.stats->stats.nbytes, (creator_flag ? RECORD_SIZE_CREATOR : RECORD_SIZE));
+    if (json)
+	json_summary(fs->dir, p.stats->stats.nblocks, p.stats->stats.nbytes,
+		     time_now() - start, &p.latency);
+    fflush(stderr); /* JIC */
+
+    xfree(threads);
+    xfree(p.stats);
+    pthread_mutex_destroy(&p.lock);
+}
+
+/*
+ * Send the same stream as generate_stream() would, but from a file
+ * which genstream wrote earlier, using sendfile() so the data never
+ * passes through our buffers.
+ */
+static void
+send_file(stream_t *st, const char *filename, uint64_t length, uint64_t seek)
+{
+    uint64_t record_mask = (creator_flag ? RECORD_MASK_CREATOR : RECORD_MASK);
+    struct stat64 sb;
+    int fd;
+
+    length &= ~record_mask;	/* has to be multiple of record size */
+
+    if ((fd = open(filename, O_RDONLY)) < 0)
+	fatal("cannot open \"%s\": %s", filename, strerror(errno));
+    if (fstat64(fd, &sb) < 0)
+	fatal("cannot stat \"%s\": %s", filename, strerror(errno));
+    if ((uint64_t)sb.st_size < seek + length)
+	fatal("\"%s\" is too short to send %llu bytes at offset %llu",
+	      filename, (unsigned long long)length, (unsigned long long)seek);
+
+    if (seek && stream_seek(st, seek) < 0)
+	fatal("%s: stream_seek failed", st->name);
+    if (stream_sendfile(st, fd, seek, length) < 0)
+	fatal("%s: stream_sendfile failed", st->name);
+    close(fd);
 }
 
 static const char usage_str[] =
 "Usage: genstream [options] SIZE file\n"
 "       genstream [options] SIZE > file\n"
 "       genstream [options] --protocol=tcp [--port=PORT] size host\n"
+"       genstream [options] --protocol=udp [--port=PORT] size host\n"
+"       genstream [options] --protocol=unix|unix-seqpacket size path\n"
+"       genstream [options] --fileset=N SIZE|MIN-MAX directory\n"
 "options:\n"
 "    -S, --sync                 open files with O_SYNC\n"
 "    -D, --direct               open files with O_DIRECT\n"
 "    -M, --mmap                 use mmap instead of the read() syscall\n"
+"    --mmap-window=SIZE         with --mmap, map at most SIZE bytes of the file\n"
+"                               at once (default and maximum 1GiB)\n"
+"    --mmap-sequential          with --mmap, advise the kernel of sequential access\n"
+"    --mmap-hugepage            with --mmap, advise the kernel to use huge pages\n"
+"    --mmap-populate            with --mmap, fault in each window when it's mapped\n"
+"    --mmap-writeback=MODE      with --mmap, how each written window is written\n"
+"                               back (sync, async; default sync)\n"
+"    --mmap-writeback-wait      with --mmap-writeback=async, wait for the window\n"
+"                               before last to be written back\n"
+"    --splice                   hand buffers to a pipe with vmsplice() instead\n"
+"                               of copying them with write()\n"
+"    --zerocopy                 in TCP mode, send with MSG_ZEROCOPY\n"
+"    --sendfile=FILE            send FILE, written earlier by genstream with the\n"
+"                               same options, with sendfile()\n"
+"    --connections=N            in TCP mode, stripe the stream across N\n"
+"                               connections, --chunk-size bytes at a time\n"
+"                               (default 1MiB)\n"
+"    --datagram-size=SIZE       in UDP mode, send datagrams of SIZE bytes, a\n"
+"                               multiple of 16 (default 1472)\n"
+"    --datagram-faults=SPEC     in UDP mode, lose, duplicate or reorder every\n"
+"                               Nth datagram, SPEC being a list like\n"
+"                               lose:N,duplicate:N,reorder:N\n"
+"    --socket-buffer=SIZE       with --protocol, set the socket's send buffer\n"
+"                               to SIZE bytes, beyond the sysctl limit if\n"
+"                               allowed\n"
+"    --rate=SIZE                write at most SIZE bytes per second\n"
+"    --burst=SIZE               with --rate, let up to SIZE bytes go at once\n"
+"                               ahead of the rate (default one block)\n"
+"    --duty-cycle=ON:OFF        with --rate, alternate ON seconds at the\n"
+"                               --peak-rate with OFF seconds at the --rate,\n"
+"                               or without --peak-rate, ON seconds at the\n"
+"                               --rate with OFF seconds of silence\n"
+"    --peak-rate=SIZE           with --duty-cycle, the rate in the on phase\n"
+"    --ramp=TIME                with --rate, rise to the rate over TIME\n"
+"    --fileset=N                write N files under the directory, each tagged\n"
+"                               differently, with --threads threads, of SIZE\n"
+"                               bytes or between MIN and MAX bytes\n"
+"    --fileset-depth=D          with --fileset, spread the files over D levels\n"
+"                               of subdirectories (default 0)\n"
+"    --fileset-fanout=F         with --fileset, make F subdirectories in each\n"
+"                               directory (default 16)\n"
 "    -b SIZE, --blocksize=SIZE  block size for read() syscalls\n"
 "    -s SIZE, --seek=SIZE       seek to the given offset before writing\n"
 "    -t, --no-truncate          don't truncate the output file (if file given)\n"
@@ -123,10 +545,138 @@ static const char usage_str[] =
 "    -c, --close                close file descriptor after mmaping\n"
 "    -T NUM, --tag=N            generate given 8-bit tag value in stream\n"
 "    -C, --record-creator       record start time & pid in stream\n"
-"    -p PORT, --port=PORT       use PORT in TCP mode, default 5000\n"
+"    -p PORT, --port=PORT       use PORT in TCP or UDP mode, default 5000\n"
+"    --record-impl=NAME         use the named record generating implementation\n"
+"                               (auto, scalar, template, sse2, avx2,\n"
+"                               avx512; default auto)\n"
+"    --threads=N                write a file with N threads in parallel\n"
+"    --chunk-size=SIZE          in --threads mode, write SIZE bytes at a time\n"
+"                               in each thread (default 64MiB)\n"
+"    --layout=LAYOUT            in --threads mode, how the file is divided\n"
+"                               between threads (interleaved, contiguous;\n"
+"                               default interleaved)\n"
+"    --engine=ENGINE            write files with sync write() calls or io_uring\n"
+"                               (sync, io_uring; default sync)\n"
+"    --iodepth=N                with --engine=io_uring, keep N writes in flight\n"
+"                               (default 8)\n"
+"    --register-buffers         with --engine=io_uring, use registered buffers\n"
+"    --register-files           with --engine=io_uring, use a registered file\n"
+"    --sqpoll                   with --engine=io_uring, use a kernel thread to\n"
+"                               poll for submissions\n"
+"    --watchdog=TIME            report any write which takes longer than TIME,\n"
+"                               and a timeline of them at the end\n"
+"    --interval=TIME            report the bytes and records written and the\n"
+"                               throughput every TIME\n"
+"    --interval-csv=FILE        with --interval, write the reports to FILE\n"
+"                               as CSV rows instead\n"
+"    --json=FILE                write the configuration, the --interval reports\n"
+"                               and the summary to FILE as JSON lines\n"
+"    --shm-stats                publish the counters in shared memory for\n"
+"                               streamtop, every --interval or second\n"
+"    --perf-counters            report the CPU time, and the cycles and\n"
+"                               instructions per byte where perf events are\n"
+"                               allowed\n"
 "SIZE arguments may be specified as nnn[KMGT]\n"
+"TIME arguments may be specified as nnn[.nnn][s|ms|us]\n"
 ;
 
+/* how the datagrams went, in UDP mode */
+static void
+emit_datagram_stats(stream_t *s, uint64_t deltat)
+{
+    deltat = MAX(deltat, 1);
+    fprintf(stderr, "%s: udp: %llu datagrams in %u.%06u seconds (%g datagrams/sec), "
+		    "%llu syscalls (%g per GiB)\n",
+	    argv0,
+	    (unsigned long long)s->stats.ndatagrams,
+	    time_seconds(deltat), time_microseconds(deltat),
+	    (double)s->stats.ndatagrams / time_double(deltat),
+	    (unsigned long long)s->stats.nsyscalls,
+	    (double)s->stats.nsyscalls * (1ULL<<30) / (double)MAX(s->stats.nbytes, 1));
+}
+
+/* how closely the writing kept to the rate, with --rate */
+static void
+emit_pacing_stats(const pacer_t *p)
+{
+    uint64_t elapsed = MAX(time_now_ns() - p->start, 1);
+    uint64_t scheduled = MAX(p->tat - p->start, 1);
+    char sizebuf1[32];
+    char sizebuf2[32];
+
+    fprintf(stderr, "%s: pacing: %s/sec achieved against a target of %s/sec, "
+		    "%llu waits, worst lag %u.%06u seconds\n",
+	    argv0,
+	    iec_sizestr((uint64_t)((double)p->nbytes * NANOSEC / elapsed),
+			sizebuf1, sizeof(sizebuf1)),
+	    iec_sizestr((uint64_t)((double)p->nbytes * NANOSEC / scheduled),
+			sizebuf2, sizeof(sizebuf2)),
+	    (unsigned long long)p->nwaits,
+	    time_seconds(p->max_lag / 1000), time_microseconds(p->max_lag / 1000));
+}
+
+/*
+ * Parse a duty cycle like "2:8" or "500ms:1.5s" for --duty-cycle.
+ */
+static bool_t
+parse_duty_cycle(const char *str, pacer_t *p)
+{
+    char *copy = xstrdup(str);
+    char *off = strchr(copy, ':');
+    uint64_t on_us, off_us;
+    bool_t ok;
+
+    if (off)
+	*off++ = '\0';
+    ok = (off && parse_duration(copy, &on_us) && parse_duration(off, &off_us) &&
+	  on_us > 0);
+    if (ok)
+    {
+	p->on_ns = on_us * 1000;
+	p->off_ns = off_us * 1000;
+    }
+    xfree(copy);
+    return ok;
+}
+
+/*
+ * Parse a list of faults like "lose:100,reorder:7" for --datagram-faults.
+ */
+static bool_t
+parse_faults(const char *str, udp_faults_t *faults)
+{
+    char *copy = xstrdup(str);
+    char *tok, *val, *end;
+    char *saveptr = 0;
+    bool_t ok = TRUE;
+    long n;
+
+    for (tok = strtok_r(copy, ",", &saveptr) ;
+	 ok && tok ;
+	 tok = strtok_r(0, ",", &saveptr))
+    {
+	if ((val = strchr(tok, ':')) == 0)
+	{
+	    ok = FALSE;
+	    break;
+	}
+	*val++ = '\0';
+	n = strtol(val, &end, 0);
+	if (*end || n < 1)
+	    ok = FALSE;
+	else if (!strcmp(tok, "lose"))
+	    faults->lose = n;
+	else if (!strcmp(tok, "duplicate"))
+	    faults->duplicate = n;
+	else if (!strcmp(tok, "reorder"))
+	    faults->reorder = n;
+	else
+	    ok = FALSE;
+    }
+    xfree(copy);
+    return ok;
+}
+
 static void
 usage(void)
 {
@@ -151,6 +701,42 @@ static const struct option longopts[] =
     {"port",		required_argument,  NULL, 'p'},
     {"version",		no_argument,	    NULL, 'V'},
     {"retry-eagain",	no_argument,	    NULL, ARGS_NOSHORT(0)},
+    {"record-impl",	required_argument,  NULL, ARGS_NOSHORT(1)},
+    {"threads",		required_argument,  NULL, ARGS_NOSHORT(2)},
+    {"chunk-size",	required_argument,  NULL, ARGS_NOSHORT(3)},
+    {"layout",		required_argument,  NULL, ARGS_NOSHORT(4)},
+    {"engine",		required_argument,  NULL, ARGS_NOSHORT(5)},
+    {"iodepth",		required_argument,  NULL, ARGS_NOSHORT(6)},
+    {"register-buffers",	no_argument,	    NULL, ARGS_NOSHORT(7)},
+    {"register-files",	no_argument,	    NULL, ARGS_NOSHORT(8)},
+    {"sqpoll",		no_argument,	    NULL, ARGS_NOSHORT(9)},
+    {"mmap-window",	required_argument,  NULL, ARGS_NOSHORT(10)},
+    {"mmap-sequential",	no_argument,	    NULL, ARGS_NOSHORT(11)},
+    {"mmap-hugepage",	no_argument,	    NULL, ARGS_NOSHORT(12)},
+    {"mmap-populate",	no_argument,	    NULL, ARGS_NOSHORT(13)},
+    {"mmap-writeback",	required_argument,  NULL, ARGS_NOSHORT(14)},
+    {"mmap-writeback-wait", no_argument,    NULL, ARGS_NOSHORT(15)},
+    {"splice",		no_argument,	    NULL, ARGS_NOSHORT(16)},
+    {"zerocopy",	no_argument,	    NULL, ARGS_NOSHORT(17)},
+    {"sendfile",	required_argument,  NULL, ARGS_NOSHORT(18)},
+    {"connections",	required_argument,  NULL, ARGS_NOSHORT(19)},
+    {"datagram-size",	required_argument,  NULL, ARGS_NOSHORT(20)},
+    {"datagram-faults",	required_argument,  NULL, ARGS_NOSHORT(21)},
+    {"socket-buffer",	required_argument,  NULL, ARGS_NOSHORT(22)},
+    {"rate",		required_argument,  NULL, ARGS_NOSHORT(23)},
+    {"burst",		required_argument,  NULL, ARGS_NOSHORT(24)},
+    {"duty-cycle",	required_argument,  NULL, ARGS_NOSHORT(25)},
+    {"peak-rate",	required_argument,  NULL, ARGS_NOSHORT(26)},
+    {"ramp",		required_argument,  NULL, ARGS_NOSHORT(27)},
+    {"fileset",		required_argument,  NULL, ARGS_NOSHORT(28)},
+    {"fileset-depth",	required_argument,  NULL, ARGS_NOSHORT(29)},
+    {"fileset-fanout",	required_argument,  NULL, ARGS_NOSHORT(30)},
+    {"watchdog",	required_argument,  NULL, ARGS_NOSHORT(31)},
+    {"interval",	required_argument,  NULL, ARGS_NOSHORT(32)},
+    {"interval-csv",	required_argument,  NULL, ARGS_NOSHORT(33)},
+    {"json",		required_argument,  NULL, ARGS_NOSHORT(34)},
+    {"shm-stats",	no_argument,	    NULL, ARGS_NOSHORT(35)},
+    {"perf-counters",	no_argument,	    NULL, ARGS_NOSHORT(36)},
     {0, 0, 0, 0}
 };
 
@@ -158,8 +744,10 @@ int
 main(int argc, char **argv)
 {
     uint64_t length;
-    const char *filename = 0;	/* or hostname for TCP */
+    const char *filename = 0;	/* or hostname for TCP, or socket path */
     bool_t mmap_flag = FALSE;
+    bool_t splice_flag = FALSE;
+    const char *sendfile_name = 0;
     int oflags = O_WRONLY|O_CREAT;
     int otrunc = O_TRUNC;
     int xflags = 0;
@@ -170,6 +758,35 @@ main(int argc, char **argv)
     int c;
     int protocol = 0;
     uint16_t port = 0;
+    int engine = ENGINE_SYNC;
+    unsigned int iodepth = 0;
+    uint64_t mmap_window = DEFAULT_MMAP_WINDOW;
+    unsigned int datagram_size = 0;
+    udp_faults_t faults;
+    bool_t have_faults = FALSE;
+    uint64_t socket_buffer = 0;
+    uint64_t watchdog_us = 0;
+    watchdog_t wd;
+    uint64_t interval_us = 0;
+    FILE *csv = 0;
+    progress_t pr;
+    const char *json_path = 0;
+    bool_t shm_flag = FALSE;
+    bool_t perf_flag = FALSE;
+    perfcount_t pc;
+    uint64_t nblocks, nbytes, deltat;
+    char *name;
+    stream_latency_t latency;
+    pacer_t pacer;
+    bool_t pacing_flag;
+    uint64_t start;
+    uint64_t nfiles = 0;
+    unsigned int depth = 0;
+    unsigned int fanout = 0;
+    uint64_t max_length = 0;
+
+    memset(&faults, 0, sizeof(faults));
+    pacer_init(&pacer, 0, 0);
 
 #ifdef O_LARGEFILE
     oflags |= O_LARGEFILE;
@@ -250,6 +867,229 @@ main(int argc, char **argv)
 	case ARGS_NOSHORT(0): // retry-eagain
 	    xflags |= STREAM_RETRY_EAGAIN;
 	    break;
+
+	case ARGS_NOSHORT(1): // record-impl
+	    if (!record_impl_select(optarg))
+		fatal("unknown or unsupported record implementation \"%s\"", optarg);
+	    break;
+
+	case ARGS_NOSHORT(2): // threads
+	    {
+		char *end;
+		long n = strtol(optarg, &end, 0);
+
+		if (*end || n < 1)
+		    fatal("cannot parse number of threads \"%s\"", optarg);
+		num_threads = n;
+	    }
+	    break;
+
+	case ARGS_NOSHORT(3): // chunk-size
+	    if (!parse_length(optarg, &chunk_size) || !chunk_size)
+		fatal("cannot parse chunk size \"%s\"", optarg);
+	    break;
+
+	case ARGS_NOSHORT(4): // layout
+	    if (!strcmp(optarg, "interleaved"))
+		layout = LAYOUT_INTERLEAVED;
+	    else if (!strcmp(optarg, "contiguous"))
+		layout = LAYOUT_CONTIGUOUS;
+	    else
+		fatal("cannot parse layout \"%s\"", optarg);
+	    break;
+
+	case ARGS_NOSHORT(5): // engine
+	    if (!parse_engine(optarg, &engine))
+		fatal("cannot parse engine \"%s\"", optarg);
+	    break;
+
+	case ARGS_NOSHORT(6): // iodepth
+	    {
+		char *end;
+		long n = strtol(optarg, &end, 0);
+
+		if (*end || n < 1 || n > 4096)
+		    fatal("cannot parse iodepth \"%s\"", optarg);
+		iodepth = n;
+	    }
+	    break;
+
+	case ARGS_NOSHORT(7): // register-buffers
+	    xflags |= STREAM_URING_REGISTER_BUFFERS;
+	    break;
+
+	case ARGS_NOSHORT(8): // register-files
+	    xflags |= STREAM_URING_REGISTER_FILES;
+	    break;
+
+	case ARGS_NOSHORT(9): // sqpoll
+	    xflags |= STREAM_URING_SQPOLL;
+	    break;
+
+	case ARGS_NOSHORT(10): // mmap-window
+	    if (!parse_length(optarg, &mmap_window) || !mmap_window ||
+		mmap_window > MAX_MMAP_WINDOW)
+		fatal("cannot parse mmap window \"%s\"", optarg);
+	    break;
+
+	case ARGS_NOSHORT(11): // mmap-sequential
+	    xflags |= STREAM_MMAP_SEQUENTIAL;
+	    break;
+
+	case ARGS_NOSHORT(12): // mmap-hugepage
+	    xflags |= STREAM_MMAP_HUGEPAGE;
+	    break;
+
+	case ARGS_NOSHORT(13): // mmap-populate
+	    xflags |= STREAM_MMAP_POPULATE;
+	    break;
+
+	case ARGS_NOSHORT(14): // mmap-writeback
+	    if (!strcmp(optarg, "sync"))
+		xflags &= ~STREAM_MMAP_ASYNC;
+	    else if (!strcmp(optarg, "async"))
+		xflags |= STREAM_MMAP_ASYNC;
+	    else
+		fatal("unknown mmap writeback mode \"%s\"", optarg);
+	    break;
+
+	case ARGS_NOSHORT(15): // mmap-writeback-wait
+	    xflags |= STREAM_MMAP_WAIT;
+	    break;
+
+	case ARGS_NOSHORT(16): // splice
+	    splice_flag = TRUE;
+	    break;
+
+	case ARGS_NOSHORT(17): // zerocopy
+	    xflags |= STREAM_ZEROCOPY;
+	    break;
+
+	case ARGS_NOSHORT(18): // sendfile
+	    sendfile_name = optarg;
+	    break;
+
+	case ARGS_NOSHORT(19): // connections
+	    {
+		char *end;
+		long n = strtol(optarg, &end, 0);
+
+		if (*end || n < 1 || n > MAX_CONNECTIONS)
+		    fatal("cannot parse number of connections \"%s\"", optarg);
+		num_connections = n;
+	    }
+	    break;
+
+	case ARGS_NOSHORT(20): // datagram-size
+	    {
+		uint64_t n;
+
+		if (!parse_length(optarg, &n) || n == 0 ||
+		    n > MAX_DATAGRAM_SIZE || (n & RECORD_MASK_CREATOR))
+		    fatal("cannot parse datagram size \"%s\"", optarg);
+		datagram_size = n;
+	    }
+	    break;
+
+	case ARGS_NOSHORT(21): // datagram-faults
+	    if (!parse_faults(optarg, &faults))
+		fatal("cannot parse datagram faults \"%s\"", optarg);
+	    have_faults = TRUE;
+	    break;
+
+	case ARGS_NOSHORT(22): // socket-buffer
+	    if (!parse_length(optarg, &socket_buffer) || socket_buffer == 0 ||
+		socket_buffer > MAX_SOCKET_BUFFER)
+		fatal("cannot parse socket buffer size \"%s\"", optarg);
+	    break;
+
+	case ARGS_NOSHORT(23): // rate
+	    if (!parse_length(optarg, &pacer.rate) || pacer.rate == 0)
+		fatal("cannot parse rate \"%s\"", optarg);
+	    break;
+
+	case ARGS_NOSHORT(24): // burst
+	    if (!parse_length(optarg, &pacer.burst) || pacer.burst == 0)
+		fatal("cannot parse burst size \"%s\"", optarg);
+	    break;
+
+	case ARGS_NOSHORT(25): // duty-cycle
+	    if (!parse_duty_cycle(optarg, &pacer))
+		fatal("cannot parse duty cycle \"%s\"", optarg);
+	    break;
+
+	case ARGS_NOSHORT(26): // peak-rate
+	    if (!parse_length(optarg, &pacer.peak_rate) || pacer.peak_rate == 0)
+		fatal("cannot parse peak rate \"%s\"", optarg);
+	    break;
+
+	case ARGS_NOSHORT(27): // ramp
+	    {
+		uint64_t us;
+
+		if (!parse_duration(optarg, &us))
+		    fatal("cannot parse ramp time \"%s\"", optarg);
+		pacer.ramp_ns = us * 1000;
+	    }
+	    break;
+
+	case ARGS_NOSHORT(28): // fileset
+	    {
+		char *end;
+
+		nfiles = strtoull(optarg, &end, 0);
+		if (*end || nfiles < 1)
+		    fatal("cannot parse number of files \"%s\"", optarg);
+	    }
+	    break;
+
+	case ARGS_NOSHORT(29): // fileset-depth
+	    {
+		char *end;
+		long n = strtol(optarg, &end, 0);
+
+		if (*end || n < 0 || n > FILESET_MAX_DEPTH)
+		    fatal("cannot parse fileset depth \"%s\"", optarg);
+		depth = n;
+	    }
+	    break;
+
+	case ARGS_NOSHORT(30): // fileset-fanout
+	    {
+		char *end;
+		long n = strtol(optarg, &end, 0);
+
+		if (*end || n < 1 || n > FILESET_MAX_FANOUT)
+		    fatal("cannot parse fileset fanout \"%s\"", optarg);
+		fanout = n;
+	    }
+	    break;
+
+	case ARGS_NOSHORT(31): // watchdog
+	    if (!parse_duration(optarg, &watchdog_us) || !watchdog_us)
+		fatal("cannot parse watchdog time \"%s\"", optarg);
+	    break;
+
+	case ARGS_NOSHORT(32): // interval
+	    if (!parse_duration(optarg, &interval_us) || !interval_us)
+		fatal("cannot parse interval \"%s\"", optarg);
+	    break;
+
+	case ARGS_NOSHORT(33): // interval-csv
+	    interval_csv = optarg;
+	    break;
+
+	case ARGS_NOSHORT(34): // json
+	    json_path = optarg;
+	    break;
+
+	case ARGS_NOSHORT(35): // shm-stats
+	    shm_flag = TRUE;
+	    break;
+
+	case ARGS_NOSHORT(36): // perf-counters
+	    perf_flag = TRUE;
+	    break;
 	}
     }
     oflags |= otrunc;
@@ -261,7 +1101,9 @@ main(int argc, char **argv)
 	filename = files[1];
 	/* fall through */
     case 1:
-	if (!parse_length(files[0], &length))
+	/* each file in a fileset can be a different size */
+	if (nfiles ? !parse_length_range(files[0], &length, &max_length)
+		   : !parse_length(files[0], &length))
 	    fatal("cannot parse length \"%s\"", files[0]);
 	break;
     default:
@@ -270,6 +1112,8 @@ main(int argc, char **argv)
 
     if (port && !protocol)
 	fatal("must specify --protocol=tcp with --port");
+    if (port && IS_UNIX_PROTOCOL(protocol))
+	fatal("cannot use --port with a Unix domain socket");
 
     if (filename == 0)
     {
@@ -294,28 +1138,276 @@ main(int argc, char **argv)
 	    port = DEFAULT_PORT;
     }
 
+    if (!mmap_flag && (xflags & (STREAM_MMAP_SEQUENTIAL|
+				 STREAM_MMAP_HUGEPAGE|
+				 STREAM_MMAP_POPULATE|
+				 STREAM_MMAP_ASYNC)))
+	fatal("--mmap-sequential, --mmap-hugepage, --mmap-populate and --mmap-writeback need --mmap");
+    if ((xflags & STREAM_MMAP_WAIT) && !(xflags & STREAM_MMAP_ASYNC))
+	fatal("--mmap-writeback-wait needs --mmap-writeback=async");
     if ((xflags & STREAM_CLOSE) && !mmap_flag)
 	fatal("--close is not useful except with --mmap");
 
+    if (num_threads > 1 && (filename == 0 || protocol || mmap_flag))
+	fatal("--threads only works when writing a named file");
+    if (num_connections > 1)
+    {
+	if (protocol != IPPROTO_TCP)
+	    fatal("--connections needs --protocol=tcp");
+	if (seek || sendfile_name)
+	    fatal("cannot use --connections with --seek or --sendfile");
+	if (!chunk_size)
+	    chunk_size = DEFAULT_STRIPE_SIZE;
+	chunk_size &= ~(creator_flag ? RECORD_MASK_CREATOR : RECORD_MASK);
+	if (!chunk_size)
+	    fatal("chunk size is smaller than a record");
+    }
+    if (!chunk_size)
+	chunk_size = GENERATE_CHUNK_SIZE;
+    if (splice_flag && (protocol || mmap_flag || num_threads > 1 ||
+			engine != ENGINE_SYNC))
+	fatal("cannot use --splice with --protocol, --mmap, --threads or --engine=io_uring");
+    if ((xflags & STREAM_ZEROCOPY) && protocol != IPPROTO_TCP)
+	fatal("--zerocopy needs --protocol=tcp");
+    if ((datagram_size || have_faults) && protocol != IPPROTO_UDP)
+	fatal("--datagram-size and --datagram-faults need --protocol=udp");
+    if (protocol == IPPROTO_UDP && (seek || sendfile_name))
+	fatal("cannot use --protocol=udp with --seek or --sendfile");
+    if (protocol == PROTOCOL_UNIX_SEQPACKET && sendfile_name)
+	fatal("cannot use --protocol=unix-seqpacket with --sendfile");
+    if (socket_buffer && !protocol)
+	fatal("--socket-buffer needs --protocol");
+    pacing_flag = (pacer.rate != 0);
+    if (!pacing_flag && (pacer.burst || pacer.on_ns || pacer.ramp_ns))
+	fatal("--burst, --duty-cycle and --ramp need --rate");
+    if (pacer.peak_rate && !pacer.on_ns)
+	fatal("--peak-rate needs --duty-cycle");
+    if (pacing_flag && (mmap_flag || num_threads > 1 || sendfile_name))
+	fatal("cannot use --rate with --mmap, --threads or --sendfile");
+    if (sendfile_name && ((xflags & STREAM_ZEROCOPY) || splice_flag ||
+			  mmap_flag || num_threads > 1 ||
+			  engine != ENGINE_SYNC))
+	fatal("cannot use --sendfile with --zerocopy, --splice, --mmap, --threads or --engine=io_uring");
+    if (engine == ENGINE_URING)
+    {
+	if (filename == 0 || protocol || mmap_flag)
+	    fatal("--engine=io_uring only works when writing a named file");
+	if (num_threads > 1)
+	    fatal("cannot use --engine=io_uring with --threads");
+	if (!iodepth)
+	    iodepth = DEFAULT_IODEPTH;
+    }
+    else if (iodepth || (xflags & (STREAM_URING_REGISTER_BUFFERS|
+				   STREAM_URING_REGISTER_FILES|
+				   STREAM_URING_SQPOLL)))
+    {
+	fatal("--iodepth, --register-buffers, --register-files and --sqpoll need --engine=io_uring");
+    }
+
+    if (nfiles)
+    {
+	if (filename == 0 || protocol || mmap_flag || splice_flag ||
+	    sendfile_name || engine != ENGINE_SYNC || pacing_flag ||
+	    seek || (xflags & (STREAM_UNLINK|STREAM_CLOSE)))
+	    fatal("--fileset needs a directory, and cannot be used with --protocol, "
+		  "--mmap, --splice, --sendfile, --engine=io_uring, --rate, --seek "
+		  "or --unlink");
+	if (max_length > length && length == 0)
+	    fatal("the smallest file size in a range must not be zero");
+    }
+    else if (depth || fanout)
+	fatal("--fileset-depth and --fileset-fanout need --fileset");
+    if (!fanout)
+	fanout = FILESET_DEFAULT_FANOUT;
+    if (watchdog_us && (nfiles || num_connections > 1))
+	fatal("--watchdog cannot be used with --fileset or --connections");
+    if (interval_csv && !interval_us)
+	fatal("--interval-csv needs --interval");
+
     /* ensure stats are dumped when we get a sigint */
     signal(SIGINT, handle_sig);
     signal(SIGTERM, handle_sig);
 
-    if (protocol)
-	stream = stream_client_open(filename, protocol, port, xflags, bsize);
+    if (json_path)
+    {
+	json_obj_t o;
+
+	if ((json = json_open(json_path)) == 0)
+	    exit(1);
+	json_begin(&o, "config");
+	json_add_str(&o, "program", "genstream");
+	json_add_str(&o, "version", VERSION);
+	json_add_str(&o, "mode",
+		     (nfiles ? "fileset" :
+		      protocol == IPPROTO_UDP ? "udp" :
+		      IS_UNIX_PROTOCOL(protocol) ? "unix" :
+		      protocol ? "tcp" :
+		      filename == 0 ? "stdout" :
+		      mmap_flag ? "mmap" : "file"));
+	json_add_str(&o, "path", filename);
+	json_add_uint(&o, "length", length);
+	if (nfiles)
+	{
+	    json_add_uint(&o, "files", nfiles);
+	    json_add_uint(&o, "max_length", MAX(max_length, length));
+	}
+	json_add_uint(&o, "seek", seek);
+	json_add_uint(&o, "tag", tag);
+	json_add_bool(&o, "creator", creator_flag);
+	json_add_uint(&o, "blocksize", bsize);
+	json_add_uint(&o, "threads", num_threads);
+	json_add_uint(&o, "connections", num_connections);
+	json_add_str(&o, "engine", (engine == ENGINE_URING ? "io_uring" : "sync"));
+	json_add_str(&o, "record_impl", record_impl_name());
+	json_emit(json, &o);
+    }
+    if (shm_flag && (shm = shmstats_create("genstream", filename, tag)) == 0)
+	exit(1);
+    /* the --interval thread also updates the segment, quietly if need be */
+    if (interval_us || shm)
+    {
+	if (interval_csv && (csv = fopen(interval_csv, "w")) == 0)
+	{
+	    perrorf("fopen(\"%s\")", interval_csv);
+	    exit(1);
+	}
+	progress = &pr;
+	progress_init(progress,
+		      (interval_us ? interval_us * 1000 : SHMSTATS_INTERVAL),
+		      csv, (creator_flag ? RECORD_SIZE_CREATOR : RECORD_SIZE), 0);
+	progress->json = json;
+	progress->shm = shm;
+	progress->quiet = !interval_us;
+	progress_start(progress);
+    }
+    if (perf_flag)
+    {
+	perf = &pc;
+	perfcount_init(perf);
+    }
+
+    if (nfiles)
+    {
+	fileset_t fs;
+
+	fileset_init(&fs, filename, nfiles, depth, fanout, length, max_length,
+		     (creator_flag ? RECORD_MASK_CREATOR : RECORD_MASK));
+	if (perf)
+	    perfcount_start(perf);
+	generate_fileset(&fs, oflags, xflags, bsize);
+	if (perf)
+	    perfcount_destroy(perf);
+	if (json && json_close(json) < 0)
+	    return 1;
+	return !!signalled;
+    }
+
+    if (protocol == IPPROTO_UDP)
+    {
+	stream = stream_udp_client_open(filename, port, xflags, bsize,
+					datagram_size, &faults);
+    }
+    else if (protocol)
+    {
+	connections = xmalloc(num_connections * sizeof(stream_t *));
+	if (stream_client_open_many(filename, protocol, port, xflags, bsize,
+				    connections, num_connections, chunk_size) < 0)
+	    exit(1);	/* error message printed at lower level in stream.c */
+	stream = connections[0];
+    }
+    else if (filename == 0 && splice_flag)
+	stream = stream_splice_dopen(fileno(stdout), oflags, xflags, bsize);
     else if (filename == 0)
 	stream = stream_unix_dopen(fileno(stdout), oflags, xflags, bsize);
+    else if (splice_flag)
+	stream = stream_splice_open(filename, oflags, xflags, bsize);
     else if (mmap_flag)
-	stream = stream_mmap_open(filename, oflags, xflags, length+seek);
+	stream = stream_mmap_open(filename, oflags, xflags, seek, length+seek,
+				  mmap_window);
+    else if (engine == ENGINE_URING)
+	stream = stream_uring_open(filename, oflags, xflags, bsize, iodepth);
     else
 	stream = stream_unix_open(filename, oflags, xflags, bsize);
 
     if (stream == 0)
 	exit(1);    /* error message printed at lower level in stream.c */
+    if (pacing_flag)
+    {
+	unsigned int i;
+
+	if (!pacer.burst)
+	    pacer.burst = stream->bufsize;
+	/* the connections are written in turn, so they share the one pace */
+	for (i = 0 ; i < num_connections ; i++)
+	    (connections ? connections[i] : stream)->pacer = &pacer;
+    }
+    /* likewise one thread times all the connections */
+    {
+	unsigned int i;
+
+	memset(&latency, 0, sizeof(latency));
+	for (i = 0 ; i < num_connections ; i++)
+	    (connections ? connections[i] : stream)->latency = &latency;
+	if (shm)
+	    shm->latency = &latency;
+    }
+    if (watchdog_us)
+    {
+	/* slot 0 for the stream, then one for each thread */
+	watchdog = &wd;
+	watchdog_init(watchdog, 1 + num_threads, watchdog_us * 1000, 0, 0);
+	stream->watch = watchdog_slot(watchdog, 0, stream->name, seek);
+	watchdog_start(watchdog);
+    }
+    if (socket_buffer)
+    {
+	unsigned int i;
+
+	for (i = 0 ; i < num_connections ; i++)
+	    if (stream_set_socket_buffer((connections ? connections[i] : stream),
+					 socket_buffer) < 0)
+		exit(1);    /* error message printed at lower level in stream.c */
+    }
+    if (progress)
+    {
+	if (connections)
+	    progress_watch(progress, connections, num_connections, seek);
+	else
+	    progress_watch(progress, &stream, 1, seek);
+    }
+
+    start = time_now();
+    /* so the counters see only the generating */
+    if (perf)
+	perfcount_start(perf);
+    if (sendfile_name)
+	send_file(stream, sendfile_name, length, seek);
+    else
+	generate_stream(stream, length, seek);
+    if (perf)
+	perfcount_stop(perf);
+    /* before the connections are added up below */
+    stop_progress();
 
+    if (num_connections > 1)
+    {
+	unsigned int i;
 
-    generate_stream(stream, length, seek);
-    stream_flush(stream);
+	for (i = 0 ; i < num_connections ; i++)
+	    fprintf(stderr, "%s: connection %u: %llu blocks %llu bytes\n",
+		    argv0, i,
+		    (unsigned long long)connections[i]->stats.nblocks,
+		    (unsigned long long)connections[i]->stats.nbytes);
+	/* the summary is for all the connections together */
+	for (i = 1 ; i < num_connections ; i++)
+	{
+	    stream->stats.nblocks += connections[i]->stats.nblocks;
+	    stream->stats.nbytes += connections[i]->stats.nbytes;
+	    stream->stats.zcsends += connections[i]->stats.zcsends;
+	    stream->stats.zccopied += connections[i]->stats.zccopied;
+	    stream_close(connections[i]);
+	}
+    }
 
     /* used for determining how many blocks have been read or written */
     fprintf(stderr, "%s: %s %llu blocks %llu bytes\n",
@@ -323,10 +1415,58 @@ main(int argc, char **argv)
 	    stream->name,
 	    (unsigned long long)stream->stats.nblocks,
 	    (unsigned long long)stream->stats.nbytes);
-    fflush(stderr); /* JIC */
+    /* how long writing back each mmap window took */
+    if (stream->stats.nflushes)
+    {
+	uint64_t mean = stream->stats.flushtime / stream->stats.nflushes;
 
+	fprintf(stderr, "%s: wrote back %llu windows in %u.%06u seconds, "
+			"mean %u.%06u max %u.%06u seconds per window\n",
+		argv0,
+		(unsigned long long)stream->stats.nflushes,
+		time_seconds(stream->stats.flushtime),
+		time_microseconds(stream->stats.flushtime),
+		time_seconds(mean), time_microseconds(mean),
+		time_seconds(stream->stats.flushmax),
+		time_microseconds(stream->stats.flushmax));
+    }
+    if ((xflags & STREAM_ZEROCOPY))
+	fprintf(stderr, "%s: zero-copy: %llu sends without copying, %llu copied\n",
+		argv0,
+		(unsigned long long)stream->stats.zcsends,
+		(unsigned long long)stream->stats.zccopied);
+    if (protocol == IPPROTO_UDP)
+	emit_datagram_stats(stream, time_now() - start);
+    if (pacing_flag)
+	emit_pacing_stats(&pacer);
+
+    /* the stream is gone once closed, but its closing counts */
+    nblocks = stream->stats.nblocks;
+    nbytes = stream->stats.nbytes;
+    deltat = time_now() - start;
+    name = xstrdup(stream->name);
     stream_close(stream);
+    /* the tail latencies which the averages above hide */
+    stream_emit_latency(argv0, &latency);
+    /* whether it was the CPU which limited the throughput */
+    if (perf)
+	perfcount_emit(perf, nbytes, (creator_flag ? RECORD_SIZE_CREATOR : RECORD_SIZE));
+    if (watchdog)
+    {
+	watchdog_stop(watchdog);
+	watchdog_emit_timeline(watchdog);
+    }
+    if (json)
+	json_summary(name, nblocks, nbytes, deltat, &latency);
+    if (watchdog)
+	watchdog_destroy(watchdog);
+    if (perf)
+	perfcount_destroy(perf);
+    xfree(name);
+    fflush(stderr); /* JIC */
 
+    if (json && json_close(json) < 0)
+	return 1;
     return !!signalled;
 }
 
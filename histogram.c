@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2021 Greg Banks <gnb@fmeh.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#include "common.h"
+#include "histogram.h"
+
+void
+histogram_init(histogram_t *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+/*
+ * A value at or above HISTOGRAM_SUB_COUNT whose top bit is bit e
+ * goes in the bucket given by e and the HISTOGRAM_SUB_BITS bits
+ * below the top bit.
+ */
+unsigned int
+histogram_bucket(uint64_t v)
+{
+    unsigned int shift;
+
+    if (v < HISTOGRAM_SUB_COUNT)
+	return (unsigned int)v;
+    shift = 63 - __builtin_clzll(v) - HISTOGRAM_SUB_BITS;
+    return (shift + 1) * HISTOGRAM_SUB_COUNT +
+	   (unsigned int)((v >> shift) - HISTOGRAM_SUB_COUNT);
+}
+
+/* the largest value which goes in bucket b */
+uint64_t
+histogram_bucket_max(unsigned int b)
+{
+    unsigned int shift;
+    uint64_t mant;
+
+    if (b < HISTOGRAM_SUB_COUNT)
+	return b;
+    shift = b / HISTOGRAM_SUB_COUNT - 1;
+    mant = b % HISTOGRAM_SUB_COUNT + HISTOGRAM_SUB_COUNT;
+    return ((mant + 1) << shift) - 1;
+}
+
+void
+histogram_add(histogram_t *h, uint64_t v)
+{
+    h->buckets[histogram_bucket(v)]++;
+    h->count++;
+    if (v > h->max)
+	h->max = v;
+}
+
+void
+histogram_merge(histogram_t *to, const histogram_t *from)
+{
+    unsigned int b;
+
+    for (b = 0 ; b < HISTOGRAM_NBUCKETS ; b++)
+	to->buckets[b] += from->buckets[b];
+    to->count += from->count;
+    if (from->max > to->max)
+	to->max = from->max;
+}
+
+/*
+ * Returns a value which at least pct percent of the values added
+ * are no greater than, the top of the bucket it falls in, but never
+ * more than the largest value added.
+ */
+uint64_t
+histogram_percentile(const histogram_t *h, double pct)
+{
+    uint64_t rank, seen = 0;
+    unsigned int b;
+
+    if (!h->count)
+	return 0;
+    rank = (uint64_t)(pct / 100.0 * h->count + 0.5);
+    if (rank < 1)
+	rank = 1;
+    for (b = 0 ; b < HISTOGRAM_NBUCKETS ; b++)
+    {
+	seen += h->buckets[b];
+	if (seen >= rank)
+	    return MIN(histogram_bucket_max(b), h->max);
+    }
+    return h->max;
+}
+
+/* one line of percentiles, in microseconds, of values in nanoseconds */
+void
+histogram_emit(const char *prefix, const char *what, const histogram_t *h)
+{
+    if (!h->count)
+	return;
+    fprintf(stderr, "%s: %s latency p50 %.1f p90 %.1f p99 %.1f "
+		    "p99.9 %.1f max %.1f usec\n",
+	    prefix, what,
+	    histogram_percentile(h, 50.0) / 1000.0,
+	    histogram_percentile(h, 90.0) / 1000.0,
+	    histogram_percentile(h, 99.0) / 1000.0,
+	    histogram_percentile(h, 99.9) / 1000.0,
+	    h->max / 1000.0);
+}
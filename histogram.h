@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2021 Greg Banks <gnb@fmeh.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef _CHECKSTREAM_HISTOGRAM_H_
+#define _CHECKSTREAM_HISTOGRAM_H_ 1
+
+#include "common.h"
+
+/*
+ * A log-linear histogram of 64-bit values such as latencies in
+ * nanoseconds.  Values below 2^HISTOGRAM_SUB_BITS have a bucket each,
+ * and each power of two above that is split into 2^HISTOGRAM_SUB_BITS
+ * equal buckets, so any value is known to within about 6%, and adding
+ * one is a few instructions with no allocation.
+ */
+#define HISTOGRAM_SUB_BITS	4
+#define HISTOGRAM_SUB_COUNT	(1U<<HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_NBUCKETS	((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_COUNT)
+
+typedef struct histogram
+{
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[HISTOGRAM_NBUCKETS];
+} histogram_t;
+
+extern void histogram_init(histogram_t *h);
+extern unsigned int histogram_bucket(uint64_t v);
+extern uint64_t histogram_bucket_max(unsigned int b);
+extern void histogram_add(histogram_t *h, uint64_t v);
+extern void histogram_merge(histogram_t *to, const histogram_t *from);
+extern uint64_t histogram_percentile(const histogram_t *h, double pct);
+extern void histogram_emit(const char *prefix, const char *what,
+			   const histogram_t *h);
+
+#endif /* _CHECKSTREAM_HISTOGRAM_H_ */
@@ -0,0 +1,238 @@
+/*
+ * Copyright (c) 2021 Greg Banks <gnb@fmeh.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#include "common.h"
+#include "json.h"
+#include <math.h>
+
+/* Returns 0, having reported the error, if the file can't be created */
+json_writer_t *
+json_open(const char *path)
+{
+    json_writer_t *w;
+    FILE *fp;
+
+    if ((fp = fopen(path, "w")) == 0)
+    {
+	perrorf("fopen(\"%s\")", path);
+	return 0;
+    }
+    w = xmalloc(sizeof(json_writer_t));
+    w->fp = fp;
+    w->path = xstrdup(path);
+    w->buf = xmalloc(JSON_BUFSIZE);
+    setvbuf(fp, w->buf, _IOFBF, JSON_BUFSIZE);
+    pthread_mutex_init(&w->lock, 0);
+    return w;
+}
+
+/* for events someone may be waiting to see, like the periodic ones */
+void
+json_flush(json_writer_t *w)
+{
+    pthread_mutex_lock(&w->lock);
+    fflush(w->fp);
+    pthread_mutex_unlock(&w->lock);
+}
+
+int
+json_close(json_writer_t *w)
+{
+    int r = 0;
+
+    if (fclose(w->fp) < 0)
+    {
+	perrorf("fclose(\"%s\")", w->path);
+	r = -1;
+    }
+    pthread_mutex_destroy(&w->lock);
+    xfree(w->buf);
+    xfree(w->path);
+    xfree(w);
+    return r;
+}
+
+static void
+json_append(json_obj_t *o, const char *s, size_t n)
+{
+    if (o->len + n + 1 > o->max)
+    {
+	o->max = MAX(2 * o->max, o->len + n + 1);
+	o->buf = xrealloc(o->buf, o->max);
+    }
+    memcpy(o->buf + o->len, s, n);
+    o->len += n;
+    o->buf[o->len] = '\0';
+}
+
+static void
+json_appendf(json_obj_t *o, const char *fmt, ...)
+    __attribute__ (( format(printf, 2, 3) ));
+
+static void
+json_appendf(json_obj_t *o, const char *fmt, ...)
+{
+    char buf[64];
+    va_list args;
+    int n;
+
+    va_start(args, fmt);
+    n = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    json_append(o, buf, MIN((size_t)n, sizeof(buf) - 1));
+}
+
+static void
+json_string(json_obj_t *o, const char *s)
+{
+    const char *p;
+
+    json_append(o, "\"", 1);
+    for (p = s ; *p ; p++)
+    {
+	if (*p == '"' || *p == '\\')
+	{
+	    json_append(o, "\\", 1);
+	    json_append(o, p, 1);
+	}
+	else if ((unsigned char)*p < 0x20)
+	    json_appendf(o, "\\u%04x", (unsigned)(unsigned char)*p);
+	else
+	    json_append(o, p, 1);
+    }
+    json_append(o, "\"", 1);
+}
+
+/* the separator and key of the next member */
+static void
+json_key(json_obj_t *o, const char *key)
+{
+    if (o->comma)
+	json_append(o, ",", 1);
+    if (key)
+    {
+	json_string(o, key);
+	json_append(o, ":", 1);
+    }
+    o->comma = TRUE;
+}
+
+void
+json_begin(json_obj_t *o, const char *event)
+{
+    memset(o, 0, sizeof(*o));
+    json_append(o, "{", 1);
+    json_add_str(o, "event", event);
+    json_add_double(o, "time", (double)time_now() / MICROSEC);
+}
+
+void
+json_add_str(json_obj_t *o, const char *key, const char *str)
+{
+    json_key(o, key);
+    if (str)
+	json_string(o, str);
+    else
+	json_append(o, "null", 4);
+}
+
+void
+json_add_uint(json_obj_t *o, const char *key, uint64_t v)
+{
+    json_key(o, key);
+    json_appendf(o, "%llu", (unsigned long long)v);
+}
+
+void
+json_add_double(json_obj_t *o, const char *key, double v)
+{
+    json_key(o, key);
+    /* JSON has no infinities or NaNs */
+    if (isfinite(v))
+	json_appendf(o, "%.16g", v);
+    else
+	json_append(o, "null", 4);
+}
+
+void
+json_add_bool(json_obj_t *o, const char *key, bool_t v)
+{
+    json_key(o, key);
+    if (v)
+	json_append(o, "true", 4);
+    else
+	json_append(o, "false", 5);
+}
+
+/* percentiles in microseconds, as histogram_emit() reports them */
+void
+json_add_histogram(json_obj_t *o, const char *key, const histogram_t *h)
+{
+    json_open_object(o, key);
+    json_add_uint(o, "count", h->count);
+    if (h->count)
+    {
+	json_add_double(o, "p50_us", histogram_percentile(h, 50.0) / 1000.0);
+	json_add_double(o, "p90_us", histogram_percentile(h, 90.0) / 1000.0);
+	json_add_double(o, "p99_us", histogram_percentile(h, 99.0) / 1000.0);
+	json_add_double(o, "p99.9_us", histogram_percentile(h, 99.9) / 1000.0);
+	json_add_double(o, "max_us", h->max / 1000.0);
+    }
+    json_close_object(o);
+}
+
+void
+json_open_object(json_obj_t *o, const char *key)
+{
+    json_key(o, key);
+    json_append(o, "{", 1);
+    o->comma = FALSE;
+}
+
+void
+json_close_object(json_obj_t *o)
+{
+    json_append(o, "}", 1);
+    o->comma = TRUE;
+}
+
+void
+json_open_array(json_obj_t *o, const char *key)
+{
+    json_key(o, key);
+    json_append(o, "[", 1);
+    o->comma = FALSE;
+}
+
+void
+json_close_array(json_obj_t *o)
+{
+    json_append(o, "]", 1);
+    o->comma = TRUE;
+}
+
+/* writes the event as one line and frees it */
+void
+json_emit(json_writer_t *w, json_obj_t *o)
+{
+    json_append(o, "}\n", 2);
+    pthread_mutex_lock(&w->lock);
+    fwrite(o->buf, 1, o->len, w->fp);
+    pthread_mutex_unlock(&w->lock);
+    xfree(o->buf);
+    o->buf = 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2021 Greg Banks <gnb@fmeh.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef _CHECKSTREAM_JSON_H_
+#define _CHECKSTREAM_JSON_H_ 1
+
+#include "common.h"
+#include "histogram.h"
+#include <pthread.h>
+
+/*
+ * Events as JSON lines, see --json.  Each event is one object on a
+ * line of its own, built up in memory with the json_add functions and
+ * then written whole by json_emit(), so events from several threads
+ * don't interleave.  Every event has an "event" naming what happened
+ * and a "time" in seconds since the epoch.  The file is written
+ * through a large stdio buffer, flushed only by json_flush() and when
+ * closed, so a storm of errors costs little more than formatting.
+ */
+typedef struct
+{
+    FILE *fp;
+    char *path;
+    char *buf;			/* stdio's */
+    pthread_mutex_t lock;
+} json_writer_t;
+
+typedef struct
+{
+    char *buf;
+    size_t len;
+    size_t max;
+    bool_t comma;		/* before the next member */
+} json_obj_t;
+
+#define JSON_BUFSIZE	(1ULL<<20)
+
+extern json_writer_t *json_open(const char *path);
+extern void json_flush(json_writer_t *w);
+extern int json_close(json_writer_t *w);
+
+extern void json_begin(json_obj_t *o, const char *event);
+extern void json_add_str(json_obj_t *o, const char *key, const char *str);
+extern void json_add_uint(json_obj_t *o, const char *key, uint64_t v);
+extern void json_add_double(json_obj_t *o, const char *key, double v);
+extern void json_add_bool(json_obj_t *o, const char *key, bool_t v);
+extern void json_add_histogram(json_obj_t *o, const char *key,
+			       const histogram_t *h);
+/* a key of 0 is for an element of an array */
+extern void json_open_object(json_obj_t *o, const char *key);
+extern void json_close_object(json_obj_t *o);
+extern void json_open_array(json_obj_t *o, const char *key);
+extern void json_close_array(json_obj_t *o);
+extern void json_emit(json_writer_t *w, json_obj_t *o);
+
+#endif /* _CHECKSTREAM_JSON_H_ */
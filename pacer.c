@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2021 Greg Banks <gnb@fmeh.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#include "common.h"
+#include "pacer.h"
+#include <time.h>
+#include <errno.h>
+
+/*
+ * The pacer is a token bucket kept as a virtual clock: tat is the
+ * time at which all the bytes released so far are due to have gone
+ * at the profile's rate, and n more bytes may go once the clock has
+ * reached the time the burst allowance before that.  The writer then
+ * sleeps until that absolute deadline, and tat advances by exactly
+ * the time n bytes take, whenever the writer actually woke, so
+ * oversleeping never accumulates into drift.  When the writer falls
+ * behind, tat is pulled up to the present, so it can catch up by no
+ * more than the burst.
+ */
+
+void
+pacer_init(pacer_t *p, uint64_t rate, uint64_t burst)
+{
+    memset(p, 0, sizeof(*p));
+    p->rate = rate;
+    p->burst = burst;
+}
+
+/* the rate called for at time t, 0 if the writer should be silent */
+uint64_t
+pacer_rate_at(const pacer_t *p, uint64_t t)
+{
+    uint64_t elapsed = (t > p->start ? t - p->start : 0);
+    uint64_t rate = p->rate;
+
+    if (p->on_ns)
+    {
+	bool_t on = (elapsed % (p->on_ns + p->off_ns) < p->on_ns);
+
+	if (p->peak_rate)
+	    rate = (on ? p->peak_rate : p->rate);
+	else if (!on)
+	    return 0;
+    }
+    if (elapsed < p->ramp_ns)
+    {
+	/* from a trickle, so the first bytes aren't scheduled forever */
+	rate = (uint64_t)((double)rate * elapsed / p->ramp_ns);
+	rate = MAX(rate, MAX(p->rate / 100, 1));
+    }
+    return rate;
+}
+
+/* when a silent phase which includes t ends */
+static uint64_t
+pacer_next_on(const pacer_t *p, uint64_t t)
+{
+    uint64_t cycle = p->on_ns + p->off_ns;
+
+    return t + cycle - (t - p->start) % cycle;
+}
+
+/*
+ * Schedules n bytes which the writer has ready at time now, and
+ * returns the time before which they may not go.
+ */
+uint64_t
+pacer_schedule(pacer_t *p, uint64_t now, uint64_t n)
+{
+    uint64_t rate;
+    uint64_t tau;
+    uint64_t deadline;
+
+    if (!p->start)
+	p->start = p->tat = now;
+    if (p->tat < now)
+	p->tat = now;
+    if ((rate = pacer_rate_at(p, p->tat)) == 0)
+    {
+	p->tat = pacer_next_on(p, p->tat);
+	rate = pacer_rate_at(p, p->tat);
+    }
+
+    tau = (uint64_t)((double)p->burst * NANOSEC / rate);
+    deadline = (p->tat > p->start + tau ? p->tat - tau : p->start);
+    /* across a silent phase the burst mustn't reach back into it */
+    if (p->on_ns && !p->peak_rate && deadline < p->tat &&
+	pacer_rate_at(p, deadline) == 0)
+	deadline = p->tat;
+
+    p->tat += (uint64_t)((double)n * NANOSEC / rate);
+    p->nbytes += n;
+    return deadline;
+}
+
+/* waits until n more bytes may go */
+void
+pacer_wait(pacer_t *p, uint64_t n)
+{
+    uint64_t deadline = pacer_schedule(p, time_now_ns(), n);
+    uint64_t now = time_now_ns();
+    struct timespec ts;
+
+    if (deadline <= now)
+	return;
+    p->nwaits++;
+    ts.tv_sec = deadline / NANOSEC;
+    ts.tv_nsec = deadline % NANOSEC;
+    /* a signal cuts the wait short, for the caller to notice */
+    if (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0) == 0)
+    {
+	now = time_now_ns();
+	if (now > deadline)
+	    p->max_lag = MAX(p->max_lag, now - deadline);
+    }
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2021 Greg Banks <gnb@fmeh.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef _CHECKSTREAM_PACER_H_
+#define _CHECKSTREAM_PACER_H_ 1
+
+#include "common.h"
+
+/*
+ * Paces a writer to a rate profile: a steady rate, optionally
+ * alternating with a peak rate or with silence on a duty cycle, and
+ * optionally ramping up from nothing at the start.  Times are
+ * CLOCK_MONOTONIC nanoseconds, as from time_now_ns().
+ */
+typedef struct pacer
+{
+    /* the profile */
+    uint64_t rate;		/* bytes per second */
+    uint64_t burst;		/* bytes which may go at once, ahead of the rate */
+    uint64_t peak_rate;		/* during the on phase, or 0 for the rate */
+    uint64_t on_ns;		/* duty cycle, or 0 for the rate all the time */
+    uint64_t off_ns;		/* at the rate, or silent if there's no peak_rate */
+    uint64_t ramp_ns;		/* rise from nothing over this long */
+    /* the schedule */
+    uint64_t start;		/* time of the first bytes, 0 before them */
+    uint64_t tat;		/* when the bytes so far are due to have gone */
+    /* statistics */
+    uint64_t nbytes;
+    uint64_t nwaits;		/* times the writer was held back */
+    uint64_t max_lag;		/* longest a wait overslept its deadline */
+} pacer_t;
+
+extern void pacer_init(pacer_t *p, uint64_t rate, uint64_t burst);
+extern uint64_t pacer_rate_at(const pacer_t *p, uint64_t t);
+extern uint64_t pacer_schedule(pacer_t *p, uint64_t now, uint64_t n);
+extern void pacer_wait(pacer_t *p, uint64_t n);
+
+#endif /* _CHECKSTREAM_PACER_H_ */
@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) 2021 Greg Banks <gnb@fmeh.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#include "common.h"
+#include "perfcount.h"
+#if HAVE_LINUX_PERF_EVENT_H
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#endif
+
+extern const char *argv0;
+
+static const char * const perf_event_names[PERF_NUM_EVENTS] =
+    { "cycles", "instructions", "cache misses", "branch misses" };
+static const char * const perf_event_keys[PERF_NUM_EVENTS] =
+    { "cycles", "instructions", "cache_misses", "branch_misses" };
+
+#if HAVE_LINUX_PERF_EVENT_H
+static const uint64_t perf_event_configs[PERF_NUM_EVENTS] =
+{
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES
+};
+
+static int
+perf_open(perf_event_t e, bool_t user_only)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = perf_event_configs[e];
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = !!user_only;
+    attr.exclude_hv = 1;
+    /* to scale up the counts if the PMU was shared with other events */
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED|PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+/*
+ * Opens whichever of the counters the kernel allows, counting the
+ * kernel's work for us too unless perf_event_paranoid forbids it.
+ * Without any, only the CPU time is reported.
+ */
+void
+perfcount_init(perfcount_t *pc)
+{
+    perf_event_t e;
+    int err = ENOSYS;
+    bool_t any = FALSE;
+
+    memset(pc, 0, sizeof(*pc));
+    for (e = 0 ; e < PERF_NUM_EVENTS ; e++)
+	pc->fds[e] = -1;
+#if HAVE_LINUX_PERF_EVENT_H
+    for (e = 0 ; e < PERF_NUM_EVENTS ; e++)
+    {
+	pc->fds[e] = perf_open(e, pc->user_only);
+	if (pc->fds[e] < 0 && (errno == EACCES || errno == EPERM) &&
+	    !pc->user_only)
+	{
+	    pc->user_only = TRUE;
+	    pc->fds[e] = perf_open(e, pc->user_only);
+	}
+	if (pc->fds[e] < 0)
+	    err = errno;
+	else
+	    any = TRUE;
+    }
+#endif
+    if (!any)
+	fprintf(stderr, "%s: perf_event_open: %s, reporting CPU time only\n",
+		argv0, strerror(err));
+}
+
+void
+perfcount_start(perfcount_t *pc)
+{
+#if HAVE_LINUX_PERF_EVENT_H
+    perf_event_t e;
+
+    for (e = 0 ; e < PERF_NUM_EVENTS ; e++)
+    {
+	if (pc->fds[e] < 0)
+	    continue;
+	ioctl(pc->fds[e], PERF_EVENT_IOC_RESET, 0);
+	ioctl(pc->fds[e], PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+    getrusage(RUSAGE_SELF, &pc->ru0);
+    pc->t0 = time_now();
+}
+
+void
+perfcount_stop(perfcount_t *pc)
+{
+#if HAVE_LINUX_PERF_EVENT_H
+    perf_event_t e;
+    uint64_t v[3];	/* value, time enabled, time running */
+
+    for (e = 0 ; e < PERF_NUM_EVENTS ; e++)
+    {
+	if (pc->fds[e] < 0)
+	    continue;
+	ioctl(pc->fds[e], PERF_EVENT_IOC_DISABLE, 0);
+	if (read(pc->fds[e], v, sizeof(v)) != sizeof(v) || !v[2])
+	    continue;
+	pc->counts[e] = (v[2] < v[1] ?
+			 (uint64_t)((double)v[0] * v[1] / v[2]) : v[0]);
+	pc->have[e] = TRUE;
+    }
+#endif
+    getrusage(RUSAGE_SELF, &pc->ru1);
+    pc->t1 = time_now();
+}
+
+static double
+timeval_diff(const struct timeval *a, const struct timeval *b)
+{
+    return (double)(b->tv_sec - a->tv_sec) +
+	   (double)(b->tv_usec - a->tv_usec) / MICROSEC;
+}
+
+#define GIB	(1024.0 * 1024.0 * 1024.0)
+
+/* the CPU time and counts, and what they come to for the data moved */
+void
+perfcount_emit(const perfcount_t *pc, uint64_t nbytes,
+	       unsigned int record_size)
+{
+    double user = timeval_diff(&pc->ru0.ru_utime, &pc->ru1.ru_utime);
+    double sys = timeval_diff(&pc->ru0.ru_stime, &pc->ru1.ru_stime);
+    double wall = time_double(MAX(pc->t1 - pc->t0, 1));
+    perf_event_t e;
+
+    fprintf(stderr, "%s: cpu: user %.3f sys %.3f seconds, %.1f%% of one CPU",
+	    argv0, user, sys, 100.0 * (user + sys) / wall);
+    if (nbytes)
+	fprintf(stderr, ", %.3f CPU-seconds per GiB",
+		(user + sys) / ((double)nbytes / GIB));
+    fputc('\n', stderr);
+
+    if (!pc->have[PERF_CYCLES] && !pc->have[PERF_INSTRUCTIONS] &&
+	!pc->have[PERF_CACHE_MISSES] && !pc->have[PERF_BRANCH_MISSES])
+	return;
+    fprintf(stderr, "%s: perf:", argv0);
+    for (e = 0 ; e < PERF_NUM_EVENTS ; e++)
+	if (pc->have[e])
+	    fprintf(stderr, " %llu %s", (unsigned long long)pc->counts[e],
+		    perf_event_names[e]);
+    if (pc->user_only)
+	fputs(" (user space only)", stderr);
+    fputc('\n', stderr);
+    if (!nbytes)
+	return;
+    fprintf(stderr, "%s: perf:", argv0);
+    if (pc->have[PERF_CYCLES])
+	fprintf(stderr, " %.3f cycles/byte",
+		(double)pc->counts[PERF_CYCLES] / nbytes);
+    if (pc->have[PERF_INSTRUCTIONS])
+	fprintf(stderr, " %.2f instructions/record",
+		(double)pc->counts[PERF_INSTRUCTIONS] / MAX(nbytes / record_size, 1));
+    if (pc->have[PERF_CYCLES] && pc->have[PERF_INSTRUCTIONS] &&
+	pc->counts[PERF_CYCLES])
+	fprintf(stderr, " %.2f instructions/cycle",
+		(double)pc->counts[PERF_INSTRUCTIONS] / pc->counts[PERF_CYCLES]);
+    fputc('\n', stderr);
+}
+
+/* the same, as a member of a --json event */
+void
+perfcount_json(json_obj_t *o, const char *key, const perfcount_t *pc,
+	       uint64_t nbytes, unsigned int record_size)
+{
+    double user = timeval_diff(&pc->ru0.ru_utime, &pc->ru1.ru_utime);
+    double sys = timeval_diff(&pc->ru0.ru_stime, &pc->ru1.ru_stime);
+    perf_event_t e;
+
+    json_open_object(o, key);
+    json_add_double(o, "user_seconds", user);
+    json_add_double(o, "sys_seconds", sys);
+    if (nbytes)
+	json_add_double(o, "cpu_seconds_per_gib",
+			(user + sys) / ((double)nbytes / GIB));
+    for (e = 0 ; e < PERF_NUM_EVENTS ; e++)
+	if (pc->have[e])
+	    json_add_uint(o, perf_event_keys[e], pc->counts[e]);
+    if (nbytes && pc->have[PERF_CYCLES])
+	json_add_double(o, "cycles_per_byte",
+			(double)pc->counts[PERF_CYCLES] / nbytes);
+    if (nbytes && pc->have[PERF_INSTRUCTIONS])
+	json_add_double(o, "instructions_per_record",
+			(double)pc->counts[PERF_INSTRUCTIONS] /
+			MAX(nbytes / record_size, 1));
+    if (pc->user_only)
+	json_add_bool(o, "user_space_only", TRUE);
+    json_close_object(o);
+}
+
+void
+perfcount_destroy(perfcount_t *pc)
+{
+    perf_event_t e;
+
+    for (e = 0 ; e < PERF_NUM_EVENTS ; e++)
+	if (pc->fds[e] >= 0)
+	    close(pc->fds[e]);
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2021 Greg Banks <gnb@fmeh.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef _CHECKSTREAM_PERFCOUNT_H_
+#define _CHECKSTREAM_PERFCOUNT_H_ 1
+
+#include "common.h"
+#include "json.h"
+#include <sys/resource.h>
+
+/*
+ * What the work cost in CPU, see --perf-counters: the user and system
+ * time from getrusage(), and the hardware counters from
+ * perf_event_open() where the kernel lets us have them.  The counters
+ * are inherited by the threads started after perfcount_start(), so the
+ * threaded modes are counted whole once their threads are joined.
+ */
+typedef enum
+{
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_CACHE_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_NUM_EVENTS
+} perf_event_t;
+
+typedef struct
+{
+    int fds[PERF_NUM_EVENTS];	/* -1 for the ones we can't have */
+    bool_t have[PERF_NUM_EVENTS];	/* counted, from start to stop */
+    uint64_t counts[PERF_NUM_EVENTS];
+    bool_t user_only;		/* perf_event_paranoid keeps the kernel out */
+    struct rusage ru0, ru1;
+    uint64_t t0, t1;		/* microseconds since the epoch */
+} perfcount_t;
+
+extern void perfcount_init(perfcount_t *pc);
+extern void perfcount_start(perfcount_t *pc);
+extern void perfcount_stop(perfcount_t *pc);
+extern void perfcount_emit(const perfcount_t *pc, uint64_t nbytes,
+			   unsigned int record_size);
+extern void perfcount_json(json_obj_t *o, const char *key,
+			   const perfcount_t *pc, uint64_t nbytes,
+			   unsigned int record_size);
+extern void perfcount_destroy(perfcount_t *pc);
+
+#endif /* _CHECKSTREAM_PERFCOUNT_H_ */
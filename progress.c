@@ -0,0 +1,257 @@
+/*
+ * Copyright (c) 2021 Greg Banks <gnb@fmeh.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#include "common.h"
+#include "stream.h"
+#include "progress.h"
+#include "shmstats.h"
+#include <time.h>
+
+extern const char *argv0;
+
+void
+progress_init(progress_t *p, uint64_t interval, FILE *csv,
+	      unsigned int record_size, uint32_t (*get_errors)(void))
+{
+    pthread_condattr_t attr;
+
+    memset(p, 0, sizeof(*p));
+    p->interval = MAX(interval, 1);
+    p->csv = csv;
+    p->record_size = record_size;
+    p->get_errors = get_errors;
+    p->t0 = p->last = time_now_ns();
+    pthread_mutex_init(&p->lock, 0);
+    /* the timed waits are on the same clock as the reports */
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&p->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    if (csv)
+    {
+	fprintf(csv, "seconds,bytes,records,kib_per_sec,"
+		     "total_bytes,total_kib_per_sec,offset,errors\n");
+	fflush(csv);
+    }
+}
+
+/*
+ * Counts the bytes of nstreams streams, the first byte of which is
+ * at offset base, from now on.  The streams are written by other
+ * threads, which is why their counts are only ever read here, and
+ * must stay open until progress_unwatch().
+ */
+void
+progress_watch(progress_t *p, stream_t **streams, unsigned int nstreams,
+	       uint64_t base)
+{
+    pthread_mutex_lock(&p->lock);
+    p->streams = xmalloc(nstreams * sizeof(stream_t *));
+    memcpy(p->streams, streams, nstreams * sizeof(stream_t *));
+    p->nstreams = nstreams;
+    p->base = base;
+    p->offset = base;
+    pthread_mutex_unlock(&p->lock);
+}
+
+/* bytes in all so far, under the lock */
+static uint64_t
+progress_sample(progress_t *p)
+{
+    uint64_t nbytes = 0, nblocks = 0;
+    unsigned int i;
+
+    for (i = 0 ; i < p->nstreams ; i++)
+    {
+	nbytes += __atomic_load_n(&p->streams[i]->stats.nbytes, __ATOMIC_RELAXED);
+	nblocks += __atomic_load_n(&p->streams[i]->stats.nblocks, __ATOMIC_RELAXED);
+    }
+    if (p->nstreams)
+	p->offset = p->base + nbytes;
+    p->blocks = p->done_blocks + nblocks;
+    return p->done + nbytes;
+}
+
+void
+progress_unwatch(progress_t *p)
+{
+    pthread_mutex_lock(&p->lock);
+    p->done = progress_sample(p);
+    p->done_blocks = p->blocks;
+    xfree(p->streams);
+    p->streams = 0;
+    p->nstreams = 0;
+    pthread_mutex_unlock(&p->lock);
+}
+
+/* the latest sample and the program's own counters, under the lock */
+static void
+progress_publish(progress_t *p, uint64_t total)
+{
+    shmstats_data_t *d = p->shm->data;
+    unsigned int op;
+
+    shmstats_update_begin(p->shm);
+    d->nblocks = p->blocks;
+    d->nbytes = total;
+    d->offset = p->offset;
+    /* the histograms are being added to, but a count or two out is fine */
+    if (p->shm->latency)
+	for (op = 0 ; op < MIN(STREAM_NUM_OPS, SHMSTATS_NUM_OPS) ; op++)
+	    d->latency[op] = p->shm->latency->ops[op];
+    if (p->shm->fill)
+	p->shm->fill(d);
+    shmstats_update_end(p->shm);
+}
+
+/* reports the interval since the last report, under the lock */
+static void
+progress_emit(progress_t *p, uint64_t now)
+{
+    uint64_t total = progress_sample(p);
+    uint64_t nbytes = total - p->last_bytes;
+    double elapsed = (double)(now - p->t0) / NANOSEC;
+    double rate, total_rate;
+    uint32_t nerrors = (p->get_errors ? p->get_errors() : 0);
+
+    rate = (double)nbytes / 1024.0 / MAX((double)(now - p->last) / NANOSEC, 1e-9);
+    total_rate = (double)total / 1024.0 / MAX(elapsed, 1e-9);
+    p->last = now;
+    p->last_bytes = total;
+    if (p->shm)
+	progress_publish(p, total);
+    if (p->quiet)
+	return;
+    if (p->csv)
+    {
+	fprintf(p->csv, "%.3f,%llu,%llu,%.1f,%llu,%.1f,%llu,%u\n",
+		elapsed,
+		(unsigned long long)nbytes,
+		(unsigned long long)(nbytes / p->record_size),
+		rate,
+		(unsigned long long)total,
+		total_rate,
+		(unsigned long long)p->offset,
+		nerrors);
+	fflush(p->csv);
+    }
+    else
+    {
+	fprintf(stderr, "%s: +%.3fs: %llu bytes %llu records (%.1f KiB/sec), "
+			"%llu bytes in all (%.1f KiB/sec), offset %llu",
+		argv0, elapsed,
+		(unsigned long long)nbytes,
+		(unsigned long long)(nbytes / p->record_size),
+		rate,
+		(unsigned long long)total,
+		total_rate,
+		(unsigned long long)p->offset);
+	if (p->get_errors)
+	    fprintf(stderr, ", %u errors", nerrors);
+	fputc('\n', stderr);
+    }
+    if (p->json)
+    {
+	json_obj_t o;
+
+	json_begin(&o, "interval");
+	json_add_double(&o, "seconds", elapsed);
+	json_add_uint(&o, "bytes", nbytes);
+	json_add_uint(&o, "records", nbytes / p->record_size);
+	json_add_double(&o, "kib_per_sec", rate);
+	json_add_uint(&o, "total_bytes", total);
+	json_add_double(&o, "total_kib_per_sec", total_rate);
+	json_add_uint(&o, "offset", p->offset);
+	if (p->get_errors)
+	    json_add_uint(&o, "errors", nerrors);
+	json_emit(p->json, &o);
+	json_flush(p->json);
+    }
+}
+
+void
+progress_report(progress_t *p, uint64_t now)
+{
+    pthread_mutex_lock(&p->lock);
+    progress_emit(p, now);
+    pthread_mutex_unlock(&p->lock);
+}
+
+static void *
+progress_thread(void *arg)
+{
+    progress_t *p = arg;
+    uint64_t now, deadline = p->t0 + p->interval;
+    struct timespec ts;
+
+    pthread_mutex_lock(&p->lock);
+    while (!p->stopping)
+    {
+	ts.tv_sec = deadline / NANOSEC;
+	ts.tv_nsec = deadline % NANOSEC;
+	pthread_cond_timedwait(&p->cond, &p->lock, &ts);
+	now = time_now_ns();
+	if (p->stopping || now < deadline)
+	    continue;
+	progress_emit(p, now);
+	/* keep to the original schedule, skipping any intervals missed */
+	deadline += p->interval;
+	if (deadline <= now)
+	    deadline = now + p->interval - (now - p->t0) % p->interval;
+    }
+    pthread_mutex_unlock(&p->lock);
+    return 0;
+}
+
+void
+progress_start(progress_t *p)
+{
+    int r;
+
+    if ((r = pthread_create(&p->thread, 0, progress_thread, p)))
+	fatal("pthread_create: %s", strerror(r));
+    p->running = TRUE;
+}
+
+/*
+ * Stops the thread, and reports whatever was done since the last
+ * report, so the totals of the last row are the totals of the run.
+ */
+void
+progress_stop(progress_t *p)
+{
+    pthread_mutex_lock(&p->lock);
+    p->stopping = TRUE;
+    pthread_cond_signal(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+    if (p->running)
+	pthread_join(p->thread, 0);
+    p->running = FALSE;
+
+    pthread_mutex_lock(&p->lock);
+    if (progress_sample(p) != p->last_bytes || p->last == p->t0)
+	progress_emit(p, time_now_ns());
+    pthread_mutex_unlock(&p->lock);
+}
+
+void
+progress_destroy(progress_t *p)
+{
+    xfree(p->streams);
+    pthread_cond_destroy(&p->cond);
+    pthread_mutex_destroy(&p->lock);
+}
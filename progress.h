@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2021 Greg Banks <gnb@fmeh.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef _CHECKSTREAM_PROGRESS_H_
+#define _CHECKSTREAM_PROGRESS_H_ 1
+
+#include "common.h"
+#include "json.h"
+#include <pthread.h>
+
+/*
+ * Reports progress every --interval, as a line on stderr or a row of
+ * a CSV file, and as an event with --json, and keeps the --shm-stats
+ * segment up to date, perhaps quietly.  A thread wakes up each
+ * interval and samples the byte counts of the streams being watched,
+ * which the streams keep anyway, so the loops doing the work read no
+ * clocks and take no locks for it.
+ * Times are CLOCK_MONOTONIC nanoseconds.
+ */
+struct stream;
+struct shmstats;
+
+typedef struct
+{
+    uint64_t interval;
+    FILE *csv;			/* rows go here, or lines to stderr */
+    unsigned int record_size;	/* to count records from bytes */
+    uint32_t (*get_errors)(void);	/* or 0 when there are none */
+    json_writer_t *json;	/* for the reports as events too, or 0 */
+    struct shmstats *shm;	/* to update each interval too, or 0 */
+    bool_t quiet;		/* only update shm, no reports */
+    pthread_t thread;
+    bool_t running;
+    /* under lock */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool_t stopping;
+    struct stream **streams;	/* being watched */
+    unsigned int nstreams;
+    uint64_t base;		/* offset of the streams' first byte */
+    uint64_t done;		/* bytes of streams no longer watched */
+    uint64_t done_blocks;
+    uint64_t blocks;		/* in all, as of the last sample */
+    uint64_t offset;		/* as of the last sample */
+    uint64_t t0;
+    uint64_t last;		/* time of the last report */
+    uint64_t last_bytes;	/* bytes in all as of then */
+} progress_t;
+
+extern void progress_init(progress_t *p, uint64_t interval, FILE *csv,
+			  unsigned int record_size,
+			  uint32_t (*get_errors)(void));
+extern void progress_watch(progress_t *p, struct stream **streams,
+			   unsigned int nstreams, uint64_t base);
+extern void progress_unwatch(progress_t *p);
+extern void progress_report(progress_t *p, uint64_t now);
+extern void progress_start(progress_t *p);
+extern void progress_stop(progress_t *p);
+extern void progress_destroy(progress_t *p);
+
+#endif /* _CHECKSTREAM_PROGRESS_H_ */
@@ -0,0 +1,275 @@
+/*
+ * Copyright (c) 2021 Greg Banks <gnb@fmeh.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#include "common.h"
+#include "stream.h"
+#include "check.h"
+#include "reassembly.h"
+
+/*
+ * In UDP mode datagrams can be lost, duplicated or reordered on the
+ * way, so they are put back in order before their records are checked.
+ * Each datagram is placed by the offset of its first good record, and
+ * one which arrives ahead of its turn is held in a window until those
+ * before it arrive.  When the window overflows, or the stream ends,
+ * the gaps before the held datagrams are lost.  The records are then
+ * checked in offset order, with lost ranges as runs of their own, so
+ * extents are merged and reported just as for any other stream.
+ * Duplicated datagrams are dropped, and reordered datagrams are
+ * reported as they arrive but their records are checked as usual.
+ */
+#define UDP_REORDER_WINDOW	(4ULL<<20)	/* bytes held at most */
+#define UDP_MAX_DATAGRAMS	(64*64)		/* per stream_udp_recv() */
+
+typedef struct
+{
+    uint64_t offset;		/* from the start of the stream */
+    uint64_t len;
+} held_t;
+
+typedef struct
+{
+    checker_t *checker;
+    uint64_t offset0;		/* expected offset of the stream */
+    uint64_t length;
+    uint64_t next;		/* next byte to be checked */
+    uint64_t high;		/* just past the furthest datagram so far */
+    unsigned char *window;	/* held datagrams, by offset modulo the size */
+    held_t *held;		/* in offset order */
+    unsigned int nheld;
+    unsigned int maxheld;
+    struct
+    {
+	uint64_t start;
+	uint64_t end;
+    } noted[FM_NUM];		/* duplicated or reordered, being merged */
+} reassembly_t;
+
+/* check the records in len bytes at buf, which belong at off */
+static void
+reassembly_check(reassembly_t *r, const unsigned char *buf,
+		 uint64_t off, uint64_t len)
+{
+    checker_t *c = r->checker;
+    size_t record_size = c->fmt.size;
+    uint64_t nrecs, ngood;
+
+    off += r->offset0;
+    for (nrecs = len / record_size ; nrecs ; nrecs -= ngood)
+    {
+	if ((ngood = checker_block(c, buf, nrecs, off)) == 0)
+	{
+	    checker_record(c, (const record_t *)buf, off);
+	    ngood = 1;
+	}
+	buf += ngood * record_size;
+	off += ngood * record_size;
+    }
+}
+
+static void
+reassembly_flush_noted(reassembly_t *r, failure_mode_t failure)
+{
+    uint64_t start = r->noted[failure].start;
+    uint64_t end = r->noted[failure].end;
+
+    if (end > start)
+    {
+	found_extent(argv0, r->offset0 + start, end - start, failure, 0);
+	if (get_num_errors() == 1)
+	    handle_first_error();
+    }
+    r->noted[failure].start = r->noted[failure].end = 0;
+}
+
+/* report a duplicated or reordered datagram, merged with the last */
+static void
+reassembly_note(reassembly_t *r, failure_mode_t failure,
+		uint64_t off, uint64_t len)
+{
+    if (r->noted[failure].end <= r->noted[failure].start ||
+	r->noted[failure].end != off)
+    {
+	reassembly_flush_noted(r, failure);
+	r->noted[failure].start = off;
+	r->noted[failure].end = off;
+    }
+    r->noted[failure].end += len;
+}
+
+/* check the held datagrams from next onwards, as far as they go */
+static void
+reassembly_check_held(reassembly_t *r)
+{
+    held_t *h;
+    uint64_t woff, n;
+
+    while (r->nheld && r->held[0].offset == r->next)
+    {
+	h = &r->held[0];
+	/* in two pieces if it wraps around the window */
+	woff = h->offset % UDP_REORDER_WINDOW;
+	n = MIN(h->len, UDP_REORDER_WINDOW - woff);
+	reassembly_check(r, r->window + woff, h->offset, n);
+	if (n < h->len)
+	    reassembly_check(r, r->window, h->offset + n, h->len - n);
+	r->next += h->len;
+	memmove(h, h + 1, --r->nheld * sizeof(held_t));
+    }
+}
+
+/* give up on everything missing before upto */
+static void
+reassembly_lose(reassembly_t *r, uint64_t upto)
+{
+    uint64_t end;
+
+    while (r->next < upto)
+    {
+	reassembly_check_held(r);
+	if (r->next >= upto)
+	    break;
+	end = (r->nheld ? MIN(r->held[0].offset, upto) : upto);
+	checker_new_run(r->checker, r->offset0 + r->next, FM_LOST, 0);
+	r->next = end;
+    }
+    reassembly_check_held(r);
+}
+
+static void
+reassembly_hold(reassembly_t *r, const unsigned char *buf,
+		uint64_t off, uint64_t len)
+{
+    uint64_t woff = off % UDP_REORDER_WINDOW;
+    uint64_t n = MIN(len, UDP_REORDER_WINDOW - woff);
+    unsigned int i;
+
+    memcpy(r->window + woff, buf, n);
+    memcpy(r->window, buf + n, len - n);
+
+    if (r->nheld == r->maxheld)
+    {
+	r->maxheld = (r->maxheld ? 2 * r->maxheld : 64);
+	r->held = xrealloc(r->held, r->maxheld * sizeof(held_t));
+    }
+    for (i = r->nheld ; i > 0 && r->held[i-1].offset > off ; i--)
+	r->held[i] = r->held[i-1];
+    r->held[i].offset = off;
+    r->held[i].len = len;
+    r->nheld++;
+}
+
+static bool_t
+reassembly_overlaps_held(const reassembly_t *r, uint64_t off, uint64_t end)
+{
+    unsigned int i;
+
+    /* datagrams usually arrive near the furthest, so look there first */
+    for (i = r->nheld ; i > 0 ; i--)
+    {
+	const held_t *h = &r->held[i-1];
+
+	if (h->offset + h->len <= off)
+	    break;
+	if (h->offset < end)
+	    return TRUE;
+    }
+    return FALSE;
+}
+
+static void
+reassembly_datagram(reassembly_t *r, const unsigned char *buf, uint64_t len)
+{
+    size_t record_size = r->checker->fmt.size;
+    uint64_t off = r->high;	/* if no record says otherwise */
+    uint64_t i, fi, end;
+
+    len -= len % record_size;
+    for (i = 0 ; i < len ; i += record_size)
+    {
+	const record_t *rec = (const record_t *)(buf + i);
+
+	if (record_checksum(rec, creator_flag))
+	    continue;
+	fi = record_get_offset(rec, tag_flag);
+	if (fi >= r->offset0 + i && !(fi & (record_size-1)))
+	    off = fi - r->offset0 - i;
+	break;
+    }
+    if (len == 0 || off >= r->length)
+	return;		    /* not part of the stream */
+    len = MIN(len, r->length - off);
+    end = off + len;
+
+    if (off < r->next || reassembly_overlaps_held(r, off, end))
+    {
+	reassembly_note(r, FM_DUPLICATE, off, len);
+	return;
+    }
+    if (end <= r->high)
+	reassembly_note(r, FM_REORDERED, off, len);
+    r->high = MAX(r->high, end);
+
+    /* the window only holds so much, so give up on the oldest gaps */
+    if (end - r->next > UDP_REORDER_WINDOW)
+	reassembly_lose(r, end - UDP_REORDER_WINDOW);
+
+    if (off == r->next)
+    {
+	reassembly_check(r, buf, off, len);
+	r->next = end;
+	reassembly_check_held(r);
+    }
+    else
+    {
+	reassembly_hold(r, buf, off, len);
+    }
+}
+
+/*
+ * Returns the expected offset just past the last record checked.
+ */
+uint64_t
+check_datagrams(checker_t *c, stream_t *s, uint64_t length, uint64_t offset0)
+{
+    reassembly_t r;
+    struct iovec *dgrams = xmalloc(UDP_MAX_DATAGRAMS * sizeof(struct iovec));
+    int i, n;
+
+    memset(&r, 0, sizeof(r));
+    r.checker = c;
+    r.offset0 = offset0;
+    r.length = length;
+    r.window = xvalloc(UDP_REORDER_WINDOW);
+
+    while (!signalled && r.next < length)
+    {
+	if ((n = stream_udp_recv(s, dgrams, UDP_MAX_DATAGRAMS)) <= 0)
+	    break;
+	for (i = 0 ; i < n ; i++)
+	    reassembly_datagram(&r, dgrams[i].iov_base, dgrams[i].iov_len);
+    }
+    if (!signalled)
+	reassembly_lose(&r, length);
+    reassembly_flush_noted(&r, FM_DUPLICATE);
+    reassembly_flush_noted(&r, FM_REORDERED);
+
+    xfree(r.held);
+    free(r.window);	    /* allocated by valloc() */
+    xfree(dgrams);
+    return offset0 + r.next;
+}
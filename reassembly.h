@@ -0,0 +1,35 @@
+/*
+ * Copyright (c) 2021 Greg Banks <gnb@fmeh.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef _CHECKSTREAM_REASSEMBLY_H_
+#define _CHECKSTREAM_REASSEMBLY_H_ 1
+
+#include "common.h"
+#include "check.h"
+
+/*
+ * Checks a stream of UDP datagrams, putting them back in order first,
+ * see --protocol=udp.
+ */
+#define UDP_IDLE_TIMEOUT	2000		/* milliseconds before giving up */
+
+struct stream;
+
+extern uint64_t check_datagrams(checker_t *c, struct stream *s,
+				uint64_t length, uint64_t offset0);
+
+#endif /* _CHECKSTREAM_REASSEMBLY_H_ */
@@ -0,0 +1,869 @@
+/*
+ * Copyright (c) 2021 Greg Banks <gnb@fmeh.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#include "common.h"
+#include "record.h"
+#include <pthread.h>
+
+/*
+ * The SIMD kernels below rely on two properties of the records.
+ *
+ * First, the ones-complement sum is independent of byte order
+ * (RFC 1071), so the checksum of a record can be verified by
+ * summing the 16 bit words as loaded, without any ntohs().
+ * A record passes the check when the folded sum is 0xffff.
+ *
+ * Second, after byte swapping each 64 bit word of a record we
+ * get the offset (and tag) in the low 48 bits of the first word
+ * and the creator in the second word, in host byte order, which
+ * can be compared directly against expected values computed by
+ * simply incrementing the offset by the record size.  This is
+ * only true on little-endian machines, which is all of x86.
+ *
+ * Generating records is the same trick run backwards: byte swap
+ * the expected values into place, leaving the checksum field zero,
+ * then sum the words as stored and fill in the complement of the
+ * folded sum.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RECORD_HAVE_X86_SIMD	1
+#if defined(__clang__) || __GNUC__ >= 5
+#define RECORD_HAVE_AVX512	1
+#endif
+#include <immintrin.h>
+#endif
+
+/* the largest number of records handled by one vector */
+#define RECORD_MAX_LANES	8
+
+/* mask for the offset and tag fields in a byte swapped record */
+#define RECORD_KEY_MASK		0x0000ffffffffffffULL
+
+void
+record_format_init(record_format_t *fmt,
+		   bool_t tag_flag, uint8_t tag,
+		   bool_t creator_flag, uint64_t creator)
+{
+    memset(fmt, 0, sizeof(*fmt));
+    fmt->size = (creator_flag ? RECORD_SIZE_CREATOR : RECORD_SIZE);
+    fmt->tag_flag = tag_flag;
+    fmt->tag = tag;
+    fmt->creator_flag = creator_flag;
+    fmt->creator = creator;
+}
+
+/*
+ * Returns the first offset at which the SIMD kernels cannot be
+ * used because the offset no longer fits in the record and the
+ * scalar decoding would report a bad offset.
+ */
+static inline uint64_t
+record_offset_limit(const record_format_t *fmt)
+{
+    return (fmt->tag_flag ? (1ULL<<40) : (1ULL<<48));
+}
+
+/* the tag as it appears in a byte swapped record */
+static inline uint64_t
+record_tag_bits(const record_format_t *fmt)
+{
+    return (fmt->tag_flag ? ((uint64_t)fmt->tag << 40) : 0);
+}
+
+/*-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-*/
+
+static bool_t
+scalar_supported(void)
+{
+    return TRUE;
+}
+
+static size_t
+scalar_check(const record_format_t *fmt, const void *buf,
+	     size_t nrec, uint64_t off)
+{
+    const unsigned char *p = buf;
+    size_t i;
+
+    for (i = 0 ; i < nrec ; i++, p += fmt->size, off += fmt->size)
+    {
+	if (!record_is_valid(fmt, (const record_t *)p, off))
+	    break;
+    }
+    return i;
+}
+
+static size_t
+scalar_fill(const record_format_t *fmt, void *buf,
+	    size_t nrec, uint64_t off)
+{
+    unsigned char *p = buf;
+    size_t i;
+
+    for (i = 0 ; i < nrec ; i++, p += fmt->size, off += fmt->size)
+	record_encode(fmt, (record_t *)p, off);
+    return nrec;
+}
+
+/*-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-*/
+
+/*
+ * Consecutive records differ only in the low 32 bits of the offset
+ * and in the checksum.  The template implementation builds a record
+ * holding everything else once, and derives each checksum from the
+ * previous one instead of summing the whole record again (RFC 1624).
+ *
+ * Adding the record size to the low 32 bits of the offset adds the
+ * record size to the ones-complement sum, even when the addition
+ * carries from the low 16 bit word into the high one, because in
+ * ones-complement arithmetic 0x10000 == 1.  The only carry which
+ * breaks this is out of the low 32 bits into the high offset word,
+ * which is part of the template, so the template is rebuilt there.
+ */
+typedef struct
+{
+    record_t rec;	/* with zero low offset and checksum */
+    uint32_t sum;	/* folded sum of rec, in host byte order */
+} record_template_t;
+
+static void
+template_init(record_template_t *t, const record_format_t *fmt, uint64_t off)
+{
+    memset(&t->rec, 0, sizeof(t->rec));
+    record_encode(fmt, &t->rec, off & ~0xffffffffULL);
+    /* the checksum is the complement of the folded sum */
+    t->sum = (~ntohs(t->rec.w16[0])) & 0xffff;
+    t->rec.w16[0] = 0;
+}
+
+/* the folded sum of the record at offset off, from scratch */
+static inline uint32_t
+template_sum(const record_template_t *t, uint64_t off)
+{
+    uint32_t sum = t->sum + ((off >> 16) & 0xffff) + (off & 0xffff);
+
+    sum = (sum >> 16) + (sum & 0xffff);
+    return (sum >> 16) + (sum & 0xffff);
+}
+
+/* the folded sum of the record after the one with folded sum `sum' */
+static inline uint32_t
+template_next_sum(uint32_t sum, size_t size)
+{
+    sum += size;
+    if (sum > 0xffff)
+	sum -= 0xffff;
+    return sum;
+}
+
+static inline void
+template_make(const record_template_t *t, record_t *rec,
+	      uint64_t off, uint32_t sum)
+{
+    *rec = t->rec;
+    rec->w16[0] = htons(~sum);
+    rec->w32[1] = htonl(off & 0xffffffff);
+}
+
+/*
+ * Returns how many of nrec records starting at offset off come
+ * before the next carry into the high offset word.
+ */
+static inline size_t
+template_span(const record_format_t *fmt, uint64_t off, size_t nrec)
+{
+    uint64_t n = ((1ULL<<32) - (off & 0xffffffff)) / fmt->size;
+
+    return (n < nrec ? (size_t)n : nrec);
+}
+
+static size_t
+template_check(const record_format_t *fmt, const void *buf,
+	       size_t nrec, uint64_t off)
+{
+    const unsigned char *p = buf;
+    record_template_t t;
+    record_t expected;
+    uint32_t sum;
+    size_t i = 0, j, n;
+
+    while (i < nrec)
+    {
+	n = template_span(fmt, off, nrec - i);
+	template_init(&t, fmt, off);
+	sum = template_sum(&t, off);
+	for (j = 0 ; j < n ; j++, p += fmt->size, off += fmt->size)
+	{
+	    template_make(&t, &expected, off, sum);
+	    if (expected.w64[0] != ((const record_t *)p)->w64[0] ||
+		(fmt->creator_flag &&
+		 expected.w64[1] != ((const record_t *)p)->w64[1]))
+	    {
+		/*
+		 * Either the record is bad, or it has the other one
+		 * of the two checksum values which mean zero; let
+		 * the full decode decide.
+		 */
+		if (!record_is_valid(fmt, (const record_t *)p, off))
+		    return i + j;
+	    }
+	    sum = template_next_sum(sum, fmt->size);
+	}
+	i += n;
+    }
+    return i;
+}
+
+static size_t
+template_fill(const record_format_t *fmt, void *buf,
+	      size_t nrec, uint64_t off)
+{
+    unsigned char *p = buf;
+    record_template_t t;
+    uint32_t sum;
+    size_t i = 0, j, n;
+
+    while (i < nrec)
+    {
+	n = template_span(fmt, off, nrec - i);
+	template_init(&t, fmt, off);
+	sum = template_sum(&t, off);
+	for (j = 0 ; j < n ; j++, p += fmt->size, off += fmt->size)
+	{
+	    record_t rec;
+
+	    template_make(&t, &rec, off, sum);
+	    ((record_t *)p)->w64[0] = rec.w64[0];
+	    if (fmt->creator_flag)
+		((record_t *)p)->w64[1] = rec.w64[1];
+	    sum = template_next_sum(sum, fmt->size);
+	}
+	i += n;
+    }
+    return i;
+}
+
+/*-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-*/
+#if RECORD_HAVE_X86_SIMD
+
+/*
+ * The checksum step is the same for every vector width: sum the
+ * two 16 bit words in each 32 bit lane, then sum the lanes within
+ * a record, then fold the carries twice.  The result is in the
+ * low 32 bits of the record and is 0xffff iff the record passes.
+ */
+
+static bool_t
+sse2_supported(void)
+{
+#if defined(__x86_64__)
+    return TRUE;	/* SSE2 is part of the x86_64 baseline */
+#else
+    __builtin_cpu_init();
+    return !!__builtin_cpu_supports("sse2");
+#endif
+}
+
+__attribute__((target("sse2")))
+static inline __m128i
+sse2_bswap64(__m128i v)
+{
+    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0,1,2,3));
+    return _mm_shufflehi_epi16(v, _MM_SHUFFLE(0,1,2,3));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i
+sse2_fold(__m128i s)
+{
+    const __m128i lo16 = _mm_set1_epi32(0xffff);
+
+    s = _mm_add_epi32(_mm_and_si128(s, lo16), _mm_srli_epi32(s, 16));
+    return _mm_add_epi32(_mm_and_si128(s, lo16), _mm_srli_epi32(s, 16));
+}
+
+__attribute__((target("sse2")))
+static size_t
+sse2_check_8(const record_format_t *fmt, const unsigned char *p,
+	     size_t nrec, uint64_t off)
+{
+    const __m128i lo16 = _mm_set1_epi32(0xffff);
+    const __m128i csum_ok = _mm_set_epi32(0, 0xffff, 0, 0xffff);
+    const __m128i csum_mask = _mm_set_epi32(0, -1, 0, -1);
+    const __m128i key_mask = _mm_set1_epi64x(RECORD_KEY_MASK);
+    const __m128i key_inc = _mm_set1_epi64x(2*RECORD_SIZE);
+    const __m128i zero = _mm_setzero_si128();
+    uint64_t tb = record_tag_bits(fmt);
+    __m128i key = _mm_set_epi64x((off+RECORD_SIZE) | tb, off | tb);
+    size_t i;
+
+    for (i = 0 ; i + 2 <= nrec ; i += 2, p += 2*RECORD_SIZE)
+    {
+	__m128i v = _mm_loadu_si128((const __m128i *)p);
+	__m128i s, bad;
+
+	s = _mm_add_epi32(_mm_and_si128(v, lo16), _mm_srli_epi32(v, 16));
+	s = sse2_fold(_mm_add_epi32(s, _mm_srli_epi64(s, 32)));
+	bad = _mm_and_si128(_mm_xor_si128(s, csum_ok), csum_mask);
+	bad = _mm_or_si128(bad,
+		_mm_xor_si128(_mm_and_si128(sse2_bswap64(v), key_mask), key));
+	if (_mm_movemask_epi8(_mm_cmpeq_epi8(bad, zero)) != 0xffff)
+	    break;
+	key = _mm_add_epi64(key, key_inc);
+    }
+    return i;
+}
+
+__attribute__((target("sse2")))
+static size_t
+sse2_check_16(const record_format_t *fmt, const unsigned char *p,
+	      size_t nrec, uint64_t off)
+{
+    const __m128i lo16 = _mm_set1_epi32(0xffff);
+    const __m128i csum_ok = _mm_set_epi32(0, 0, 0, 0xffff);
+    const __m128i csum_mask = _mm_set_epi32(0, 0, 0, -1);
+    const __m128i key_mask = _mm_set_epi64x(-1LL, RECORD_KEY_MASK);
+    const __m128i key_inc = _mm_set_epi64x(0, RECORD_SIZE_CREATOR);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i key = _mm_set_epi64x(fmt->creator, off | record_tag_bits(fmt));
+    size_t i;
+
+    for (i = 0 ; i < nrec ; i++, p += RECORD_SIZE_CREATOR)
+    {
+	__m128i v = _mm_loadu_si128((const __m128i *)p);
+	__m128i s, bad;
+
+	s = _mm_add_epi32(_mm_and_si128(v, lo16), _mm_srli_epi32(v, 16));
+	s = _mm_add_epi32(s, _mm_srli_si128(s, 8));
+	s = sse2_fold(_mm_add_epi32(s, _mm_srli_si128(s, 4)));
+	bad = _mm_and_si128(_mm_xor_si128(s, csum_ok), csum_mask);
+	bad = _mm_or_si128(bad,
+		_mm_xor_si128(_mm_and_si128(sse2_bswap64(v), key_mask), key));
+	if (_mm_movemask_epi8(_mm_cmpeq_epi8(bad, zero)) != 0xffff)
+	    break;
+	key = _mm_add_epi64(key, key_inc);
+    }
+    return i;
+}
+
+static size_t
+sse2_check(const record_format_t *fmt, const void *buf,
+	   size_t nrec, uint64_t off)
+{
+    if (fmt->creator_flag)
+	return sse2_check_16(fmt, buf, nrec, off);
+    return sse2_check_8(fmt, buf, nrec, off);
+}
+
+__attribute__((target("sse2")))
+static size_t
+sse2_fill_8(const record_format_t *fmt, unsigned char *p,
+	    size_t nrec, uint64_t off)
+{
+    const __m128i lo16 = _mm_set1_epi32(0xffff);
+    const __m128i csum_mask = _mm_set1_epi64x(0xffff);
+    const __m128i key_inc = _mm_set1_epi64x(2*RECORD_SIZE);
+    uint64_t tb = record_tag_bits(fmt);
+    __m128i key = _mm_set_epi64x((off+RECORD_SIZE) | tb, off | tb);
+    size_t i;
+
+    for (i = 0 ; i + 2 <= nrec ; i += 2, p += 2*RECORD_SIZE)
+    {
+	__m128i v = sse2_bswap64(key);
+	__m128i s;
+
+	s = _mm_add_epi32(_mm_and_si128(v, lo16), _mm_srli_epi32(v, 16));
+	s = sse2_fold(_mm_add_epi32(s, _mm_srli_epi64(s, 32)));
+	v = _mm_or_si128(v, _mm_andnot_si128(s, csum_mask));
+	_mm_storeu_si128((__m128i *)p, v);
+	key = _mm_add_epi64(key, key_inc);
+    }
+    return i;
+}
+
+__attribute__((target("sse2")))
+static size_t
+sse2_fill_16(const record_format_t *fmt, unsigned char *p,
+	     size_t nrec, uint64_t off)
+{
+    const __m128i lo16 = _mm_set1_epi32(0xffff);
+    const __m128i csum_mask = _mm_set_epi64x(0, 0xffff);
+    const __m128i key_inc = _mm_set_epi64x(0, RECORD_SIZE_CREATOR);
+    __m128i key = _mm_set_epi64x(fmt->creator, off | record_tag_bits(fmt));
+    size_t i;
+
+    for (i = 0 ; i < nrec ; i++, p += RECORD_SIZE_CREATOR)
+    {
+	__m128i v = sse2_bswap64(key);
+	__m128i s;
+
+	s = _mm_add_epi32(_mm_and_si128(v, lo16), _mm_srli_epi32(v, 16));
+	s = _mm_add_epi32(s, _mm_srli_si128(s, 8));
+	s = sse2_fold(_mm_add_epi32(s, _mm_srli_si128(s, 4)));
+	v = _mm_or_si128(v, _mm_andnot_si128(s, csum_mask));
+	_mm_storeu_si128((__m128i *)p, v);
+	key = _mm_add_epi64(key, key_inc);
+    }
+    return i;
+}
+
+static size_t
+sse2_fill(const record_format_t *fmt, void *buf,
+	  size_t nrec, uint64_t off)
+{
+    if (fmt->creator_flag)
+	return sse2_fill_16(fmt, buf, nrec, off);
+    return sse2_fill_8(fmt, buf, nrec, off);
+}
+
+/*-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-*/
+
+static bool_t
+avx2_supported(void)
+{
+    __builtin_cpu_init();
+    return !!__builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+avx2_bswap64(__m256i v)
+{
+    const __m256i shuf = _mm256_set_epi8(
+	    8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7,
+	    8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7);
+
+    return _mm256_shuffle_epi8(v, shuf);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+avx2_fold(__m256i s)
+{
+    const __m256i lo16 = _mm256_set1_epi32(0xffff);
+
+    s = _mm256_add_epi32(_mm256_and_si256(s, lo16), _mm256_srli_epi32(s, 16));
+    return _mm256_add_epi32(_mm256_and_si256(s, lo16), _mm256_srli_epi32(s, 16));
+}
+
+__attribute__((target("avx2")))
+static size_t
+avx2_check_8(const record_format_t *fmt, const unsigned char *p,
+	     size_t nrec, uint64_t off)
+{
+    const __m256i lo16 = _mm256_set1_epi32(0xffff);
+    const __m256i csum_ok = _mm256_set1_epi64x(0xffff);
+    const __m256i csum_mask = _mm256_set1_epi64x(0xffffffffLL);
+    const __m256i key_mask = _mm256_set1_epi64x(RECORD_KEY_MASK);
+    const __m256i key_inc = _mm256_set1_epi64x(4*RECORD_SIZE);
+    uint64_t tb = record_tag_bits(fmt);
+    __m256i key = _mm256_set_epi64x((off+3*RECORD_SIZE) | tb,
+				    (off+2*RECORD_SIZE) | tb,
+				    (off+RECORD_SIZE) | tb,
+				    off | tb);
+    size_t i;
+
+    for (i = 0 ; i + 4 <= nrec ; i += 4, p += 4*RECORD_SIZE)
+    {
+	__m256i v = _mm256_loadu_si256((const __m256i *)p);
+	__m256i s, bad;
+
+	s = _mm256_add_epi32(_mm256_and_si256(v, lo16), _mm256_srli_epi32(v, 16));
+	s = avx2_fold(_mm256_add_epi32(s, _mm256_srli_epi64(s, 32)));
+	bad = _mm256_and_si256(_mm256_xor_si256(s, csum_ok), csum_mask);
+	bad = _mm256_or_si256(bad,
+		_mm256_xor_si256(_mm256_and_si256(avx2_bswap64(v), key_mask), key));
+	if (!_mm256_testz_si256(bad, bad))
+	    break;
+	key = _mm256_add_epi64(key, key_inc);
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t
+avx2_check_16(const record_format_t *fmt, const unsigned char *p,
+	      size_t nrec, uint64_t off)
+{
+    const __m256i lo16 = _mm256_set1_epi32(0xffff);
+    const __m256i csum_ok = _mm256_set_epi64x(0, 0xffff, 0, 0xffff);
+    const __m256i csum_mask = _mm256_set_epi64x(0, 0xffffffffLL, 0, 0xffffffffLL);
+    const __m256i key_mask = _mm256_set_epi64x(-1LL, RECORD_KEY_MASK,
+					       -1LL, RECORD_KEY_MASK);
+    const __m256i key_inc = _mm256_set_epi64x(0, 2*RECORD_SIZE_CREATOR,
+					      0, 2*RECORD_SIZE_CREATOR);
+    uint64_t tb = record_tag_bits(fmt);
+    __m256i key = _mm256_set_epi64x(fmt->creator, (off+RECORD_SIZE_CREATOR) | tb,
+				    fmt->creator, off | tb);
+    size_t i;
+
+    for (i = 0 ; i + 2 <= nrec ; i += 2, p += 2*RECORD_SIZE_CREATOR)
+    {
+	__m256i v = _mm256_loadu_si256((const __m256i *)p);
+	__m256i s, bad;
+
+	/* note the byte shifts operate within each 128 bit lane */
+	s = _mm256_add_epi32(_mm256_and_si256(v, lo16), _mm256_srli_epi32(v, 16));
+	s = _mm256_add_epi32(s, _mm256_srli_si256(s, 8));
+	s = avx2_fold(_mm256_add_epi32(s, _mm256_srli_si256(s, 4)));
+	bad = _mm256_and_si256(_mm256_xor_si256(s, csum_ok), csum_mask);
+	bad = _mm256_or_si256(bad,
+		_mm256_xor_si256(_mm256_and_si256(avx2_bswap64(v), key_mask), key));
+	if (!_mm256_testz_si256(bad, bad))
+	    break;
+	key = _mm256_add_epi64(key, key_inc);
+    }
+    return i;
+}
+
+static size_t
+avx2_check(const record_format_t *fmt, const void *buf,
+	   size_t nrec, uint64_t off)
+{
+    if (fmt->creator_flag)
+	return avx2_check_16(fmt, buf, nrec, off);
+    return avx2_check_8(fmt, buf, nrec, off);
+}
+
+__attribute__((target("avx2")))
+static size_t
+avx2_fill_8(const record_format_t *fmt, unsigned char *p,
+	    size_t nrec, uint64_t off)
+{
+    const __m256i lo16 = _mm256_set1_epi32(0xffff);
+    const __m256i csum_mask = _mm256_set1_epi64x(0xffff);
+    const __m256i key_inc = _mm256_set1_epi64x(4*RECORD_SIZE);
+    uint64_t tb = record_tag_bits(fmt);
+    __m256i key = _mm256_set_epi64x((off+3*RECORD_SIZE) | tb,
+				    (off+2*RECORD_SIZE) | tb,
+				    (off+RECORD_SIZE) | tb,
+				    off | tb);
+    size_t i;
+
+    for (i = 0 ; i + 4 <= nrec ; i += 4, p += 4*RECORD_SIZE)
+    {
+	__m256i v = avx2_bswap64(key);
+	__m256i s;
+
+	s = _mm256_add_epi32(_mm256_and_si256(v, lo16), _mm256_srli_epi32(v, 16));
+	s = avx2_fold(_mm256_add_epi32(s, _mm256_srli_epi64(s, 32)));
+	v = _mm256_or_si256(v, _mm256_andnot_si256(s, csum_mask));
+	_mm256_storeu_si256((__m256i *)p, v);
+	key = _mm256_add_epi64(key, key_inc);
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t
+avx2_fill_16(const record_format_t *fmt, unsigned char *p,
+	     size_t nrec, uint64_t off)
+{
+    const __m256i lo16 = _mm256_set1_epi32(0xffff);
+    const __m256i csum_mask = _mm256_set_epi64x(0, 0xffff, 0, 0xffff);
+    const __m256i key_inc = _mm256_set_epi64x(0, 2*RECORD_SIZE_CREATOR,
+					      0, 2*RECORD_SIZE_CREATOR);
+    uint64_t tb = record_tag_bits(fmt);
+    __m256i key = _mm256_set_epi64x(fmt->creator, (off+RECORD_SIZE_CREATOR) | tb,
+				    fmt->creator, off | tb);
+    size_t i;
+
+    for (i = 0 ; i + 2 <= nrec ; i += 2, p += 2*RECORD_SIZE_CREATOR)
+    {
+	__m256i v = avx2_bswap64(key);
+	__m256i s;
+
+	s = _mm256_add_epi32(_mm256_and_si256(v, lo16), _mm256_srli_epi32(v, 16));
+	s = _mm256_add_epi32(s, _mm256_srli_si256(s, 8));
+	s = avx2_fold(_mm256_add_epi32(s, _mm256_srli_si256(s, 4)));
+	v = _mm256_or_si256(v, _mm256_andnot_si256(s, csum_mask));
+	_mm256_storeu_si256((__m256i *)p, v);
+	key = _mm256_add_epi64(key, key_inc);
+    }
+    return i;
+}
+
+static size_t
+avx2_fill(const record_format_t *fmt, void *buf,
+	  size_t nrec, uint64_t off)
+{
+    if (fmt->creator_flag)
+	return avx2_fill_16(fmt, buf, nrec, off);
+    return avx2_fill_8(fmt, buf, nrec, off);
+}
+
+/*-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-*/
+#if RECORD_HAVE_AVX512
+
+static bool_t
+avx512_supported(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512f") &&
+	   __builtin_cpu_supports("avx512bw");
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static inline __m512i
+avx512_bswap64(__m512i v)
+{
+    const __m512i shuf = _mm512_set_epi64(
+	    0x08090a0b0c0d0e0fLL, 0x0001020304050607LL,
+	    0x08090a0b0c0d0e0fLL, 0x0001020304050607LL,
+	    0x08090a0b0c0d0e0fLL, 0x0001020304050607LL,
+	    0x08090a0b0c0d0e0fLL, 0x0001020304050607LL);
+
+    return _mm512_shuffle_epi8(v, shuf);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static inline __m512i
+avx512_fold(__m512i s)
+{
+    const __m512i lo16 = _mm512_set1_epi32(0xffff);
+
+    s = _mm512_add_epi32(_mm512_and_si512(s, lo16), _mm512_srli_epi32(s, 16));
+    return _mm512_add_epi32(_mm512_and_si512(s, lo16), _mm512_srli_epi32(s, 16));
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static size_t
+avx512_check_8(const record_format_t *fmt, const unsigned char *p,
+	       size_t nrec, uint64_t off)
+{
+    const __m512i lo16 = _mm512_set1_epi32(0xffff);
+    const __m512i csum_ok = _mm512_set1_epi64(0xffff);
+    const __m512i csum_mask = _mm512_set1_epi64(0xffffffffLL);
+    const __m512i key_mask = _mm512_set1_epi64(RECORD_KEY_MASK);
+    const __m512i key_inc = _mm512_set1_epi64(8*RECORD_SIZE);
+    __m512i key = _mm512_add_epi64(
+	    _mm512_set1_epi64(off | record_tag_bits(fmt)),
+	    _mm512_set_epi64(7*RECORD_SIZE, 6*RECORD_SIZE,
+			     5*RECORD_SIZE, 4*RECORD_SIZE,
+			     3*RECORD_SIZE, 2*RECORD_SIZE,
+			     RECORD_SIZE, 0));
+    size_t i;
+
+    for (i = 0 ; i + 8 <= nrec ; i += 8, p += 8*RECORD_SIZE)
+    {
+	__m512i v = _mm512_loadu_si512((const void *)p);
+	__m512i s, bad;
+
+	s = _mm512_add_epi32(_mm512_and_si512(v, lo16), _mm512_srli_epi32(v, 16));
+	s = avx512_fold(_mm512_add_epi32(s, _mm512_srli_epi64(s, 32)));
+	bad = _mm512_and_si512(_mm512_xor_si512(s, csum_ok), csum_mask);
+	bad = _mm512_or_si512(bad,
+		_mm512_xor_si512(_mm512_and_si512(avx512_bswap64(v), key_mask), key));
+	if (_mm512_test_epi64_mask(bad, bad))
+	    break;
+	key = _mm512_add_epi64(key, key_inc);
+    }
+    return i;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static size_t
+avx512_check_16(const record_format_t *fmt, const unsigned char *p,
+		size_t nrec, uint64_t off)
+{
+    const __m512i lo16 = _mm512_set1_epi32(0xffff);
+    const __m512i csum_ok = _mm512_set_epi64(0, 0xffff, 0, 0xffff,
+					     0, 0xffff, 0, 0xffff);
+    const __m512i csum_mask = _mm512_set_epi64(0, 0xffffffffLL, 0, 0xffffffffLL,
+					       0, 0xffffffffLL, 0, 0xffffffffLL);
+    const __m512i key_mask = _mm512_set_epi64(-1LL, RECORD_KEY_MASK,
+					      -1LL, RECORD_KEY_MASK,
+					      -1LL, RECORD_KEY_MASK,
+					      -1LL, RECORD_KEY_MASK);
+    const __m512i key_inc = _mm512_set_epi64(0, 4*RECORD_SIZE_CREATOR,
+					     0, 4*RECORD_SIZE_CREATOR,
+					     0, 4*RECORD_SIZE_CREATOR,
+					     0, 4*RECORD_SIZE_CREATOR);
+    uint64_t k0 = off | record_tag_bits(fmt);
+    __m512i key = _mm512_set_epi64(fmt->creator, k0 + 3*RECORD_SIZE_CREATOR,
+				   fmt->creator, k0 + 2*RECORD_SIZE_CREATOR,
+				   fmt->creator, k0 + RECORD_SIZE_CREATOR,
+				   fmt->creator, k0);
+    size_t i;
+
+    for (i = 0 ; i + 4 <= nrec ; i += 4, p += 4*RECORD_SIZE_CREATOR)
+    {
+	__m512i v = _mm512_loadu_si512((const void *)p);
+	__m512i s, bad;
+
+	/* note the byte shifts operate within each 128 bit lane */
+	s = _mm512_add_epi32(_mm512_and_si512(v, lo16), _mm512_srli_epi32(v, 16));
+	s = _mm512_add_epi32(s, _mm512_bsrli_epi128(s, 8));
+	s = avx512_fold(_mm512_add_epi32(s, _mm512_bsrli_epi128(s, 4)));
+	bad = _mm512_and_si512(_mm512_xor_si512(s, csum_ok), csum_mask);
+	bad = _mm512_or_si512(bad,
+		_mm512_xor_si512(_mm512_and_si512(avx512_bswap64(v), key_mask), key));
+	if (_mm512_test_epi64_mask(bad, bad))
+	    break;
+	key = _mm512_add_epi64(key, key_inc);
+    }
+    return i;
+}
+
+static size_t
+avx512_check(const record_format_t *fmt, const void *buf,
+	     size_t nrec, uint64_t off)
+{
+    if (fmt->creator_flag)
+	return avx512_check_16(fmt, buf, nrec, off);
+    return avx512_check_8(fmt, buf, nrec, off);
+}
+
+#endif /* RECORD_HAVE_AVX512 */
+#endif /* RECORD_HAVE_X86_SIMD */
+/*-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-*/
+
+const record_impl_t record_impls[] =
+{
+    {"scalar", scalar_supported, scalar_check, scalar_fill},
+    {"template", scalar_supported, template_check, template_fill},
+#if RECORD_HAVE_X86_SIMD
+    {"sse2", sse2_supported, sse2_check, sse2_fill},
+    {"avx2", avx2_supported, avx2_check, avx2_fill},
+#if RECORD_HAVE_AVX512
+    /* generating is store bound, the AVX2 version is as good as it gets */
+    {"avx512", avx512_supported, avx512_check, avx2_fill},
+#endif
+#endif
+    {0, 0, 0, 0}
+};
+
+static const record_impl_t *current_impl;
+static pthread_once_t auto_once = PTHREAD_ONCE_INIT;
+
+const record_impl_t *
+record_impl_find(const char *name)
+{
+    const record_impl_t *impl;
+
+    for (impl = record_impls ; impl->name ; impl++)
+    {
+	if (!strcmp(impl->name, name))
+	    return impl;
+    }
+    return 0;
+}
+
+/* the last supported implementation is the fastest */
+static const record_impl_t *
+record_impl_best(void)
+{
+    const record_impl_t *impl, *best = 0;
+
+    for (impl = record_impls ; impl->name ; impl++)
+    {
+	if (impl->supported())
+	    best = impl;
+    }
+    return best;
+}
+
+static void
+record_impl_auto(void)
+{
+    if (current_impl == 0)
+	current_impl = record_impl_best();
+}
+
+/*
+ * Without --record-impl the choice is made by whichever thread first
+ * needs it, which may be one of several started together.
+ */
+static inline const record_impl_t *
+record_impl_current(void)
+{
+    pthread_once(&auto_once, record_impl_auto);
+    return current_impl;
+}
+
+bool_t
+record_impl_select(const char *name)
+{
+    const record_impl_t *impl;
+
+    if (name == 0 || !strcmp(name, "auto"))
+    {
+	current_impl = record_impl_best();
+	return TRUE;
+    }
+
+    impl = record_impl_find(name);
+    if (impl == 0 || !impl->supported())
+	return FALSE;
+    current_impl = impl;
+    return TRUE;
+}
+
+const char *
+record_impl_name(void)
+{
+    return record_impl_current()->name;
+}
+
+size_t
+record_check_block(const record_format_t *fmt, const void *buf,
+		   size_t nrec, uint64_t off)
+{
+    const record_impl_t *impl = record_impl_current();
+    const unsigned char *p = buf;
+    size_t i = 0;
+
+    if (impl->check == scalar_check ||
+	off + (uint64_t)nrec * fmt->size > record_offset_limit(fmt))
+	return scalar_check(fmt, buf, nrec, off);
+
+    while (i < nrec)
+    {
+	size_t lim, n;
+
+	i += impl->check(fmt, p + i*fmt->size, nrec - i, off + i*fmt->size);
+	if (i == nrec)
+	    break;
+
+	/*
+	 * The kernel stopped early, at a short tail or at a
+	 * vector containing a bad record.  Use the scalar code
+	 * to find the bad record, or to finish the tail.
+	 */
+	lim = MIN(nrec, i + RECORD_MAX_LANES);
+	n = scalar_check(fmt, p + i*fmt->size, lim - i, off + i*fmt->size);
+	i += n;
+	if (i < lim)
+	    break;
+    }
+    return i;
+}
+
+void
+record_fill_block(const record_format_t *fmt, void *buf,
+		  size_t nrec, uint64_t off)
+{
+    const record_impl_t *impl = record_impl_current();
+    unsigned char *p = buf;
+    size_t i = 0;
+
+    if (off + (uint64_t)nrec * fmt->size <= record_offset_limit(fmt))
+	i = impl->fill(fmt, buf, nrec, off);
+    /* the tail, or everything if the offsets are out of range */
+    scalar_fill(fmt, p + i*fmt->size, nrec - i, off + i*fmt->size);
+}
@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2021 Greg Banks <gnb@fmeh.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef _CHECKSTREAM_RECORD_H_
+#define _CHECKSTREAM_RECORD_H_ 1
+
+#include "common.h"
+
+/*
+ * Describes the layout of the records in a stream, and the values
+ * of those fields which do not depend on the record's offset.
+ */
+typedef struct
+{
+    size_t size;		/* RECORD_SIZE or RECORD_SIZE_CREATOR */
+    bool_t tag_flag;
+    uint8_t tag;
+    bool_t creator_flag;
+    uint64_t creator;		/* in host byte order */
+} record_format_t;
+
+extern void record_format_init(record_format_t *fmt,
+			       bool_t tag_flag, uint8_t tag,
+			       bool_t creator_flag, uint64_t creator);
+
+/*
+ * Decode the fields of a single record.
+ */
+static inline uint16_t
+record_checksum(const record_t *rec, bool_t creator_flag)
+{
+    if (creator_flag)
+	return aligned_ip_checksum_8(&rec->w16[0]);
+    return aligned_ip_checksum_4(&rec->w16[0]);
+}
+
+static inline uint64_t
+record_get_offset(const record_t *rec, bool_t tag_flag)
+{
+    if (tag_flag)
+	return (uint64_t)ntohl(rec->w32[1]) | ((uint64_t)rec->w8[3] << 32);
+    return (uint64_t)ntohl(rec->w32[1]) | ((uint64_t)ntohs(rec->w16[1]) << 32);
+}
+
+static inline uint8_t
+record_get_tag(const record_t *rec)
+{
+    return rec->w8[2];
+}
+
+static inline uint64_t
+record_get_creator(const record_t *rec)
+{
+    return (uint64_t)ntohl(rec->w32[3]) | ((uint64_t)ntohl(rec->w32[2]) << 32);
+}
+
+/*
+ * Returns TRUE if the record would pass every check
+ * that checkstream makes of a record found at offset off.
+ */
+static inline bool_t
+record_is_valid(const record_format_t *fmt, const record_t *rec, uint64_t off)
+{
+    if (record_checksum(rec, fmt->creator_flag))
+	return FALSE;
+    if (record_get_offset(rec, fmt->tag_flag) != off)
+	return FALSE;
+    if (fmt->tag_flag && record_get_tag(rec) != fmt->tag)
+	return FALSE;
+    if (fmt->creator_flag && record_get_creator(rec) != fmt->creator)
+	return FALSE;
+    return TRUE;
+}
+
+/*
+ * Encode a single record to be written at offset off.
+ */
+static inline void
+record_encode(const record_format_t *fmt, record_t *rec, uint64_t off)
+{
+    if (fmt->tag_flag)
+    {
+	rec->w8[2] = fmt->tag;
+	rec->w8[3] = (off >> 32) & 0xff;
+    }
+    else
+    {
+	rec->w16[1] = htons((off >> 32) & 0xffff);
+    }
+    rec->w32[1] = htonl(off & 0xffffffff);
+    if (fmt->creator_flag)
+    {
+	rec->w32[2] = htonl(fmt->creator >> 32);
+	rec->w32[3] = htonl(fmt->creator & 0xffffffff);
+	rec->w16[0] = aligned_ip_checksum_7(&rec->w16[1]);
+    }
+    else
+    {
+	rec->w16[0] = aligned_ip_checksum_3(&rec->w16[1]);
+    }
+}
+
+/*
+ * Block kernels.  The check function checks up to nrec consecutive
+ * records in buf, the first of which is expected at offset off, and
+ * returns the number of leading records which are all valid.  The
+ * fill function encodes up to nrec consecutive records into buf and
+ * returns the number encoded.  Both are allowed to stop early, e.g.
+ * at a short tail or at a vector containing a bad record, and the
+ * record_check_block() and record_fill_block() wrappers take care
+ * of finishing the job using the scalar implementation.
+ */
+typedef struct
+{
+    const char *name;
+    bool_t (*supported)(void);
+    size_t (*check)(const record_format_t *, const void *buf,
+		    size_t nrec, uint64_t off);
+    size_t (*fill)(const record_format_t *, void *buf,
+		   size_t nrec, uint64_t off);
+} record_impl_t;
+
+/* null-terminated, in increasing order of preference */
+extern const record_impl_t record_impls[];
+extern const record_impl_t *record_impl_find(const char *name);
+/* pass 0 to select the best implementation the CPU supports */
+extern bool_t record_impl_select(const char *name);
+extern const char *record_impl_name(void);
+
+/*
+ * Returns the number of leading records in buf which are valid,
+ * i.e. the index of the first bad record or nrec if all are good.
+ */
+extern size_t record_check_block(const record_format_t *fmt,
+				 const void *buf, size_t nrec, uint64_t off);
+
+/*
+ * Encodes nrec consecutive records into buf, the first of which
+ * is to be written at offset off.  The result is byte for byte
+ * the same as calling record_encode() for each record.
+ */
+extern void record_fill_block(const record_format_t *fmt,
+			      void *buf, size_t nrec, uint64_t off);
+
+#endif /* _CHECKSTREAM_RECORD_H_ */
@@ -0,0 +1,435 @@
+/*
+ * Copyright (c) 2021 Greg Banks <gnb@fmeh.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#define _GNU_SOURCE 1	/* for ppoll() and accept4() */
+#include "common.h"
+#include "stream.h"
+#include "check.h"
+#include "server.h"
+#if HAVE_SYS_EPOLL_H
+#include <pthread.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+/*
+ * In --server mode checkstream stays up checking the streams of any
+ * number of genstream clients, at most --max-clients at once, each of
+ * which sends --length bytes.  The main thread accepts connections and
+ * hands each to the least busy of a small pool of threads, each of
+ * which runs an epoll loop over its connections.  A thread reads from
+ * a ready connection into its one buffer and checks the whole records
+ * there, keeping any fraction of a record until the rest arrives, so
+ * an idle connection costs only its client_t.  Each client has its own
+ * checker and extents, reported with its number, and the summary when
+ * the server is stopped covers all the clients.
+ */
+#define SERVER_BUFSIZE	(64*1024)	/* default bytes read at once */
+#define SERVER_EVENTS	64		/* most events handled per wakeup */
+
+typedef struct server server_t;
+typedef struct event_loop event_loop_t;
+typedef struct client client_t;
+
+struct client
+{
+    client_t *next;		/* on the event loop's list */
+    client_t *prev;
+    server_t *server;
+    event_loop_t *loop;
+    unsigned int id;
+    int fd;
+    char *name;			/* prefixes the client's reports */
+    checker_t checker;
+    uint64_t offset;		/* expected offset of the next record */
+    uint64_t left;		/* bytes still to be checked */
+    uint8_t partial[RECORD_SIZE_CREATOR];
+    unsigned int npartial;	/* bytes of a record read so far */
+    uint64_t start;		/* when accepted, in microseconds */
+    uint64_t nblocks;
+    uint64_t nbytes;
+    extent_t extent;
+};
+
+struct event_loop
+{
+    server_t *server;
+    pthread_t thread;
+    int epfd;
+    unsigned int nclients;
+    client_t *clients;
+};
+
+struct server
+{
+    /* protects the lists of clients and the counts, and serialises the
+     * reports and the global statistics */
+    pthread_mutex_t lock;
+    int lsock;
+    int stop_pipe[2];		/* readable when the loops should stop */
+    int wake_pipe[2];		/* written when a client is finished */
+    uint64_t length;		/* from each client */
+    uint64_t offset0;
+    size_t bufsize;
+    unsigned int max_clients;
+    unsigned int nactive;
+    unsigned int naccepted;
+    unsigned int nfailed;	/* clients with errors */
+    unsigned int nloops;
+    event_loop_t *loops;
+    stream_t *stats;		/* for all the clients together */
+};
+
+static void
+client_found_run(checker_t *c, uint64_t off,
+		 failure_mode_t failure, uint64_t detail)
+{
+    client_t *cl = c->closure;
+
+    pthread_mutex_lock(&cl->server->lock);
+    extent_advance(&cl->extent, off, failure, detail);
+    pthread_mutex_unlock(&cl->server->lock);
+}
+
+/*
+ * Reads what's ready on the client's connection into buf and checks
+ * the whole records there.  Returns FALSE when the client is finished,
+ * because all its data has been checked or the connection was closed
+ * or failed.
+ */
+static bool_t
+client_read(client_t *cl, uint8_t *buf, size_t size)
+{
+    checker_t *c = &cl->checker;
+    size_t record_size = c->fmt.size;
+    const uint8_t *p = buf;
+    uint64_t nrecs, ngood;
+    ssize_t n;
+
+    memcpy(buf, cl->partial, cl->npartial);
+    n = read(cl->fd, buf + cl->npartial,
+	     MIN(size - cl->npartial, cl->left - cl->npartial));
+    if (n < 0)
+    {
+	if (errno == EAGAIN || errno == EINTR)
+	    return TRUE;
+	perrorf("client %u: read", cl->id);
+	return FALSE;
+    }
+    if (n == 0)
+	return FALSE;
+    cl->nblocks++;
+    cl->nbytes += n;
+
+    for (nrecs = (cl->npartial + n) / record_size ; nrecs ; nrecs -= ngood)
+    {
+	if ((ngood = checker_block(c, p, nrecs, cl->offset)) == 0)
+	{
+	    checker_record(c, (const record_t *)p, cl->offset);
+	    ngood = 1;
+	}
+	p += ngood * record_size;
+	cl->offset += ngood * record_size;
+	cl->left -= ngood * record_size;
+    }
+    cl->npartial = buf + cl->npartial + n - p;
+    memcpy(cl->partial, p, cl->npartial);
+
+    return (cl->left > 0);
+}
+
+/*
+ * Reports the client and adds it to the server's statistics, and
+ * closes its connection.  A client whose connection closed early is
+ * short, but one still connected when the server stops was interrupted.
+ */
+static void
+client_finish(client_t *cl, bool_t interrupted)
+{
+    server_t *sv = cl->server;
+    event_loop_t *loop = cl->loop;
+    uint64_t deltat = MAX(time_now() - cl->start, 1);
+    char errbuf[64];
+
+    epoll_ctl(loop->epfd, EPOLL_CTL_DEL, cl->fd, 0);
+    close(cl->fd);
+
+    pthread_mutex_lock(&sv->lock);
+    extent_finish(&cl->extent, cl->offset,
+		  cl->offset + (interrupted ? 0 : cl->left));
+    if (cl->extent.nerrors && get_num_errors() == 1)
+	handle_first_error();
+    if (cl->extent.nerrors)
+	snprintf(errbuf, sizeof(errbuf), ", %u errors", cl->extent.nerrors);
+    else
+	strcpy(errbuf, ", no errors");
+    fprintf(stderr, "%s: read %llu blocks %llu bytes in %u.%06u seconds (%g KiB/sec)%s%s\n",
+	    cl->name,
+	    (unsigned long long)cl->nblocks,
+	    (unsigned long long)cl->nbytes,
+	    time_seconds(deltat), time_microseconds(deltat),
+	    (double)cl->nbytes / time_double(deltat) / 1024.0,
+	    (interrupted ? ", interrupted" : ""), errbuf);
+
+    total_bytes += cl->checker.total_bytes;
+    sv->stats->stats.nblocks += cl->nblocks;
+    sv->stats->stats.nbytes += cl->nbytes;
+    if (cl->extent.nerrors)
+	sv->nfailed++;
+    sv->nactive--;
+    if (cl->prev)
+	cl->prev->next = cl->next;
+    else
+	loop->clients = cl->next;
+    if (cl->next)
+	cl->next->prev = cl->prev;
+    loop->nclients--;
+    pthread_mutex_unlock(&sv->lock);
+
+    /* there may be room for another client now */
+    if (write(sv->wake_pipe[1], "", 1) < 0 && errno != EAGAIN)
+	perrorf("write");
+
+    xfree(cl->name);
+    xfree(cl);
+}
+
+static void *
+event_loop_thread(void *arg)
+{
+    event_loop_t *loop = arg;
+    server_t *sv = loop->server;
+    struct epoll_event events[SERVER_EVENTS];
+    uint8_t *buf = xvalloc(sv->bufsize);
+    int i, n;
+
+    for (;;)
+    {
+	if ((n = epoll_wait(loop->epfd, events, SERVER_EVENTS, -1)) < 0)
+	{
+	    if (errno == EINTR)
+		continue;
+	    fatal("epoll_wait: %s", strerror(errno));
+	}
+	for (i = 0 ; i < n ; i++)
+	{
+	    client_t *cl = events[i].data.ptr;
+
+	    if (cl == 0)
+		goto stopping;
+	    if (!client_read(cl, buf, sv->bufsize))
+		client_finish(cl, FALSE);
+	}
+    }
+
+stopping:
+    /* no more clients can arrive, the main thread has stopped accepting */
+    while (loop->clients)
+	client_finish(loop->clients, TRUE);
+    free(buf);	    /* allocated by valloc() */
+    return 0;
+}
+
+static void
+server_accept_client(server_t *sv)
+{
+    struct sockaddr_in sin;
+    socklen_t slen = sizeof(sin);
+    struct epoll_event ev;
+    event_loop_t *loop;
+    client_t *cl;
+    char namebuf[300];
+    unsigned int i;
+    int fd;
+
+    if ((fd = accept4(sv->lsock, (struct sockaddr *)&sin, &slen,
+		      SOCK_NONBLOCK|SOCK_CLOEXEC)) < 0)
+    {
+	if (errno != EAGAIN && errno != EINTR && errno != ECONNABORTED)
+	    perrorf("accept");
+	return;
+    }
+
+    cl = xmalloc(sizeof(client_t));
+    cl->server = sv;
+    cl->fd = fd;
+    cl->offset = sv->offset0;
+    cl->left = sv->length;
+    cl->start = time_now();
+    checker_init(&cl->checker, stderr, client_found_run, cl);
+
+    pthread_mutex_lock(&sv->lock);
+    cl->id = sv->naccepted++;
+    snprintf(namebuf, sizeof(namebuf), "%s: client %u", argv0, cl->id);
+    cl->name = xstrdup(namebuf);
+    extent_begin(&cl->extent, cl->name, sv->offset0);
+    if (verbose)
+	fprintf(stderr, "%s: connection from %s:%u\n",
+		cl->name, inet_ntoa(sin.sin_addr), (unsigned)ntohs(sin.sin_port));
+
+    loop = &sv->loops[0];
+    for (i = 1 ; i < sv->nloops ; i++)
+    {
+	if (sv->loops[i].nclients < loop->nclients)
+	    loop = &sv->loops[i];
+    }
+    cl->loop = loop;
+    cl->next = loop->clients;
+    if (cl->next)
+	cl->next->prev = cl;
+    loop->clients = cl;
+    loop->nclients++;
+    sv->nactive++;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = cl;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+	fatal("epoll_ctl: %s", strerror(errno));
+    pthread_mutex_unlock(&sv->lock);
+}
+
+void
+check_server(int protocol, int port, const char *port_filename,
+	     uint64_t bsize, uint64_t length, uint64_t offset0,
+	     unsigned int max_clients)
+{
+    uint64_t record_mask = (creator_flag ? RECORD_MASK_CREATOR : RECORD_MASK);
+    server_t sv;
+    struct epoll_event ev;
+    struct pollfd pfd[2];
+    sigset_t sigs, osigs;
+    unsigned int i;
+    bool_t full;
+    char c;
+    int r;
+
+    if ((length & record_mask))
+    {
+	fprintf(stderr, "%s: warning: unaligned length "
+		        "(will not check last %d bytes)\n",
+			argv0, (int)(length & record_mask));
+	length &= ~record_mask;
+    }
+
+    memset(&sv, 0, sizeof(sv));
+    pthread_mutex_init(&sv.lock, 0);
+    sv.length = length;
+    sv.offset0 = offset0;
+    sv.bufsize = (bsize ? MAX(bsize, 2*RECORD_SIZE_CREATOR) : SERVER_BUFSIZE);
+    sv.max_clients = max_clients;
+    sv.stats = xmalloc(sizeof(stream_t));
+    /* each client's bytes count when it's finished */
+    if (progress)
+	progress_watch(progress, &sv.stats, 1, 0);
+    if ((sv.lsock = stream_server_listen(protocol, port, port_filename,
+					 max_clients)) < 0)
+	exit(1);	    /* error printed at lower level in stream.c */
+    if (fcntl(sv.lsock, F_SETFL, O_NONBLOCK) < 0)
+	fatal("fcntl(O_NONBLOCK): %s", strerror(errno));
+    if (pipe(sv.stop_pipe) < 0 || pipe(sv.wake_pipe) < 0)
+	fatal("pipe: %s", strerror(errno));
+    if (fcntl(sv.wake_pipe[0], F_SETFL, O_NONBLOCK) < 0 ||
+	fcntl(sv.wake_pipe[1], F_SETFL, O_NONBLOCK) < 0)
+	fatal("fcntl(O_NONBLOCK): %s", strerror(errno));
+    start_us = time_now();
+
+    /*
+     * The signals which stop the server are only taken by the main
+     * thread, and only while it waits, so none can be missed.
+     */
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &sigs, &osigs);
+
+    sv.nloops = num_threads;
+    sv.loops = xmalloc(sv.nloops * sizeof(event_loop_t));
+    for (i = 0 ; i < sv.nloops ; i++)
+    {
+	event_loop_t *loop = &sv.loops[i];
+
+	loop->server = &sv;
+	if ((loop->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+	    fatal("epoll_create1: %s", strerror(errno));
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = 0;
+	if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, sv.stop_pipe[0], &ev) < 0)
+	    fatal("epoll_ctl: %s", strerror(errno));
+	if ((r = pthread_create(&loop->thread, 0, event_loop_thread, loop)))
+	    fatal("pthread_create: %s", strerror(r));
+    }
+
+    pfd[0].fd = sv.lsock;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = sv.wake_pipe[0];
+    pfd[1].events = POLLIN;
+    while (!signalled)
+    {
+	pthread_mutex_lock(&sv.lock);
+	full = (sv.nactive >= sv.max_clients);
+	pthread_mutex_unlock(&sv.lock);
+	/* when full, leave new connections waiting in the backlog */
+	pfd[0].fd = (full ? -1 : sv.lsock);
+
+	if (ppoll(pfd, 2, 0, &osigs) < 0)
+	{
+	    if (errno == EINTR)
+		continue;
+	    fatal("ppoll: %s", strerror(errno));
+	}
+	if ((pfd[1].revents & POLLIN))
+	{
+	    while (read(sv.wake_pipe[0], &c, 1) > 0)
+		;
+	}
+	if ((pfd[0].revents & POLLIN))
+	    server_accept_client(&sv);
+    }
+    close(sv.lsock);
+
+    /* stop the loops, which report the clients still connected */
+    if (write(sv.stop_pipe[1], "", 1) < 0)
+	fatal("write: %s", strerror(errno));
+    for (i = 0 ; i < sv.nloops ; i++)
+    {
+	pthread_join(sv.loops[i].thread, 0);
+	close(sv.loops[i].epfd);
+    }
+    pthread_sigmask(SIG_SETMASK, &osigs, 0);
+
+    emit_separator();
+    fprintf(stderr, "%s: end of server summary\n", argv0);
+    fprintf(stderr, "%s: checked %u clients, %u with errors\n",
+	    argv0, sv.naccepted, sv.nfailed);
+    emit_stats(sv.stats);
+    if (progress)
+	progress_unwatch(progress);
+
+    xfree(sv.loops);
+    xfree(sv.stats);
+    close(sv.stop_pipe[0]);
+    close(sv.stop_pipe[1]);
+    close(sv.wake_pipe[0]);
+    close(sv.wake_pipe[1]);
+    pthread_mutex_destroy(&sv.lock);
+}
+
+#endif /* HAVE_SYS_EPOLL_H */
@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2021 Greg Banks <gnb@fmeh.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef _CHECKSTREAM_SERVER_H_
+#define _CHECKSTREAM_SERVER_H_ 1
+
+#include "common.h"
+
+/*
+ * The --server mode of checkstream, which checks the streams of any
+ * number of genstream clients connecting over TCP, until stopped by a
+ * signal.  Needs epoll.
+ */
+/* clients checked at once */
+#define DEFAULT_MAX_CLIENTS	64
+#define MAX_MAX_CLIENTS		65536
+
+#if HAVE_SYS_EPOLL_H
+extern void check_server(int protocol, int port, const char *port_filename,
+			 uint64_t bsize, uint64_t length, uint64_t offset0,
+			 unsigned int max_clients);
+#endif
+
+#endif /* _CHECKSTREAM_SERVER_H_ */
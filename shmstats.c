@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2021 Greg Banks <gnb@fmeh.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#include "common.h"
+#include "shmstats.h"
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <sched.h>
+
+/* times a reader tries for a consistent copy before giving up */
+#define SHMSTATS_TRIES	1000
+
+/*
+ * Returns 0, having reported the error, if the segment can't be
+ * made.  One left behind by a dead process with the same pid is
+ * replaced.
+ */
+shmstats_t *
+shmstats_create(const char *program, const char *name, uint64_t tag)
+{
+    shmstats_t *s;
+    shmstats_data_t *d;
+    char shmname[64];
+    int fd;
+    void *p;
+
+    snprintf(shmname, sizeof(shmname), "/%s.%d", program, (int)getpid());
+    if ((fd = shm_open(shmname, O_RDWR|O_CREAT|O_TRUNC, 0644)) < 0)
+    {
+	perrorf("shm_open(\"%s\")", shmname);
+	return 0;
+    }
+    if (ftruncate(fd, sizeof(shmstats_data_t)) < 0)
+    {
+	perrorf("ftruncate(\"%s\")", shmname);
+	goto error;
+    }
+    p = mmap(0, sizeof(shmstats_data_t), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+    {
+	perrorf("mmap(\"%s\")", shmname);
+	goto error;
+    }
+    close(fd);
+
+    s = xmalloc(sizeof(shmstats_t));
+    s->shmname = xstrdup(shmname);
+    s->data = d = p;
+    d->version = SHMSTATS_VERSION;
+    d->pid = getpid();
+    snprintf(d->program, sizeof(d->program), "%s", program);
+    snprintf(d->name, sizeof(d->name), "%s", (name ? name : "-"));
+    d->tag = tag;
+    d->start = d->updated = time_now();
+    /* last, so a reader sees all of the above or nothing */
+    __atomic_store_n(&d->magic, SHMSTATS_MAGIC, __ATOMIC_RELEASE);
+    return s;
+
+error:
+    shm_unlink(shmname);
+    close(fd);
+    return 0;
+}
+
+/*
+ * An update is between these two, by one thread at a time.  The
+ * odd count must be visible before any of the new values are.
+ */
+void
+shmstats_update_begin(shmstats_t *s)
+{
+    __atomic_store_n(&s->data->seq, s->data->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void
+shmstats_update_end(shmstats_t *s)
+{
+    s->data->updated = time_now();
+    __atomic_store_n(&s->data->seq, s->data->seq + 1, __ATOMIC_RELEASE);
+}
+
+void
+shmstats_destroy(shmstats_t *s)
+{
+    munmap(s->data, sizeof(shmstats_data_t));
+    if (shm_unlink(s->shmname) < 0)
+	perrorf("shm_unlink(\"%s\")", s->shmname);
+    xfree(s->shmname);
+    xfree(s);
+}
+
+/*
+ * Copies the segment, retrying while an update is under way or one
+ * happened during the copy.  Returns -1 if that goes on for too long,
+ * or the segment isn't one this code understands.
+ */
+int
+shmstats_snapshot(const shmstats_data_t *shared, shmstats_data_t *snap)
+{
+    uint32_t seq;
+    int tries;
+
+    for (tries = 0 ; tries < SHMSTATS_TRIES ; tries++)
+    {
+	seq = __atomic_load_n(&shared->seq, __ATOMIC_ACQUIRE);
+	if (!(seq & 1))
+	{
+	    memcpy(snap, shared, sizeof(shmstats_data_t));
+	    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+	    if (__atomic_load_n(&shared->seq, __ATOMIC_RELAXED) == seq)
+		return (snap->magic == SHMSTATS_MAGIC &&
+			snap->version == SHMSTATS_VERSION ? 0 : -1);
+	}
+	sched_yield();
+    }
+    return -1;
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2021 Greg Banks <gnb@fmeh.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef _CHECKSTREAM_SHMSTATS_H_
+#define _CHECKSTREAM_SHMSTATS_H_ 1
+
+#include "common.h"
+#include "histogram.h"
+
+/*
+ * Live counters in a POSIX shared memory segment, see --shm-stats,
+ * for streamtop and other monitors to read.  Each process has a
+ * segment of its own, named after the program and its pid.  The
+ * --interval thread copies the counters in, so the loops doing the
+ * work never touch the segment, and a sequence count which is odd
+ * while it does so lets readers retry rather than see half an update.
+ * The layout is fixed, with plain integers only, so a reader built
+ * separately can check the magic and version and use it as is.
+ */
+#define SHMSTATS_MAGIC		0x43534d53	/* "SMSC" */
+#define SHMSTATS_VERSION	1
+#define SHMSTATS_DIR		"/dev/shm"	/* where Linux shows the segments */
+#define SHMSTATS_INTERVAL	(1ULL * NANOSEC)	/* without --interval */
+#define SHMSTATS_MAX_FAILURES	16
+#define SHMSTATS_NAMELEN	16
+#define SHMSTATS_NUM_OPS	4		/* STREAM_NUM_OPS */
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seq;		/* odd while the rest is being written */
+    uint32_t pid;
+    char program[SHMSTATS_NAMELEN];
+    char name[256];		/* the file, directory or host */
+    uint64_t tag;
+    uint64_t start;		/* microseconds since the epoch */
+    uint64_t updated;		/* ditto */
+    /* as --interval reports them */
+    uint64_t nblocks;
+    uint64_t nbytes;
+    uint64_t offset;
+    /* checkstream only */
+    uint64_t total_bytes;	/* checked */
+    uint64_t nerrors;		/* extents of every failure mode */
+    uint32_t nfailures;
+    uint32_t pad;
+    char failure_names[SHMSTATS_MAX_FAILURES][SHMSTATS_NAMELEN];
+    uint64_t num_errors[SHMSTATS_MAX_FAILURES];
+    uint64_t corrupt_bytes[SHMSTATS_MAX_FAILURES];
+    /* nanoseconds, indexed by stream_op_t */
+    histogram_t latency[SHMSTATS_NUM_OPS];
+} shmstats_data_t;
+
+struct stream_latency;
+
+typedef struct shmstats
+{
+    char *shmname;		/* as given to shm_open() */
+    shmstats_data_t *data;
+    const struct stream_latency *latency;	/* to copy in, or 0 */
+    /* copies in the program's own counters, during an update */
+    void (*fill)(shmstats_data_t *d);
+} shmstats_t;
+
+extern shmstats_t *shmstats_create(const char *program, const char *name,
+				   uint64_t tag);
+extern void shmstats_update_begin(shmstats_t *s);
+extern void shmstats_update_end(shmstats_t *s);
+extern void shmstats_destroy(shmstats_t *s);
+extern int shmstats_snapshot(const shmstats_data_t *shared,
+			     shmstats_data_t *snap);
+
+#endif /* _CHECKSTREAM_SHMSTATS_H_ */
@@ -16,18 +16,39 @@
  * along with this program; if not, write to the Free Software
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
  */
+#define _GNU_SOURCE 1	/* for sync_file_range(), sendmmsg() and recvmmsg() */
 #include "common.h"
 #include "stream.h"
+#include "pacer.h"
+#include "watchdog.h"
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <errno.h>
-
-#ifndef MIN
-#define MIN(a,b)    ((a)<(b)?(a):(b))
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+#if HAVE_IO_URING || HAVE_VMSPLICE
+#include <sys/uio.h>
+#endif
+#if HAVE_IO_URING
+#include <linux/io_uring.h>
+#endif
+#include <poll.h>
+#if HAVE_MSG_ZEROCOPY
+#include <linux/errqueue.h>
+#endif
+#if HAVE_UDP_GSO
+#include <netinet/udp.h>
+#endif
+#if HAVE_SENDFILE
+#include <sys/sendfile.h>
 #endif
 
 #define sperror(s, call) \
@@ -45,21 +66,99 @@ _stream_pull_buffer(stream_t *s)
     return s->current + s->remain;
 }
 
+/* how many bytes a pull can read into _stream_pull_buffer() */
+static inline int64_t
+_stream_pull_len(stream_t *s)
+{
+    return (s->buffer + s->bufsize) - _stream_pull_buffer(s);
+}
+
 static inline unsigned char *
 _stream_push_buffer(stream_t *s)
 {
     return s->buffer;
 }
 
+/*
+ * Timing an operation reads the monotonic clock twice, which the vDSO
+ * makes far cheaper than the syscall being timed, and neither adding
+ * to the stream's own histogram nor marking its watchdog slot needs a
+ * lock.
+ */
+static inline uint64_t
+_stream_op_start(const stream_t *s)
+{
+    uint64_t now;
+
+    if (!s->latency && !s->watch)
+	return 0;
+    now = time_now_ns();
+    if (s->watch)
+	watchdog_begin(s->watch, now, s->stats.nbytes);
+    return now;
+}
+
+static inline void
+_stream_op_done(stream_latency_t *lat, struct watchdog_slot *ws,
+		stream_op_t op, uint64_t start)
+{
+    uint64_t now;
+
+    if (!lat && !ws)
+	return;
+    now = time_now_ns();
+    if (lat)
+	histogram_add(&lat->ops[op], now - start);
+    if (ws)
+	watchdog_end(ws, now);
+}
+
+/*
+ * Streams which read into their own buffer have a small bounce area
+ * in front of it.  When the caller needs more bytes than remain in
+ * the buffer, which is usually because a record straddles the end
+ * of the buffer, only those few remaining bytes are copied, into the
+ * end of the bounce area, and the next read is for the whole of the
+ * buffer.  So reads are always full sized and aligned, which O_DIRECT
+ * needs, and the caller still sees contiguous bytes without copying.
+ * Only if more bytes remain than fit in the bounce area are they
+ * moved to the start of the buffer and the read made shorter.
+ */
 int
 stream_pull(stream_t *s)
 {
+    uint64_t start;
     int pulled;
 
-    if (s->remain)
+    if ((s->xflags & STREAM_WINDOW))
+    {
+	/* the stream moves its window and sets current and remain */
+	start = _stream_op_start(s);
+	pulled = (s->ops->pull)(s);
+	_stream_op_done(s->latency, s->watch, STREAM_OP_PULL, start);
+	if (pulled < 0)
+	    return -1;
+	s->stats.nblocks++;
+	s->stats.nbytes += pulled;
+	return pulled;
+    }
+
+    if ((uint64_t)s->remain <= s->bounce)
+    {
+	if (s->remain)
+	    memmove(s->buffer - s->remain, s->current, s->remain);
+	s->current = s->buffer - s->remain;
+    }
+    else
+    {
 	memmove(s->buffer, s->current, s->remain);
-    s->current = s->buffer;
-    if ((pulled = (s->ops->pull)(s)) < 0)
+	s->current = s->buffer;
+    }
+    s->stats.ncopied += s->remain;
+    start = _stream_op_start(s);
+    pulled = (s->ops->pull)(s);
+    _stream_op_done(s->latency, s->watch, STREAM_OP_PULL, start);
+    if (pulled < 0)
 	return -1;
     s->remain += pulled;
     s->stats.nblocks++;
@@ -104,9 +203,29 @@ stream_read(stream_t *s, char *buf, int len)
 int
 stream_push(stream_t *s)
 {
+    uint64_t start;
     int pushed;
 
-    if ((pushed = (s->ops->push)(s)) < 0)
+    if (s->pacer && _stream_used_len(s))
+	pacer_wait(s->pacer, _stream_used_len(s));
+
+    if ((s->xflags & STREAM_WINDOW))
+    {
+	/* the stream moves its window and sets current and remain */
+	start = _stream_op_start(s);
+	pushed = (s->ops->push)(s);
+	_stream_op_done(s->latency, s->watch, STREAM_OP_PUSH, start);
+	if (pushed < 0)
+	    return -1;
+	s->stats.nblocks++;
+	s->stats.nbytes += pushed;
+	return 0;
+    }
+
+    start = _stream_op_start(s);
+    pushed = (s->ops->push)(s);
+    _stream_op_done(s->latency, s->watch, STREAM_OP_PUSH, start);
+    if (pushed < 0)
 	return -1;
     if (pushed < _stream_used_len(s))
     {
@@ -124,9 +243,15 @@ stream_push(stream_t *s)
 int
 stream_seek(stream_t *s, uint64_t off)
 {
+    uint64_t start;
+    int r;
+
     if (s->ops->seek == 0)
 	return -EOPNOTSUPP;
-    return (*s->ops->seek)(s, off);
+    start = _stream_op_start(s);
+    r = (*s->ops->seek)(s, off);
+    _stream_op_done(s->latency, s->watch, STREAM_OP_SEEK, start);
+    return r;
 }
 
 #if STREAM_UNUSED
@@ -163,65 +288,340 @@ stream_write(stream_t *s, char *buf, int len)
 int
 stream_flush(stream_t *s)
 {
-    if ((s->oflags & O_ACCMODE) != O_RDONLY)
-	return stream_push(s);
+    int r;
+
+    if ((s->oflags & O_ACCMODE) == O_RDONLY)
+	return 0;
+    s->xflags |= STREAM_FLUSHING;
+    r = stream_push(s);
+    s->xflags &= ~STREAM_FLUSHING;
+    return r;
+}
+
+/*
+ * Send length bytes of the file open on fd, starting at offset, to
+ * the stream with sendfile(), so the data goes from the page cache
+ * to the stream without passing through our buffers.  Anything in
+ * the buffer is flushed first.
+ */
+int
+stream_sendfile(stream_t *s, int fd, uint64_t offset, uint64_t length)
+{
+#if HAVE_SENDFILE
+    off_t off = offset;
+    uint64_t start;
+    ssize_t n;
+
+    if (s->current != s->buffer && stream_flush(s) < 0)
+	return -1;
+    while (length)
+    {
+	start = _stream_op_start(s);
+	n = sendfile(s->fd, fd, &off, MIN(length, 1ULL<<30));
+	_stream_op_done(s->latency, s->watch, STREAM_OP_PUSH, start);
+	if (n < 0)
+	{
+	    if (errno == EINTR)
+		continue;
+	    sperror(s, sendfile);
+	    return -1;
+	}
+	if (n == 0)
+	{
+	    fprintf(stderr, "%s: sendfile: unexpected end of file\n", s->name);
+	    return -1;
+	}
+	s->stats.nblocks++;
+	s->stats.nbytes += n;
+	length -= n;
+    }
     return 0;
+#else
+    fprintf(stderr, "%s: sendfile not implemented on this platform\n", s->name);
+    return -1;
+#endif
 }
 
 int
 stream_close(stream_t *s)
 {
+    /* the close frees the stream but not the histograms or the slot */
+    stream_latency_t *lat = s->latency;
+    struct watchdog_slot *ws = s->watch;
+    uint64_t start;
+    int r;
+
     if (stream_flush(s) < 0)
 	return -1;
-    return (*s->ops->close)(s);
+    start = _stream_op_start(s);
+    r = (*s->ops->close)(s);
+    _stream_op_done(lat, ws, STREAM_OP_CLOSE, start);
+    return r;
 }
 
+void
+stream_latency_merge(stream_latency_t *to, const stream_latency_t *from)
+{
+    unsigned int op;
 
+    for (op = 0 ; op < STREAM_NUM_OPS ; op++)
+	histogram_merge(&to->ops[op], &from->ops[op]);
+}
 
+/* the names users know the operations by */
+static const char * const stream_op_names[STREAM_NUM_OPS] =
+    { "read", "write", "seek", "close" };
 
-static int
-mmap_pull(stream_t *s)
+/* the operations which happened */
+void
+stream_emit_latency(const char *prefix, const stream_latency_t *lat)
 {
-    fprintf(stderr, "mmap_pull called\n");
-    return -1;
+    unsigned int op;
+
+    for (op = 0 ; op < STREAM_NUM_OPS ; op++)
+	histogram_emit(prefix, stream_op_names[op], &lat->ops[op]);
 }
 
-static int
-mmap_push(stream_t *s)
+/* likewise, as an object of --json histograms keyed by operation */
+void
+stream_json_latency(json_obj_t *o, const char *key, const stream_latency_t *lat)
 {
-#if 0
-    fprintf(stderr, "mmap_push called\n");
-    exit(1);
-#endif
-    return _stream_used_len(s);
+    unsigned int op;
+
+    json_open_object(o, key);
+    for (op = 0 ; op < STREAM_NUM_OPS ; op++)
+    {
+	if (lat->ops[op].count)
+	    json_add_histogram(o, stream_op_names[op], &lat->ops[op]);
+    }
+    json_close_object(o);
 }
 
-static int
-mmap_seek(stream_t *s, uint64_t off)
+
+
+
+/*
+ * A stream which maps a window of the file at a time, so that very
+ * large files don't need the address space and page tables to map
+ * them whole.  Pulling or pushing moves the window to start at the
+ * page containing the current position, so a record straddling the
+ * end of the window is seen contiguously in the next window, and
+ * unmaps the old window.  Written windows are written back before
+ * they're unmapped, so there is no one giant msync() at the end.
+ */
+typedef struct
 {
-    if (off >= s->bufsize)
-	return -EINVAL;
-    s->current = s->buffer + off;
-    s->remain = s->bufsize - off;
-    return 0;
+    uint64_t window;		/* most bytes to map at once */
+    uint64_t counted;		/* file offset up to which writes are counted */
+    uint64_t wboff[2];		/* the last two windows written back */
+    uint64_t wblen[2];
+    int prot;
+} mmap_window_t;
+
+/* file offset of s->current */
+static inline uint64_t
+_mmap_offset(stream_t *s)
+{
+    return s->pos + (s->current - s->buffer);
 }
 
+/*
+ * Write back a window which is about to be unmapped, and time it.
+ * By default the window is msync()ed.  With STREAM_MMAP_ASYNC the
+ * writeback is only started, and with STREAM_MMAP_WAIT as well we
+ * then wait for the window before last to finish, so only about
+ * three windows of dirty or writeback pages are ever outstanding.
+ * The final window waits for everything.
+ */
 static int
-mmap_close(stream_t *s)
+mmap_writeback(stream_t *s, bool_t final)
 {
+    mmap_window_t *w = s->priv;
+    uint64_t start = time_now();
+    uint64_t elapsed;
     int error = 0;
 
-    if (!(s->xflags & STREAM_NOMSYNC))
+    if (!(s->xflags & STREAM_MMAP_ASYNC) || final)
     {
 	if (msync(s->buffer, s->bufsize, MS_SYNC) < 0)
+	{
+	    error = -errno;
+	    sperror(s, msync);
+	}
+	/* earlier windows may still be under writeback */
+	if ((s->xflags & STREAM_MMAP_ASYNC) && s->fd >= 0 &&
+	    fdatasync(s->fd) < 0)
+	{
+	    error = -errno;
+	    sperror(s, fdatasync);
+	}
+    }
+    else
+    {
+#ifdef HAVE_SYNC_FILE_RANGE
+	if (sync_file_range(s->fd, s->pos, s->bufsize,
+			    SYNC_FILE_RANGE_WRITE) < 0)
+	{
+	    error = -errno;
+	    sperror(s, sync_file_range);
+	}
+	if ((s->xflags & STREAM_MMAP_WAIT) && w->wblen[1] &&
+	    sync_file_range(s->fd, w->wboff[1], w->wblen[1],
+			    SYNC_FILE_RANGE_WAIT_BEFORE|
+			    SYNC_FILE_RANGE_WRITE|
+			    SYNC_FILE_RANGE_WAIT_AFTER) < 0)
+	{
+	    error = -errno;
+	    sperror(s, sync_file_range);
+	}
+#else
+	/* can't wait for part of a file here */
+	if (msync(s->buffer, s->bufsize, MS_ASYNC) < 0)
+	{
+	    error = -errno;
 	    sperror(s, msync);
+	}
+#endif
+	w->wboff[1] = w->wboff[0];
+	w->wblen[1] = w->wblen[0];
+	w->wboff[0] = s->pos;
+	w->wblen[0] = s->bufsize;
     }
 
+    elapsed = time_now() - start;
+    s->stats.nflushes++;
+    s->stats.flushtime += elapsed;
+    s->stats.flushmax = MAX(s->stats.flushmax, elapsed);
+    return error;
+}
+
+static int
+mmap_unmap(stream_t *s, bool_t final)
+{
+    int error = 0;
+
+    if (s->buffer == 0)
+	return 0;
+    if ((s->oflags & O_ACCMODE) != O_RDONLY &&
+	!(s->xflags & STREAM_NOMSYNC))
+	error = mmap_writeback(s, final);
     if (munmap(s->buffer, s->bufsize) < 0)
     {
 	error = -errno;
 	sperror(s, munmap);
     }
+    s->pos = _mmap_offset(s);
+    s->buffer = s->current = 0;
+    s->bufsize = 0;
+    s->remain = 0;
+    return error ? -1 : 0;
+}
+
+/* replace the window with one starting at the page containing off */
+static int
+mmap_map(stream_t *s, uint64_t off)
+{
+    mmap_window_t *w = s->priv;
+    unsigned long page_size = sysconf(_SC_PAGESIZE);
+    uint64_t start = off & ~(uint64_t)(page_size-1);
+    uint64_t len;
+    int mflags = MAP_SHARED;
+    unsigned char *p;
+
+    if (mmap_unmap(s, FALSE) < 0)
+	return -1;
+    s->pos = off;
+    if (start >= s->end)
+	return 0;	/* end of file, no window */
+    len = MIN(w->window + (off - start), s->end - start);
+
+#ifdef MAP_POPULATE
+    if ((s->xflags & STREAM_MMAP_POPULATE))
+	mflags |= MAP_POPULATE;
+#endif
+    p = mmap(0, len, w->prot, mflags, s->fd, start);
+    if (p == MAP_FAILED)
+    {
+	sperror(s, mmap);
+	return -1;
+    }
+#ifdef MADV_SEQUENTIAL
+    if ((s->xflags & STREAM_MMAP_SEQUENTIAL) &&
+	madvise(p, len, MADV_SEQUENTIAL) < 0)
+	sperror(s, madvise);
+#endif
+#ifdef MADV_HUGEPAGE
+    if ((s->xflags & STREAM_MMAP_HUGEPAGE) &&
+	madvise(p, len, MADV_HUGEPAGE) < 0)
+	sperror(s, madvise);
+#endif
+
+    s->pos = start;
+    s->buffer = p;
+    s->bufsize = len;
+    s->current = p + (off - start);
+    s->remain = len - (off - start);
+    return 0;
+}
+
+static int
+mmap_pull(stream_t *s)
+{
+    uint64_t end = s->pos + s->bufsize;
+
+    if (mmap_map(s, _mmap_offset(s)) < 0)
+	return -1;
+    /* the bytes newly available */
+    return s->pos + s->bufsize - MIN(end, s->pos + s->bufsize);
+}
+
+static int
+mmap_push(stream_t *s)
+{
+    mmap_window_t *w = s->priv;
+    uint64_t off = _mmap_offset(s);
+    int pushed = off - w->counted;
+
+    w->counted = off;
+    if (off < s->end)
+    {
+	if (mmap_map(s, off) < 0)
+	    return -1;
+    }
+    else
+    {
+	/* no need for another window when flushing at the end,
+	 * but do the final writeback now so it's in the stats */
+	if (mmap_unmap(s, TRUE) < 0)
+	    return -1;
+    }
+    return pushed;
+}
+
+static int
+mmap_seek(stream_t *s, uint64_t off)
+{
+    mmap_window_t *w = s->priv;
+
+    if (off >= s->end)
+	return -EINVAL;
+    w->counted = off;
+    if (off >= s->pos && off < s->pos + s->bufsize)
+    {
+	s->current = s->buffer + (off - s->pos);
+	s->remain = s->bufsize - (off - s->pos);
+	return 0;
+    }
+    return mmap_map(s, off);
+}
+
+static int
+mmap_close(stream_t *s)
+{
+    int error = 0;
+
+    if (mmap_unmap(s, TRUE) < 0)
+	error = -1;
 
     if (s->fd >= 0 && close(s->fd) < 0)
     {
@@ -229,6 +629,7 @@ mmap_close(stream_t *s)
 	sperror(s, close);
     }
 
+    xfree(s->priv);
     xfree(s->name);
     xfree(s);
     return error ? -1 : 0;
@@ -243,35 +644,36 @@ static stream_ops_t mmap_ops =
 };
 
 stream_t *
-stream_mmap_open(const char *filename, int oflags, int xflags, uint64_t size)
+stream_mmap_open(const char *filename, int oflags, int xflags,
+		 uint64_t offset, uint64_t size, uint64_t window)
 {
     stream_t *s;
-    int prot;
+    mmap_window_t *w;
     unsigned long page_size = sysconf(_SC_PAGESIZE);
     struct stat64 sb;
 
+    s = xmalloc(sizeof(stream_t));
+    s->name = xstrdup(filename);
+    s->ops = &mmap_ops;
+    s->priv = w = xmalloc(sizeof(mmap_window_t));
 
     switch (oflags & O_ACCMODE)
     {
     case O_RDONLY:
-	prot = PROT_READ;
+	w->prot = PROT_READ;
 	break;
     case O_WRONLY:
 	/* mmap() needs the mode to be O_RDWR */
 	oflags &= ~O_ACCMODE;
 	oflags |= O_RDWR;
-	prot = PROT_READ|PROT_WRITE;
+	w->prot = PROT_READ|PROT_WRITE;
 	break;
     default:
 	fprintf(stderr, "stream_mmap_open: invalid access mode\n");
-	return 0;
+	goto failure;
     }
-
-    s = xmalloc(sizeof(stream_t));
-    s->name = xstrdup(filename);
-    s->bufsize = size;
-    s->remain = size;
-    s->ops = &mmap_ops;
+    s->oflags = oflags;
+    s->xflags = xflags | STREAM_WINDOW;
 
     if ((s->fd = open(filename, oflags, 0600)) < 0)
     {
@@ -284,11 +686,11 @@ stream_mmap_open(const char *filename, int oflags, int xflags, uint64_t size)
 	sperror(s, fstat64);
 	goto failure;
     }
-    if (size == 0)
+    if (size == 0 || (size > (uint64_t)sb.st_size && w->prot == PROT_READ))
     {
 	size = sb.st_size;
     }
-    else if (size > sb.st_size)
+    else if (size > (uint64_t)sb.st_size)
     {
 	if (ftruncate64(s->fd, size) < 0)
 	{
@@ -296,18 +698,24 @@ stream_mmap_open(const char *filename, int oflags, int xflags, uint64_t size)
 	    goto failure;
 	}
     }
-    size = (size + page_size-1) & ~(page_size-1);
+    s->end = size;
 
-
-    s->buffer = mmap(0, size, prot, MAP_SHARED, s->fd, /*offset*/0);
-    if (s->buffer == MAP_FAILED)
-    {
-	sperror(s, mmap);
+    /* with --close there's no going back for another window */
+    if (window == 0 || (xflags & STREAM_CLOSE))
+	window = size;
+    w->window = (window + page_size-1) & ~(page_size-1);
+    /* map only from where the caller is going to start */
+    if ((xflags & STREAM_CLOSE))
+	offset = 0;
+    w->counted = offset;
+    if (mmap_map(s, offset) < 0)
 	goto failure;
+    if (w->prot == PROT_READ)
+    {
+	/* count the first window as if it had been pulled */
+	s->stats.nblocks++;
+	s->stats.nbytes += s->remain;
     }
-    s->current = s->buffer;
-    s->oflags = oflags;
-    s->xflags = xflags;
 
     if ((xflags & STREAM_UNLINK) && unlink(filename) < 0)
     {
@@ -328,8 +736,11 @@ stream_mmap_open(const char *filename, int oflags, int xflags, uint64_t size)
     return s;
 
 failure:
+    if (s->buffer)
+	munmap(s->buffer, s->bufsize);
     if (s->fd >= 0)
 	close(s->fd);
+    xfree(s->priv);
     xfree(s->name);
     xfree(s);
     return 0;
@@ -339,7 +750,7 @@ failure:
 static int
 unix_pull(stream_t *s)
 {
-    int n = read(s->fd, _stream_pull_buffer(s), _stream_used_len(s));
+    int n = read(s->fd, _stream_pull_buffer(s), _stream_pull_len(s));
     if (n < 0 && errno != EINTR)
 	sperror(s, read);
     return n;
@@ -351,6 +762,11 @@ unix_push(stream_t *s)
     int64_t retry_sleep_ns = 10000000; /* 10 ms */
     int retries_remaining = 10;
     int n;
+
+    /* an empty write is a no-op, except that on a SOCK_SEQPACKET socket
+     * it sends an empty packet, which the reader takes as the end */
+    if (_stream_used_len(s) == 0)
+	return 0;
     while ((n = write(s->fd, _stream_push_buffer(s), _stream_used_len(s))) < 0)
     {
 	if (errno == EAGAIN &&
@@ -395,7 +811,7 @@ unix_close(stream_t *s)
 	ret = -1;
     }
 
-    xfree(s->buffer);
+    xfree(s->buffer - s->bounce);
     xfree(s->name);
     xfree(s);
 
@@ -421,7 +837,10 @@ stream_unix_dopen_1(const char *name, int fd, int oflags,
     if (bsize == 0)
 	bsize = 4096;	/* simulate dumb stdio defaults */
     s->name = xstrdup(name);
-    s->buffer = xvalloc(bsize);
+    /* readers get a bounce area, a page so the buffer stays aligned */
+    if ((oflags & O_ACCMODE) == O_RDONLY)
+	s->bounce = sysconf(_SC_PAGESIZE);
+    s->buffer = (unsigned char *)xvalloc(s->bounce + bsize) + s->bounce;
     s->bufsize = bsize;
     s->remain = ((oflags & O_ACCMODE) == O_WRONLY) ? bsize : 0;
     s->current = s->buffer;
@@ -456,198 +875,2419 @@ stream_unix_open(const char *filename, int oflags, int xflags, uint64_t bsize)
     return s;
 }
 
-stream_t *
-stream_unix_dopen(int fd, int oflags, int xflags, uint64_t bsize)
+static void
+fd_name(int fd, char *name, size_t len)
 {
-    char name[32];
-
     if (fd == STDIN_FILENO)
 	strcpy(name, "-stdin-");
     else if (fd == STDOUT_FILENO)
 	strcpy(name, "-stdout-");
     else
-	snprintf(name, sizeof(name), "fd%d", fd);
+	snprintf(name, len, "fd%d", fd);
+}
+
+stream_t *
+stream_unix_dopen(int fd, int oflags, int xflags, uint64_t bsize)
+{
+    char name[32];
 
+    fd_name(fd, name, sizeof(name));
     return stream_unix_dopen_1(name, fd, oflags, xflags, bsize, FALSE);
 }
 
+#if HAVE_VMSPLICE
+
+/*
+ * A writing stream which hands its buffers to a pipe with vmsplice()
+ * instead of copying them with write().  The pipe then refers to our
+ * pages until its reader consumes them, so we fill a ring of buffers
+ * in turn, with enough pages in the ring that by the time a buffer
+ * comes round again the pipe can't still hold any of it.  When the
+ * fd isn't a pipe, the data goes through a private pipe and is
+ * spliced on to the fd from there before push returns.
+ */
+#define SPLICE_PIPE_SIZE    (1<<20)	/* the default pipe-max-size */
 
+typedef struct
+{
+    unsigned char *ring;
+    unsigned long slot;		/* bufsize rounded up to whole pages */
+    unsigned int nbufs;
+    unsigned int next;
+    int pipefd[2];		/* private pipe, or -1 */
+} splice_t;
 
 static int
-client_pull(stream_t *s)
+splice_push(stream_t *s)
 {
-    fprintf(stderr, "client_pull called\n");
-    return -1;
+    splice_t *sp = s->priv;
+    int pfd = (sp->pipefd[1] >= 0 ? sp->pipefd[1] : s->fd);
+    int len = _stream_used_len(s);
+    struct iovec iov;
+    ssize_t n, m;
+
+    iov.iov_base = _stream_push_buffer(s);
+    iov.iov_len = len;
+    while (iov.iov_len)
+    {
+	if ((n = vmsplice(pfd, &iov, 1, 0)) < 0)
+	{
+	    if (errno == EINTR)
+		continue;
+	    sperror(s, vmsplice);
+	    return -1;
+	}
+	iov.iov_base = (char *)iov.iov_base + n;
+	iov.iov_len -= n;
+	/* empty the private pipe before anything else happens */
+	while (sp->pipefd[0] >= 0 && n > 0)
+	{
+	    if ((m = splice(sp->pipefd[0], 0, s->fd, 0, n, 0)) < 0)
+	    {
+		if (errno == EINTR)
+		    continue;
+		sperror(s, splice);
+		return -1;
+	    }
+	    n -= m;
+	}
+    }
+
+    /* the pipe may still be holding this buffer, so move on */
+    sp->next = (sp->next + 1) % sp->nbufs;
+    s->buffer = s->current = sp->ring + sp->next * sp->slot;
+    s->remain = s->bufsize;
+    return len;
 }
 
 static int
-client_seek(stream_t *s, uint64_t off)
+splice_close(stream_t *s)
 {
-    if (off >= s->bufsize)
-	return -EINVAL;
-    s->current = s->buffer + off;
-    s->remain = s->bufsize - off;
-    return 0;
+    splice_t *sp = s->priv;
+    int ret = 0;
+
+    if (s->fd >= 0 && close(s->fd) < 0)
+    {
+	sperror(s, close);
+	ret = -1;
+    }
+    if (sp->pipefd[0] >= 0)
+    {
+	close(sp->pipefd[0]);
+	close(sp->pipefd[1]);
+    }
+
+    xfree(sp->ring);
+    xfree(sp);
+    xfree(s->name);
+    xfree(s);
+
+    return ret;
 }
 
-static stream_ops_t client_ops =
+static stream_ops_t splice_ops =
 {
-    client_pull,
-    unix_push,
-    client_seek,
-    unix_close
+    0,
+    splice_push,
+    unix_seek,
+    splice_close
 };
 
-stream_t *
-stream_client_open(const char *hostname, int protocol, int port,
-		   int xflags, int bsize)
+static stream_t *
+stream_splice_dopen_1(const char *name, int fd, int oflags,
+		      int xflags, unsigned long bsize)
 {
-    struct hostent *he;
-    struct sockaddr_in sin;
-    int sock;
-    stream_t *stream;
+    stream_t *s;
+    splice_t *sp;
+    unsigned long page_size = sysconf(_SC_PAGESIZE);
+    struct stat64 sb;
+    int pfd;
+    long psize;
 
-    if ((he = gethostbyname(hostname)) == 0)
+    if ((oflags & O_ACCMODE) != O_WRONLY)
     {
-	herror(hostname);
+	fprintf(stderr, "%s: can only splice when writing\n", name);
 	return 0;
     }
-    if (he->h_addrtype != AF_INET)
+    if (fstat64(fd, &sb) < 0)
     {
-	fprintf(stderr, "%s: bad address type %d\n", hostname, he->h_addrtype);
+	perrorf("fstat64(\"%s\")", name);
+	return 0;
+    }
+    /* a socket would still be sending our pages after we reuse them */
+    if (S_ISSOCK(sb.st_mode))
+    {
+	fprintf(stderr, "%s: cannot splice to a socket\n", name);
 	return 0;
     }
 
-    memset(&sin, 0, sizeof(sin));
-    sin.sin_family = AF_INET;
-    memcpy(&sin.sin_addr, he->h_addr, he->h_length);
-    sin.sin_port = htons(port);
+    s = xmalloc(sizeof(stream_t));
+    s->priv = sp = xmalloc(sizeof(splice_t));
+    sp->pipefd[0] = sp->pipefd[1] = -1;
 
-    assert(protocol == IPPROTO_TCP);
-    sock = socket(PF_INET, SOCK_STREAM, protocol);
-    if (sock < 0)
+    if (bsize == 0)
+	bsize = 4096;
+    s->name = xstrdup(name);
+    s->bufsize = bsize;
+    s->oflags = oflags;
+    s->xflags = xflags | STREAM_WINDOW;
+    s->fd = fd;
+    s->ops = &splice_ops;
+
+    if (!S_ISFIFO(sb.st_mode) && pipe(sp->pipefd) < 0)
     {
-	perrorf("socket");
-	return 0;
+	sperror(s, pipe);
+	goto failure;
     }
+    pfd = (sp->pipefd[1] >= 0 ? sp->pipefd[1] : fd);
 
-    if (connect(sock, (struct sockaddr *)&sin, sizeof(sin)) < 0)
+    /* a bigger pipe means fewer trips, but it's only a hint */
+    psize = fcntl(pfd, F_SETPIPE_SZ, MAX(SPLICE_PIPE_SIZE, bsize));
+    if (psize < 0 && (psize = fcntl(pfd, F_GETPIPE_SZ)) < 0)
     {
-	perrorf("host %s", hostname);
-	close(sock);
+	sperror(s, fcntl);
+	goto failure;
+    }
+
+    /* buffers mustn't share pages, or the pipe holds two at once */
+    sp->slot = (bsize + page_size-1) & ~(page_size-1);
+    sp->nbufs = (psize + sp->slot-1) / sp->slot + 1;
+    sp->ring = xvalloc(sp->nbufs * sp->slot);
+    s->buffer = s->current = sp->ring;
+    s->remain = bsize;
+
+    return s;
+
+failure:
+    s->fd = -1;		/* the caller still owns it */
+    splice_close(s);
+    return 0;
+}
+
+#else
+
+static stream_t *
+stream_splice_dopen_1(const char *name, int fd, int oflags,
+		      int xflags, unsigned long bsize)
+{
+    fprintf(stderr, "%s: splice not implemented on this platform\n", name);
+    return 0;
+}
+
+#endif /* HAVE_VMSPLICE */
+
+stream_t *
+stream_splice_open(const char *filename, int oflags, int xflags, uint64_t bsize)
+{
+    int fd;
+    stream_t *s;
+
+    if ((fd = open(filename, oflags, 0600)) < 0)
+    {
+	perrorf("open(\"%s\")", filename);
+	return 0;
+    }
+    if ((s = stream_splice_dopen_1(filename, fd, oflags, xflags, bsize)) == 0)
+    {
+	close(fd);
+	return 0;
+    }
+    if ((xflags & STREAM_UNLINK) && unlink(filename) < 0)
+    {
+	sperror(s, unlink);
+	(*s->ops->close)(s);
 	return 0;
     }
+    return s;
+}
 
-    stream = stream_unix_dopen_1(he->h_name, sock, O_WRONLY, xflags, bsize, TRUE);
-    stream->ops = &client_ops;
-    return stream;
+stream_t *
+stream_splice_dopen(int fd, int oflags, int xflags, uint64_t bsize)
+{
+    char name[32];
+
+    fd_name(fd, name, sizeof(name));
+    return stream_splice_dopen_1(name, fd, oflags, xflags, bsize);
 }
 
 
+/*
+ * Streams over part of a file which is shared with other streams,
+ * possibly in other threads.  Reads use pread() and writes pwrite(),
+ * which never move the shared file offset, and closing the stream
+ * doesn't close the file descriptor.
+ */
 static int
-server_push(stream_t *s)
+pread_pull(stream_t *s)
 {
-    fprintf(stderr, "server_push called\n");
+    int64_t len = MIN((int64_t)(s->end - s->pos), _stream_pull_len(s));
+    int n;
+
+    if (len <= 0)
+	return 0;
+    n = pread64(s->fd, _stream_pull_buffer(s), len, s->pos);
+    if (n < 0)
+    {
+	if (errno != EINTR)
+	    sperror(s, pread64);
+	return n;
+    }
+    s->pos += n;
+    return n;
+}
+
+static int
+pread_push(stream_t *s)
+{
+    fprintf(stderr, "pread_push called\n");
     return -1;
 }
 
 static int
-server_seek(stream_t *s, uint64_t off)
+pread_seek(stream_t *s, uint64_t off)
 {
-    if (off >= s->bufsize)
-	return -EINVAL;
-    s->current = s->buffer + off;
-    s->remain = s->bufsize - off;
+    s->pos = off;
+    s->current = s->buffer;
+    s->remain = 0;
     return 0;
 }
 
-static stream_ops_t server_ops =
+static int
+pread_close(stream_t *s)
 {
-    unix_pull,
-    server_push,
-    server_seek,
-    unix_close
+    xfree(s->buffer - s->bounce);
+    xfree(s->name);
+    xfree(s);
+    return 0;
+}
+
+static stream_ops_t pread_ops =
+{
+    pread_pull,
+    pread_push,
+    pread_seek,
+    pread_close
 };
 
-stream_t *stream_server_open(int protocol, int port, int xflags, int bsize, const char *port_filename)
+stream_t *
+stream_pread_open(const char *name, int fd, int xflags, uint64_t bsize,
+		  uint64_t offset, uint64_t length)
 {
-    struct sockaddr_in sin;
-    socklen_t slen = sizeof(sin);
-    int rsock, sock;
-    stream_t *stream;
-    int reuse = 1;
+    stream_t *s;
 
-    memset(&sin, 0, sizeof(sin));
-    sin.sin_family = AF_INET;
-    sin.sin_addr.s_addr = INADDR_ANY;
-    sin.sin_port = htons(port);
+    s = stream_unix_dopen_1(name, fd, O_RDONLY, xflags, bsize, FALSE);
+    s->ops = &pread_ops;
+    s->pos = offset;
+    s->end = offset + length;
+    return s;
+}
 
-    assert(protocol == IPPROTO_TCP);
-    rsock = socket(PF_INET, SOCK_STREAM, protocol);
-    if (rsock < 0)
+static int
+pwrite_pull(stream_t *s)
+{
+    fprintf(stderr, "pwrite_pull called\n");
+    return -1;
+}
+
+static int
+pwrite_push(stream_t *s)
+{
+    int64_t retry_sleep_ns = 10000000; /* 10 ms */
+    int retries_remaining = 10;
+    int n;
+    while ((n = pwrite64(s->fd, _stream_push_buffer(s), _stream_used_len(s), s->pos)) < 0)
     {
-	perrorf("socket");
-	return 0;
+	if (errno == EAGAIN &&
+	    (s->xflags & STREAM_RETRY_EAGAIN) &&
+	    --retries_remaining > 0)
+	{
+	    struct timespec delay;
+	    delay.tv_sec = retry_sleep_ns / 1000000000;
+	    delay.tv_nsec = retry_sleep_ns % 1000000000;
+	    nanosleep(&delay, NULL);
+	    retry_sleep_ns *= 2;
+	    continue;
+	}
+	if (errno != EINTR)
+	    sperror(s, pwrite64);
+	return n;
     }
+    s->pos += n;
+    return n;
+}
 
-    if (setsockopt(rsock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0)
+static int
+pwrite_seek(stream_t *s, uint64_t off)
+{
+    if (stream_flush(s) < 0)
+	return -1;
+    s->pos = off;
+    return 0;
+}
+
+static stream_ops_t pwrite_ops =
+{
+    pwrite_pull,
+    pwrite_push,
+    pwrite_seek,
+    pread_close
+};
+
+stream_t *
+stream_pwrite_open(const char *name, int fd, int xflags, uint64_t bsize,
+		   uint64_t offset, uint64_t length)
+{
+    stream_t *s;
+
+    s = stream_unix_dopen_1(name, fd, O_WRONLY, xflags, bsize, FALSE);
+    s->ops = &pwrite_ops;
+    s->pos = offset;
+    s->end = offset + length;
+    return s;
+}
+
+
+#if HAVE_IO_URING
+/*
+ * A stream which keeps up to a queue depth of reads or writes in
+ * flight at once using io_uring, each to its own buffer from a ring
+ * of buffers.  The kernel may complete them in any order, but they
+ * are handed back by stream_pull() and retired by stream_push() in
+ * offset order, so callers see the same sequential stream as from
+ * the unix backend.  The ring is driven with raw system calls rather
+ * than liburing.
+ *
+ * Each buffer is twice the block size.  Reads go into the second
+ * half, which leaves room in front for the bytes left over from the
+ * previous buffer, so that the caller sees them contiguously; writes
+ * are made from the start of the buffer.
+ */
+typedef struct
+{
+    unsigned char *base;
+    uint64_t offset;
+    unsigned int len;
+    int res;
+    bool_t busy;		/* submitted and not yet completed */
+} uring_slot_t;
+
+typedef struct
+{
+    int ring_fd;
+    unsigned int depth;
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_flags;
+    unsigned int *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    unsigned int nsubmit;	/* queued but not yet passed to the kernel */
+    uring_slot_t *slots;
+    unsigned int head;		/* oldest slot in flight */
+    unsigned int nqueued;	/* slots in flight, starting at head */
+    int held;			/* slot holding the caller's data, or -1 */
+    uint64_t next_off;
+} uring_t;
+
+static inline bool_t
+_stream_is_reader(const stream_t *s)
+{
+    return ((s->oflags & O_ACCMODE) == O_RDONLY);
+}
+
+static int
+sys_io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+sys_io_uring_enter(int fd, unsigned int to_submit,
+		   unsigned int min_complete, unsigned int flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		   flags, NULL, 0);
+}
+
+static int
+sys_io_uring_register(int fd, unsigned int opcode, void *arg,
+		      unsigned int nargs)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nargs);
+}
+
+static void
+uring_queue(stream_t *s, unsigned int i)
+{
+    uring_t *u = s->priv;
+    uring_slot_t *slot = &u->slots[i];
+    unsigned int tail = *u->sq_tail;
+    unsigned int idx = tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[idx];
+    bool_t reader = _stream_is_reader(s);
+
+    memset(sqe, 0, sizeof(*sqe));
+    if ((s->xflags & STREAM_URING_REGISTER_BUFFERS))
     {
-	perrorf("setsockopt(SO_REUSEADDR)");
-	close(rsock);
-	return 0;
+	sqe->opcode = (reader ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED);
+	sqe->buf_index = i;
+    }
+    else
+    {
+	sqe->opcode = (reader ? IORING_OP_READ : IORING_OP_WRITE);
     }
+    if ((s->xflags & STREAM_URING_REGISTER_FILES))
+    {
+	sqe->fd = 0;	/* index into the registered files */
+	sqe->flags |= IOSQE_FIXED_FILE;
+    }
+    else
+    {
+	sqe->fd = s->fd;
+    }
+    sqe->addr = (unsigned long)(reader ? slot->base + s->bufsize : slot->base);
+    sqe->len = slot->len;
+    sqe->off = slot->offset;
+    sqe->user_data = i;
+    u->sq_array[idx] = idx;
+    __atomic_store_n(u->sq_tail, tail+1, __ATOMIC_RELEASE);
+
+    slot->busy = TRUE;
+    u->nsubmit++;
+}
 
-    if (bind(rsock, (struct sockaddr *)&sin, sizeof(sin)) < 0)
+static int
+uring_submit(stream_t *s)
+{
+    uring_t *u = s->priv;
+    int n;
+
+    if ((s->xflags & STREAM_URING_SQPOLL))
     {
-	perrorf("bind(%d)", (int)port);
-	close(rsock);
+	/* the kernel thread picks up new entries, if it's awake */
+	u->nsubmit = 0;
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if ((__atomic_load_n(u->sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_NEED_WAKEUP) &&
+	    sys_io_uring_enter(u->ring_fd, 0, 0, IORING_ENTER_SQ_WAKEUP) < 0)
+	{
+	    sperror(s, io_uring_enter);
+	    return -1;
+	}
 	return 0;
     }
 
-    if (port_filename != 0)
+    while (u->nsubmit)
     {
-        socklen_t addr_len = sizeof(sin);
-        int fd;
-        char portbuf[32];
-
-        if (getsockname(rsock, (struct sockaddr *)&sin, &addr_len) < 0)
-        {
-            perrorf("getsockname");
-            close(rsock);
-            return 0;
-        }
-        if ((fd = open(port_filename, O_WRONLY|O_CREAT|O_TRUNC, 0666)) < 0)
-        {
-            perrorf("port file %s", port_filename);
-            close(rsock);
-            return 0;
-        }
-        snprintf(portbuf, sizeof(portbuf), "%d", (int)ntohs(sin.sin_port));
-        portbuf[sizeof(portbuf)-1] = '\0';
-        write_handling_shorts(fd, portbuf, strlen(portbuf));
-        close(fd);
+	if ((n = sys_io_uring_enter(u->ring_fd, u->nsubmit, 0, 0)) < 0)
+	{
+	    if (errno == EINTR)
+		continue;
+	    sperror(s, io_uring_enter);
+	    return -1;
+	}
+	u->nsubmit -= n;
     }
+    return 0;
+}
 
-    if (listen(rsock, 5) < 0)
+static void
+uring_reap(stream_t *s)
+{
+    uring_t *u = s->priv;
+    unsigned int head = *u->cq_head;
+
+    while (head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
     {
-	perrorf("listen");
-	close(rsock);
-	return 0;
+	struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+	uring_slot_t *slot = &u->slots[cqe->user_data];
+
+	slot->res = cqe->res;
+	slot->busy = FALSE;
+	head++;
     }
+    __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+}
 
-    sock = accept(rsock, (struct sockaddr *)&sin, &slen);
-    if (sock < 0)
+/* wait for the slot's I/O to complete */
+static int
+uring_wait(stream_t *s, unsigned int i, bool_t restart)
+{
+    uring_t *u = s->priv;
+
+    if (uring_submit(s) < 0)
+	return -1;
+    for (;;)
     {
-	perrorf("accept");
-	close(rsock);
-	return 0;
+	uring_reap(s);
+	if (!u->slots[i].busy)
+	    return 0;
+	if (sys_io_uring_enter(u->ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0)
+	{
+	    if (errno == EINTR && restart)
+		continue;
+	    if (errno != EINTR)
+		sperror(s, io_uring_enter);
+	    return -1;
+	}
     }
-    close(rsock);
+}
 
-    stream = stream_unix_dopen_1(inet_ntoa(sin.sin_addr), sock, O_RDONLY, xflags, bsize, TRUE);
-    stream->ops = &server_ops;
+/* wait for all the I/O in flight, ignoring the results */
+static void
+uring_drain(stream_t *s)
+{
+    uring_t *u = s->priv;
 
-    return stream;
+    for ( ; u->nqueued ; u->nqueued--)
+    {
+	if (uring_wait(s, u->head, TRUE) < 0)
+	    break;
+	u->head = (u->head + 1) % u->depth;
+    }
+    u->nqueued = 0;
 }
 
+/*
+ * Wait for the oldest write to complete and check its result.  A
+ * short write, as when the disk is nearly full, is a normal
+ * completion, so the rest of the slot is written again until it all
+ * goes or the kernel says why not.
+ */
+static int
+uring_retire(stream_t *s)
+{
+    uring_t *u = s->priv;
+    uring_slot_t *slot = &u->slots[u->head];
+    unsigned char *base = slot->base;
+    int r = 0;
+
+    for (;;)
+    {
+	if (uring_wait(s, u->head, TRUE) < 0)
+	{
+	    slot->base = base;
+	    return -1;
+	}
+	if (slot->res < 0)
+	{
+	    errno = -slot->res;
+	    sperror(s, write);
+	    r = -1;
+	    break;
+	}
+	if (slot->res == 0)
+	{
+	    errno = ENOSPC;
+	    sperror(s, write);
+	    r = -1;
+	    break;
+	}
+	if (slot->res == (int)slot->len)
+	    break;
+	slot->base += slot->res;
+	slot->offset += slot->res;
+	slot->len -= slot->res;
+	uring_queue(s, u->head);
+    }
+    /* the buffer is reused from its start */
+    slot->base = base;
+    u->head = (u->head + 1) % u->depth;
+    u->nqueued--;
+    return r;
+}
+
+static int
+uring_pull(stream_t *s)
+{
+    uring_t *u = s->priv;
+    uring_slot_t *slot = &u->slots[u->head];
+    unsigned char *data = slot->base + s->bufsize;
+
+    /*
+     * The caller is finished with the held buffer except for any
+     * leftover bytes, which stream_pull() has moved to the front of
+     * it.  Move them in front of the next buffer's data, then the
+     * held buffer can be reused.
+     */
+    if (s->remain)
+	memmove(data - s->remain, s->buffer, s->remain);
+    s->stats.ncopied += s->remain;
+    u->held = -1;
+
+    /* keep the queue full */
+    while (u->nqueued < u->depth)
+    {
+	uring_slot_t *next = &u->slots[(u->head + u->nqueued) % u->depth];
+
+	next->offset = u->next_off;
+	next->len = s->bufsize;
+	uring_queue(s, (u->head + u->nqueued) % u->depth);
+	u->next_off += s->bufsize;
+	u->nqueued++;
+    }
+
+    if (uring_wait(s, u->head, FALSE) < 0)
+	return -1;
+    u->held = u->head;
+    u->head = (u->head + 1) % u->depth;
+    u->nqueued--;
+    s->buffer = s->current = data - s->remain;
+
+    if (slot->res < 0)
+    {
+	errno = -slot->res;
+	sperror(s, read);
+	return -1;
+    }
+    if (slot->res < (int)slot->len)
+    {
+	/*
+	 * Short read, e.g. at the end of the file: the reads queued
+	 * after this one are for the wrong offsets, so start again.
+	 */
+	uring_drain(s);
+	u->next_off = slot->offset + slot->res;
+    }
+    return slot->res;
+}
+
+static int
+uring_push(stream_t *s)
+{
+    uring_t *u = s->priv;
+    int64_t len = _stream_used_len(s);
+    unsigned int i = (u->head + u->nqueued) % u->depth;
+
+    if (len == 0)
+	return 0;
+
+    u->slots[i].offset = u->next_off;
+    u->slots[i].len = len;
+    uring_queue(s, i);
+    if (uring_submit(s) < 0)
+	return -1;
+    u->next_off += len;
+    u->nqueued++;
+
+    /* the next buffer to fill is the oldest, once its write is done */
+    if (u->nqueued == u->depth && uring_retire(s) < 0)
+	return -1;
+    s->buffer = u->slots[(u->head + u->nqueued) % u->depth].base;
+    return len;
+}
+
+static int
+uring_seek(stream_t *s, uint64_t off)
+{
+    uring_t *u = s->priv;
+
+    if (!_stream_is_reader(s))
+    {
+	if (stream_flush(s) < 0)
+	    return -1;
+	while (u->nqueued)
+	{
+	    if (uring_retire(s) < 0)
+		return -1;
+	}
+    }
+    else
+    {
+	uring_drain(s);
+	u->held = -1;
+    }
+    u->next_off = off;
+    return 0;
+}
+
+static void
+uring_free(stream_t *s)
+{
+    uring_t *u = s->priv;
+    unsigned int i;
+
+    if (u->sqes)
+	munmap(u->sqes, u->sqes_size);
+    if (u->cq_ring && u->cq_ring != u->sq_ring)
+	munmap(u->cq_ring, u->cq_ring_size);
+    if (u->sq_ring)
+	munmap(u->sq_ring, u->sq_ring_size);
+    if (u->ring_fd >= 0)
+	close(u->ring_fd);
+    for (i = 0 ; i < u->depth ; i++)
+	xfree(u->slots[i].base);
+    xfree(u->slots);
+    xfree(u);
+    xfree(s->name);
+    xfree(s);
+}
+
+static int
+uring_close(stream_t *s)
+{
+    uring_t *u = s->priv;
+    int error = 0;
+
+    if (!_stream_is_reader(s))
+    {
+	while (u->nqueued)
+	{
+	    if (uring_retire(s) < 0)
+		error = -1;
+	}
+    }
+    else
+    {
+	uring_drain(s);
+    }
+
+    if (s->fd >= 0 && close(s->fd) < 0)
+    {
+	error = -errno;
+	sperror(s, close);
+    }
+
+    uring_free(s);
+    return error ? -1 : 0;
+}
+
+static stream_ops_t uring_ops =
+{
+    uring_pull,
+    uring_push,
+    uring_seek,
+    uring_close
+};
+
+static int
+uring_setup(stream_t *s)
+{
+    uring_t *u = s->priv;
+    struct io_uring_params p;
+    unsigned int i;
+
+    memset(&p, 0, sizeof(p));
+    if ((s->xflags & STREAM_URING_SQPOLL))
+    {
+	p.flags |= IORING_SETUP_SQPOLL;
+	p.sq_thread_idle = 1000;	/* milliseconds */
+    }
+    if ((u->ring_fd = sys_io_uring_setup(u->depth, &p)) < 0)
+    {
+	sperror(s, io_uring_setup);
+	return -1;
+    }
+
+    u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    u->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if ((p.features & IORING_FEAT_SINGLE_MMAP))
+    {
+	u->sq_ring_size = u->cq_ring_size = MAX(u->sq_ring_size, u->cq_ring_size);
+    }
+    u->sq_ring = mmap(0, u->sq_ring_size, PROT_READ|PROT_WRITE,
+		      MAP_SHARED|MAP_POPULATE, u->ring_fd, IORING_OFF_SQ_RING);
+    if (u->sq_ring == MAP_FAILED)
+    {
+	u->sq_ring = 0;
+	sperror(s, mmap);
+	return -1;
+    }
+    if ((p.features & IORING_FEAT_SINGLE_MMAP))
+    {
+	u->cq_ring = u->sq_ring;
+    }
+    else
+    {
+	u->cq_ring = mmap(0, u->cq_ring_size, PROT_READ|PROT_WRITE,
+			  MAP_SHARED|MAP_POPULATE, u->ring_fd, IORING_OFF_CQ_RING);
+	if (u->cq_ring == MAP_FAILED)
+	{
+	    u->cq_ring = 0;
+	    sperror(s, mmap);
+	    return -1;
+	}
+    }
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(0, u->sqes_size, PROT_READ|PROT_WRITE,
+		   MAP_SHARED|MAP_POPULATE, u->ring_fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED)
+    {
+	u->sqes = 0;
+	sperror(s, mmap);
+	return -1;
+    }
+
+    u->sq_head = (unsigned int *)((char *)u->sq_ring + p.sq_off.head);
+    u->sq_tail = (unsigned int *)((char *)u->sq_ring + p.sq_off.tail);
+    u->sq_mask = (unsigned int *)((char *)u->sq_ring + p.sq_off.ring_mask);
+    u->sq_flags = (unsigned int *)((char *)u->sq_ring + p.sq_off.flags);
+    u->sq_array = (unsigned int *)((char *)u->sq_ring + p.sq_off.array);
+    u->cq_head = (unsigned int *)((char *)u->cq_ring + p.cq_off.head);
+    u->cq_tail = (unsigned int *)((char *)u->cq_ring + p.cq_off.tail);
+    u->cq_mask = (unsigned int *)((char *)u->cq_ring + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)((char *)u->cq_ring + p.cq_off.cqes);
+
+    if ((s->xflags & STREAM_URING_REGISTER_BUFFERS))
+    {
+	struct iovec *iov = xmalloc(u->depth * sizeof(struct iovec));
+	int r;
+
+	for (i = 0 ; i < u->depth ; i++)
+	{
+	    iov[i].iov_base = u->slots[i].base;
+	    iov[i].iov_len = 2 * s->bufsize;
+	}
+	r = sys_io_uring_register(u->ring_fd, IORING_REGISTER_BUFFERS, iov, u->depth);
+	xfree(iov);
+	if (r < 0)
+	{
+	    sperror(s, io_uring_register);
+	    return -1;
+	}
+    }
+    if ((s->xflags & STREAM_URING_REGISTER_FILES) &&
+	sys_io_uring_register(u->ring_fd, IORING_REGISTER_FILES, &s->fd, 1) < 0)
+    {
+	sperror(s, io_uring_register);
+	return -1;
+    }
+    return 0;
+}
+
+stream_t *
+stream_uring_open(const char *filename, int oflags, int xflags,
+		  uint64_t bsize, unsigned int depth)
+{
+    stream_t *s;
+    uring_t *u;
+    unsigned int i;
+
+    if (bsize == 0)
+	bsize = 4096;	/* same as the unix backend */
+    if (depth == 0)
+	depth = 1;
+
+    s = xmalloc(sizeof(stream_t));
+    s->name = xstrdup(filename);
+    s->bufsize = bsize;
+    s->oflags = oflags;
+    s->xflags = xflags;
+    s->ops = &uring_ops;
+    s->priv = u = xmalloc(sizeof(uring_t));
+    u->ring_fd = -1;
+    u->depth = depth;
+    u->held = -1;
+    u->slots = xmalloc(depth * sizeof(uring_slot_t));
+    for (i = 0 ; i < depth ; i++)
+	u->slots[i].base = xvalloc(2 * bsize);
+    s->buffer = s->current = u->slots[0].base;
+    s->remain = (_stream_is_reader(s) ? 0 : bsize);
+
+    if ((s->fd = open(filename, oflags, 0600)) < 0)
+    {
+	sperror(s, open);
+	goto failure;
+    }
+    if (uring_setup(s) < 0)
+	goto failure;
+    if ((xflags & STREAM_UNLINK) && unlink(filename) < 0)
+    {
+	sperror(s, unlink);
+	goto failure;
+    }
+    return s;
+
+failure:
+    if (s->fd >= 0)
+	close(s->fd);
+    uring_free(s);
+    return 0;
+}
+
+#else
+
+stream_t *
+stream_uring_open(const char *filename, int oflags, int xflags,
+		  uint64_t bsize, unsigned int depth)
+{
+    fprintf(stderr, "%s: io_uring not implemented on this platform\n", filename);
+    return 0;
+}
+
+#endif /* HAVE_IO_URING */
+
+
+/*
+ * A stream which wraps another reading stream, and pulls from it in
+ * a separate thread into a ring of buffers ahead of the caller, so
+ * that reading overlaps with whatever the caller does with the data.
+ * The reader thread is the only producer and the caller the only
+ * consumer, so buffers are handed over by publishing the ring indexes
+ * with atomic stores, and neither side takes a lock.  A side which
+ * finds the ring empty or full sleeps on the other side's index with
+ * a futex, and is only woken if it said it was going to sleep.
+ *
+ * As with the io_uring stream each buffer is twice the block size,
+ * with the data in the second half and room in front for the bytes
+ * left over from the previous buffer.
+ */
+typedef struct
+{
+    unsigned char *base;
+    int res;
+    int error;			/* errno when res < 0 */
+} readahead_slot_t;
+
+typedef struct
+{
+    stream_t *inner;
+    unsigned char *inner_buffer;	/* restored before closing inner */
+    unsigned int nslots;
+    readahead_slot_t *slots;
+    uint32_t head;		/* written only by the caller */
+    uint32_t tail;		/* written only by the reader thread */
+    uint32_t head_waiting;	/* the reader is waiting for head to move */
+    uint32_t tail_waiting;	/* the caller is waiting for tail to move */
+    bool_t stop;
+    bool_t running;
+    pthread_t thread;
+} readahead_t;
+
+/*
+ * Wait until *word is not old, or until woken.  Returns -1 if
+ * interrupted by a signal.
+ */
+static int
+readahead_sleep(uint32_t *word, uint32_t *waiting, uint32_t old)
+{
+    int r = 0;
+
+    __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(word, __ATOMIC_SEQ_CST) == old)
+    {
+#ifdef __linux__
+	r = syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, old, NULL, NULL, 0);
+	if (r < 0 && errno != EINTR)
+	    r = 0;
+#else
+	sched_yield();
+#endif
+    }
+    __atomic_store_n(waiting, 0, __ATOMIC_SEQ_CST);
+    return r;
+}
+
+/* publish a new value of an index, and wake the other side if needed */
+static void
+readahead_publish(uint32_t *word, uint32_t *waiting, uint32_t val)
+{
+    __atomic_store_n(word, val, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST))
+    {
+#ifdef __linux__
+	syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#endif
+    }
+}
+
+static void *
+readahead_thread(void *arg)
+{
+    stream_t *s = arg;
+    readahead_t *ra = s->priv;
+    stream_t *inner = ra->inner;
+    sigset_t sigs;
+
+    /*
+     * Leave signals to the caller's thread.  Closing the stream
+     * cancels this thread, but only while it's blocked pulling
+     * from the inner stream, e.g. from a pipe.
+     */
+    sigfillset(&sigs);
+    pthread_sigmask(SIG_BLOCK, &sigs, 0);
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, 0);
+
+    for (;;)
+    {
+	uint32_t tail = ra->tail;
+	readahead_slot_t *slot;
+	uint32_t head;
+
+	/* one buffer is always held by the caller */
+	while ((head = __atomic_load_n(&ra->head, __ATOMIC_ACQUIRE)) + ra->nslots - 1 == tail &&
+	       !__atomic_load_n(&ra->stop, __ATOMIC_ACQUIRE))
+	{
+	    uint64_t start = time_now();
+	    readahead_sleep(&ra->head, &ra->head_waiting, head);
+	    __atomic_fetch_add(&s->stats.blocked, time_now() - start, __ATOMIC_RELAXED);
+	}
+	if (__atomic_load_n(&ra->stop, __ATOMIC_ACQUIRE))
+	    break;
+
+	slot = &ra->slots[tail % ra->nslots];
+	inner->buffer = inner->current = slot->base + s->bufsize;
+	inner->remain = 0;
+	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, 0);
+	slot->res = (inner->ops->pull)(inner);
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, 0);
+	slot->error = errno;
+	readahead_publish(&ra->tail, &ra->tail_waiting, tail+1);
+	if (slot->res <= 0)
+	    break;	/* end of file or error, the caller will restart us */
+    }
+    return 0;
+}
+
+static int
+readahead_start(stream_t *s)
+{
+    readahead_t *ra = s->priv;
+    int r;
+
+    ra->stop = FALSE;
+    if ((r = pthread_create(&ra->thread, 0, readahead_thread, s)))
+    {
+	errno = r;
+	sperror(s, pthread_create);
+	return -1;
+    }
+    ra->running = TRUE;
+    return 0;
+}
+
+static void
+readahead_stop(stream_t *s)
+{
+    readahead_t *ra = s->priv;
+
+    if (!ra->running)
+	return;
+    __atomic_store_n(&ra->stop, TRUE, __ATOMIC_SEQ_CST);
+#ifdef __linux__
+    syscall(SYS_futex, &ra->head, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#endif
+    pthread_cancel(ra->thread);
+    pthread_join(ra->thread, 0);
+    ra->running = FALSE;
+    /* discard anything read ahead */
+    ra->tail = ra->head;
+}
+
+static int
+readahead_pull(stream_t *s)
+{
+    readahead_t *ra = s->priv;
+    readahead_slot_t *slot;
+    unsigned char *data;
+    uint32_t tail;
+    int res;
+
+    if (!ra->running && readahead_start(s) < 0)
+	return -1;
+
+    slot = &ra->slots[ra->head % ra->nslots];
+    data = slot->base + s->bufsize;
+    while ((tail = __atomic_load_n(&ra->tail, __ATOMIC_ACQUIRE)) == ra->head)
+    {
+	uint64_t start = time_now();
+	int r = readahead_sleep(&ra->tail, &ra->tail_waiting, tail);
+
+	s->stats.starved += time_now() - start;
+	if (r < 0)
+	    return -1;	/* EINTR, like read() */
+    }
+
+    /*
+     * Move any leftover bytes, which stream_pull() has moved to the
+     * front of the buffer we're finished with, in front of the new
+     * data.  Then the old buffer can be handed back to the reader.
+     */
+    if (s->remain)
+	memmove(data - s->remain, s->buffer, s->remain);
+    s->stats.ncopied += s->remain;
+    s->buffer = s->current = data - s->remain;
+    res = slot->res;
+    errno = slot->error;
+    readahead_publish(&ra->head, &ra->head_waiting, ra->head+1);
+
+    if (res <= 0)
+    {
+	/* the reader thread has finished; start another if pulled again */
+	pthread_join(ra->thread, 0);
+	ra->running = FALSE;
+	errno = slot->error;
+    }
+    return res;
+}
+
+static int
+readahead_push(stream_t *s)
+{
+    fprintf(stderr, "readahead_push called\n");
+    return -1;
+}
+
+static int
+readahead_seek(stream_t *s, uint64_t off)
+{
+    readahead_t *ra = s->priv;
+
+    /* data already read ahead is for the wrong offsets */
+    readahead_stop(s);
+    return stream_seek(ra->inner, off);
+}
+
+static int
+readahead_close(stream_t *s)
+{
+    readahead_t *ra = s->priv;
+    unsigned int i;
+    int ret;
+
+    readahead_stop(s);
+    ra->inner->buffer = ra->inner->current = ra->inner_buffer;
+    ra->inner->remain = 0;
+    ret = stream_close(ra->inner);
+
+    for (i = 0 ; i < ra->nslots ; i++)
+	xfree(ra->slots[i].base);
+    xfree(ra->slots);
+    xfree(ra);
+    xfree(s->name);
+    xfree(s);
+    return ret;
+}
+
+static stream_ops_t readahead_ops =
+{
+    readahead_pull,
+    readahead_push,
+    readahead_seek,
+    readahead_close
+};
+
+stream_t *
+stream_readahead_open(stream_t *inner, unsigned int nbufs)
+{
+    stream_t *s;
+    readahead_t *ra;
+    unsigned int i;
+
+    if ((inner->oflags & O_ACCMODE) != O_RDONLY)
+    {
+	fprintf(stderr, "stream_readahead_open: only for reading\n");
+	return 0;
+    }
+    if (nbufs < 2)
+	nbufs = 2;
+
+    s = xmalloc(sizeof(stream_t));
+    s->name = xstrdup(inner->name);
+    s->bufsize = inner->bufsize;
+    s->oflags = inner->oflags;
+    s->xflags = inner->xflags;
+    s->fd = inner->fd;
+    s->ops = &readahead_ops;
+    s->priv = ra = xmalloc(sizeof(readahead_t));
+    ra->inner = inner;
+    ra->inner_buffer = inner->buffer;
+    ra->nslots = nbufs;
+    ra->slots = xmalloc(nbufs * sizeof(readahead_slot_t));
+    for (i = 0 ; i < nbufs ; i++)
+	ra->slots[i].base = xvalloc(2 * s->bufsize);
+    s->buffer = s->current = ra->slots[0].base;
+    return s;
+}
+
+
+static int
+client_pull(stream_t *s)
+{
+    fprintf(stderr, "client_pull called\n");
+    return -1;
+}
+
+static int
+client_seek(stream_t *s, uint64_t off)
+{
+    if (off >= s->bufsize)
+	return -EINVAL;
+    s->current = s->buffer + off;
+    s->remain = s->bufsize - off;
+    return 0;
+}
+
+static stream_ops_t client_ops =
+{
+    client_pull,
+    unix_push,
+    client_seek,
+    unix_close
+};
+
+#if HAVE_MSG_ZEROCOPY
+
+/*
+ * A TCP client stream which sends with MSG_ZEROCOPY, so the kernel
+ * transmits straight from our pages instead of copying them.  The
+ * pages stay in use until the data is acknowledged, which the kernel
+ * tells us with a notification on the socket's error queue, so we
+ * fill a ring of buffers in turn and wait for a buffer's notification
+ * before reusing it.  Each successful send is numbered by the kernel
+ * from zero, and for TCP the notifications arrive in order, so it's
+ * enough to remember the number of the last send from each buffer.
+ * Notifications also say whether the kernel had to copy the data
+ * after all, as it always does over loopback.
+ */
+#define ZEROCOPY_RING_SIZE	(4<<20)	/* a generous send buffer */
+
+typedef struct
+{
+    unsigned char *ring;
+    unsigned long slot;		/* bufsize rounded up to whole pages */
+    unsigned int nbufs;
+    unsigned int next;
+    uint32_t *last;		/* per buffer: sends issued when it was sent */
+    uint32_t nsent;		/* sends issued */
+    uint32_t ndone;		/* sends completed */
+} zerocopy_t;
+
+static inline bool_t
+_zerocopy_busy(const zerocopy_t *zc, unsigned int i)
+{
+    return ((int32_t)(zc->last[i] - zc->ndone) > 0);
+}
+
+/* handle one notification, optionally waiting for it */
+static int
+zerocopy_reap(stream_t *s, bool_t wait)
+{
+    zerocopy_t *zc = s->priv;
+    char control[128];
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    struct sock_extended_err *ee;
+    struct pollfd pfd;
+
+    for (;;)
+    {
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	if (recvmsg(s->fd, &msg, MSG_ERRQUEUE) >= 0)
+	    break;
+	if (errno == EINTR)
+	    continue;
+	if (errno != EAGAIN)
+	{
+	    sperror(s, recvmsg);
+	    return -1;
+	}
+	if (!wait)
+	    return 0;
+	/* POLLERR means something is on the error queue */
+	pfd.fd = s->fd;
+	pfd.events = 0;
+	if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+	{
+	    sperror(s, poll);
+	    return -1;
+	}
+    }
+
+    for (cm = CMSG_FIRSTHDR(&msg) ; cm ; cm = CMSG_NXTHDR(&msg, cm))
+    {
+	ee = (struct sock_extended_err *)CMSG_DATA(cm);
+	if (ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY || ee->ee_errno != 0)
+	    continue;
+	/* completes sends ee_info to ee_data inclusive */
+	if ((ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED))
+	    s->stats.zccopied += ee->ee_data - ee->ee_info + 1;
+	else
+	    s->stats.zcsends += ee->ee_data - ee->ee_info + 1;
+	zc->ndone = ee->ee_data + 1;
+    }
+    return 0;
+}
+
+static int
+zerocopy_push(stream_t *s)
+{
+    zerocopy_t *zc = s->priv;
+    unsigned char *p = _stream_push_buffer(s);
+    int len = _stream_used_len(s);
+    int flags;
+    int done = 0;
+    ssize_t n;
+
+    while (done < len)
+    {
+	/*
+	 * ENOBUFS means too much memory is pinned.  Wait for some
+	 * sends to complete, or if none are in flight, just copy.
+	 */
+	flags = MSG_ZEROCOPY;
+	if ((n = send(s->fd, p + done, len - done, flags)) < 0 &&
+	    errno == ENOBUFS)
+	{
+	    if (zc->nsent != zc->ndone)
+	    {
+		if (zerocopy_reap(s, TRUE) < 0)
+		    return -1;
+		continue;
+	    }
+	    flags = 0;
+	    n = send(s->fd, p + done, len - done, flags);
+	}
+	if (n < 0)
+	{
+	    if (errno == EINTR)
+		continue;
+	    sperror(s, send);
+	    return -1;
+	}
+	done += n;
+	/* only zerocopy sends are numbered */
+	if (flags)
+	    zc->nsent++;
+	else
+	    s->stats.zccopied++;
+    }
+    zc->last[zc->next] = zc->nsent;
+
+    /*
+     * Move on to the next buffer, once the kernel is done with it.
+     * A flush waits for everything, which also completes the stats.
+     */
+    zc->next = (zc->next + 1) % zc->nbufs;
+    while (((s->xflags & STREAM_FLUSHING) && zc->nsent != zc->ndone) ||
+	   _zerocopy_busy(zc, zc->next))
+    {
+	if (zerocopy_reap(s, TRUE) < 0)
+	    return -1;
+    }
+    s->buffer = s->current = zc->ring + zc->next * zc->slot;
+    s->remain = s->bufsize;
+    return len;
+}
+
+static int
+zerocopy_close(stream_t *s)
+{
+    zerocopy_t *zc = s->priv;
+    int ret = 0;
+
+    /* the kernel may still be sending from the ring */
+    while (s->fd >= 0 && zc->nsent != zc->ndone)
+    {
+	if (zerocopy_reap(s, TRUE) < 0)
+	{
+	    ret = -1;
+	    break;
+	}
+    }
+    if (s->fd >= 0 && close(s->fd) < 0)
+    {
+	sperror(s, close);
+	ret = -1;
+    }
+
+    xfree(zc->ring);
+    xfree(zc->last);
+    xfree(zc);
+    xfree(s->name);
+    xfree(s);
+
+    return ret;
+}
+
+static stream_ops_t zerocopy_ops =
+{
+    client_pull,
+    zerocopy_push,
+    client_seek,
+    zerocopy_close
+};
+
+static stream_t *
+stream_zerocopy_dopen(const char *name, int sock, int xflags, unsigned long bsize)
+{
+    stream_t *s;
+    zerocopy_t *zc;
+    unsigned long page_size = sysconf(_SC_PAGESIZE);
+    int one = 1;
+
+    if (setsockopt(sock, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0)
+    {
+	perrorf("setsockopt(SO_ZEROCOPY)");
+	close(sock);
+	return 0;
+    }
+
+    s = xmalloc(sizeof(stream_t));
+    s->priv = zc = xmalloc(sizeof(zerocopy_t));
+
+    if (bsize == 0)
+	bsize = 4096;
+    s->name = xstrdup(name);
+    s->bufsize = bsize;
+    s->oflags = O_WRONLY;
+    s->xflags = xflags | STREAM_WINDOW;
+    s->fd = sock;
+    s->ops = &zerocopy_ops;
+
+    /* buffers mustn't share pages, or reusing one changes another */
+    zc->slot = (bsize + page_size-1) & ~(page_size-1);
+    zc->nbufs = ZEROCOPY_RING_SIZE / zc->slot + 2;
+    zc->ring = xvalloc(zc->nbufs * zc->slot);
+    zc->last = xmalloc(zc->nbufs * sizeof(uint32_t));
+    s->buffer = s->current = zc->ring;
+    s->remain = bsize;
+
+    return s;
+}
+
+#else
+
+static stream_t *
+stream_zerocopy_dopen(const char *name, int sock, int xflags, unsigned long bsize)
+{
+    fprintf(stderr, "%s: MSG_ZEROCOPY not implemented on this platform\n", name);
+    close(sock);
+    return 0;
+}
+
+#endif /* HAVE_MSG_ZEROCOPY */
+
+/*
+ * Returns a socket of the given type connected to the port on the
+ * host, and sets *namep to the host's canonical name.
+ */
+static int
+client_connect(const char *hostname, int type, int protocol, int port,
+	       const char **namep)
+{
+    struct hostent *he;
+    struct sockaddr_in sin;
+    int sock;
+
+    if ((he = gethostbyname(hostname)) == 0)
+    {
+	herror(hostname);
+	return -1;
+    }
+    if (he->h_addrtype != AF_INET)
+    {
+	fprintf(stderr, "%s: bad address type %d\n", hostname, he->h_addrtype);
+	return -1;
+    }
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    memcpy(&sin.sin_addr, he->h_addr, he->h_length);
+    sin.sin_port = htons(port);
+
+    sock = socket(PF_INET, type, protocol);
+    if (sock < 0)
+    {
+	perrorf("socket");
+	return -1;
+    }
+
+    if (connect(sock, (struct sockaddr *)&sin, sizeof(sin)) < 0)
+    {
+	perrorf("host %s", hostname);
+	close(sock);
+	return -1;
+    }
+
+    *namep = he->h_name;
+    return sock;
+}
+
+/*
+ * Unix domain sockets take the cost of the network stack out of local
+ * IPC, and are named by a path in place of a host and port.
+ */
+static int
+unix_socket_address(const char *path, struct sockaddr_un *sun)
+{
+    memset(sun, 0, sizeof(*sun));
+    sun->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(sun->sun_path))
+    {
+	fprintf(stderr, "%s: socket path too long\n", path);
+	return -1;
+    }
+    strcpy(sun->sun_path, path);
+    return 0;
+}
+
+static int
+unix_socket_type(int protocol)
+{
+    return (protocol == PROTOCOL_UNIX_SEQPACKET ? SOCK_SEQPACKET : SOCK_STREAM);
+}
+
+static int
+unix_client_connect(const char *path, int type)
+{
+    struct sockaddr_un sun;
+    int sock;
+
+    if (unix_socket_address(path, &sun) < 0)
+	return -1;
+
+    sock = socket(PF_UNIX, type, 0);
+    if (sock < 0)
+    {
+	perrorf("socket");
+	return -1;
+    }
+
+    if (connect(sock, (struct sockaddr *)&sun, sizeof(sun)) < 0)
+    {
+	perrorf("socket %s", path);
+	close(sock);
+	return -1;
+    }
+    return sock;
+}
+
+stream_t *
+stream_client_open(const char *hostname, int protocol, int port,
+		   int xflags, int bsize)
+{
+    const char *name;
+    int sock;
+    stream_t *stream;
+
+    if (protocol == IPPROTO_UDP)
+	return stream_udp_client_open(hostname, port, xflags, bsize, 0, 0);
+
+    if (IS_UNIX_PROTOCOL(protocol))
+    {
+	/* the hostname is the socket's path */
+	if ((sock = unix_client_connect(hostname, unix_socket_type(protocol))) < 0)
+	    return 0;
+	name = hostname;
+    }
+    else
+    {
+	assert(protocol == IPPROTO_TCP);
+	if ((sock = client_connect(hostname, SOCK_STREAM, protocol, port, &name)) < 0)
+	    return 0;
+    }
+
+    if ((xflags & STREAM_ZEROCOPY))
+	return stream_zerocopy_dopen(name, sock, xflags, bsize);
+
+    stream = stream_unix_dopen_1(name, sock, O_WRONLY, xflags, bsize, TRUE);
+    stream->ops = &client_ops;
+    return stream;
+}
+
+
+static int
+server_push(stream_t *s)
+{
+    fprintf(stderr, "server_push called\n");
+    return -1;
+}
+
+static int
+server_seek(stream_t *s, uint64_t off)
+{
+    if (off >= s->bufsize)
+	return -EINVAL;
+    s->current = s->buffer + off;
+    s->remain = s->bufsize - off;
+    return 0;
+}
+
+static stream_ops_t server_ops =
+{
+    unix_pull,
+    server_push,
+    server_seek,
+    unix_close
+};
+
+/*
+ * A SOCK_SEQPACKET socket delivers each of the client's writes as a
+ * packet, and silently drops whatever part of a packet doesn't fit in
+ * the read, so the buffer must be at least the client's block size.
+ */
+static int
+seqpacket_pull(stream_t *s)
+{
+    int64_t len = _stream_pull_len(s);
+    ssize_t n = recv(s->fd, _stream_pull_buffer(s), len, MSG_TRUNC);
+
+    if (n < 0)
+    {
+	if (errno != EINTR)
+	    sperror(s, recv);
+	return -1;
+    }
+    if (n > len)
+    {
+	fprintf(stderr, "%s: packet of %lld bytes truncated to %lld, "
+			"blocksize must be at least the sender's\n",
+		s->name, (long long)n, (long long)len);
+	return -1;
+    }
+    return n;
+}
+
+static stream_ops_t seqpacket_server_ops =
+{
+    seqpacket_pull,
+    server_push,
+    server_seek,
+    unix_close
+};
+
+/*
+ * Returns a socket of the given type listening at the path, replacing
+ * any socket left there by an earlier server.
+ */
+static int
+unix_server_listen(const char *path, int type)
+{
+    struct sockaddr_un sun;
+    struct stat sb;
+    int rsock;
+
+    if (unix_socket_address(path, &sun) < 0)
+	return -1;
+
+    rsock = socket(PF_UNIX, type, 0);
+    if (rsock < 0)
+    {
+	perrorf("socket");
+	return -1;
+    }
+
+    if (lstat(path, &sb) == 0 && S_ISSOCK(sb.st_mode))
+	unlink(path);
+    if (bind(rsock, (struct sockaddr *)&sun, sizeof(sun)) < 0)
+    {
+	perrorf("bind(\"%s\")", path);
+	close(rsock);
+	return -1;
+    }
+
+    if (listen(rsock, 5) < 0)
+    {
+	perrorf("listen");
+	close(rsock);
+	unlink(path);
+	return -1;
+    }
+    return rsock;
+}
+
+/*
+ * Accepts one connection at the path, which is removed again once the
+ * connection is made, as no other client is expected.
+ */
+stream_t *
+stream_unix_server_open(const char *path, int protocol, int xflags, int bsize)
+{
+    int rsock;
+    int sock;
+    stream_t *stream;
+
+    if ((rsock = unix_server_listen(path, unix_socket_type(protocol))) < 0)
+	return 0;
+    sock = accept(rsock, 0, 0);
+    if (sock < 0)
+	perrorf("accept");
+    close(rsock);
+    unlink(path);
+    if (sock < 0)
+	return 0;
+
+    stream = stream_unix_dopen_1(path, sock, O_RDONLY, xflags, bsize, TRUE);
+    stream->ops = (protocol == PROTOCOL_UNIX_SEQPACKET ?
+		   &seqpacket_server_ops : &server_ops);
+    return stream;
+}
+
+/*
+ * Returns a socket of the given type bound to the port on any address,
+ * and writes the port to port_filename if it's given.
+ */
+static int
+server_bind(int type, int protocol, int port, const char *port_filename)
+{
+    struct sockaddr_in sin;
+    int rsock;
+    int reuse = 1;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = INADDR_ANY;
+    sin.sin_port = htons(port);
+
+    rsock = socket(PF_INET, type, protocol);
+    if (rsock < 0)
+    {
+	perrorf("socket");
+	return -1;
+    }
+
+    if (setsockopt(rsock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0)
+    {
+	perrorf("setsockopt(SO_REUSEADDR)");
+	close(rsock);
+	return -1;
+    }
+
+    if (bind(rsock, (struct sockaddr *)&sin, sizeof(sin)) < 0)
+    {
+	perrorf("bind(%d)", (int)port);
+	close(rsock);
+	return -1;
+    }
+
+    if (port_filename != 0)
+    {
+        socklen_t addr_len = sizeof(sin);
+        int fd;
+        char portbuf[32];
+
+        if (getsockname(rsock, (struct sockaddr *)&sin, &addr_len) < 0)
+        {
+            perrorf("getsockname");
+            close(rsock);
+            return -1;
+        }
+        if ((fd = open(port_filename, O_WRONLY|O_CREAT|O_TRUNC, 0666)) < 0)
+        {
+            perrorf("port file %s", port_filename);
+            close(rsock);
+            return -1;
+        }
+        snprintf(portbuf, sizeof(portbuf), "%d", (int)ntohs(sin.sin_port));
+        portbuf[sizeof(portbuf)-1] = '\0';
+        write_handling_shorts(fd, portbuf, strlen(portbuf));
+        close(fd);
+    }
+    return rsock;
+}
+
+/*
+ * Returns a listening socket, for servers which accept their own
+ * connections as well as those which use stream_server_open().
+ */
+int
+stream_server_listen(int protocol, int port, const char *port_filename,
+		     unsigned int backlog)
+{
+    int rsock;
+
+    assert(protocol == IPPROTO_TCP);
+    if ((rsock = server_bind(SOCK_STREAM, protocol, port, port_filename)) < 0)
+	return -1;
+    if (listen(rsock, MAX(backlog, 5)) < 0)
+    {
+	perrorf("listen");
+	close(rsock);
+	return -1;
+    }
+    return rsock;
+}
+
+static stream_t *
+server_accept(int rsock, int xflags, int bsize)
+{
+    struct sockaddr_in sin;
+    socklen_t slen = sizeof(sin);
+    int sock;
+    stream_t *stream;
+
+    sock = accept(rsock, (struct sockaddr *)&sin, &slen);
+    if (sock < 0)
+    {
+	perrorf("accept");
+	return 0;
+    }
+
+    stream = stream_unix_dopen_1(inet_ntoa(sin.sin_addr), sock, O_RDONLY, xflags, bsize, TRUE);
+    stream->ops = &server_ops;
+
+    return stream;
+}
+
+stream_t *stream_server_open(int protocol, int port, int xflags, int bsize, const char *port_filename)
+{
+    int rsock;
+    stream_t *stream;
+
+    if ((rsock = stream_server_listen(protocol, port, port_filename, 1)) < 0)
+	return 0;
+    stream = server_accept(rsock, xflags, bsize);
+    close(rsock);
+    return stream;
+}
+
+/*
+ * Sets the buffer size of a socket stream in the direction it goes,
+ * beyond the sysctl limit where we're allowed to, and returns the size
+ * the kernel actually gave it, which may be less than asked for.
+ */
+int
+stream_set_socket_buffer(stream_t *s, int size)
+{
+    bool_t reading = ((s->oflags & O_ACCMODE) == O_RDONLY);
+    int opt = (reading ? SO_RCVBUF : SO_SNDBUF);
+    int actual = 0;
+    socklen_t len = sizeof(actual);
+    int r = -1;
+
+#if defined(SO_RCVBUFFORCE) && defined(SO_SNDBUFFORCE)
+    r = setsockopt(s->fd, SOL_SOCKET, (reading ? SO_RCVBUFFORCE : SO_SNDBUFFORCE),
+		   &size, sizeof(size));
+#endif
+    if (r < 0 && setsockopt(s->fd, SOL_SOCKET, opt, &size, sizeof(size)) < 0)
+    {
+	sperror(s, setsockopt);
+	return -1;
+    }
+    if (getsockopt(s->fd, SOL_SOCKET, opt, &actual, &len) < 0)
+    {
+	sperror(s, getsockopt);
+	return -1;
+    }
+    /* Linux doubles the size to allow for its own overhead */
+    if (actual < size)
+	fprintf(stderr, "%s: warning: socket buffer limited to %d bytes\n",
+		s->name, actual);
+    return actual;
+}
+
+/*
+ * With more than one connection, the stream is striped across them:
+ * chunks of stripe bytes of the offset space are sent in turn on each
+ * connection.  Each connection starts with a hello giving its index,
+ * because the order in which connections are accepted needn't be the
+ * order in which they were made, and the number of connections and
+ * stripe size, so the server needn't be told them separately.  A
+ * single connection has no hello, so it's the same as ever.
+ */
+#define STRIPE_MAGIC	0x43535452	/* "CSTR" */
+
+typedef struct
+{
+    uint32_t magic;
+    uint16_t index;
+    uint16_t count;
+    uint32_t stripe_hi;
+    uint32_t stripe_lo;
+} stripe_hello_t;
+
+int
+stream_client_open_many(const char *hostname, int protocol, int port,
+			int xflags, int bsize, stream_t **streams,
+			unsigned int n, uint64_t stripe)
+{
+    stripe_hello_t hello;
+    unsigned int i;
+
+    for (i = 0 ; i < n ; i++)
+    {
+	if ((streams[i] = stream_client_open(hostname, protocol, port,
+					     xflags, bsize)) == 0)
+	    goto failure;
+	if (n == 1)
+	    break;
+	hello.magic = htonl(STRIPE_MAGIC);
+	hello.index = htons(i);
+	hello.count = htons(n);
+	hello.stripe_hi = htonl(stripe >> 32);
+	hello.stripe_lo = htonl(stripe & 0xffffffff);
+	if (write_handling_shorts(streams[i]->fd, (const char *)&hello,
+				  sizeof(hello)) != sizeof(hello))
+	{
+	    sperror(streams[i], write);
+	    i++;
+	    goto failure;
+	}
+    }
+    return 0;
+
+failure:
+    while (i-- > 0)
+	(*streams[i]->ops->close)(streams[i]);
+    return -1;
+}
+
+int
+stream_server_open_many(int protocol, int port, int xflags, int bsize,
+			const char *port_filename, stream_t **streams,
+			unsigned int n, uint64_t *stripep)
+{
+    int rsock;
+    stream_t *s;
+    stripe_hello_t hello;
+    uint64_t stripe;
+    unsigned int i, naccepted = 0;
+
+    memset(streams, 0, n * sizeof(stream_t *));
+    if ((rsock = stream_server_listen(protocol, port, port_filename, n)) < 0)
+	return -1;
+    for ( ; naccepted < n ; naccepted++)
+    {
+	if ((s = server_accept(rsock, xflags, bsize)) == 0)
+	    goto failure;
+	if (n == 1)
+	{
+	    streams[0] = s;
+	    *stripep = 0;
+	    break;
+	}
+	if (recv(s->fd, &hello, sizeof(hello), MSG_WAITALL) != sizeof(hello))
+	{
+	    fprintf(stderr, "%s: no hello from striped connection\n", s->name);
+	    goto bad;
+	}
+	stripe = ((uint64_t)ntohl(hello.stripe_hi) << 32) | ntohl(hello.stripe_lo);
+	i = ntohs(hello.index);
+	if (ntohl(hello.magic) != STRIPE_MAGIC || ntohs(hello.count) != n ||
+	    i >= n || streams[i] != 0 || stripe == 0 ||
+	    (naccepted && stripe != *stripep))
+	{
+	    fprintf(stderr, "%s: bad hello from striped connection "
+			    "(is the client using %u connections?)\n",
+		    s->name, n);
+	    goto bad;
+	}
+	streams[i] = s;
+	*stripep = stripe;
+    }
+    close(rsock);
+    return 0;
+
+bad:
+    (*s->ops->close)(s);
+failure:
+    for (i = 0 ; i < n ; i++)
+    {
+	if (streams[i])
+	    (*streams[i]->ops->close)(streams[i]);
+	streams[i] = 0;
+    }
+    close(rsock);
+    return -1;
+}
+
+#if HAVE_SENDMMSG && HAVE_RECVMMSG
+
+/*
+ * UDP streams carry the data in datagrams of whole records, with no
+ * header because the records say where they belong; the receiver
+ * has to put them back in order itself, see checkstream.  The sender
+ * splits each buffer into datagrams and sends up to UDP_BATCH messages
+ * with each sendmmsg(), and with UDP_SEGMENT each message carries many
+ * datagrams which the kernel segments (GSO).  The receiver takes up to
+ * UDP_BATCH messages with each recvmmsg(), and with UDP_GRO the kernel
+ * may coalesce datagrams into one message, which stream_udp_recv()
+ * splits again.  Zero length datagrams mark the end of the stream.
+ *
+ * For testing receivers, the sender can lose, duplicate or reorder
+ * datagrams on purpose, for which it sends one datagram per message.
+ */
+#define UDP_BATCH		64	/* most messages per syscall */
+#define UDP_MAX_SEGMENTS	64	/* most datagrams per GSO message */
+#define UDP_MAX_MESSAGE		65507	/* biggest UDP payload over IPv4 */
+#define UDP_SLOT		65536	/* receive buffer per message */
+#define UDP_RCVBUF		(8<<20)	/* asked for, the kernel may give less */
+#define UDP_END_MARKERS		3	/* zero length datagrams sent at close */
+
+typedef struct
+{
+    unsigned int dgram;		/* sender: datagram size */
+    unsigned int nsegs;		/* sender: datagrams per message */
+    udp_faults_t faults;
+    uint64_t count;		/* sender: datagrams so far, for faults */
+    int timeout;		/* receiver: idle milliseconds before the end */
+    bool_t started;		/* receiver: a datagram has arrived */
+    bool_t ended;		/* receiver: the end marker has arrived */
+    struct mmsghdr msgs[UDP_BATCH];
+    struct iovec iovs[UDP_BATCH];
+    char control[UDP_BATCH][CMSG_SPACE(sizeof(int))];
+} udp_t;
+
+static int
+udp_sendmmsg(stream_t *s, unsigned int n)
+{
+    udp_t *u = s->priv;
+    unsigned int done = 0;
+    int r;
+
+    while (done < n)
+    {
+	if ((r = sendmmsg(s->fd, u->msgs + done, n - done, 0)) < 0)
+	{
+	    if (errno == EINTR)
+		continue;
+	    sperror(s, sendmmsg);
+	    return -1;
+	}
+	s->stats.nsyscalls++;
+	done += r;
+    }
+    return 0;
+}
+
+/* add a message to the batch, sending the batch when it's full */
+static int
+udp_add(stream_t *s, unsigned int *np, const unsigned char *p, size_t len)
+{
+    udp_t *u = s->priv;
+    unsigned int n = (*np)++;
+
+    u->iovs[n].iov_base = (void *)p;
+    u->iovs[n].iov_len = len;
+    memset(&u->msgs[n], 0, sizeof(u->msgs[n]));
+    u->msgs[n].msg_hdr.msg_iov = &u->iovs[n];
+    u->msgs[n].msg_hdr.msg_iovlen = 1;
+    s->stats.ndatagrams += (len + u->dgram - 1) / u->dgram;
+    if (*np < UDP_BATCH)
+	return 0;
+    *np = 0;
+    return udp_sendmmsg(s, UDP_BATCH);
+}
+
+static int
+udp_push(stream_t *s)
+{
+    udp_t *u = s->priv;
+    const unsigned char *p = _stream_push_buffer(s);
+    size_t len = _stream_used_len(s);
+    const udp_faults_t *f = &u->faults;
+    bool_t faulty = (f->lose || f->duplicate || f->reorder);
+    size_t step = (faulty ? 1 : u->nsegs) * u->dgram;
+    const unsigned char *held = 0;
+    size_t heldlen = 0;
+    size_t off, chunk;
+    unsigned int n = 0;
+    int r = 0;
+
+    for (off = 0 ; r == 0 && off < len ; off += chunk)
+    {
+	chunk = MIN(step, len - off);
+	if (!faulty)
+	{
+	    r = udp_add(s, &n, p + off, chunk);
+	    continue;
+	}
+
+	u->count++;
+	if (f->lose && !(u->count % f->lose))
+	    continue;
+	/* hold the datagram back until after the next one */
+	if (f->reorder && !(u->count % f->reorder) && !held &&
+	    off + chunk < len)
+	{
+	    held = p + off;
+	    heldlen = chunk;
+	    continue;
+	}
+	r = udp_add(s, &n, p + off, chunk);
+	if (r == 0 && f->duplicate && !(u->count % f->duplicate))
+	    r = udp_add(s, &n, p + off, chunk);
+	if (r == 0 && held)
+	{
+	    r = udp_add(s, &n, held, heldlen);
+	    held = 0;
+	}
+    }
+    if (r == 0 && held)
+	r = udp_add(s, &n, held, heldlen);
+    if (r == 0 && n)
+	r = udp_sendmmsg(s, n);
+
+    return (r < 0 ? -1 : (int)len);
+}
+
+static int
+udp_close(stream_t *s)
+{
+    int ret = 0;
+    int i;
+
+    if (s->fd >= 0)
+    {
+	/* the receiver may have gone already, so ignore errors */
+	if ((s->oflags & O_ACCMODE) == O_WRONLY)
+	{
+	    for (i = 0 ; i < UDP_END_MARKERS ; i++)
+		send(s->fd, "", 0, 0);
+	}
+	if (close(s->fd) < 0)
+	{
+	    sperror(s, close);
+	    ret = -1;
+	}
+    }
+
+    xfree(s->buffer);
+    xfree(s->priv);
+    xfree(s->name);
+    xfree(s);
+
+    return ret;
+}
+
+static stream_ops_t udp_client_ops =
+{
+    client_pull,
+    udp_push,
+    client_seek,
+    udp_close
+};
+
+/*
+ * Opens a UDP stream to the port on the host, sending datagrams of
+ * dgram bytes, or DEFAULT_DATAGRAM_SIZE if dgram is 0, with the given
+ * faults if faults isn't 0.
+ */
+stream_t *
+stream_udp_client_open(const char *hostname, int port, int xflags,
+		       uint64_t bsize, unsigned int dgram,
+		       const udp_faults_t *faults)
+{
+    const char *name;
+    int sock;
+    stream_t *s;
+    udp_t *u;
+
+    if ((sock = client_connect(hostname, SOCK_DGRAM, IPPROTO_UDP, port, &name)) < 0)
+	return 0;
+
+    s = xmalloc(sizeof(stream_t));
+    s->priv = u = xmalloc(sizeof(udp_t));
+    u->dgram = (dgram ? dgram : DEFAULT_DATAGRAM_SIZE);
+    u->nsegs = 1;
+    if (faults)
+	u->faults = *faults;
+#if HAVE_UDP_GSO
+    {
+	int gso = u->dgram;
+
+	/* old kernels can't segment, so just send a datagram per message */
+	if (u->dgram * 2 <= UDP_MAX_MESSAGE &&
+	    setsockopt(sock, SOL_UDP, UDP_SEGMENT, &gso, sizeof(gso)) == 0)
+	    u->nsegs = MIN(UDP_MAX_SEGMENTS, UDP_MAX_MESSAGE / u->dgram);
+    }
+#endif
+
+    /* by default, a few batches of messages at a time */
+    if (bsize == 0)
+	bsize = (uint64_t)u->dgram * (u->nsegs > 1 ? u->nsegs * 8 : UDP_BATCH);
+    s->name = xstrdup(name);
+    s->buffer = s->current = xvalloc(bsize);
+    s->bufsize = s->remain = bsize;
+    s->oflags = O_WRONLY;
+    s->xflags = xflags;
+    s->fd = sock;
+    s->ops = &udp_client_ops;
+
+    return s;
+}
+
+static int
+udp_server_pull(stream_t *s)
+{
+    fprintf(stderr, "%s: UDP streams are read with stream_udp_recv()\n", s->name);
+    return -1;
+}
+
+static stream_ops_t udp_server_ops =
+{
+    udp_server_pull,
+    server_push,
+    0,
+    udp_close
+};
+
+/*
+ * Opens a UDP stream receiving on the port.  The stream ends when a
+ * zero length datagram arrives, or when no datagram has arrived for
+ * timeout milliseconds since the first one.
+ */
+stream_t *
+stream_udp_server_open(int port, int xflags, const char *port_filename,
+		       unsigned int timeout)
+{
+    int sock;
+    int size = UDP_RCVBUF;
+    stream_t *s;
+    udp_t *u;
+    unsigned int i;
+
+    if ((sock = server_bind(SOCK_DGRAM, IPPROTO_UDP, port, port_filename)) < 0)
+	return 0;
+    /* the sender doesn't wait for us, so queue as much as we can */
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0)
+	setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+#if HAVE_UDP_GSO
+    {
+	int one = 1;
+
+	/* without it, datagrams are just received one per message */
+	setsockopt(sock, SOL_UDP, UDP_GRO, &one, sizeof(one));
+    }
+#endif
+
+    s = xmalloc(sizeof(stream_t));
+    s->priv = u = xmalloc(sizeof(udp_t));
+    u->timeout = timeout;
+    s->name = xstrdup("udp");
+    s->bufsize = UDP_BATCH * UDP_SLOT;
+    s->buffer = s->current = xvalloc(s->bufsize);
+    s->oflags = O_RDONLY;
+    s->xflags = xflags;
+    s->fd = sock;
+    s->ops = &udp_server_ops;
+
+    for (i = 0 ; i < UDP_BATCH ; i++)
+    {
+	u->iovs[i].iov_base = s->buffer + i * UDP_SLOT;
+	u->iovs[i].iov_len = UDP_SLOT;
+    }
+
+    return s;
+}
+
+/*
+ * Receives the next batch of datagrams, pointing the iovecs at each,
+ * in the stream's buffer until the next call.  Returns the number of
+ * datagrams, 0 at the end of the stream, or -1 on error, or when
+ * interrupted by a signal.  max must allow for UDP_MAX_SEGMENTS
+ * datagrams, which is how many one message can coalesce.
+ */
+int
+stream_udp_recv(stream_t *s, struct iovec *dgrams, unsigned int max)
+{
+    udp_t *u = s->priv;
+    unsigned int nmsgs = MAX(1, MIN(UDP_BATCH, max / UDP_MAX_SEGMENTS));
+    struct sockaddr_in sin;
+    struct pollfd pfd;
+    struct cmsghdr *cm;
+    unsigned int i, n = 0;
+    size_t seg, off, len;
+    int r;
+
+    if (u->ended)
+	return 0;
+
+    pfd.fd = s->fd;
+    pfd.events = POLLIN;
+    if ((r = poll(&pfd, 1, (u->started ? u->timeout : -1))) <= 0)
+    {
+	if (r == 0)
+	    return 0;	    /* the sender's gone quiet */
+	if (errno != EINTR)
+	    sperror(s, poll);
+	return -1;
+    }
+
+    for (i = 0 ; i < nmsgs ; i++)
+    {
+	memset(&u->msgs[i], 0, sizeof(u->msgs[i]));
+	u->msgs[i].msg_hdr.msg_iov = &u->iovs[i];
+	u->msgs[i].msg_hdr.msg_iovlen = 1;
+	u->msgs[i].msg_hdr.msg_control = u->control[i];
+	u->msgs[i].msg_hdr.msg_controllen = sizeof(u->control[i]);
+    }
+    u->msgs[0].msg_hdr.msg_name = &sin;
+    u->msgs[0].msg_hdr.msg_namelen = sizeof(sin);
+    if ((r = recvmmsg(s->fd, u->msgs, nmsgs, MSG_DONTWAIT, 0)) < 0)
+    {
+	if (errno == EAGAIN)
+	    return stream_udp_recv(s, dgrams, max);
+	if (errno != EINTR)
+	    sperror(s, recvmmsg);
+	return -1;
+    }
+    s->stats.nsyscalls++;
+    if (!u->started)
+    {
+	u->started = TRUE;
+	xfree(s->name);
+	s->name = xstrdup(inet_ntoa(sin.sin_addr));
+    }
+
+    for (i = 0 ; i < (unsigned int)r ; i++)
+    {
+	len = u->msgs[i].msg_len;
+	if (len == 0)
+	{
+	    u->ended = TRUE;
+	    break;
+	}
+	/* a coalesced message is split at the sender's datagram size */
+	seg = len;
+	for (cm = CMSG_FIRSTHDR(&u->msgs[i].msg_hdr) ; cm ;
+	     cm = CMSG_NXTHDR(&u->msgs[i].msg_hdr, cm))
+	{
+#if HAVE_UDP_GSO
+	    if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO)
+		seg = *(int *)CMSG_DATA(cm);
+#endif
+	}
+	for (off = 0 ; off < len && n < max ; off += seg)
+	{
+	    dgrams[n].iov_base = (unsigned char *)u->iovs[i].iov_base + off;
+	    dgrams[n].iov_len = MIN(seg, len - off);
+	    n++;
+	}
+	s->stats.nbytes += len;
+    }
+    s->stats.nblocks += n;
+    s->stats.ndatagrams += n;
+
+    return (n ? (int)n : stream_udp_recv(s, dgrams, max));
+}
+
+#else
+
+stream_t *
+stream_udp_client_open(const char *hostname, int port, int xflags,
+		       uint64_t bsize, unsigned int dgram,
+		       const udp_faults_t *faults)
+{
+    fprintf(stderr, "%s: UDP not implemented on this platform\n", hostname);
+    return 0;
+}
+
+stream_t *
+stream_udp_server_open(int port, int xflags, const char *port_filename,
+		       unsigned int timeout)
+{
+    fprintf(stderr, "UDP not implemented on this platform\n");
+    return 0;
+}
+
+int
+stream_udp_recv(stream_t *s, struct iovec *dgrams, unsigned int max)
+{
+    return -1;
+}
+
+#endif /* HAVE_SENDMMSG && HAVE_RECVMMSG */
+
 /* vim: set ts=8 sw=4 sts=4: */
@@ -17,18 +17,45 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
  */
 #include <sys/fcntl.h>
+#include <sys/uio.h>
+#include "histogram.h"
+#include "json.h"
 
 /* this define is used to hide code that isn't ever used without deleting it */
 #define STREAM_UNUSED 0
 
 typedef struct stream stream_t;
 typedef struct stream_ops stream_ops_t;
+struct pacer;
+struct watchdog_slot;
+
+/*
+ * How long each kind of operation took, in nanoseconds.  The
+ * histograms belong to whoever sets stream->latency, so they outlive
+ * the stream's close, and several streams used by one thread, one
+ * after another, can share them.  They aren't locked, so a stream
+ * used by several threads needs its own.
+ */
+typedef enum
+{
+    STREAM_OP_PULL,
+    STREAM_OP_PUSH,
+    STREAM_OP_SEEK,
+    STREAM_OP_CLOSE,
+    STREAM_NUM_OPS
+} stream_op_t;
+
+typedef struct stream_latency
+{
+    histogram_t ops[STREAM_NUM_OPS];
+} stream_latency_t;
 
 struct stream
 {
     char *name;			/* used for error reporting only */
     unsigned char *current;
     unsigned char *buffer;
+    uint64_t bounce;		/* size of bounce area in front of buffer */
     int64_t remain;
     uint64_t bufsize;
     int oflags;
@@ -36,13 +63,41 @@ struct stream
 #define STREAM_CLOSE	(1<<1)
 #define STREAM_NOMSYNC	(1<<2)
 #define STREAM_RETRY_EAGAIN	(1<<3)
+#define STREAM_URING_REGISTER_BUFFERS	(1<<4)
+#define STREAM_URING_REGISTER_FILES	(1<<5)
+#define STREAM_URING_SQPOLL	(1<<6)
+#define STREAM_WINDOW	(1<<7)	/* internal: pull and push move the buffer */
+#define STREAM_MMAP_SEQUENTIAL	(1<<8)
+#define STREAM_MMAP_HUGEPAGE	(1<<9)
+#define STREAM_MMAP_POPULATE	(1<<10)
+#define STREAM_MMAP_ASYNC	(1<<11)	/* start writeback of each window, don't wait */
+#define STREAM_MMAP_WAIT	(1<<12)	/* ...but wait for the window before last */
+#define STREAM_ZEROCOPY	(1<<13)	/* TCP client: send with MSG_ZEROCOPY */
+#define STREAM_FLUSHING	(1<<14)	/* internal: push is from stream_flush() */
     int xflags;
     int fd;
+    uint64_t pos;		/* pread/pwrite streams: file offset of the next pull or push;
+				 * mmap streams: file offset of the buffer */
+    uint64_t end;		/* pread/pwrite/mmap streams: file offset to stop at */
+    void *priv;			/* private state of some backends */
     struct stream_ops *ops;
+    struct pacer *pacer;	/* if set, holds back each push to its rate */
+    stream_latency_t *latency;	/* if set, each operation is timed into it */
+    struct watchdog_slot *watch; /* if set, each operation is watched for stalls */
     struct
     {
 	uint64_t nblocks;   	/* number of blocks read or written */
 	uint64_t nbytes;
+	uint64_t ncopied;	/* bytes moved within the buffer by stream_pull() */
+	uint64_t starved;	/* read-ahead: microseconds the caller waited for data */
+	uint64_t blocked;	/* read-ahead: microseconds the reader waited for space */
+	uint64_t nflushes;	/* mmap: number of windows written back */
+	uint64_t flushtime;	/* mmap: total microseconds spent writing back windows */
+	uint64_t flushmax;	/* mmap: longest writeback of one window, microseconds */
+	uint64_t zcsends;	/* zerocopy: sends completed without copying */
+	uint64_t zccopied;	/* zerocopy: sends the kernel copied anyway */
+	uint64_t ndatagrams;	/* udp: datagrams sent or received */
+	uint64_t nsyscalls;	/* udp: sendmmsg() or recvmmsg() calls */
     } stats;
 };
 
@@ -55,22 +110,76 @@ struct stream_ops
 };
 
 extern stream_t *stream_mmap_open(const char *filename, int oflags,
-				  int xflags, uint64_t bsize);
+				  int xflags, uint64_t offset, uint64_t size,
+				  uint64_t window);
 extern stream_t *stream_unix_open(const char *filename, int oflags,
 				  int xflags, uint64_t bsize);
 extern stream_t *stream_unix_dopen(int fd, int oflags, int xflags, uint64_t bsize);
+extern stream_t *stream_splice_open(const char *filename, int oflags,
+				    int xflags, uint64_t bsize);
+extern stream_t *stream_splice_dopen(int fd, int oflags, int xflags,
+				     uint64_t bsize);
+extern stream_t *stream_pread_open(const char *name, int fd, int xflags,
+				   uint64_t bsize, uint64_t offset,
+				   uint64_t length);
+extern stream_t *stream_pwrite_open(const char *name, int fd, int xflags,
+				    uint64_t bsize, uint64_t offset,
+				    uint64_t length);
+extern stream_t *stream_uring_open(const char *filename, int oflags,
+				   int xflags, uint64_t bsize,
+				   unsigned int depth);
+extern stream_t *stream_readahead_open(stream_t *inner, unsigned int nbufs);
 extern stream_t *stream_client_open(const char *hostname, int protocol,
 				    int port, int xflags, int bsize);
 extern stream_t *stream_server_open(int protocol, int port,
 				    int xflags, int bsize,
                                     const char *port_filename);
+extern int stream_server_listen(int protocol, int port,
+				const char *port_filename,
+				unsigned int backlog);
+extern stream_t *stream_unix_server_open(const char *path, int protocol,
+					 int xflags, int bsize);
+extern int stream_set_socket_buffer(stream_t *s, int size);
+/* UDP datagrams, see stream.c */
+typedef struct
+{
+    unsigned int lose;		/* lose every Nth datagram */
+    unsigned int duplicate;	/* send every Nth datagram twice */
+    unsigned int reorder;	/* send every Nth datagram after the next */
+} udp_faults_t;
+extern stream_t *stream_udp_client_open(const char *hostname, int port,
+					int xflags, uint64_t bsize,
+					unsigned int dgram,
+					const udp_faults_t *faults);
+extern stream_t *stream_udp_server_open(int port, int xflags,
+					const char *port_filename,
+					unsigned int timeout);
+extern int stream_udp_recv(stream_t *s, struct iovec *dgrams,
+			   unsigned int max);
+/* TCP striped across n connections, see stream.c */
+extern int stream_client_open_many(const char *hostname, int protocol,
+				   int port, int xflags, int bsize,
+				   stream_t **streams, unsigned int n,
+				   uint64_t stripe);
+extern int stream_server_open_many(int protocol, int port,
+				   int xflags, int bsize,
+				   const char *port_filename,
+				   stream_t **streams, unsigned int n,
+				   uint64_t *stripe);
 #if STREAM_UNUSED
 extern int stream_read(stream_t *, char *buf, int len);
 extern int stream_write(stream_t *, char *buf, int len);
 #endif
 extern int stream_flush(stream_t *);
+extern int stream_sendfile(stream_t *, int fd, uint64_t offset, uint64_t length);
 extern int stream_seek(stream_t *, uint64_t);
 extern int stream_close(stream_t *);
+extern void stream_latency_merge(stream_latency_t *to,
+				 const stream_latency_t *from);
+extern void stream_emit_latency(const char *prefix,
+				const stream_latency_t *lat);
+extern void stream_json_latency(json_obj_t *o, const char *key,
+				const stream_latency_t *lat);
 
 /* internal functions */
 extern int stream_push(stream_t *s);
@@ -98,6 +207,24 @@ stream_inline_write(stream_t *s, int len)
     return _stream_inline_bytes(s, len);
 }
 
+/*
+ * For readers and writers which can handle many records at once:
+ * the bytes already buffered, which can be read without pulling,
+ * or the space left in the buffer, which can be written without
+ * pushing.
+ */
+static inline const char *
+stream_inline_peek(stream_t *s)
+{
+    return (const char *)s->current;
+}
+
+static inline int64_t
+stream_inline_available(stream_t *s)
+{
+    return s->remain;
+}
+
 static inline const char *
 stream_inline_read(stream_t *s, int len)
 {
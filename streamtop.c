@@ -0,0 +1,321 @@
+/*
+ * Copyright (c) 2021 Greg Banks <gnb@fmeh.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#include "common.h"
+#include "histogram.h"
+#include "shmstats.h"
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+
+/*
+ * Shows the counters which every genstream and checkstream on this
+ * host running with --shm-stats publishes, refreshed like top(1).
+ */
+
+const char *argv0;
+int verbose = 0;
+
+/* one process, as of the last two looks */
+typedef struct
+{
+    shmstats_data_t now;
+    double rate;		/* bytes per second */
+} instance_t;
+
+/* indexed like stream_op_t, named as stream_emit_latency() does */
+static const char * const op_names[SHMSTATS_NUM_OPS] =
+    { "read", "write", "seek", "close" };
+
+static int
+read_segment(const char *shmname, shmstats_data_t *snap)
+{
+    struct stat sb;
+    void *p;
+    int fd;
+    int r;
+
+    /* the process may have finished since the directory was read */
+    if ((fd = shm_open(shmname, O_RDONLY, 0)) < 0)
+	return -1;
+    if (fstat(fd, &sb) < 0 || sb.st_size != sizeof(shmstats_data_t))
+    {
+	close(fd);
+	return -1;
+    }
+    p = mmap(0, sizeof(shmstats_data_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+	return -1;
+    r = shmstats_snapshot(p, snap);
+    munmap(p, sizeof(shmstats_data_t));
+    return r;
+}
+
+static int
+instance_compare(const void *a, const void *b)
+{
+    const instance_t *ia = a, *ib = b;
+
+    return (ia->now.pid < ib->now.pid ? -1 : ia->now.pid > ib->now.pid);
+}
+
+/*
+ * Finds every live process's segment, working out each one's
+ * throughput since the last look at it or, the first time, since it
+ * started.  Segments left behind by processes which died are skipped.
+ */
+static unsigned int
+scan(const instance_t *prev, unsigned int nprev, instance_t **instp)
+{
+    DIR *dir;
+    struct dirent *de;
+    instance_t *inst = 0;
+    unsigned int n = 0, max = 0, i;
+    char shmname[NAME_MAX+2];
+    shmstats_data_t *d;
+    uint64_t since, bytes;
+
+    if ((dir = opendir(SHMSTATS_DIR)) == 0)
+	fatal("%s: %s", SHMSTATS_DIR, strerror(errno));
+    while ((de = readdir(dir)) != 0)
+    {
+	if (strncmp(de->d_name, "checkstream.", 12) &&
+	    strncmp(de->d_name, "genstream.", 10))
+	    continue;
+	if (n == max)
+	{
+	    max = MAX(2 * max, 16);
+	    inst = xrealloc(inst, max * sizeof(instance_t));
+	}
+	d = &inst[n].now;
+	snprintf(shmname, sizeof(shmname), "/%s", de->d_name);
+	if (read_segment(shmname, d) < 0)
+	    continue;
+	if (kill(d->pid, 0) < 0 && errno == ESRCH)
+	    continue;
+
+	since = d->start;
+	bytes = 0;
+	for (i = 0 ; i < nprev ; i++)
+	{
+	    if (prev[i].now.pid == d->pid && prev[i].now.start == d->start)
+	    {
+		since = prev[i].now.updated;
+		bytes = prev[i].now.nbytes;
+		break;
+	    }
+	}
+	if (d->updated > since)
+	    inst[n].rate = (double)(d->nbytes - bytes) / time_double(d->updated - since);
+	else if (i < nprev)
+	    inst[n].rate = prev[i].rate;    /* not updated since */
+	else
+	    inst[n].rate = 0.0;
+	n++;
+    }
+    closedir(dir);
+
+    qsort(inst, n, sizeof(instance_t), instance_compare);
+    *instp = inst;
+    return n;
+}
+
+/* the 99th percentile of the commonest kind of operation */
+static double
+busiest_p99(const shmstats_data_t *d)
+{
+    unsigned int op, busiest = 0;
+
+    for (op = 1 ; op < SHMSTATS_NUM_OPS ; op++)
+	if (d->latency[op].count > d->latency[busiest].count)
+	    busiest = op;
+    if (!d->latency[busiest].count)
+	return 0.0;
+    return histogram_percentile(&d->latency[busiest], 99.0) / 1000.0;
+}
+
+static void
+show_details(const shmstats_data_t *d)
+{
+    unsigned int i;
+    const histogram_t *h;
+
+    /* the first and last failure modes are the valid data and the total */
+    for (i = 1 ; i + 1 < MIN(d->nfailures, SHMSTATS_MAX_FAILURES) ; i++)
+    {
+	if (!d->num_errors[i])
+	    continue;
+	printf("        %-.*s: %llu extents, %llu bytes\n",
+		SHMSTATS_NAMELEN, d->failure_names[i],
+		(unsigned long long)d->num_errors[i],
+		(unsigned long long)d->corrupt_bytes[i]);
+    }
+    for (i = 0 ; i < SHMSTATS_NUM_OPS ; i++)
+    {
+	h = &d->latency[i];
+	if (!h->count)
+	    continue;
+	printf("        %s: %llu ops, p50 %.1f p90 %.1f p99 %.1f "
+	       "p99.9 %.1f max %.1f usec\n",
+		op_names[i],
+		(unsigned long long)h->count,
+		histogram_percentile(h, 50.0) / 1000.0,
+		histogram_percentile(h, 90.0) / 1000.0,
+		histogram_percentile(h, 99.0) / 1000.0,
+		histogram_percentile(h, 99.9) / 1000.0,
+		h->max / 1000.0);
+    }
+}
+
+static void
+show(const instance_t *inst, unsigned int n)
+{
+    unsigned int i;
+    const shmstats_data_t *d;
+    char sizebuf[32];
+    char errbuf[32];
+    double rate = 0.0;
+    uint64_t nerrors = 0;
+
+    printf("%7s %-11s %4s %10s %10s %14s %7s %10s %s\n",
+	   "PID", "PROGRAM", "TAG", "BYTES", "KiB/SEC", "OFFSET",
+	   "ERRORS", "P99_USEC", "NAME");
+    for (i = 0 ; i < n ; i++)
+    {
+	d = &inst[i].now;
+	if (d->nfailures)
+	    snprintf(errbuf, sizeof(errbuf), "%llu", (unsigned long long)d->nerrors);
+	else
+	    strcpy(errbuf, "-");
+	printf("%7u %-11.*s %4llu %10s %10.1f %14llu %7s %10.1f %.*s\n",
+	       d->pid,
+	       SHMSTATS_NAMELEN, d->program,
+	       (unsigned long long)d->tag,
+	       iec_sizestr(d->nbytes, sizebuf, sizeof(sizebuf)),
+	       inst[i].rate / 1024.0,
+	       (unsigned long long)d->offset,
+	       errbuf,
+	       busiest_p99(d),
+	       (int)sizeof(d->name), d->name);
+	if (verbose)
+	    show_details(d);
+	rate += inst[i].rate;
+	nerrors += d->nerrors;
+    }
+    printf("%u processes, %.1f KiB/sec, %llu errors\n",
+	   n, rate / 1024.0, (unsigned long long)nerrors);
+    fflush(stdout);
+}
+
+static const char usage_str[] =
+"Usage: streamtop [options]\n"
+"options are:\n"
+"    -d TIME, --delay=TIME      refresh every TIME (default 1s)\n"
+"    -n N, --iterations=N       stop after N refreshes (default never)\n"
+"    -v, --verbose              show each process's errors by failure mode\n"
+"                               and latency of each kind of operation\n"
+"    -V, --version              print version and exit\n"
+"TIME arguments may be specified as nnn[.nnn][s|ms|us]\n"
+;
+
+static void
+usage(void)
+{
+    fputs(usage_str, stderr);
+    fflush(stderr);	/* JIC */
+    exit(1);
+}
+
+static const struct option longopts[] =
+{
+    {"delay",		required_argument,  NULL, 'd'},
+    {"iterations",	required_argument,  NULL, 'n'},
+    {"verbose",		no_argument,	    NULL, 'v'},
+    {"version",		no_argument,	    NULL, 'V'},
+    {0, 0, 0, 0}
+};
+
+int
+main(int argc, char **argv)
+{
+    uint64_t delay_us = MICROSEC;
+    unsigned long niterations = 0;
+    unsigned long i;
+    instance_t *inst = 0, *prev = 0;
+    unsigned int n = 0, nprev = 0;
+    bool_t clear = isatty(1);
+    struct timespec ts;
+    char *end;
+    int c;
+
+    argv0 = tail(argv[0]);
+    while ((c = getopt_long(argc, argv, "Vd:n:v", longopts, NULL)) != -1)
+    {
+	switch (c)
+	{
+	case 'd':
+	    if (!parse_duration(optarg, &delay_us) || !delay_us)
+		fatal("cannot parse delay \"%s\"", optarg);
+	    break;
+
+	case 'n':
+	    niterations = strtoul(optarg, &end, 0);
+	    if (*end || !niterations)
+		fatal("cannot parse iterations \"%s\"", optarg);
+	    break;
+
+	case 'v':
+	    verbose++;
+	    break;
+
+	case 'V':
+	    fputs("streamtop version " VERSION "\n", stdout);
+	    fflush(stdout);
+	    exit(0);
+
+	default:
+	    usage();
+	}
+    }
+    if (optind != argc)
+	usage();
+
+    for (i = 0 ; !niterations || i < niterations ; i++)
+    {
+	if (i)
+	{
+	    ts.tv_sec = delay_us / MICROSEC;
+	    ts.tv_nsec = (delay_us % MICROSEC) * 1000;
+	    nanosleep(&ts, 0);
+	}
+	n = scan(prev, nprev, &inst);
+	if (clear)
+	    fputs("\033[H\033[2J", stdout);
+	else if (i)
+	    putchar('\n');
+	show(inst, n);
+	xfree(prev);
+	prev = inst;
+	nprev = n;
+    }
+    xfree(prev);
+    return 0;
+}
+
+/* vim: set ts=8 sw=4 sts=4: */
@@ -55,10 +55,13 @@ for file in $input_files ; do
     test_funcs=$(list_symbols $file | egrep '^test(_[a-z][a-zA-Z0-9_]*|[A-Z][a-zA-Z0-9]*$)')
     setup_func=$(list_symbols $file | egrep '^(set_up|setUp)$')
     teardown_func=$(list_symbols $file | egrep '^(tear_down|tearDown)$')
+    for f in $setup_func $teardown_func ; do
+        echo "extern void $f(void); /* $file */" >> $t1
+    done
     for test_func in $test_funcs ; do
         echo "extern void $test_func(void); /* $file */" >> $t1
         if [ -n "$setup_func" -o -n "$teardown_func" ] ; then
-            echo "    {\"$base.$test_func\", $test_func, $setup_func, $teardown_func},"
+            echo "    {\"$base.$test_func\", $test_func, ${setup_func:-0}, ${teardown_func:-0}},"
         else
             echo "    {\"$base.$test_func\", $test_func},"
         fi >> $t2
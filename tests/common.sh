@@ -195,9 +195,10 @@ function assert_logged()
 {
     local msg="$*"
 
-    fgrep "$msg" $_SUBTEST_LOG > /dev/null || fail "log doesn't contain string \"$msg\""
+    fgrep -e "$msg" $_SUBTEST_LOG > /dev/null || fail "log doesn't contain string \"$msg\""
 }
 
 GENSTREAM="../genstream"
 CHECKSTREAM="../checkstream"
+STREAMTOP="../streamtop"
 
@@ -38,4 +38,95 @@ function testBasic()
     assert_success $CHECKSTREAM $f
 }
 
+function testStraddle()
+{
+    local f=tbasic.$SUBTEST.dat
+
+    # 16 byte records straddle the ends of 1000 byte buffers
+    assert_success $GENSTREAM -C 1M $f
+    assert_success $CHECKSTREAM -C -v --blocksize=1000 $f
+    assert_logged "valid data for 1048576 bytes at offset 0"
+    assert_logged "read 1049 blocks 1048576 bytes"
+    # only the 8 bytes of each straddling record are copied
+    assert_logged "copied 4192 bytes within buffers"
+}
+
+function testLatency()
+{
+    local f=tbasic.$SUBTEST.dat
+
+    assert_success $GENSTREAM --blocksize=4K 1M $f
+    assert_logged "write latency p50"
+    assert_logged "close latency p50"
+    assert_success $CHECKSTREAM --blocksize=4K --seek=4K --offset=4K $f
+    assert_logged "read latency p50"
+    assert_logged "seek latency p50"
+    # a single seek is the whole distribution
+    grep -q "seek latency p50 \([0-9.]*\) p90 \1 p99 \1 p99.9 \1 max \1 usec" $_SUBTEST_LOG || \
+	fail "expected all the percentiles of one seek to be the same"
+}
+
+function testInterval()
+{
+    local f=tbasic.$SUBTEST.dat
+    local csv=tbasic.$SUBTEST.csv.dat
+
+    # paced, so the run spans several intervals
+    assert_success $GENSTREAM --rate=16M --interval=50ms --interval-csv=$csv 4M $f
+    [ "$(head -1 $csv)" = "seconds,bytes,records,kib_per_sec,total_bytes,total_kib_per_sec,offset,errors" ] || \
+	fail "expected a CSV header"
+    [ $(wc -l < $csv) -ge 3 ] || fail "expected a row for each interval"
+    # the last row has the totals of the run
+    tail -1 $csv | grep -q "^[0-9.]*,[0-9]*,[0-9]*,[0-9.]*,4194304,[0-9.]*,4194304,0\$" || \
+	fail "expected the last row to total 4194304 bytes"
+    assert_success $CHECKSTREAM --interval=10ms --seek=1M --offset=1M $f
+    assert_logged "3145728 bytes in all"
+    assert_logged "offset 4194304, 0 errors"
+    assert_failure $CHECKSTREAM --interval-csv=$csv $f
+    assert_logged "--interval-csv needs --interval"
+}
+
+function testShmStats()
+{
+    local pid i
+
+    # paced, so streamtop can catch it at work
+    ( $GENSTREAM --rate=1M 2M | $CHECKSTREAM --shm-stats --tag=0 --length=2M ) &
+    sleep 0.2
+    pid=$(pgrep -n -f "checkstream --shm-stats") || fail "expected checkstream to be running"
+    [ -e /dev/shm/checkstream.$pid ] || fail "expected a segment for checkstream $pid"
+    for i in 1 2 3 4 5 6 7 8 9 10 ; do
+	$STREAMTOP -n 1 -v > $_SUBTEST_LOG
+	grep -q "^ *$pid checkstream .* -\$" $_SUBTEST_LOG && break
+	sleep 0.2
+    done
+    grep -q "^ *$pid checkstream .* -\$" $_SUBTEST_LOG || \
+	fail "expected streamtop to show checkstream $pid"
+    assert_logged "processes,"
+    wait
+    [ -e /dev/shm/checkstream.$pid ] && fail "expected the segment to be removed"
+    assert_success $STREAMTOP -n 2 -d 10ms
+    assert_failure $STREAMTOP -n 0
+    assert_logged "cannot parse iterations"
+}
+
+function testPerfCounters()
+{
+    local f=tbasic.$SUBTEST.dat
+    local json=tbasic.$SUBTEST.json.dat
+
+    # the CPU time is there even where perf events aren't allowed
+    assert_success $GENSTREAM --perf-counters 8M $f
+    assert_logged "CPU-seconds per GiB"
+    assert_success $CHECKSTREAM --perf-counters --json=$json $f
+    assert_logged "CPU-seconds per GiB"
+    grep -q '"event":"summary".*"cpu":{"user_seconds":[0-9.e-]*,"sys_seconds":[0-9.e-]*,"cpu_seconds_per_gib":' $json || \
+	fail "expected the CPU time in the summary"
+    if grep -q "perf_event_open" $_SUBTEST_LOG ; then
+	assert_logged "reporting CPU time only"
+    else
+	assert_logged "instructions/record"
+    fi
+}
+
 run_subtests
@@ -94,4 +94,35 @@ function testBadTag()
     assert_logged "cannot parse tag \"$tag\""
 }
 
+function testJson()
+{
+    local f=tcheckerrors.json.dat
+    local gj=tcheckerrors.json.gen.dat
+    local cj=tcheckerrors.json.check.dat
+
+    assert_success $GENSTREAM --json=$gj 1024 $f
+    dd if=/dev/zero of=$f bs=1 count=16 conv=notrunc seek=128
+    assert_failure $CHECKSTREAM --json=$cj $f
+
+    # one object per line, each saying what happened
+    for j in $gj $cj ; do
+	grep -v -q '^{"event":"[a-z]*","time":[0-9.]*,.*}$' $j && \
+	    fail "expected only JSON lines in $j"
+    done
+    grep -q '^{"event":"config",.*"program":"genstream",.*"mode":"file"' $gj || \
+	fail "expected genstream's config"
+    grep -q '^{"event":"summary",.*"blocks":[0-9]*,"bytes":1024,' $gj || \
+	fail "expected genstream's summary"
+    grep -q '^{"event":"config",.*"program":"checkstream",' $cj || \
+	fail "expected checkstream's config"
+    grep -q '^{"event":"extent",.*"failure":"zero data","offset":128,"length":16}' $cj || \
+	fail "expected the zero extent"
+    grep -q '^{"event":"extent",.*"failure":"valid data","offset":144,"length":880}' $cj || \
+	fail "expected the valid extent after it"
+    grep -q '^{"event":"summary",.*"errors":1,.*{"failure":"zero data","extents":1,"bytes":16}' $cj || \
+	fail "expected the summary to count the zero extent"
+    grep -q '^{"event":"summary",.*"latency":{"read":{"count":' $cj || \
+	fail "expected the read latency in the summary"
+}
+
 run_subtests
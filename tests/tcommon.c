@@ -128,10 +128,14 @@ void test_parse_protocol()
 
     /* valid values */
     TESTCASE("tcp", true, IPPROTO_TCP);
+    TESTCASE("udp", true, IPPROTO_UDP);
+    TESTCASE("unix", true, PROTOCOL_UNIX);
+    TESTCASE("unix-seqpacket", true, PROTOCOL_UNIX_SEQPACKET);
 
     /* invalid values */
-    TESTCASE("udp", false, CANARY);
+    TESTCASE("sctp", false, CANARY);
     TESTCASE("foobar", false, CANARY);
+    TESTCASE("unix-dgram", false, CANARY);
 
 #undef TESTCASE
 #undef CANARY
@@ -178,6 +182,43 @@ void test_parse_tcp_port()
 #undef CANARY
 }
 
+void test_parse_duration()
+{
+#define CANARY  ~0ULL
+#define TESTCASE(_str, _expected_return, _expected_us) \
+    { \
+        uint64_t us = CANARY; \
+        assert_equals(parse_duration((_str), &us), _expected_return); \
+        assert_equals(us, _expected_us); \
+    }
+
+    /* null and empty strings fail and don't update the us value */
+    TESTCASE(NULL, false, CANARY);
+    TESTCASE("", false, CANARY);
+    TESTCASE("s", false, CANARY);
+
+    /* seconds by default */
+    TESTCASE("0", true, 0);
+    TESTCASE("2", true, 2000000);
+    TESTCASE("1.5", true, 1500000);
+    TESTCASE("2s", true, 2000000);
+
+    /* smaller units */
+    TESTCASE("250ms", true, 250000);
+    TESTCASE("0.5ms", true, 500);
+    TESTCASE("100us", true, 100);
+
+    /* negative times, bad units and junk after the unit */
+    TESTCASE("-1", false, CANARY);
+    TESTCASE("1 ", false, CANARY);
+    TESTCASE("1m", false, CANARY);
+    TESTCASE("1sec", false, CANARY);
+    TESTCASE("1e30", false, CANARY);
+
+#undef TESTCASE
+#undef CANARY
+}
+
 void test_iec_sizestr(void)
 {
 #define TESTCASE(_size, _expected_result) \
@@ -211,3 +252,36 @@ void test_tail(void)
     assert_str_equals(tail("/tofu/seitan/shoreditch"), "shoreditch");
 }
 
+void test_parse_length_range()
+{
+#define CANARY  ~0ULL
+#define TESTCASE(_str, _expected_return, _expected_min, _expected_max) \
+    { \
+        uint64_t min = CANARY, max = CANARY; \
+        assert_equals(parse_length_range((_str), &min, &max), _expected_return); \
+        assert_equals(min, _expected_min); \
+        assert_equals(max, _expected_max); \
+    }
+
+    /* null and empty strings fail and don't update the values */
+    TESTCASE(NULL, false, CANARY, CANARY);
+    TESTCASE("", false, CANARY, CANARY);
+    TESTCASE("-", false, CANARY, CANARY);
+
+    /* a single size is a range of one */
+    TESTCASE("4K", true, 4096, 4096);
+
+    /* a range */
+    TESTCASE("4K-1M", true, 4096, 1048576);
+    TESTCASE("0-8", true, 0, 8);
+    TESTCASE("8-8", true, 8, 8);
+
+    /* backwards, incomplete or junk */
+    TESTCASE("1M-4K", false, CANARY, CANARY);
+    TESTCASE("4K-", false, CANARY, CANARY);
+    TESTCASE("-4K", false, CANARY, CANARY);
+    TESTCASE("4K-1M-2M", false, CANARY, CANARY);
+
+#undef TESTCASE
+#undef CANARY
+}
@@ -0,0 +1,64 @@
+#include "c_unit_fw.h"
+#include "common.h"
+#include "fileset.h"
+
+static fileset_t fs;
+
+void test_fileset_path(void)
+{
+    char buf[256];
+
+    /* with no depth, all the files are in the directory */
+    fileset_init(&fs, "top", 1000, 0, 16, 4096, 4096, RECORD_MASK);
+    assert_equals(fs.nleaves, 1);
+    fileset_path(&fs, 0, buf, sizeof(buf));
+    assert_str_equals(buf, "top/f00000000");
+    fileset_path(&fs, 999, buf, sizeof(buf));
+    assert_str_equals(buf, "top/f000003e7");
+
+    /* the files are dealt across the leaves, most significant digit first */
+    fileset_init(&fs, "top", 1000, 2, 16, 4096, 4096, RECORD_MASK);
+    assert_equals(fs.nleaves, 256);
+    fileset_path(&fs, 0x11e, buf, sizeof(buf));
+    assert_str_equals(buf, "top/d01/d0e/f0000011e");
+    fileset_path(&fs, 0xff, buf, sizeof(buf));
+    assert_str_equals(buf, "top/d0f/d0f/f000000ff");
+
+    /* there are no more leaves than files */
+    fileset_init(&fs, "top", 10, 3, 256, 4096, 4096, RECORD_MASK);
+    assert_equals(fs.nleaves, 10);
+    fileset_path(&fs, 9, buf, sizeof(buf));
+    assert_str_equals(buf, "top/d00/d00/d09/f00000009");
+}
+
+void test_fileset_size(void)
+{
+    uint64_t i, size, nsmall = 0;
+
+    /* a single size is every file's size, in whole records */
+    fileset_init(&fs, "top", 100, 0, 16, 4100, 4100, RECORD_MASK);
+    assert_equals(fileset_size(&fs, 0), 4096);
+    assert_equals(fileset_size(&fs, 99), 4096);
+
+    /* a range spreads them log-uniformly, the same every time */
+    fileset_init(&fs, "top", 10000, 0, 16, 4096, 1<<20, RECORD_MASK_CREATOR);
+    for (i = 0 ; i < 10000 ; i++)
+    {
+        size = fileset_size(&fs, i);
+        assert_true(size >= 4096 && size <= (1<<20));
+        assert_equals(size & RECORD_MASK_CREATOR, 0);
+        assert_equals(size, fileset_size(&fs, i));
+        if (size < 8192)
+            nsmall++;
+    }
+    /* one octave in eight */
+    assert_true(nsmall > 1000 && nsmall < 1500);
+}
+
+void test_fileset_tag(void)
+{
+    assert_equals(fileset_tag(0, 0), 0);
+    assert_equals(fileset_tag(5, 2), 7);
+    assert_equals(fileset_tag(0xff, 1), 0);
+    assert_equals(fileset_tag(0, 0x1234), 0x34);
+}
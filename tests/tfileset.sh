@@ -0,0 +1,95 @@
+#/bin/bash
+#
+# Tests Copyright (c) 2021 Greg Banks <gnb@fmeh.org>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+. $PWD/common.sh
+
+function tearDown()
+{
+    /bin/rm -rf tfileset.*.dat
+}
+
+function testFlat()
+{
+    local d=tfileset.flat.dat
+
+    assert_success $GENSTREAM --fileset=20 --threads=3 4K $d
+    assert_logged "wrote 20 files in"
+    assert_logged "open latency p50"
+    [ $(ls $d | wc -l) = 20 ] || fail "expected 20 files in $d"
+    [ $(stat -c %s $d/f00000013) = 4096 ] || fail "expected 4096 bytes in $d/f00000013"
+
+    assert_success $CHECKSTREAM --fileset=20 --threads=2 --length=4K $d
+    assert_logged "checked 20 files, 0 with errors"
+    assert_logged "close latency p50"
+    assert_logged "81920/81920 bytes"
+}
+
+function testTree()
+{
+    local d=tfileset.tree.dat
+
+    assert_success $GENSTREAM --fileset=100 --fileset-depth=2 --fileset-fanout=3 --threads=4 -C 1K-64K $d
+    [ -f $d/d02/d01/f00000010 ] || fail "expected file 16 in the 7th directory"
+    [ $(find $d -type d | wc -l) = 13 ] || fail "expected 12 subdirectories"
+
+    assert_success $CHECKSTREAM --fileset=100 --fileset-depth=2 --fileset-fanout=3 --threads=4 -C --length=1K-64K $d
+    assert_logged "checked 100 files, 0 with errors"
+    assert_logged ", no errors"
+
+    # the same files with another depth are all missing
+    assert_failure $CHECKSTREAM --fileset=100 --fileset-depth=1 --fileset-fanout=3 -C --length=1K-64K $d
+    assert_logged "checked 100 files, 100 with errors"
+}
+
+function testFailures()
+{
+    local d=tfileset.fail.dat
+
+    assert_success $GENSTREAM --fileset=10 --tag=5 8K $d
+
+    # another file's data has the other file's tag
+    cp $d/f00000002 $d/f00000003
+    assert_failure $CHECKSTREAM --fileset=10 --tag=5 --length=8K $d
+    assert_logged "f00000003: bad tag for 8192 bytes at offset 0"
+    assert_logged "another file tagged 7"
+    assert_logged "checked 10 files, 1 with errors"
+
+    # a missing file is short for all of it, a truncated one for the rest
+    rm $d/f00000003
+    truncate -s 1000 $d/f00000008
+    assert_failure $CHECKSTREAM --fileset=10 --tag=5 --length=8K $d
+    assert_logged "f00000003: file short for 8192 bytes at offset 0"
+    assert_logged "f00000008: file short for 7192 bytes at offset 1000"
+    assert_logged "checked 10 files, 2 with errors"
+}
+
+function testUsage()
+{
+    assert_failure $GENSTREAM --fileset=10 --rate=1M 4K tfileset.usage.dat
+    assert_logged "cannot be used with"
+    assert_failure $GENSTREAM --fileset-depth=2 4K tfileset.usage.dat
+    assert_logged "need --fileset"
+    assert_failure $GENSTREAM --fileset=10 0-4K tfileset.usage.dat
+    assert_logged "must not be zero"
+    assert_failure $CHECKSTREAM --fileset=10 tfileset.usage.dat
+    assert_logged "needs a directory and --length"
+    assert_failure $CHECKSTREAM --length=4K-8K tfileset.usage.dat
+    assert_logged "a range of lengths needs --fileset"
+}
+
+run_subtests
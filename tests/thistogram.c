@@ -0,0 +1,62 @@
+#include "c_unit_fw.h"
+#include "common.h"
+#include "histogram.h"
+
+static histogram_t h;
+
+void test_histogram_buckets(void)
+{
+    unsigned int b;
+
+    /* small values have a bucket each */
+    assert_equals(histogram_bucket(0), 0);
+    assert_equals(histogram_bucket(15), 15);
+    /* then 16 buckets for each power of two */
+    assert_equals(histogram_bucket(16), 16);
+    assert_equals(histogram_bucket(31), 31);
+    assert_equals(histogram_bucket(32), 32);
+    assert_equals(histogram_bucket(33), 32);
+    assert_equals(histogram_bucket(34), 33);
+    assert_equals(histogram_bucket(~0ULL), HISTOGRAM_NBUCKETS-1);
+
+    /* each bucket ends just before the next begins */
+    for (b = 0 ; b < HISTOGRAM_NBUCKETS-1 ; b++)
+    {
+        assert_equals(histogram_bucket(histogram_bucket_max(b)), b);
+        assert_equals(histogram_bucket(histogram_bucket_max(b) + 1), b + 1);
+    }
+    assert_equals(histogram_bucket_max(HISTOGRAM_NBUCKETS-1), ~0ULL);
+}
+
+void test_histogram_percentiles(void)
+{
+    histogram_t h2;
+    uint64_t v;
+
+    histogram_init(&h);
+    assert_equals(histogram_percentile(&h, 50.0), 0);
+
+    for (v = 1 ; v <= 1000 ; v++)
+        histogram_add(&h, v * 1000);
+    assert_equals(h.count, 1000);
+    assert_equals(h.max, 1000000);
+
+    /* each is the top of its bucket, within about 6% */
+    v = histogram_percentile(&h, 50.0);
+    assert_true(v >= 500000 && v <= 500000 + 500000/16);
+    v = histogram_percentile(&h, 99.0);
+    assert_true(v >= 990000 && v <= 990000 + 990000/16);
+    /* but never beyond the largest value */
+    assert_equals(histogram_percentile(&h, 100.0), 1000000);
+    assert_equals(histogram_percentile(&h, 99.99), 1000000);
+    /* the smallest value is in the bucket 992..1023 */
+    assert_equals(histogram_percentile(&h, 0.0), 1023);
+
+    /* merging is the same as adding them all to one */
+    histogram_init(&h2);
+    histogram_add(&h2, 5000000);
+    histogram_merge(&h, &h2);
+    assert_equals(h.count, 1001);
+    assert_equals(h.max, 5000000);
+    assert_equals(histogram_percentile(&h, 100.0), 5000000);
+}
@@ -0,0 +1,58 @@
+#include "c_unit_fw.h"
+#include "common.h"
+#include "json.h"
+
+/* the members after the event's name and time */
+static const char *
+members(const json_obj_t *o)
+{
+    const char *p = strstr(o->buf, "\"time\":");
+
+    assert_true(p != 0);
+    p += strspn(p + 7, "0123456789.") + 7;
+    return p;
+}
+
+void test_json_members(void)
+{
+    json_obj_t o;
+
+    json_begin(&o, "extent");
+    assert_true(!strncmp(o.buf, "{\"event\":\"extent\",\"time\":", 25));
+    json_add_str(&o, "name", "a \"b\"\\c\n");
+    json_add_uint(&o, "offset", 18446744073709551615ULL);
+    json_add_double(&o, "rate", 0.5);
+    json_add_double(&o, "nan", 0.0 / 0.0);
+    json_add_bool(&o, "creator", FALSE);
+    json_add_str(&o, "path", 0);
+    assert_str_equals(members(&o),
+	",\"name\":\"a \\\"b\\\"\\\\c\\u000a\""
+	",\"offset\":18446744073709551615"
+	",\"rate\":0.5,\"nan\":null,\"creator\":false,\"path\":null");
+    xfree(o.buf);
+}
+
+void test_json_nesting(void)
+{
+    json_obj_t o;
+    histogram_t h;
+
+    json_begin(&o, "summary");
+    json_open_array(&o, "failures");
+    json_open_object(&o, 0);
+    json_add_uint(&o, "bytes", 1);
+    json_close_object(&o);
+    json_open_object(&o, 0);
+    json_close_object(&o);
+    json_close_array(&o);
+    histogram_init(&h);
+    json_add_histogram(&o, "empty", &h);
+    histogram_add(&h, 2000);
+    json_add_histogram(&o, "one", &h);
+    assert_str_equals(members(&o),
+	",\"failures\":[{\"bytes\":1},{}]"
+	",\"empty\":{\"count\":0}"
+	",\"one\":{\"count\":1,\"p50_us\":2,\"p90_us\":2,\"p99_us\":2,"
+	"\"p99.9_us\":2,\"max_us\":2}");
+    xfree(o.buf);
+}
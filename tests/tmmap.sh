@@ -48,4 +48,60 @@ function testMmap()
     assert_success $CHECKSTREAM -M $fM
 }
 
+param_testWindow="4K 12K 64K"
+
+function testWindow()
+{
+    local window="$1"
+    local f=tmmap.sync.dat
+    local fM=tmmap.window.dat
+
+    # records straddle the window boundaries
+    assert_success $GENSTREAM -T 5 --seek=4100 1000000 $f
+    assert_success $GENSTREAM -M --mmap-window=$window -T 5 --seek=4100 1000000 $fM
+    cmp $f $fM || fail "files differ"
+
+    assert_success $CHECKSTREAM -M --mmap-window=$window --mmap-sequential -T 5 --seek=4100 $fM
+    assert_logged "valid data for 1000000 bytes at offset 4100"
+    assert_logged "1000000/1000000 bytes"
+
+    # only the given range
+    assert_success $CHECKSTREAM -M --mmap-window=$window -T 5 --seek=8196 --length=50000 $fM
+    assert_logged "valid data for 50000 bytes at offset 8196"
+}
+
+param_testWriteback="sync async async-wait"
+
+function testWriteback()
+{
+    local mode="$1"
+    local f=tmmap.sync.dat
+    local fM=tmmap.writeback.dat
+    local args
+
+    case "$mode" in
+    async-wait) args="--mmap-writeback=async --mmap-writeback-wait" ;;
+    *) args="--mmap-writeback=$mode" ;;
+    esac
+
+    assert_success $GENSTREAM -T 5 1000000 $f
+    assert_success $GENSTREAM -M --mmap-window=64K $args -T 5 1000000 $fM
+    cmp $f $fM || fail "files differ"
+    # 1000000 bytes is 16 windows of 64K, each written back once
+    assert_logged "wrote back 16 windows"
+
+    assert_success $CHECKSTREAM -M -T 5 $fM
+    assert_logged "1000000/1000000 bytes"
+}
+
+function testNeedsMmap()
+{
+    assert_failure $CHECKSTREAM --mmap-populate tmmap.none.dat
+    assert_logged "need --mmap"
+    assert_failure $GENSTREAM --mmap-writeback=async 1000 tmmap.none.dat
+    assert_logged "need --mmap"
+    assert_failure $GENSTREAM -M --mmap-writeback-wait 1000 tmmap.none.dat
+    assert_logged "needs --mmap-writeback=async"
+}
+
 run_subtests
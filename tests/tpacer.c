@@ -0,0 +1,97 @@
+#include "c_unit_fw.h"
+#include "common.h"
+#include "pacer.h"
+
+#define MS      1000000ULL      /* nanoseconds */
+#define T0      (1000 * NANOSEC)
+
+static pacer_t p;
+
+/* schedules n bytes at now, returning how long they're held back */
+static uint64_t schedule(uint64_t now, uint64_t n)
+{
+    uint64_t deadline = pacer_schedule(&p, now, n);
+    return (deadline > now ? deadline - now : 0);
+}
+
+void test_pacer_steady(void)
+{
+    unsigned int i;
+
+    /* 1 MB/s, with a burst of one 1000 byte block */
+    pacer_init(&p, 1000000, 1000);
+
+    /* the first block goes at once, each after that 1 ms after the last */
+    assert_equals(schedule(T0, 1000), 0);
+    assert_equals(schedule(T0, 1000), 0);
+    assert_equals(schedule(T0, 1000), 1 * MS);
+    /* each waking at the last one's deadline */
+    for (i = 3 ; i < 100 ; i++)
+        assert_equals(schedule(T0 + (i-2) * MS, 1000), 1 * MS);
+    assert_equals(p.nbytes, 100000);
+}
+
+void test_pacer_no_drift(void)
+{
+    unsigned int i;
+    uint64_t now = T0;
+
+    pacer_init(&p, 1000000, 1000);
+
+    /* waking late every time doesn't push the schedule back */
+    for (i = 0 ; i < 1000 ; i++)
+        now = pacer_schedule(&p, now, 1000) + 50000;
+    assert_equals(p.tat, T0 + 1000 * MS);
+}
+
+void test_pacer_falling_behind(void)
+{
+    pacer_init(&p, 1000000, 4000);
+
+    assert_equals(schedule(T0, 1000), 0);
+    /* after a second idle, only the burst goes at once, not a second's worth */
+    assert_equals(schedule(T0 + 1000 * MS, 4000), 0);
+    assert_equals(schedule(T0 + 1000 * MS, 1000), 0);
+    assert_equals(schedule(T0 + 1000 * MS, 1000), 1 * MS);
+}
+
+void test_pacer_duty_cycle(void)
+{
+    pacer_init(&p, 1000000, 1000);
+    p.peak_rate = 4000000;
+    p.on_ns = 100 * MS;
+    p.off_ns = 300 * MS;
+
+    assert_equals(pacer_rate_at(&p, 0), 4000000);
+    p.start = T0;
+    assert_equals(pacer_rate_at(&p, T0), 4000000);
+    assert_equals(pacer_rate_at(&p, T0 + 99 * MS), 4000000);
+    assert_equals(pacer_rate_at(&p, T0 + 100 * MS), 1000000);
+    assert_equals(pacer_rate_at(&p, T0 + 399 * MS), 1000000);
+    assert_equals(pacer_rate_at(&p, T0 + 400 * MS), 4000000);
+
+    /* without a peak rate, the off phase is silent */
+    p.peak_rate = 0;
+    assert_equals(pacer_rate_at(&p, T0 + 50 * MS), 1000000);
+    assert_equals(pacer_rate_at(&p, T0 + 150 * MS), 0);
+    p.start = 0;
+    p.tat = 0;
+
+    /* 100 blocks fill the on phase, the next waits for the next one */
+    assert_equals(schedule(T0, 1000), 0);
+    p.tat = T0 + 100 * MS;
+    assert_equals(schedule(T0 + 99 * MS, 1000), 301 * MS);
+}
+
+void test_pacer_ramp(void)
+{
+    pacer_init(&p, 1000000, 1000);
+    p.ramp_ns = 1000 * MS;
+    p.start = T0;
+
+    /* from 1% of the rate to all of it over the ramp */
+    assert_equals(pacer_rate_at(&p, T0), 10000);
+    assert_equals(pacer_rate_at(&p, T0 + 500 * MS), 500000);
+    assert_equals(pacer_rate_at(&p, T0 + 1000 * MS), 1000000);
+    assert_equals(pacer_rate_at(&p, T0 + 5000 * MS), 1000000);
+}
@@ -0,0 +1,92 @@
+#/bin/bash
+#
+# Tests Copyright (c) 2021 Greg Banks <gnb@fmeh.org>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+. $PWD/common.sh
+
+function tearDown()
+{
+    /bin/rm -f tpacing.*.dat
+}
+
+# runs the command, failing unless it takes at least the given milliseconds
+function assert_takes_at_least()
+{
+    local min_ms="$1"
+    shift
+    local start=$(date +%s%N)
+
+    assert_success "$@"
+    local ms=$[ ($(date +%s%N) - start) / 1000000 ]
+    echo "took $ms milliseconds"
+    [ $ms -ge $min_ms ] || fail "took only $ms milliseconds, expected at least $min_ms"
+}
+
+function testRate()
+{
+    local f=tpacing.rate.dat
+
+    # 1 MiB at 4 MiB/sec, one 64K block ahead of the rate
+    assert_takes_at_least 200 $GENSTREAM --rate=4M -b 64K 1M $f
+    assert_logged "pacing: "
+    assert_logged "against a target of 4 MiB/sec"
+    assert_success $CHECKSTREAM $f
+    assert_logged "1048576/1048576 bytes"
+}
+
+function testSplice()
+{
+    # the splice ring moves its window on each push, but is still paced
+    assert_takes_at_least 200 $GENSTREAM --splice --rate=4M -b 64K 1M \| $CHECKSTREAM -l 1M
+    assert_logged "1048576 bytes"
+}
+
+function testBurst()
+{
+    # a burst as big as the stream lets it all go at once
+    assert_success $GENSTREAM --rate=1K --burst=1M -b 64K 1M tpacing.burst.dat
+    assert_logged ", 0 waits, "
+}
+
+function testDutyCycle()
+{
+    # 64K in each 100ms on phase, then 200ms off, so at least 3 cycles
+    assert_takes_at_least 600 $GENSTREAM --rate=640K --duty-cycle=100ms:200ms -b 4K 256K tpacing.duty.dat
+    # or twice the rate in the on phase, so the off phase takes longer
+    assert_takes_at_least 300 $GENSTREAM --rate=256K --peak-rate=2M --duty-cycle=100ms:1 -b 4K 384K tpacing.peak.dat
+}
+
+function testRamp()
+{
+    # at 4 MiB/sec 512K would take 125ms, but starting from 1% of that
+    # the first half of the ramp only gets through about a quarter of it
+    assert_takes_at_least 250 $GENSTREAM --rate=4M --ramp=500ms -b 16K 512K tpacing.ramp.dat
+}
+
+function testUsage()
+{
+    assert_failure $GENSTREAM --burst=1M 1M tpacing.usage.dat
+    assert_logged "need --rate"
+    assert_failure $GENSTREAM --rate=1M --peak-rate=2M 1M tpacing.usage.dat
+    assert_logged "needs --duty-cycle"
+    assert_failure $GENSTREAM --rate=1M --duty-cycle=1 1M tpacing.usage.dat
+    assert_logged "cannot parse duty cycle"
+    assert_failure $GENSTREAM --rate=1M --threads=2 1M tpacing.usage.dat
+    assert_logged "cannot use --rate with"
+}
+
+run_subtests
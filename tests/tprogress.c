@@ -0,0 +1,53 @@
+#include "c_unit_fw.h"
+#include "common.h"
+#include "stream.h"
+#include "progress.h"
+
+#define T0      (1000 * NANOSEC)
+
+static uint32_t nerrors;
+
+static uint32_t
+get_errors(void)
+{
+    return nerrors;
+}
+
+void test_progress_csv(void)
+{
+    progress_t p;
+    stream_t s1, s2, *ss[2] = { &s1, &s2 };
+    char *buf = 0;
+    size_t len = 0;
+    FILE *csv;
+
+    csv = open_memstream(&buf, &len);
+    progress_init(&p, NANOSEC, csv, 16, get_errors);
+    p.t0 = p.last = T0;
+    memset(&s1, 0, sizeof(s1));
+    memset(&s2, 0, sizeof(s2));
+
+    /* each interval reports the bytes since the last, and the offset */
+    progress_watch(&p, ss, 1, 4096);
+    s1.stats.nbytes = 1024 * 1024;
+    progress_report(&p, T0 + NANOSEC);
+    s1.stats.nbytes += 512 * 1024;
+    nerrors = 2;
+    progress_report(&p, T0 + 2 * NANOSEC);
+
+    /* the bytes of streams no longer watched still count in the totals */
+    progress_unwatch(&p);
+    s1.stats.nbytes = 1024 * 1024;
+    s2.stats.nbytes = 1024 * 1024;
+    progress_watch(&p, ss, 2, 0);
+    progress_report(&p, T0 + 4 * NANOSEC);
+
+    progress_destroy(&p);
+    fclose(csv);
+    assert_str_equals(buf,
+	"seconds,bytes,records,kib_per_sec,total_bytes,total_kib_per_sec,offset,errors\n"
+	"1.000,1048576,65536,1024.0,1048576,1024.0,1052672,0\n"
+	"2.000,524288,32768,512.0,1572864,768.0,1576960,2\n"
+	"4.000,2097152,131072,1024.0,3670016,896.0,2097152,2\n");
+    free(buf);
+}
@@ -0,0 +1,75 @@
+#/bin/bash
+#
+# Tests Copyright (c) 2021 Greg Banks <gnb@fmeh.org>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+#
+
+. $PWD/common.sh
+
+function tearDown()
+{
+    /bin/rm -f treadahead.*.dat
+}
+
+# the report without the timing dependent lines
+function report()
+{
+    egrep -v 'seconds|latency|read-ahead|reading ahead' $_SUBTEST_LOG
+}
+
+param_testSameReport="2 3 16"
+
+function testSameReport()
+{
+    local nbufs="$1"
+    local f=treadahead.corrupt.dat
+
+    $GENSTREAM -C 1M $f > /dev/null 2>&1 || fail "genstream failed"
+    dd if=/dev/zero of=$f bs=1 seek=5000 count=300 conv=notrunc 2>/dev/null
+    printf 'U' | dd of=$f bs=1 seek=$[8192*3+5] conv=notrunc 2>/dev/null
+
+    for v in "" "-v" "-vv" ; do
+        assert_failure $CHECKSTREAM -C $v $f
+        report > treadahead.sync.report.dat
+        assert_failure $CHECKSTREAM -C $v --read-ahead=$nbufs $f
+        report > treadahead.ahead.report.dat
+        cmp treadahead.sync.report.dat treadahead.ahead.report.dat || fail "reports differ with $v"
+    done
+    assert_logged "read-ahead: checker starved for"
+}
+
+function testFilter()
+{
+    assert_success $GENSTREAM -T 3 1000000 \| $CHECKSTREAM -T 3 --read-ahead=4 --length=1000000
+    assert_logged "1000000/1000000 bytes"
+    assert_logged "reader blocked for"
+}
+
+function testShort()
+{
+    assert_success $GENSTREAM 100000 treadahead.short.dat
+    assert_failure $CHECKSTREAM --length=200000 --read-ahead=4 treadahead.short.dat
+    assert_logged "valid data for 100000 bytes at offset 0"
+    assert_logged "file short for 8 bytes at offset 100000"
+}
+
+function testNotMmap()
+{
+    assert_failure $CHECKSTREAM --read-ahead=4 --mmap treadahead.none.dat
+    assert_logged "cannot use --read-ahead with"
+}
+
+run_subtests
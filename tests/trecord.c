@@ -0,0 +1,308 @@
+#include "c_unit_fw.h"
+#include "common.h"
+#include "record.h"
+
+#define NREC    259     /* not a multiple of any vector width */
+
+/* this mirrors the record generation code in genstream */
+static void make_record(const record_format_t *fmt, record_t *rec, uint64_t off)
+{
+    memset(rec, 0, sizeof(*rec));
+    if (fmt->tag_flag)
+    {
+        rec->w8[2] = fmt->tag;
+        rec->w8[3] = (off >> 32) & 0xff;
+    }
+    else
+    {
+        rec->w16[1] = htons((off >> 32) & 0xffff);
+    }
+    rec->w32[1] = htonl(off & 0xffffffff);
+    if (fmt->creator_flag)
+    {
+        rec->w32[2] = htonl(fmt->creator >> 32);
+        rec->w32[3] = htonl(fmt->creator & 0xffffffff);
+        rec->w16[0] = aligned_ip_checksum_7(&rec->w16[1]);
+    }
+    else
+    {
+        rec->w16[0] = aligned_ip_checksum_3(&rec->w16[1]);
+    }
+}
+
+static void make_records(const record_format_t *fmt, unsigned char *buf,
+                         size_t nrec, uint64_t off)
+{
+    record_t rec;
+    size_t i;
+
+    for (i = 0 ; i < nrec ; i++)
+    {
+        make_record(fmt, &rec, off + i * fmt->size);
+        memcpy(buf + i * fmt->size, &rec, fmt->size);
+    }
+}
+
+static void init_format(record_format_t *fmt, int layout)
+{
+    record_format_init(fmt,
+                       /*tag_flag*/(layout & 1), /*tag*/0xa5,
+                       /*creator_flag*/(layout & 2) >> 1,
+                       /*creator*/0x0123456789abcdefULL);
+}
+#define NLAYOUTS    4
+
+static size_t check_with(const char *impl, const record_format_t *fmt,
+                         const unsigned char *buf, size_t nrec, uint64_t off)
+{
+    assert_true(record_impl_select(impl));
+    return record_check_block(fmt, buf, nrec, off);
+}
+
+void tear_down(void)
+{
+    record_impl_select(0);
+}
+
+void test_record_impls(void)
+{
+    /* there is always a scalar implementation, and it's always supported */
+    assert_true(record_impl_find("scalar") != 0);
+    assert_true(record_impl_select("scalar"));
+    assert_str_equals(record_impl_name(), "scalar");
+    assert_true(!record_impl_select("no-such-impl"));
+    assert_str_equals(record_impl_name(), "scalar");
+    assert_true(record_impl_select("auto"));
+    assert_true(record_impl_select(0));
+}
+
+void test_record_check_valid(void)
+{
+    static const uint64_t offsets[] = { 0, 8, 4096, 0xfffff000ULL, 0x12345678f0ULL };
+    unsigned char buf[NREC * RECORD_SIZE_CREATOR + 1];
+    const record_impl_t *impl;
+    record_format_t fmt;
+    int layout;
+    unsigned int oi;
+
+    for (layout = 0 ; layout < NLAYOUTS ; layout++)
+    {
+        init_format(&fmt, layout);
+        for (oi = 0 ; oi < sizeof(offsets)/sizeof(offsets[0]) ; oi++)
+        {
+            uint64_t off = offsets[oi] & ~(uint64_t)(fmt.size - 1);
+
+            for (impl = record_impls ; impl->name ; impl++)
+            {
+                if (!impl->supported())
+                    continue;
+                /* both aligned and unaligned buffers */
+                make_records(&fmt, buf, NREC, off);
+                assert_equals(check_with(impl->name, &fmt, buf, NREC, off), (size_t)NREC);
+                make_records(&fmt, buf+1, NREC, off);
+                assert_equals(check_with(impl->name, &fmt, buf+1, NREC, off), (size_t)NREC);
+                /* every length, to exercise the tails */
+                assert_equals(check_with(impl->name, &fmt, buf+1, 0, off), (size_t)0);
+                assert_equals(check_with(impl->name, &fmt, buf+1, 1, off), (size_t)1);
+                assert_equals(check_with(impl->name, &fmt, buf+1, 7, off), (size_t)7);
+                assert_equals(check_with(impl->name, &fmt, buf+1, 9, off), (size_t)9);
+                /* the wrong starting offset fails on the first record */
+                assert_equals(check_with(impl->name, &fmt, buf+1, NREC, off+fmt.size), (size_t)0);
+            }
+        }
+    }
+}
+
+enum { C_BITFLIP, C_ZERO, C_OFFSET, C_TAG, C_CREATOR, C_NUM };
+
+static void corrupt(const record_format_t *fmt, unsigned char *p,
+                    uint64_t off, int how)
+{
+    record_format_t other = *fmt;
+    record_t rec;
+
+    switch (how)
+    {
+    case C_BITFLIP:
+        p[random() % fmt->size] ^= (1 << (random() % 8));
+        return;
+    case C_ZERO:
+        memset(p, 0, fmt->size);
+        return;
+    case C_OFFSET:
+        off += fmt->size * (1 + random() % 1000);
+        break;
+    case C_TAG:
+        other.tag++;
+        break;
+    case C_CREATOR:
+        other.creator ^= 1ULL << (random() % 64);
+        break;
+    }
+    make_record(&other, &rec, off);
+    memcpy(p, &rec, fmt->size);
+}
+
+void test_record_check_equivalence(void)
+{
+    unsigned char buf[NREC * RECORD_SIZE_CREATOR];
+    const record_impl_t *impl;
+    record_format_t fmt;
+    int layout, how, iter;
+    uint64_t off = 0x100000000ULL - 64 * RECORD_SIZE_CREATOR;
+
+    srandom(42);
+    for (layout = 0 ; layout < NLAYOUTS ; layout++)
+    {
+        init_format(&fmt, layout);
+        for (how = 0 ; how < C_NUM ; how++)
+        {
+            for (iter = 0 ; iter < 200 ; iter++)
+            {
+                size_t bad = random() % NREC;
+                size_t expected;
+
+                make_records(&fmt, buf, NREC, off);
+                corrupt(&fmt, buf + bad * fmt.size, off + bad * fmt.size, how);
+                /* sometimes corrupt a second, later, record */
+                if (iter & 1)
+                {
+                    size_t bad2 = bad + random() % (NREC - bad);
+                    corrupt(&fmt, buf + bad2 * fmt.size, off + bad2 * fmt.size, how);
+                }
+                expected = check_with("scalar", &fmt, buf, NREC, off);
+
+                for (impl = record_impls ; impl->name ; impl++)
+                {
+                    if (impl->supported())
+                        assert_equals(check_with(impl->name, &fmt, buf, NREC, off), expected);
+                }
+            }
+        }
+    }
+}
+
+void test_record_check_checksum_alias(void)
+{
+    /*
+     * In ones-complement arithmetic both 0x0000 and 0xffff are
+     * zero, so there are two checksum values which pass.  At this
+     * offset genstream writes 0x0000, and 0xffff must pass too.
+     */
+    unsigned char buf[16 * RECORD_SIZE];
+    const record_impl_t *impl;
+    record_format_t fmt;
+    uint64_t off = 0xffff0000ULL;
+    record_t *rec = (record_t *)buf;
+
+    init_format(&fmt, 0);
+    make_records(&fmt, buf, 16, off);
+    assert_equals(rec->w16[0], 0);
+    rec->w16[0] = 0xffff;
+
+    for (impl = record_impls ; impl->name ; impl++)
+    {
+        if (impl->supported())
+            assert_equals(check_with(impl->name, &fmt, buf, 16, off), (size_t)16);
+    }
+}
+
+void test_record_check_offset_limit(void)
+{
+    /*
+     * Tagged records only have room for a 40 bit offset, so
+     * records beyond 1 TiB must be reported as bad even though
+     * the bits which are present match.
+     */
+    unsigned char buf[16 * RECORD_SIZE];
+    const record_impl_t *impl;
+    record_format_t fmt;
+    uint64_t off = (1ULL << 40) - 8 * RECORD_SIZE;
+
+    init_format(&fmt, 1);
+    make_records(&fmt, buf, 16, off);
+
+    for (impl = record_impls ; impl->name ; impl++)
+    {
+        if (impl->supported())
+            assert_equals(check_with(impl->name, &fmt, buf, 16, off), (size_t)8);
+    }
+}
+
+void test_record_fill_equivalence(void)
+{
+    unsigned char expected[NREC * RECORD_SIZE_CREATOR + 1];
+    unsigned char actual[NREC * RECORD_SIZE_CREATOR + 1];
+    const record_impl_t *impl;
+    record_format_t fmt;
+    int layout, iter;
+
+    srandom(17);
+    for (layout = 0 ; layout < NLAYOUTS ; layout++)
+    {
+        init_format(&fmt, layout);
+        for (iter = 0 ; iter < 200 ; iter++)
+        {
+            /* random seek offsets, some of them close to 2^32 */
+            uint64_t off = ((uint64_t)random() << ((iter & 1) ? 8 : 0)) & ~(uint64_t)(fmt.size - 1);
+            size_t nrec = random() % NREC;
+            size_t skew = iter & 1;
+
+            make_records(&fmt, expected + skew, nrec, off);
+            for (impl = record_impls ; impl->name ; impl++)
+            {
+                if (!impl->supported())
+                    continue;
+                memset(actual, 0xaa, sizeof(actual));
+                assert_true(record_impl_select(impl->name));
+                record_fill_block(&fmt, actual + skew, nrec, off);
+                assert_equals(memcmp(actual + skew, expected + skew, nrec * fmt.size), 0);
+                /* doesn't write past the end */
+                assert_equals(actual[skew + nrec * fmt.size], 0xaa);
+                /* and the result passes the checks */
+                assert_equals(record_check_block(&fmt, actual + skew, nrec, off), nrec);
+            }
+        }
+    }
+}
+
+void test_record_carry(void)
+{
+    /*
+     * Blocks which start either side of, and cross, the points where
+     * the low 32 bits of the offset carry into the high offset word.
+     * Also the record at offset 0, whose sum is all zero.
+     */
+    static const uint64_t boundaries[] = { 0, 1ULL<<32, 2ULL<<32, 0xff00000000ULL };
+    unsigned char expected[NREC * RECORD_SIZE_CREATOR];
+    unsigned char actual[NREC * RECORD_SIZE_CREATOR];
+    const record_impl_t *impl;
+    record_format_t fmt;
+    int layout;
+    unsigned int bi, k;
+
+    for (layout = 0 ; layout < NLAYOUTS ; layout++)
+    {
+        init_format(&fmt, layout);
+        for (bi = 0 ; bi < sizeof(boundaries)/sizeof(boundaries[0]) ; bi++)
+        {
+            for (k = 0 ; k < 20 ; k++)
+            {
+                uint64_t off = boundaries[bi] - k * fmt.size;
+
+                if (k > boundaries[bi] / fmt.size)
+                    break;
+                make_records(&fmt, expected, NREC, off);
+                for (impl = record_impls ; impl->name ; impl++)
+                {
+                    if (!impl->supported())
+                        continue;
+                    assert_true(record_impl_select(impl->name));
+                    record_fill_block(&fmt, actual, NREC, off);
+                    assert_equals(memcmp(actual, expected, NREC * fmt.size), 0);
+                    assert_equals(record_check_block(&fmt, expected, NREC, off), (size_t)NREC);
+                }
+            }
+        }
+    }
+}
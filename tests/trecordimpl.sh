@@ -0,0 +1,59 @@
+#/bin/bash
+#
+# Tests Copyright (c) 2021 Greg Banks <gnb@fmeh.org>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+#
+
+. $PWD/common.sh
+
+function tearDown()
+{
+    /bin/rm -f trecordimpl.*.dat
+}
+
+param_testGenerateMatchesScalar="template sse2 avx2 avx512"
+
+function testGenerateMatchesScalar()
+{
+    local impl="$1"
+    local size=65536
+    local fS=trecordimpl.$impl.scalar.dat
+    local fI=trecordimpl.$impl.impl.dat
+
+    $GENSTREAM --record-impl=$impl 8 $fI > /dev/null 2>&1 || skip "$impl not supported on this machine"
+
+    for flags in "" "-T 7" ; do
+        for i in 1 2 3 4 ; do
+            # random seeks, and one just short of the 4 GiB carry
+            local seek=$[ (RANDOM * 32768 + RANDOM) * 8 ]
+            [ $i = 4 ] && seek=$[ (1 << 32) - 4096 ]
+            echo "flags=\"$flags\" seek=$seek"
+            /bin/rm -f $fS $fI
+            assert_success $GENSTREAM $flags --record-impl=scalar --seek=$seek $size $fS
+            assert_success $GENSTREAM $flags --record-impl=$impl --seek=$seek $size $fI
+            # the files are sparse up to the seek offset
+            cmp <(tail -c $size $fS) <(tail -c $size $fI) || fail "output differs from scalar implementation"
+            assert_success $CHECKSTREAM $flags --seek=$seek $fI
+        done
+    done
+
+    # the creator depends on the pid and time, so just check it
+    /bin/rm -f $fI
+    assert_success $GENSTREAM -C --record-impl=$impl --seek=4096 $size $fI
+    assert_success $CHECKSTREAM -C --seek=4096 $fI
+}
+
+run_subtests
@@ -0,0 +1,102 @@
+#/bin/bash
+#
+# Tests Copyright (c) 2021 Greg Banks <gnb@fmeh.org>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+. $PWD/common.sh
+
+function tearDown()
+{
+    /bin/rm -rf trecursive.*.dat
+}
+
+# one row of the table of results, * matching any field
+function assert_result()
+{
+    tr -s ' ' < $_SUBTEST_LOG | sed -n 's/^[^:]*: //p' | \
+	awk -v want="$*" '
+	    BEGIN { n = split(want, w, " ") }
+	    NF == n { for (i = 1 ; i <= n && (w[i] == "*" || w[i] == $i) ; i++) ; if (i > n) found = 1 }
+	    END { exit !found }' || fail "no result \"$*\""
+}
+
+# a tree of files written every which way
+function make_tree()
+{
+    local d=$1
+
+    assert_success $GENSTREAM --fileset=30 --fileset-depth=2 --fileset-fanout=4 --tag=9 4K-16K $d
+    assert_success $GENSTREAM 64K $d/plain
+    assert_success $GENSTREAM -C 32K $d/d00/creator
+    assert_success $GENSTREAM 32K $d/whole
+    dd if=$d/whole of=$d/d01/middle bs=4096 skip=3 count=2 status=none || fail "dd failed"
+    rm $d/whole
+    touch $d/empty
+    ln -s plain $d/link
+}
+
+function testTree()
+{
+    local d=trecursive.tree.dat
+
+    make_tree $d
+    assert_success $CHECKSTREAM --recursive --threads=3 $d
+    assert_logged "walked 21 directories, checked 34 files, 0 with errors"
+    assert_result pass 65536 - no 0 $d/plain
+    assert_result pass 32768 - yes 0 $d/d00/creator
+    assert_result pass 8192 - no 12288 $d/d01/middle
+    assert_result pass 0 - no 0 $d/empty
+    assert_result pass '*' 9 no 0 $d/d00/d00/f00000000
+    assert_result pass '*' 14 no 0 $d/d01/d01/f00000005
+    fgrep -q "$d/link" $_SUBTEST_LOG && fail "symlink was followed"
+    assert_logged ", no errors"
+
+    # one thread for each CPU by default
+    assert_success $CHECKSTREAM --recursive $d
+    assert_logged "checked 34 files, 0 with errors"
+}
+
+function testFailures()
+{
+    local d=trecursive.fail.dat
+
+    make_tree $d
+    dd if=/dev/zero of=$d/plain bs=4096 seek=2 count=1 conv=notrunc status=none || fail "dd failed"
+    mkdir $d/locked
+    touch $d/locked/unseen
+    chmod 000 $d/locked
+    assert_failure $CHECKSTREAM --recursive --threads=2 $d
+    chmod 755 $d/locked
+    assert_logged "$d/plain: zero data for 4096 bytes at offset 8192"
+    assert_result fail 65536 - no 0 $d/plain
+    assert_logged "1 with errors"
+    # root can read it anyway
+    if [ $(id -u) != 0 ] ; then
+	assert_logged "1 files or directories could not be read"
+    fi
+}
+
+function testUsage()
+{
+    assert_failure $CHECKSTREAM --recursive --length=4K trecursive.usage.dat
+    assert_logged "cannot be used with"
+    assert_failure $CHECKSTREAM --recursive --fileset=10 trecursive.usage.dat
+    assert_logged "cannot be used with"
+    assert_failure $CHECKSTREAM --recursive
+    assert_logged "Usage:"
+}
+
+run_subtests
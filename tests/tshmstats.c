@@ -0,0 +1,91 @@
+#include "c_unit_fw.h"
+#include "common.h"
+#include "stream.h"
+#include "progress.h"
+#include "shmstats.h"
+#include <sys/mman.h>
+#include <fcntl.h>
+
+void test_shmstats_snapshot(void)
+{
+    shmstats_t *s;
+    shmstats_data_t snap;
+    char shmname[64];
+    int fd;
+
+    s = shmstats_create("tshmstats", "some/file", 42);
+    assert_true(s != 0);
+    assert_equals(shmstats_snapshot(s->data, &snap), 0);
+    assert_equals(snap.pid, getpid());
+    assert_str_equals(snap.program, "tshmstats");
+    assert_str_equals(snap.name, "some/file");
+    assert_equals(snap.tag, 42);
+    assert_equals(snap.nbytes, 0);
+
+    /* no copy can be had in the middle of an update */
+    shmstats_update_begin(s);
+    s->data->nbytes = 4096;
+    assert_equals(shmstats_snapshot(s->data, &snap), -1);
+    shmstats_update_end(s);
+    assert_equals(shmstats_snapshot(s->data, &snap), 0);
+    assert_equals(snap.nbytes, 4096);
+    assert_equals(snap.seq, 2);
+
+    /* nor of a segment in some other layout */
+    snap.version++;
+    assert_equals(shmstats_snapshot(&snap, &snap), -1);
+
+    /* the segment goes away */
+    snprintf(shmname, sizeof(shmname), "/tshmstats.%d", (int)getpid());
+    shmstats_destroy(s);
+    fd = shm_open(shmname, O_RDONLY, 0);
+    assert_equals(fd, -1);
+    assert_equals(errno, ENOENT);
+}
+
+static void
+fill(shmstats_data_t *d)
+{
+    d->nerrors = 3;
+}
+
+void test_shmstats_progress(void)
+{
+    progress_t p;
+    shmstats_data_t snap;
+    stream_t s1, *ss[1] = { &s1 };
+    stream_latency_t lat;
+
+    memset(&s1, 0, sizeof(s1));
+    memset(&lat, 0, sizeof(lat));
+    progress_init(&p, NANOSEC, 0, 8, 0);
+    p.quiet = TRUE;
+    p.shm = shmstats_create("tshmstats", 0, 0);
+    p.shm->latency = &lat;
+    p.shm->fill = fill;
+
+    /* the counts sampled each interval, the latencies and the program's own */
+    progress_watch(&p, ss, 1, 1024);
+    s1.stats.nblocks = 2;
+    s1.stats.nbytes = 8192;
+    histogram_add(&lat.ops[STREAM_OP_PULL], 5000);
+    progress_report(&p, p.t0 + NANOSEC);
+    assert_equals(shmstats_snapshot(p.shm->data, &snap), 0);
+    assert_str_equals(snap.name, "-");
+    assert_equals(snap.nblocks, 2);
+    assert_equals(snap.nbytes, 8192);
+    assert_equals(snap.offset, 9216);
+    assert_equals(snap.nerrors, 3);
+    assert_equals(snap.latency[STREAM_OP_PULL].count, 1);
+    assert_equals(snap.latency[STREAM_OP_PULL].max, 5000);
+
+    /* the blocks of streams no longer watched still count */
+    progress_unwatch(&p);
+    progress_report(&p, p.t0 + 2 * NANOSEC);
+    assert_equals(shmstats_snapshot(p.shm->data, &snap), 0);
+    assert_equals(snap.nblocks, 2);
+    assert_equals(snap.nbytes, 8192);
+
+    shmstats_destroy(p.shm);
+    progress_destroy(&p);
+}
@@ -30,4 +30,61 @@ function testStdio()
     assert_success $GENSTREAM $size \| $CHECKSTREAM -l $size
 }
 
+param_testSplice="128 4096 1000000 4000000"
+
+function testSplice()
+{
+    size="$1"
+
+    set -o pipefail
+
+    # the pipe is filled from a ring of buffers, which wraps around
+    # several times for the bigger sizes
+    assert_success $GENSTREAM --splice $size \| $CHECKSTREAM -l $size
+    assert_success $GENSTREAM --splice -b 12345 $size \| $CHECKSTREAM -l $size
+}
+
+function testSpliceFile()
+{
+    local f=tstdio.write.dat
+    local fS=tstdio.splice.dat
+
+    assert_success $GENSTREAM -T 5 --seek=4100 1000000 $f
+    assert_success $GENSTREAM --splice -T 5 --seek=4100 1000000 $fS
+    cmp $f $fS || fail "files differ"
+    /bin/rm -f $f $fS
+
+    assert_failure $GENSTREAM --splice --mmap 1000 $fS
+}
+
+function testWatchdog()
+{
+    local f=tstdio.watchdog.dat
+
+    set -o pipefail
+
+    # the reader stalls halfway through until the rest arrives
+    assert_success $GENSTREAM 128K $f
+    assert_success "{ head -c 65536 $f ; sleep 1 ; tail -c +65537 $f ; }" \| \
+	$CHECKSTREAM --watchdog=300ms -l 128K
+    assert_logged "-stdin-: stalled at offset 65536 for 0."
+    assert_logged "-stdin-: recovered at offset 65536 after 1."
+    assert_logged "watchdog: 1 stalls of 0.300 seconds or more"
+    assert_logged "-stdin-: offset 65536 stalled for 1."
+
+    # and the writer when the pipe is full
+    $GENSTREAM --watchdog=200ms 1M 2> tstdio.watchdog.log.dat | { sleep 1 ; cat > /dev/null ; }
+    fgrep -q -e "-stdout-: recovered at offset" tstdio.watchdog.log.dat || \
+	fail "genstream didn't report the stall"
+    /bin/rm -f tstdio.watchdog.log.dat
+
+    assert_success $CHECKSTREAM --watchdog=10s $f
+    assert_logged "watchdog: no stalls of 10.000 seconds or more"
+    assert_failure $CHECKSTREAM --watchdog=1s --recursive .
+    assert_logged "cannot be used with"
+    assert_failure $CHECKSTREAM --watchdog=soon $f
+    assert_logged "cannot parse watchdog time"
+    /bin/rm -f $f
+}
+
 run_subtests
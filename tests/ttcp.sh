@@ -21,6 +21,9 @@
 
 PORTFILE=ttcp.port
 PIDFILE=ttcp.pid
+SERVERLOG=ttcp.server.log
+SOCKET=ttcp.sock
+CHECK_ARGS=
 
 function tearDown()
 {
@@ -32,7 +35,8 @@ function tearDown()
             kill -TERM "$pid"
         fi
     fi
-    /bin/rm -f $PORTFILE $PIDFILE
+    /bin/rm -f $PORTFILE $PIDFILE $SERVERLOG $SOCKET
+    CHECK_ARGS=
 }
 
 function wait_for_file()
@@ -44,7 +48,7 @@ function wait_for_file()
     local total_delay_ms=0
     echo "Waiting up to $timeout_secs seconds for $file to appear"
     while (( total_delay_ms < timeout_ms )) ; do
-        if [ -f "$file" ] ; then
+        if [ -e "$file" ] ; then
             printf "...file $file exists after %d.%03d seconds\n" $[ total_delay_ms / 1000 ] $[total_delay_ms % 1000 ]
             return 0
         fi
@@ -67,24 +71,257 @@ function wait_for_file()
 #    wait $(cat $PIDFILE)
 #}
 
-function testTCP()
+function tcp_transfer()
 {
-    size=4096
+    local size="$1"
+    shift
+
     /bin/rm -f $PORTFILE
     /bin/rm -f $PIDFILE
 
     echo "Starting checkstream in server mode"
-    ( $CHECKSTREAM --protocol tcp --length $size --port dynamic --port-filename $PORTFILE ) &
+    ( $CHECKSTREAM $CHECK_ARGS --protocol tcp --length $size --port dynamic --port-filename $PORTFILE ) &
     echo $! > $PIDFILE
     echo "Wrote \""$(cat $PIDFILE)"\" to pid file $PIDFILE"
     wait_for_file $PORTFILE
 
     echo "Starting genstream in client mode"
-    assert_success $GENSTREAM --protocol=tcp --port=$(cat $PORTFILE) $size localhost
+    assert_success $GENSTREAM "$@" --protocol=tcp --port=$(cat $PORTFILE) $size localhost
 
     echo "Waiting for checkstream process"
     wait $(cat $PIDFILE)
     [ $? = 0 ] || fail "checkstream failed"
 }
 
+function testTCP()
+{
+    tcp_transfer 4096
+}
+
+function testZerocopy()
+{
+    # over loopback the kernel always copies, but every send is
+    # accounted for one way or the other
+    tcp_transfer 1048576 -b 65536 --zerocopy
+    assert_logged "zero-copy: 0 sends without copying, 16 copied"
+}
+
+function testSendfile()
+{
+    local f=ttcp.sendfile.dat
+
+    assert_success $GENSTREAM 1048576 $f
+    tcp_transfer 1048576 --sendfile=$f
+    assert_logged "localhost 1 blocks 1048576 bytes"
+    /bin/rm -f $f
+
+    assert_failure $GENSTREAM --zerocopy 1000 $f
+    assert_logged "needs --protocol=tcp"
+}
+
+param_testConnections="2 3 8"
+
+function testConnections()
+{
+    local n="$1"
+
+    # stripes of 12K and a length which isn't a whole number of them
+    CHECK_ARGS="--connections=$n -C"
+    tcp_transfer 1000000 --connections=$n --chunk-size=12K -C
+    assert_logged "localhost 245 blocks 1000000 bytes"
+    assert_logged "connection $[n-1]: "
+}
+
+function testConnectionsMismatch()
+{
+    /bin/rm -f $PORTFILE
+
+    # a single connection has no hello, which the server rejects
+    ( $CHECKSTREAM --connections=2 --protocol tcp --length 4096 --port dynamic --port-filename $PORTFILE ) &
+    echo $! > $PIDFILE
+    wait_for_file $PORTFILE
+    $GENSTREAM --protocol=tcp --port=$(cat $PORTFILE) 4096 localhost
+    wait $(cat $PIDFILE)
+    [ $? != 0 ] || fail "checkstream succeeded unexpectedly"
+}
+
+# start checkstream --server in the background, logging to $SERVERLOG
+function start_server()
+{
+    /bin/rm -f $PORTFILE $PIDFILE
+
+    $CHECKSTREAM --server "$@" --protocol tcp --port dynamic --port-filename $PORTFILE > $SERVERLOG 2>&1 &
+    echo $! > $PIDFILE
+    wait_for_file $PORTFILE
+}
+
+# stop the server, and check its exit status
+function stop_server()
+{
+    local expected="$1"
+    local pid=$(cat $PIDFILE)
+
+    kill -TERM $pid
+    wait $pid
+    local status=$?
+    cat $SERVERLOG
+    /bin/rm -f $PIDFILE
+    [ $status = $expected ] || fail "checkstream exited with $status not $expected"
+}
+
+function assert_server_logged()
+{
+    local msg="$*"
+
+    fgrep "$msg" $SERVERLOG > /dev/null || fail "server log doesn't contain string \"$msg\""
+}
+
+function testServer()
+{
+    local port i
+
+    start_server --threads=2 --max-clients=3 --length 1M
+    port=$(cat $PORTFILE)
+    # more clients at once than the server takes, with odd sized writes
+    for i in 1 2 3 4 5 6 ; do
+        $GENSTREAM -b 1000 --protocol=tcp --port=$port 1M localhost &
+    done
+    wait $(jobs -p | fgrep -v $(cat $PIDFILE))
+    stop_server 0
+    assert_server_logged "client 5: read"
+    assert_server_logged "checked 6 clients, 0 with errors"
+    assert_server_logged "6291456 bytes in"
+}
+
+function testServerErrors()
+{
+    local port
+
+    start_server -C -T 1 --length 64K
+    port=$(cat $PORTFILE)
+    $GENSTREAM -C -T 1 --protocol=tcp --port=$port 64K localhost
+    $GENSTREAM -C -T 1 --protocol=tcp --port=$port 20000 localhost
+    $GENSTREAM -C -T 2 --protocol=tcp --port=$port 64K localhost
+    stop_server 1
+    assert_server_logged "client 0: valid data for 65536 bytes at offset 0"
+    assert_server_logged "client 1: file short for 45536 bytes at offset 20000"
+    assert_server_logged "client 2: bad tag for 65536 bytes at offset 0"
+    assert_server_logged "checked 3 clients, 2 with errors"
+}
+
+function testServerUsage()
+{
+    assert_failure $CHECKSTREAM --server --length 1M
+    assert_logged "needs --protocol=tcp, and cannot be used with --seek, --read-ahead"
+    assert_failure $CHECKSTREAM --max-clients=2 --protocol=tcp --length 1M
+    assert_logged "needs --server"
+}
+
+# send a stream over UDP, logging the checkstream output to $SERVERLOG
+function udp_transfer()
+{
+    local size="$1"
+    local expected="$2"
+    shift 2
+
+    /bin/rm -f $PORTFILE $PIDFILE
+
+    $CHECKSTREAM --protocol udp --length $size --port dynamic --port-filename $PORTFILE > $SERVERLOG 2>&1 &
+    echo $! > $PIDFILE
+    wait_for_file $PORTFILE
+
+    assert_success $GENSTREAM "$@" --protocol=udp --port=$(cat $PORTFILE) $size localhost
+
+    wait $(cat $PIDFILE)
+    local status=$?
+    cat $SERVERLOG
+    /bin/rm -f $PIDFILE
+    [ $status = $expected ] || fail "checkstream exited with $status not $expected"
+}
+
+function testUDP()
+{
+    # small enough not to overflow the socket buffer on a busy machine
+    udp_transfer 65536 0
+    assert_logged "udp: 45 datagrams"
+    assert_server_logged "valid data for 65536 bytes at offset 0"
+    assert_server_logged "no errors"
+}
+
+param_testUDPFaults="lost:lose duplicated:duplicate reordered:reorder"
+
+function testUDPFaults()
+{
+    local failure="${1%%:*}"
+    local fault="${1##*:}"
+
+    udp_transfer 65536 1 --datagram-size=1024 --datagram-faults=$fault:8
+    assert_server_logged "$failure for 1024 bytes at offset 7168"
+}
+
+function testUDPUsage()
+{
+    assert_failure $GENSTREAM --datagram-size=1000 --protocol=udp 4096 localhost
+    assert_logged "cannot parse datagram size"
+    assert_failure $GENSTREAM --datagram-faults=lose:2 4096 ttcp.dat
+    assert_logged "need --protocol=udp"
+    assert_failure $CHECKSTREAM --protocol=udp --seek=4096 --length=4096
+    assert_logged "cannot use --seek or --read-ahead with --protocol=udp"
+}
+
+# send a stream over a Unix domain socket, logging the checkstream
+# output to $SERVERLOG
+function unix_transfer()
+{
+    local size="$1"
+    local expected="$2"
+    shift 2
+
+    /bin/rm -f $SOCKET $PIDFILE
+
+    $CHECKSTREAM $CHECK_ARGS --length $size $SOCKET > $SERVERLOG 2>&1 &
+    echo $! > $PIDFILE
+    wait_for_file $SOCKET
+
+    $GENSTREAM "$@" $size $SOCKET
+
+    wait $(cat $PIDFILE)
+    local status=$?
+    cat $SERVERLOG
+    /bin/rm -f $PIDFILE
+    [ $status = $expected ] || fail "checkstream exited with $status not $expected"
+}
+
+param_testUnix="unix unix-seqpacket"
+
+function testUnix()
+{
+    local protocol="$1"
+
+    CHECK_ARGS="--protocol=$protocol -b 64K --socket-buffer=1M"
+    unix_transfer 1048576 0 --protocol=$protocol -b 64K --socket-buffer=1M
+    assert_server_logged "valid data for 1048576 bytes at offset 0"
+    assert_server_logged "read 16 blocks 1048576 bytes"
+    [ -e $SOCKET ] && fail "socket $SOCKET was left behind"
+    true
+}
+
+function testUnixSeqpacketTruncated()
+{
+    # a packet larger than the reader's buffer would lose data
+    CHECK_ARGS="--protocol=unix-seqpacket -b 4K"
+    unix_transfer 1048576 1 --protocol=unix-seqpacket -b 64K
+    assert_server_logged "packet of 65536 bytes truncated to 4096"
+}
+
+function testUnixUsage()
+{
+    assert_failure $CHECKSTREAM --protocol=unix --length 4096
+    assert_logged "needs a socket path"
+    assert_failure $GENSTREAM --protocol=unix --port=5001 4096 $SOCKET
+    assert_logged "cannot use --port with a Unix domain socket"
+    assert_failure $GENSTREAM --socket-buffer=1M 4096 ttcp.dat
+    assert_logged "needs --protocol"
+}
+
 run_subtests
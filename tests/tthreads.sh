@@ -0,0 +1,121 @@
+#/bin/bash
+#
+# Tests Copyright (c) 2021 Greg Banks <gnb@fmeh.org>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+#
+
+. $PWD/common.sh
+
+function tearDown()
+{
+    /bin/rm -f tthreads.*.dat
+}
+
+# the report without the timing dependent lines
+function report()
+{
+    egrep -v 'seconds|threads' $_SUBTEST_LOG
+}
+
+function make_corrupt_file()
+{
+    local f="$1"
+
+    $GENSTREAM -C 1M $f > /dev/null 2>&1 || fail "genstream failed"
+    # zeroes across a chunk boundary
+    dd if=/dev/zero of=$f bs=1 seek=$[65536-64] count=128 conv=notrunc 2>/dev/null
+    # a bad checksum at the start of a chunk
+    printf 'U' | dd of=$f bs=1 seek=$[3*65536+5] conv=notrunc 2>/dev/null
+    # transposed records ending at a chunk boundary
+    dd if=$f of=$f bs=1 skip=100000 seek=$[5*65536-96] count=96 conv=notrunc 2>/dev/null
+    # zeroes at the end of the file
+    dd if=/dev/zero of=$f bs=1 seek=$[1048576-48] count=48 conv=notrunc 2>/dev/null
+}
+
+param_testSameReport="1 2 3 8"
+
+function testSameReport()
+{
+    local nthreads="$1"
+    local f=tthreads.corrupt.dat
+
+    make_corrupt_file $f
+
+    for v in "" "-v" "-vv" ; do
+        assert_failure $CHECKSTREAM -C $v $f
+        report > tthreads.single.report.dat
+        assert_failure $CHECKSTREAM -C $v --threads=$nthreads --chunk-size=64K $f
+        report > tthreads.multi.report.dat
+        cmp tthreads.single.report.dat tthreads.multi.report.dat || fail "reports differ with $v"
+    done
+    assert_logged "zero data for 128 bytes at offset 65472"
+    assert_logged "bad offset for 96 bytes at offset 327584"
+}
+
+function testGood()
+{
+    local f=tthreads.good.dat
+
+    assert_success $GENSTREAM -T 5 --seek=4096 300000 $f
+    assert_success $CHECKSTREAM -T 5 --seek=4096 --threads=4 --chunk-size=8K $f
+    assert_logged "valid data for 300000 bytes at offset 4096"
+    assert_logged "300000/300000 bytes"
+}
+
+function testShort()
+{
+    local f=tthreads.short.dat
+
+    assert_success $GENSTREAM 100000 $f
+    assert_failure $CHECKSTREAM --length=200000 --threads=3 --chunk-size=16K $f
+    assert_logged "read failed at offset 100000"
+    assert_logged "valid data for 100000 bytes at offset 0"
+    assert_logged "file short for 8 bytes at offset 100000"
+}
+
+function testNotFilterMode()
+{
+    assert_failure $CHECKSTREAM --threads=2 --length=8 < /dev/null
+    assert_logged "only works when reading a named file"
+}
+
+param_testGenSameFile="1 2 3 8"
+
+function testGenSameFile()
+{
+    local nthreads="$1"
+
+    # not a multiple of the chunk or block size
+    assert_success $GENSTREAM -T 7 --seek=8192 1000000 tthreads.single.dat
+    egrep -o '[0-9]+ bytes' $_SUBTEST_LOG > tthreads.single.summary.dat
+    for layout in interleaved contiguous ; do
+        assert_success $GENSTREAM -T 7 --seek=8192 --threads=$nthreads \
+            --chunk-size=64K --layout=$layout 1000000 tthreads.multi.dat
+        cmp tthreads.single.dat tthreads.multi.dat || fail "files differ with $layout"
+        egrep -o '[0-9]+ bytes' $_SUBTEST_LOG | tail -1 > tthreads.multi.summary.dat
+        cmp tthreads.single.summary.dat tthreads.multi.summary.dat || fail "byte counts differ with $layout"
+    done
+    assert_success $CHECKSTREAM -T 7 --seek=8192 tthreads.multi.dat
+    assert_logged "1000000/1000000 bytes"
+}
+
+function testGenNotStdout()
+{
+    assert_failure $GENSTREAM --threads=2 8
+    assert_logged "only works when writing a named file"
+}
+
+run_subtests
@@ -0,0 +1,101 @@
+#/bin/bash
+#
+# Tests Copyright (c) 2021 Greg Banks <gnb@fmeh.org>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+#
+
+. $PWD/common.sh
+
+function setUp()
+{
+    # io_uring can be missing at build time or disabled at run time
+    $GENSTREAM --engine=io_uring 8 turing.probe.dat > /dev/null 2>&1 || skip "io_uring not available"
+}
+
+function tearDown()
+{
+    /bin/rm -f turing.*.dat
+}
+
+# the report without the timing dependent lines
+function report()
+{
+    egrep -v 'seconds|latency|io_uring' $_SUBTEST_LOG
+}
+
+param_testSameFile="default --iodepth=1 --iodepth=32 --register-buffers --register-files --sqpoll"
+
+function testSameFile()
+{
+    local opts="$1"
+    [ "$opts" = default ] && opts=
+
+    # not a multiple of the block size
+    assert_success $GENSTREAM -T 9 --seek=8192 1000000 turing.sync.dat
+    assert_success $GENSTREAM -T 9 --seek=8192 --engine=io_uring $opts 1000000 turing.uring.dat
+    cmp turing.sync.dat turing.uring.dat || fail "files differ"
+    assert_success $CHECKSTREAM -T 9 --seek=8192 --engine=io_uring $opts turing.uring.dat
+    assert_logged "valid data for 1000000 bytes at offset 8192"
+    assert_logged "1000000/1000000 bytes"
+}
+
+function testSameReport()
+{
+    local f=turing.corrupt.dat
+
+    $GENSTREAM -C 1M $f > /dev/null 2>&1 || fail "genstream failed"
+    dd if=/dev/zero of=$f bs=1 seek=5000 count=300 conv=notrunc 2>/dev/null
+    printf 'U' | dd of=$f bs=1 seek=$[8192*3+5] conv=notrunc 2>/dev/null
+
+    for v in "" "-v" "-vv" ; do
+        assert_failure $CHECKSTREAM -C $v $f
+        report > turing.sync.report.dat
+        assert_failure $CHECKSTREAM -C $v --engine=io_uring --iodepth=3 $f
+        report > turing.uring.report.dat
+        cmp turing.sync.report.dat turing.uring.report.dat || fail "reports differ with $v"
+    done
+}
+
+function testShort()
+{
+    # reads past the end of the file complete short
+    assert_success $GENSTREAM 100000 turing.short.dat
+    assert_failure $CHECKSTREAM --length=200000 --engine=io_uring turing.short.dat
+    assert_logged "valid data for 100000 bytes at offset 0"
+    assert_logged "file short for 8 bytes at offset 100000"
+}
+
+function limited_genstream()
+{
+    ( ulimit -f 100 ; trap '' XFSZ ; exec $GENSTREAM "$@" )
+}
+
+function testShortWrite()
+{
+    # a write which crosses the file size limit completes short, and
+    # the rest is written again to get the error
+    assert_failure limited_genstream --engine=io_uring --iodepth=4 1000000 turing.full.dat
+    assert_logged "File too large"
+    [ $(stat -c %s turing.full.dat) = 102400 ] || fail "file not filled to the limit"
+}
+
+function testNeedsEngine()
+{
+    assert_failure $CHECKSTREAM --iodepth=4 turing.probe.dat
+    assert_logged "need --engine=io_uring"
+}
+
+run_subtests
@@ -0,0 +1,72 @@
+#include "c_unit_fw.h"
+#include "common.h"
+#include "watchdog.h"
+
+#define MS      1000000ULL      /* nanoseconds */
+#define T0      (1000 * NANOSEC)
+
+static watchdog_t w;
+
+void test_watchdog_quick(void)
+{
+    watchdog_slot_t *ws;
+
+    watchdog_init(&w, 2, 100 * MS, 0, 0);
+    ws = watchdog_slot(&w, 1, "quick", 4096);
+
+    /* operations shorter than the threshold aren't stalls */
+    watchdog_begin(ws, T0, 0);
+    assert_equals(ws->start, T0);
+    assert_equals(ws->offset, 4096);
+    watchdog_end(ws, T0 + 99 * MS);
+    assert_equals(ws->start, 0);
+    assert_equals(w.nstalls, 0);
+
+    watchdog_destroy(&w);
+}
+
+void test_watchdog_recovered(void)
+{
+    watchdog_slot_t *ws;
+
+    watchdog_init(&w, 1, 100 * MS, 0, 0);
+    ws = watchdog_slot(&w, 0, "slow", 1000);
+
+    /* each stall is recorded with its offset and how long it took */
+    watchdog_begin(ws, T0, 8192);
+    watchdog_end(ws, T0 + 100 * MS);
+    watchdog_begin(ws, T0 + 200 * MS, 16384);
+    watchdog_end(ws, T0 + 2200 * MS);
+    assert_equals(w.nstalls, 2);
+    assert_equals(w.stalls[0].offset, 9192);
+    assert_equals(w.stalls[0].duration, 100 * MS);
+    assert_true(w.stalls[0].recovered);
+    assert_equals(w.stalls[1].offset, 17384);
+    assert_equals(w.stalls[1].duration, 2000 * MS);
+    assert_str_equals(w.stalls[1].name, "slow");
+
+    watchdog_destroy(&w);
+}
+
+void test_watchdog_stalled(void)
+{
+    watchdog_slot_t *ws;
+    struct timespec ts = { 0, 20 * MS };
+
+    watchdog_init(&w, 1, 10 * MS, 0, 0);
+    ws = watchdog_slot(&w, 0, "hung", 0);
+    watchdog_start(&w);
+
+    /* an operation still in flight when stopped is left unrecovered */
+    watchdog_begin(ws, time_now_ns(), 65536);
+    nanosleep(&ts, 0);
+    watchdog_stop(&w);
+    assert_equals(w.nstalls, 1);
+    assert_equals(w.stalls[0].offset, 65536);
+    assert_true(w.stalls[0].duration >= 20 * MS);
+    assert_true(!w.stalls[0].recovered);
+    /* it was reported as stalled meanwhile */
+    assert_equals(ws->reported, ws->start);
+
+    watchdog_destroy(&w);
+}
@@ -0,0 +1,488 @@
+/*
+ * Copyright (c) 2021 Greg Banks <gnb@fmeh.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#define _GNU_SOURCE 1	/* for statx() */
+#include "common.h"
+#include "stream.h"
+#include "check.h"
+#include "walk.h"
+#include <limits.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+
+/* --recursive looks this far into a file for records to learn its format from */
+#define INFER_CHUNK_SIZE	(64*1024)
+#define INFER_LIMIT		(1ULL<<20)
+
+/*
+ * Works out the format of a file and the offset its records start
+ * from, from the first two consecutive valid records in the len bytes
+ * at buf, which were read from file offset pos.  A tag of 0 is
+ * indistinguishable from no tag, and is taken as none; a --tag or
+ * --creator given is taken as read.  Returns FALSE if there are no
+ * such records.
+ */
+static bool_t
+infer_format(const char *buf, size_t len, uint64_t pos,
+	     record_format_t *fmt, uint64_t *offset0p)
+{
+    const record_t *rec, *next;
+    bool_t cflag, tagged;
+    size_t size, k;
+    uint64_t off;
+
+    for (size = RECORD_SIZE ; size <= RECORD_SIZE_CREATOR ; size *= 2)
+    {
+	cflag = (size == RECORD_SIZE_CREATOR);
+	if (creator_flag && !cflag)
+	    continue;
+	for (k = 0 ; (k + 2) * size <= len ; k++)
+	{
+	    rec = (const record_t *)(buf + k * size);
+	    next = (const record_t *)(buf + (k + 1) * size);
+	    /* a zero record fails the checksum too */
+	    if (record_checksum(rec, cflag) || record_checksum(next, cflag))
+		continue;
+	    tagged = (tag_flag || record_get_tag(rec) != 0);
+	    off = record_get_offset(rec, tagged);
+	    if (record_get_offset(next, tagged) != off + size ||
+		(tagged && record_get_tag(next) != record_get_tag(rec)) ||
+		(cflag && record_get_creator(next) != record_get_creator(rec)))
+		continue;
+	    record_format_init(fmt, tagged,
+			       (tag_flag ? tag : record_get_tag(rec)), cflag, 0);
+	    pos += k * size;
+	    *offset0p = (off >= pos ? off - pos : 0);
+	    return TRUE;
+	}
+    }
+    return FALSE;
+}
+
+/*
+ * Looks for records to learn the file's format from in up to the first
+ * INFER_LIMIT bytes, which may begin with a hole as when written with
+ * genstream --seek.  Reading them is usually the first read of a file,
+ * so they're left in the page cache for the checking.
+ */
+static void
+infer_file_format(const char *path, int fd, uint64_t size,
+		  record_format_t *fmt, uint64_t *offset0p)
+{
+    char *buf = xvalloc(INFER_CHUNK_SIZE);
+    uint64_t pos;
+    ssize_t n;
+
+    for (pos = 0 ; pos < MIN(size, INFER_LIMIT) ; pos += n)
+    {
+	if ((n = pread(fd, buf, INFER_CHUNK_SIZE, pos)) < 0)
+	    perrorf("pread(\"%s\")", path);
+	if (n <= 0 || infer_format(buf, n, pos, fmt, offset0p))
+	    break;
+    }
+    free(buf);	    /* allocated by valloc() */
+}
+
+/*
+ * In --recursive mode the threads walk the tree as they check it.
+ * Each thread has a deque of directories to be read and files to be
+ * checked.  It takes its own work from the front, most recently found
+ * first, so it works depth first close to what it has just read, and
+ * when it has none it steals from the back of another thread's deque,
+ * where the oldest and usually the biggest parts of the tree are.  So
+ * the walking is shared like the checking, and no thread waits on it
+ * while there is anything to do.
+ */
+typedef struct walk_item walk_item_t;
+struct walk_item
+{
+    walk_item_t *next;
+    walk_item_t *prev;
+    bool_t is_dir;
+    char path[];
+};
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    walk_item_t *head;		/* where the owner takes from */
+    walk_item_t *tail;		/* where the others steal from */
+} walk_deque_t;
+
+typedef struct
+{
+    char *path;
+    uint64_t size;		/* bytes checked */
+    uint64_t offset0;
+    record_format_t fmt;
+    int nerrors;		/* -1 if unreadable */
+} walk_result_t;
+
+typedef struct
+{
+    files_t files;
+    unsigned int nthreads;
+    walk_deque_t *deques;	/* one per thread */
+    uint64_t pending;		/* items queued or being worked on */
+    unsigned int nidle;		/* threads waiting for work */
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+    /* under files.lock */
+    uint64_t ndirs;
+    walk_result_t *results;
+    uint64_t nresults;
+    uint64_t maxresults;
+} walk_pool_t;
+
+typedef struct
+{
+    walk_pool_t *pool;
+    unsigned int index;
+    pthread_t thread;
+} walker_t;
+
+/* bytes of directory entries read at once */
+#define WALK_DENTS_SIZE		(64*1024)
+
+static void
+walk_wake(walk_pool_t *p, bool_t all)
+{
+    pthread_mutex_lock(&p->idle_lock);
+    if (all)
+	pthread_cond_broadcast(&p->idle_cond);
+    else
+	pthread_cond_signal(&p->idle_cond);
+    pthread_mutex_unlock(&p->idle_lock);
+}
+
+static void
+walk_push(walk_pool_t *p, unsigned int index, bool_t is_dir, const char *path)
+{
+    walk_deque_t *d = &p->deques[index];
+    walk_item_t *item = xmalloc(sizeof(walk_item_t) + strlen(path) + 1);
+
+    item->is_dir = is_dir;
+    strcpy(item->path, path);
+    __atomic_add_fetch(&p->pending, 1, __ATOMIC_SEQ_CST);
+
+    pthread_mutex_lock(&d->lock);
+    item->next = d->head;
+    if (d->head)
+	d->head->prev = item;
+    else
+	d->tail = item;
+    d->head = item;
+    pthread_mutex_unlock(&d->lock);
+
+    if (__atomic_load_n(&p->nidle, __ATOMIC_SEQ_CST))
+	walk_wake(p, FALSE);
+}
+
+static walk_item_t *
+walk_take(walk_pool_t *p, unsigned int index)
+{
+    walk_deque_t *d;
+    walk_item_t *item;
+    unsigned int i;
+
+    for (i = 0 ; i < p->nthreads ; i++)
+    {
+	d = &p->deques[(index + i) % p->nthreads];
+	pthread_mutex_lock(&d->lock);
+	if (i == 0 && (item = d->head) != 0)
+	{
+	    d->head = item->next;
+	    if (d->head)
+		d->head->prev = 0;
+	    else
+		d->tail = 0;
+	}
+	else if (i > 0 && (item = d->tail) != 0)
+	{
+	    d->tail = item->prev;
+	    if (d->tail)
+		d->tail->next = 0;
+	    else
+		d->head = 0;
+	}
+	pthread_mutex_unlock(&d->lock);
+	if (item)
+	    return item;
+    }
+    return 0;
+}
+
+static bool_t
+walk_any(walk_pool_t *p)
+{
+    unsigned int i;
+    bool_t any = FALSE;
+
+    for (i = 0 ; !any && i < p->nthreads ; i++)
+    {
+	pthread_mutex_lock(&p->deques[i].lock);
+	any = (p->deques[i].head != 0);
+	pthread_mutex_unlock(&p->deques[i].lock);
+    }
+    return any;
+}
+
+/* the type of a directory entry whose type getdents64() didn't say */
+static int
+walk_type(int dirfd, const char *name)
+{
+#if HAVE_STATX
+    struct statx stx;
+
+    if (statx(dirfd, name, AT_SYMLINK_NOFOLLOW|AT_NO_AUTOMOUNT,
+	      STATX_TYPE, &stx) < 0)
+	return DT_UNKNOWN;
+    return IFTODT(stx.stx_mode);
+#else
+    struct stat64 sb;
+
+    if (fstatat64(dirfd, name, &sb, AT_SYMLINK_NOFOLLOW) < 0)
+	return DT_UNKNOWN;
+    return IFTODT(sb.st_mode);
+#endif
+}
+
+/*
+ * Queues the subdirectories and the regular files in the directory.
+ * Symbolic links are not followed, so the walk stays in the tree.
+ */
+static void
+walk_dir(walk_pool_t *p, unsigned int index, const char *path)
+{
+    char *buf = xmalloc(WALK_DENTS_SIZE);
+    char child[PATH_MAX];
+    struct dirent64 *de;
+    long n = -1, off;
+    int fd, type;
+
+    if ((fd = openat(AT_FDCWD, path, O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC)) < 0)
+	perrorf("open(\"%s\")", path);
+    else
+    {
+	while ((n = syscall(SYS_getdents64, fd, buf, WALK_DENTS_SIZE)) > 0)
+	{
+	    for (off = 0 ; off < n ; off += de->d_reclen)
+	    {
+		de = (struct dirent64 *)(buf + off);
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+		    continue;
+		type = de->d_type;
+		if (type == DT_UNKNOWN)
+		    type = walk_type(fd, de->d_name);
+		if (type != DT_DIR && type != DT_REG)
+		    continue;
+		if (snprintf(child, sizeof(child), "%s/%s",
+			     path, de->d_name) >= (int)sizeof(child))
+		{
+		    fprintf(stderr, "%s: %s/%s: path too long\n",
+			    argv0, path, de->d_name);
+		    pthread_mutex_lock(&p->files.lock);
+		    num_unreadable++;
+		    pthread_mutex_unlock(&p->files.lock);
+		    continue;
+		}
+		walk_push(p, index, (type == DT_DIR), child);
+	    }
+	}
+	if (n < 0)
+	    perrorf("getdents64(\"%s\")", path);
+	close(fd);
+    }
+    xfree(buf);
+
+    pthread_mutex_lock(&p->files.lock);
+    if (n == 0)
+	p->ndirs++;
+    else
+    {
+	num_unreadable++;
+	if (get_num_errors() == 1)
+	    handle_first_error();
+    }
+    pthread_mutex_unlock(&p->files.lock);
+}
+
+static void
+walk_file(walk_pool_t *p, const char *path, stream_latency_t *lat)
+{
+    walk_result_t r;
+
+    memset(&r, 0, sizeof(r));
+    record_format_init(&r.fmt, tag_flag, tag, creator_flag, 0);
+    r.nerrors = check_file(&p->files, path, &r.fmt, &r.offset0, &r.size,
+			   infer_file_format, lat);
+    r.path = xstrdup(path);
+
+    pthread_mutex_lock(&p->files.lock);
+    if (p->nresults == p->maxresults)
+    {
+	p->maxresults = (p->maxresults ? 2 * p->maxresults : 256);
+	p->results = xrealloc(p->results, p->maxresults * sizeof(walk_result_t));
+    }
+    p->results[p->nresults++] = r;
+    pthread_mutex_unlock(&p->files.lock);
+}
+
+static void *
+walk_thread(void *arg)
+{
+    walker_t *w = arg;
+    walk_pool_t *p = w->pool;
+    stream_latency_t *lat = xmalloc(sizeof(stream_latency_t));
+    walk_item_t *item;
+
+    while (!signalled)
+    {
+	if ((item = walk_take(p, w->index)) != 0)
+	{
+	    if (item->is_dir)
+		walk_dir(p, w->index, item->path);
+	    else
+		walk_file(p, item->path, lat);
+	    xfree(item);
+	    /* the last item done ends the walk */
+	    if (__atomic_sub_fetch(&p->pending, 1, __ATOMIC_SEQ_CST) == 0)
+		walk_wake(p, TRUE);
+	    continue;
+	}
+
+	pthread_mutex_lock(&p->idle_lock);
+	__atomic_add_fetch(&p->nidle, 1, __ATOMIC_SEQ_CST);
+	while (!signalled && __atomic_load_n(&p->pending, __ATOMIC_SEQ_CST) &&
+	       !walk_any(p))
+	    pthread_cond_wait(&p->idle_cond, &p->idle_lock);
+	__atomic_sub_fetch(&p->nidle, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&p->idle_lock);
+	if (!__atomic_load_n(&p->pending, __ATOMIC_SEQ_CST))
+	    break;
+    }
+    /* let the others see the walk has been interrupted */
+    walk_wake(p, TRUE);
+    files_merge_latency(&p->files, lat);
+    return 0;
+}
+
+static int
+walk_result_compare(const void *a, const void *b)
+{
+    return strcmp(((const walk_result_t *)a)->path,
+		  ((const walk_result_t *)b)->path);
+}
+
+/* the table of files and how they fared, in path order */
+static void
+emit_walk_results(walk_pool_t *p)
+{
+    walk_result_t *r;
+    char tagbuf[8];
+    uint64_t i;
+
+    qsort(p->results, p->nresults, sizeof(walk_result_t), walk_result_compare);
+    printf("%s: %-10s %14s %4s %8s %14s  %s\n",
+	   argv0, "result", "bytes", "tag", "creator", "offset", "path");
+    for (i = 0 ; i < p->nresults ; i++)
+    {
+	r = &p->results[i];
+	if (r->fmt.tag_flag)
+	    snprintf(tagbuf, sizeof(tagbuf), "%u", (unsigned)r->fmt.tag);
+	else
+	    strcpy(tagbuf, "-");
+	printf("%s: %-10s %14llu %4s %8s %14llu  %s\n",
+	       argv0,
+	       (r->nerrors < 0 ? "unreadable" : r->nerrors ? "fail" : "pass"),
+	       (unsigned long long)r->size, tagbuf,
+	       (r->fmt.creator_flag ? "yes" : "no"),
+	       (unsigned long long)r->offset0, r->path);
+	xfree(r->path);
+    }
+    fflush(stdout);
+    xfree(p->results);
+}
+
+void
+check_recursive(const char *dir, int oflags, int xflags, uint64_t bsize)
+{
+    walk_pool_t p;
+    walker_t *walkers;
+    struct stat64 sb;
+    unsigned int i;
+    int r;
+
+    memset(&p, 0, sizeof(p));
+    files_init(&p.files, oflags, xflags, bsize);
+    pthread_mutex_init(&p.idle_lock, 0);
+    pthread_cond_init(&p.idle_cond, 0);
+    p.nthreads = num_threads;
+    p.deques = xmalloc(num_threads * sizeof(walk_deque_t));
+    for (i = 0 ; i < num_threads ; i++)
+	pthread_mutex_init(&p.deques[i].lock, 0);
+
+    if (stat64(dir, &sb) < 0)
+    {
+	perrorf("stat64(\"%s\")", dir);
+	exit(1);
+    }
+    walk_push(&p, 0, S_ISDIR(sb.st_mode), dir);
+
+    start_us = time_now();
+
+    walkers = xmalloc(num_threads * sizeof(walker_t));
+    for (i = 0 ; i < num_threads ; i++)
+    {
+	walkers[i].pool = &p;
+	walkers[i].index = i;
+	if ((r = pthread_create(&walkers[i].thread, 0, walk_thread, &walkers[i])))
+	    fatal("pthread_create: %s", strerror(r));
+    }
+    for (i = 0 ; i < num_threads ; i++)
+	pthread_join(walkers[i].thread, 0);
+
+    emit_walk_results(&p);
+    emit_separator();
+    fprintf(stderr, "%s: walked %llu directories, checked %llu files, %llu with errors\n",
+	    argv0, (unsigned long long)p.ndirs,
+	    (unsigned long long)p.files.nfiles,
+	    (unsigned long long)p.files.nfailed);
+    if (num_unreadable)
+	fprintf(stderr, "%s: %u files or directories could not be read\n",
+		argv0, num_unreadable);
+    files_finish(&p.files);
+
+    /* after an interruption, some may be left */
+    for (i = 0 ; i < num_threads ; i++)
+    {
+	walk_item_t *item;
+
+	while ((item = p.deques[i].head) != 0)
+	{
+	    p.deques[i].head = item->next;
+	    xfree(item);
+	}
+	pthread_mutex_destroy(&p.deques[i].lock);
+    }
+    xfree(p.deques);
+    xfree(walkers);
+    pthread_cond_destroy(&p.idle_cond);
+    pthread_mutex_destroy(&p.idle_lock);
+}
@@ -0,0 +1,31 @@
+/*
+ * Copyright (c) 2021 Greg Banks <gnb@fmeh.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef _CHECKSTREAM_WALK_H_
+#define _CHECKSTREAM_WALK_H_ 1
+
+#include "common.h"
+
+/*
+ * The --recursive mode of checkstream, which walks a directory tree
+ * with --threads threads, checking every regular file in whatever
+ * format its first records have.
+ */
+extern void check_recursive(const char *dir, int oflags, int xflags,
+			    uint64_t bsize);
+
+#endif /* _CHECKSTREAM_WALK_H_ */
@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) 2021 Greg Banks <gnb@fmeh.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#include "common.h"
+#include "watchdog.h"
+#include <time.h>
+
+extern const char *argv0;
+
+/* the thread looks at the slots this many times per threshold */
+#define WATCHDOG_LOOKS		4
+#define WATCHDOG_MIN_INTERVAL	(1000000ULL)	/* 1 ms */
+#define WATCHDOG_MAX_INTERVAL	NANOSEC
+
+void
+watchdog_init(watchdog_t *w, unsigned int nslots, uint64_t threshold,
+	      uint64_t limit, void (*on_limit)(void))
+{
+    pthread_condattr_t attr;
+
+    memset(w, 0, sizeof(*w));
+    w->threshold = MAX(threshold, 1);
+    w->limit = limit;
+    w->on_limit = on_limit;
+    w->t0 = time_now_ns();
+    w->nslots = nslots;
+    w->slots = xmalloc(nslots * sizeof(watchdog_slot_t));
+    pthread_mutex_init(&w->lock, 0);
+    /* the timed waits are on the same clock as the operations */
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&w->cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+/*
+ * Slot i is for a stream called name whose first byte is at offset
+ * base.  A slot may be given to a new stream once the old one is done
+ * with it, but only one stream at a time may use it.
+ */
+watchdog_slot_t *
+watchdog_slot(watchdog_t *w, unsigned int i, const char *name, uint64_t base)
+{
+    watchdog_slot_t *ws = &w->slots[i];
+
+    ws->dog = w;
+    ws->name = name;
+    ws->base = base;
+    return ws;
+}
+
+/* "hh:mm:ss.mmm" for wall clock microseconds */
+static const char *
+format_when(uint64_t us, char *buf, size_t len)
+{
+    time_t sec = (time_t)(us / MICROSEC);
+    struct tm tm;
+    size_t n;
+
+    localtime_r(&sec, &tm);
+    n = strftime(buf, len, "%H:%M:%S", &tm);
+    snprintf(buf + n, len - n, ".%03u", (unsigned)(us % MICROSEC / 1000));
+    return buf;
+}
+
+/* adds the operation which started at start to the timeline, under the lock */
+static void
+watchdog_record(watchdog_t *w, watchdog_slot_t *ws, uint64_t start,
+		uint64_t now, bool_t recovered)
+{
+    watchdog_stall_t *st;
+
+    if (w->nstalls == w->maxstalls)
+    {
+	w->maxstalls = (w->maxstalls ? 2 * w->maxstalls : 16);
+	w->stalls = xrealloc(w->stalls, w->maxstalls * sizeof(watchdog_stall_t));
+    }
+    st = &w->stalls[w->nstalls++];
+    st->when = time_now() - (time_now_ns() - start) / 1000;
+    st->elapsed = start - MIN(start, w->t0);
+    st->duration = now - start;
+    st->offset = ws->offset;
+    st->name = xstrdup(ws->name);
+    st->recovered = recovered;
+}
+
+/*
+ * Called by the stream when an operation which took at least the
+ * threshold is done at last.
+ */
+void
+watchdog_recovered(watchdog_slot_t *ws, uint64_t start, uint64_t now)
+{
+    watchdog_t *w = ws->dog;
+    char buf[32];
+
+    pthread_mutex_lock(&w->lock);
+    watchdog_record(w, ws, start, now, TRUE);
+    fprintf(stderr, "%s: %s %s: recovered at offset %llu after %.3f seconds\n",
+	    argv0, format_when(time_now(), buf, sizeof(buf)), ws->name,
+	    (unsigned long long)ws->offset,
+	    (double)(now - start) / NANOSEC);
+    pthread_mutex_unlock(&w->lock);
+}
+
+/*
+ * Reports each stall when it reaches the threshold and again each time
+ * it doubles, so a hang goes on being noticed without flooding the log.
+ */
+static void
+watchdog_look(watchdog_t *w, uint64_t now)
+{
+    watchdog_slot_t *ws;
+    uint64_t start, offset;
+    unsigned int i;
+    char buf[32];
+
+    for (i = 0 ; i < w->nslots ; i++)
+    {
+	ws = &w->slots[i];
+	start = __atomic_load_n(&ws->start, __ATOMIC_ACQUIRE);
+	if (!start || now < start || now - start < w->threshold)
+	    continue;
+	offset = ws->offset;
+	/* the operation may have finished, and another begun, meanwhile */
+	if (__atomic_load_n(&ws->start, __ATOMIC_ACQUIRE) != start)
+	    continue;
+	if (ws->reported != start)
+	{
+	    ws->reported = start;
+	    ws->next_report = start + w->threshold;
+	}
+	if (w->limit && now - start >= w->limit)
+	{
+	    fprintf(stderr, "%s: %s %s: stalled at offset %llu for %.3f seconds, "
+			    "past the limit of %.3f seconds\n",
+		    argv0, format_when(time_now(), buf, sizeof(buf)), ws->name,
+		    (unsigned long long)offset,
+		    (double)(now - start) / NANOSEC,
+		    (double)w->limit / NANOSEC);
+	    watchdog_record(w, ws, start, now, FALSE);
+	    watchdog_emit_timeline(w);
+	    fflush(stderr);
+	    pthread_mutex_unlock(&w->lock);
+	    w->on_limit();
+	    pthread_mutex_lock(&w->lock);
+	    w->limit = 0;	/* if it returns, don't do it again */
+	    continue;
+	}
+	if (now >= ws->next_report)
+	{
+	    fprintf(stderr, "%s: %s %s: stalled at offset %llu for %.3f seconds\n",
+		    argv0, format_when(time_now(), buf, sizeof(buf)), ws->name,
+		    (unsigned long long)offset,
+		    (double)(now - start) / NANOSEC);
+	    ws->next_report = start + 2 * (ws->next_report - start);
+	}
+    }
+}
+
+static void *
+watchdog_thread(void *arg)
+{
+    watchdog_t *w = arg;
+    uint64_t interval, deadline;
+    struct timespec ts;
+
+    interval = (w->limit ? MIN(w->threshold, w->limit) : w->threshold) / WATCHDOG_LOOKS;
+    interval = MAX(interval, WATCHDOG_MIN_INTERVAL);
+    interval = MIN(interval, WATCHDOG_MAX_INTERVAL);
+
+    pthread_mutex_lock(&w->lock);
+    while (!w->stopping)
+    {
+	deadline = time_now_ns() + interval;
+	ts.tv_sec = deadline / NANOSEC;
+	ts.tv_nsec = deadline % NANOSEC;
+	pthread_cond_timedwait(&w->cond, &w->lock, &ts);
+	if (!w->stopping)
+	    watchdog_look(w, time_now_ns());
+    }
+    pthread_mutex_unlock(&w->lock);
+    return 0;
+}
+
+void
+watchdog_start(watchdog_t *w)
+{
+    int r;
+
+    if ((r = pthread_create(&w->thread, 0, watchdog_thread, w)))
+	fatal("pthread_create: %s", strerror(r));
+    w->running = TRUE;
+}
+
+/*
+ * Stops the thread.  Operations still stalled, as when the program
+ * is interrupted out of a hang, go in the timeline unrecovered.
+ */
+void
+watchdog_stop(watchdog_t *w)
+{
+    uint64_t start, now = time_now_ns();
+    unsigned int i;
+
+    pthread_mutex_lock(&w->lock);
+    w->stopping = TRUE;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    if (w->running)
+	pthread_join(w->thread, 0);
+    w->running = FALSE;
+
+    pthread_mutex_lock(&w->lock);
+    for (i = 0 ; i < w->nslots ; i++)
+    {
+	start = __atomic_load_n(&w->slots[i].start, __ATOMIC_ACQUIRE);
+	if (start && now > start && now - start >= w->threshold)
+	    watchdog_record(w, &w->slots[i], start, now, FALSE);
+    }
+    pthread_mutex_unlock(&w->lock);
+}
+
+/* every stall, in the order they ended */
+void
+watchdog_emit_timeline(const watchdog_t *w)
+{
+    const watchdog_stall_t *st;
+    uint64_t total = 0, longest = 0;
+    unsigned int i;
+    char buf[32];
+
+    for (i = 0 ; i < w->nstalls ; i++)
+    {
+	total += w->stalls[i].duration;
+	longest = MAX(longest, w->stalls[i].duration);
+    }
+    if (!w->nstalls)
+    {
+	fprintf(stderr, "%s: watchdog: no stalls of %.3f seconds or more\n",
+		argv0, (double)w->threshold / NANOSEC);
+	return;
+    }
+    fprintf(stderr, "%s: watchdog: %u stalls of %.3f seconds or more, "
+		    "%.3f seconds in all, longest %.3f seconds\n",
+	    argv0, w->nstalls, (double)w->threshold / NANOSEC,
+	    (double)total / NANOSEC, (double)longest / NANOSEC);
+    for (i = 0 ; i < w->nstalls ; i++)
+    {
+	st = &w->stalls[i];
+	fprintf(stderr, "%s: watchdog: %s (+%.3f) %s: offset %llu stalled for %.3f seconds%s\n",
+		argv0, format_when(st->when, buf, sizeof(buf)),
+		(double)st->elapsed / NANOSEC, st->name,
+		(unsigned long long)st->offset,
+		(double)st->duration / NANOSEC,
+		(st->recovered ? "" : ", not recovered"));
+    }
+}
+
+void
+watchdog_destroy(watchdog_t *w)
+{
+    unsigned int i;
+
+    for (i = 0 ; i < w->nstalls ; i++)
+	xfree(w->stalls[i].name);
+    xfree(w->stalls);
+    xfree(w->slots);
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->lock);
+}
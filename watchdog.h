@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2021 Greg Banks <gnb@fmeh.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef _CHECKSTREAM_WATCHDOG_H_
+#define _CHECKSTREAM_WATCHDOG_H_ 1
+
+#include "common.h"
+#include <pthread.h>
+
+/*
+ * Watches for reads and writes which hang, as when an NFS server fails
+ * over.  Each stream watched has a slot, in which it notes the time and
+ * offset of each operation as it starts and clears them when it's done,
+ * without taking a lock.  A thread looks over the slots a few times per
+ * threshold and reports any operation in flight for longer, and the
+ * stream itself reports the recovery when the operation completes.
+ * Every stall goes in a timeline reported at the end.  Times are
+ * CLOCK_MONOTONIC nanoseconds.
+ */
+struct watchdog;
+
+typedef struct watchdog_slot
+{
+    struct watchdog *dog;
+    const char *name;		/* of the stream, for the reports */
+    uint64_t base;		/* offset of the stream's first byte */
+    uint64_t start;		/* of the operation in flight, or 0 */
+    uint64_t offset;		/* of the operation in flight */
+    /* the watchdog thread's, for the stall being reported */
+    uint64_t reported;		/* start of the operation */
+    uint64_t next_report;	/* when to report it again */
+} watchdog_slot_t;
+
+typedef struct
+{
+    uint64_t when;		/* wall clock microseconds it started */
+    uint64_t elapsed;		/* since the watchdog started, nanoseconds */
+    uint64_t duration;
+    uint64_t offset;
+    char *name;
+    bool_t recovered;
+} watchdog_stall_t;
+
+typedef struct watchdog
+{
+    uint64_t threshold;		/* operations longer than this are stalls */
+    uint64_t limit;		/* call on_limit for a stall this long, or 0 */
+    void (*on_limit)(void);
+    uint64_t t0;
+    unsigned int nslots;
+    watchdog_slot_t *slots;
+    pthread_t thread;
+    bool_t running;
+    /* under lock */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool_t stopping;
+    watchdog_stall_t *stalls;	/* the timeline */
+    unsigned int nstalls;
+    unsigned int maxstalls;
+} watchdog_t;
+
+extern void watchdog_init(watchdog_t *w, unsigned int nslots,
+			  uint64_t threshold, uint64_t limit,
+			  void (*on_limit)(void));
+extern watchdog_slot_t *watchdog_slot(watchdog_t *w, unsigned int i,
+				      const char *name, uint64_t base);
+extern void watchdog_start(watchdog_t *w);
+extern void watchdog_stop(watchdog_t *w);
+extern void watchdog_emit_timeline(const watchdog_t *w);
+extern void watchdog_destroy(watchdog_t *w);
+extern void watchdog_recovered(watchdog_slot_t *ws, uint64_t start,
+			       uint64_t now);
+
+/* an operation nbytes into the stream starts at time now */
+static inline void
+watchdog_begin(watchdog_slot_t *ws, uint64_t now, uint64_t nbytes)
+{
+    ws->offset = ws->base + nbytes;
+    __atomic_store_n(&ws->start, now, __ATOMIC_RELEASE);
+}
+
+/* ...and is done at time now */
+static inline void
+watchdog_end(watchdog_slot_t *ws, uint64_t now)
+{
+    uint64_t start = ws->start;
+
+    __atomic_store_n(&ws->start, 0, __ATOMIC_RELEASE);
+    if (now - start >= ws->dog->threshold)
+	watchdog_recovered(ws, start, now);
+}
+
+#endif /* _CHECKSTREAM_WATCHDOG_H_ */